@@ -53,6 +53,7 @@ public:
   static const std::string CFG_KEY_DISTRIBUTION_ENABLED;
   static const std::string CFG_KEY_DISTRIBUTION_LISTENING;
   static const std::string CFG_KEY_DISTRIBUTION_PEERS;
+  static const std::string CFG_KEY_DISTRIBUTION_LEADERLESS;
   static const std::string CFG_KEY_DISTRIBUTION_TCP;
   static const std::string CFG_KEY_DISTRIBUTION_TCP_PORT;
   static const std::string CFG_KEY_DISTRIBUTION_TCP_USERNAME;
@@ -60,6 +61,11 @@ public:
   static const std::string CFG_KEY_DISTRIBUTION_TCP_ATTEMPTS;
   static const std::string CFG_KEY_DISTRIBUTION_TCP_INTERVAL;
 
+  static const std::string CFG_KEY_STATISTICS;
+  static const std::string CFG_KEY_STATISTICS_PACKED_HISTORY;
+  static const std::string CFG_KEY_STATISTICS_DAILY_RETENTION;
+  static const std::string CFG_KEY_STATISTICS_WEEKLY_RETENTION;
+
   static bool match(const std::string &str, const std::string &key, workrave::BreakId &id);
 };
 
@@ -21,6 +21,14 @@
 #define IDISTRIBUTIOMANAGER_HH
 
 #include <string>
+#include <list>
+
+#ifdef PLATFORM_OS_WIN32_NATIVE
+typedef __int64 int64_t;
+#else
+#include <stdint.h>
+#endif
+
 using namespace std;
 
 namespace workrave
@@ -30,10 +38,57 @@ namespace workrave
   class IDistributionManager
   {
   public:
+    //! Counters of a remote client.
+    /*!
+     *  Traffic counters are kept for the connection to a client, so they
+     *  are zero for clients that are reached through another client.
+     */
+    struct PeerStats
+    {
+      //! ID of the client, empty if not yet known.
+      std::string id;
+
+      //! ID of the client through which the client is reached, empty if
+      //! it is connected directly.
+      std::string via;
+
+      //! Bytes received and sent.
+      int64_t bytes_in;
+      int64_t bytes_out;
+
+      //! Packets received and sent.
+      int packets_in;
+      int packets_out;
+
+      //! Packets and bytes waiting to be sent.
+      int queue_packets;
+      int queue_bytes;
+
+      //! Number of reconnect attempts.
+      int reconnects;
+
+      //! Last measured round trip time in milliseconds, -1 if unknown.
+      int rtt;
+
+      //! Master requests sent to and received from the client.
+      int claims_out;
+      int claims_in;
+
+      //! Master requests rejected by and rejected for the client.
+      int rejects_in;
+      int rejects_out;
+
+      //! Seconds since the last packet from the client, -1 if none.
+      int idle;
+    };
+
+    typedef std::list<PeerStats> PeerStatsList;
+
     virtual ~IDistributionManager() {}
 
     virtual bool is_master() const = 0;
     virtual int get_number_of_peers() = 0;
+    virtual void get_peer_stats(PeerStatsList &stats) = 0;
     virtual bool connect(string url) = 0;
 
     virtual bool disconnect_all() = 0;
@@ -55,6 +110,9 @@ namespace workrave
     virtual bool get_listening() const = 0;
     virtual void set_listening(bool b) = 0;
 
+    virtual bool get_leaderless() const = 0;
+    virtual void set_leaderless(bool b) = 0;
+
     virtual string get_username() const = 0;
     virtual void set_username(string name) = 0;
 
@@ -21,6 +21,7 @@
 #define ISTATISTICS_HH
 
 #include <time.h>
+#include <string.h>
 
 #ifdef PLATFORM_OS_WIN32_NATIVE
 typedef __int64 int64_t;
@@ -58,11 +59,109 @@ namespace workrave {
         STATS_VALUE_SIZEOF
       };
 
+    enum StatsResolution
+      {
+        STATS_RESOLUTION_DAY = 0,
+        STATS_RESOLUTION_WEEK,
+        STATS_RESOLUTION_MONTH,
+        STATS_RESOLUTION_SIZEOF
+      };
+
+    enum StatsHourlyValueType
+      {
+        STATS_HOURLY_ACTIVE_TIME = 0,
+        STATS_HOURLY_MOUSE_MOVEMENT,
+        STATS_HOURLY_CLICKS,
+        STATS_HOURLY_KEYSTROKES,
+        STATS_HOURLY_BREAKS_PROMPTED,
+        STATS_HOURLY_BREAKS_TAKEN,
+        STATS_HOURLY_BREAKS_SKIPPED,
+        STATS_HOURLY_SIZEOF
+      };
+
+    enum
+      {
+        STATS_HOURS = 24
+      };
+
     typedef int BreakStats[STATS_BREAKVALUE_SIZEOF];
     typedef int64_t MiscStats[STATS_VALUE_SIZEOF];
+    typedef int HourlyStats[STATS_HOURLY_SIZEOF];
 
     struct DailyStats
     {
+      DailyStats() : hourly_stats(NULL)
+      {
+        clear();
+      }
+
+      DailyStats(const DailyStats &other) : hourly_stats(NULL)
+      {
+        *this = other;
+      }
+
+      ~DailyStats()
+      {
+        delete [] hourly_stats;
+      }
+
+      DailyStats &operator=(const DailyStats &other)
+      {
+        if (this != &other)
+          {
+            start = other.start;
+            stop = other.stop;
+            memcpy((void *)break_stats, other.break_stats, sizeof(break_stats));
+            memcpy((void *)misc_stats, other.misc_stats, sizeof(misc_stats));
+            resolution = other.resolution;
+
+            if (other.hourly_stats == NULL)
+              {
+                delete [] hourly_stats;
+                hourly_stats = NULL;
+              }
+            else
+              {
+                if (hourly_stats == NULL)
+                  {
+                    hourly_stats = new HourlyStats[STATS_HOURS];
+                  }
+                memcpy((void *)hourly_stats, other.hourly_stats, STATS_HOURS * sizeof(HourlyStats));
+              }
+          }
+        return *this;
+      }
+
+      //! Resets all statistics to zero.
+      void clear()
+      {
+        memset((void *)&start, 0, sizeof(start));
+        memset((void *)&stop, 0, sizeof(stop));
+        memset((void *)break_stats, 0, sizeof(break_stats));
+        memset((void *)misc_stats, 0, sizeof(misc_stats));
+        resolution = STATS_RESOLUTION_DAY;
+
+        delete [] hourly_stats;
+        hourly_stats = NULL;
+      }
+
+      //! Returns the statistics of an hour, allocating those of the day if needed.
+      HourlyStats &get_hourly_stats(int hour)
+      {
+        if (hourly_stats == NULL)
+          {
+            hourly_stats = new HourlyStats[STATS_HOURS];
+            memset((void *)hourly_stats, 0, STATS_HOURS * sizeof(HourlyStats));
+          }
+        return hourly_stats[hour];
+      }
+
+      //! Returns a value of an hour, 0 if the day has no hourly statistics.
+      int get_hourly_value(int hour, StatsHourlyValueType type) const
+      {
+        return hourly_stats != NULL ? hourly_stats[hour][type] : 0;
+      }
+
       //! Start time of this day.
       struct tm start;
 
@@ -74,6 +173,16 @@ namespace workrave {
 
       //! Misc statistics
       MiscStats misc_stats;
+
+      //! Period covered by these statistics. Old days are rolled up into weeks and months.
+      StatsResolution resolution;
+
+      //! Statistics per hour of the day, indexed by the local hour.
+      /*!
+       *  Only allocated for days with hourly statistics, as most of the
+       *  history predates them or is rolled up into weeks and months.
+       */
+      HourlyStats *hourly_stats;
     };
 
   public:
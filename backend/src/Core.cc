@@ -85,6 +85,14 @@ const int SAVESTATETIME = 60;
 #define DBUS_PATH_WORKRAVE         "/org/workrave/Workrave/Core"
 #define DBUS_SERVICE_WORKRAVE      "org.workrave.Workrave"
 
+#ifdef HAVE_DISTRIBUTION
+//! Encoding of timer and break state that holds the changes since the previous state.
+const int STATE_ENCODING_DELTA = 1;
+
+//! Number of delta updates after which the full timer or break state is sent.
+const int STATE_SNAPSHOT_INTERVAL = 20;
+#endif
+
 //! Constructs a new Core.
 Core::Core() :
   last_process_time(0),
@@ -104,10 +112,15 @@ Core::Core() :
   resume_break(BREAK_ID_NONE),
   local_state(ACTIVITY_IDLE),
   monitor_state(ACTIVITY_UNKNOWN)
+#ifdef HAVE_DBUS
+  ,
+  dbus(NULL)
+#endif
 #ifdef HAVE_DISTRIBUTION
   ,
   dist_manager(NULL),
   remote_state(ACTIVITY_IDLE),
+  leaderless_mode(false),
   idlelog_manager(NULL)
 #  ifndef NDEBUG
   ,
@@ -256,6 +269,10 @@ Core::init_bus()
 
       dbus->connect(DBUS_PATH_WORKRAVE, "org.workrave.CoreInterface", this);
       dbus->connect(DBUS_PATH_WORKRAVE, "org.workrave.ConfigInterface", configurator);
+      dbus->connect(DBUS_PATH_WORKRAVE, "org.workrave.StatisticsInterface", statistics);
+#ifdef HAVE_DISTRIBUTION
+      dbus->connect(DBUS_PATH_WORKRAVE, "org.workrave.NetworkInterface", dist_manager);
+#endif
       dbus->register_object_path(DBUS_PATH_WORKRAVE);
       
 #ifdef HAVE_TESTS
@@ -1174,15 +1191,34 @@ Core::process_distribution()
   if (dist_manager != NULL)
     {
       dist_manager->heartbeart();
-      dist_manager->set_lock_master(state == ACTIVITY_ACTIVE);
-      master_node = dist_manager->is_master();
 
-      if (!master_node && state == ACTIVITY_ACTIVE)
+      bool leaderless = dist_manager->get_leaderless();
+      if (leaderless != leaderless_mode)
         {
-          master_node = dist_manager->claim();
+          remote_states.clear();
+          leaderless_mode = leaderless;
+          idlelog_manager->set_leaderless(leaderless);
+        }
+
+      if (!leaderless_mode)
+        {
+          dist_manager->set_lock_master(state == ACTIVITY_ACTIVE);
+          master_node = dist_manager->is_master();
+
+          if (!master_node && state == ACTIVITY_ACTIVE)
+            {
+              master_node = dist_manager->claim();
+            }
         }
     }
 
+  if (previous_master_mode != master_node)
+    {
+      // The remote clients only know the state of the previous master.
+      sent_timer_state.valid = false;
+      sent_break_state.valid = false;
+    }
+
   if ( (previous_master_mode != master_node) ||
        (master_node && local_state != state) )
     {
@@ -1194,14 +1230,20 @@ Core::process_distribution()
 
       dist_manager->broadcast_client_message(DCM_MONITOR, buffer);
 
+      // Without a master, every client computes its own timers.
       buffer.clear();
-      bool ret = request_timer_state(buffer);
+      bool ret = !leaderless_mode && request_timer_update(buffer);
       if (ret)
         {
           dist_manager->broadcast_client_message(DCM_TIMERS, buffer);
         }
     }
 
+  if (dist_manager != NULL && !leaderless_mode)
+    {
+      process_state_requests();
+    }
+
 #endif
 }
 
@@ -1241,22 +1283,53 @@ Core::process_state()
 #endif
 
 #ifdef HAVE_DISTRIBUTION
-  if (!master_node)
+  if (leaderless_mode)
     {
-      if (active_insist_policy == INSIST_POLICY_IGNORE)
+      // Every client keeps its own idle history.
+      idlelog_manager->update_all_idlelogs(monitor_state, remote_states);
+
+      if (idlelog_manager->has_unsent_idlelog())
         {
-          // Our own monitor is suspended, also ignore
-          // activity from remote parties.
-          monitor_state = ACTIVITY_IDLE;
+          // The other clients merge the new intervals into their copy.
+          PacketBuffer buffer;
+          buffer.create();
+
+          idlelog_manager->get_unsent_idlelog(buffer);
+          dist_manager->broadcast_client_message(DCM_IDLELOG, buffer);
         }
-      else
+
+      if (active_insist_policy != INSIST_POLICY_IGNORE)
         {
-          monitor_state = remote_state;
+          // The user is active if any client is active.
+          map<std::string, ActivityState>::iterator i;
+          for (i = remote_states.begin(); i != remote_states.end(); i++)
+            {
+              if (i->second == ACTIVITY_ACTIVE)
+                {
+                  monitor_state = ACTIVITY_ACTIVE;
+                }
+            }
         }
     }
+  else
+    {
+      if (!master_node)
+        {
+          if (active_insist_policy == INSIST_POLICY_IGNORE)
+            {
+              // Our own monitor is suspended, also ignore
+              // activity from remote parties.
+              monitor_state = ACTIVITY_IDLE;
+            }
+          else
+            {
+              monitor_state = remote_state;
+            }
+        }
 
-  // Update our idle history.
-  idlelog_manager->update_all_idlelogs(dist_manager->get_master_id(), monitor_state);
+      // Update our idle history.
+      idlelog_manager->update_all_idlelogs(dist_manager->get_master_id(), monitor_state);
+    }
 #endif
 }
 
@@ -1867,11 +1940,17 @@ Core::request_client_message(DistributionClientMessageID id, PacketBuffer &buffe
   switch (id)
     {
     case DCM_BREAKS:
-      ret = request_break_state(buffer);
+      if (!leaderless_mode)
+        {
+          ret = request_break_update(buffer);
+        }
       break;
 
     case DCM_TIMERS:
-      ret = request_timer_state(buffer);
+      if (!leaderless_mode)
+        {
+          ret = request_timer_update(buffer);
+        }
       break;
 
     case DCM_CONFIG:
@@ -1898,6 +1977,18 @@ Core::request_client_message(DistributionClientMessageID id, PacketBuffer &buffe
 }
 
 
+//! Returns whether a timer or break state message asks the master for the full state.
+/*!
+ *  A request consists of a zero break count only. Older clients
+ *  consider it to be an empty state and ignore it.
+ */
+static bool
+is_state_request(PacketBuffer &buffer)
+{
+  return buffer.bytes_available() == 2 && buffer.peek_ushort(0) == 0;
+}
+
+
 //! The distribution manager delivers a client message.
 bool
 Core::client_message(DistributionClientMessageID id, bool master, const char *client_id,
@@ -1905,20 +1996,36 @@ Core::client_message(DistributionClientMessageID id, bool master, const char *cl
 {
   bool ret = false;
 
-  (void) client_id;
-
   switch (id)
     {
     case DCM_BREAKS:
-      ret = set_break_state(master, buffer);
+      if (is_state_request(buffer))
+        {
+          // Answered by process_state_requests().
+          sent_break_state.requested = master_node;
+          ret = true;
+        }
+      else
+        {
+          // Without a master, the break state is computed locally.
+          ret = leaderless_mode || set_break_state(master, buffer);
+        }
       break;
 
     case DCM_TIMERS:
-      ret = set_timer_state(buffer);
+      if (is_state_request(buffer))
+        {
+          sent_timer_state.requested = master_node;
+          ret = true;
+        }
+      else
+        {
+          ret = leaderless_mode || set_timer_state(buffer);
+        }
       break;
 
     case DCM_MONITOR:
-      ret = set_monitor_state(master, buffer);
+      ret = set_monitor_state(master, client_id, buffer);
       break;
 
     case DCM_BREAKCONTROL:
@@ -1942,6 +2049,60 @@ Core::client_message(DistributionClientMessageID id, bool master, const char *cl
 }
 
 
+//! Converts the state of a timer to the fields that are replicated.
+static void
+timer_state_to_fields(const Timer::TimerStateData &data, guint32 *fields)
+{
+  fields[0] = (guint32)data.current_time;
+  fields[1] = (guint32)data.elapsed_time;
+  fields[2] = (guint32)data.elapsed_idle_time;
+  fields[3] = (guint32)data.last_pred_reset_time;
+  fields[4] = (guint32)data.total_overdue_time;
+  fields[5] = (guint32)data.last_limit_time;
+  fields[6] = (guint32)data.last_limit_elapsed;
+  fields[7] = (guint32)data.snooze_inhibited;
+}
+
+
+//! Converts the replicated fields to the state of a timer.
+static void
+fields_to_timer_state(const guint32 *fields, Timer::TimerStateData &data)
+{
+  data.current_time = fields[0];
+  data.elapsed_time = fields[1];
+  data.elapsed_idle_time = fields[2];
+  data.last_pred_reset_time = fields[3];
+  data.total_overdue_time = fields[4];
+  data.last_limit_time = fields[5];
+  data.last_limit_elapsed = fields[6];
+  data.snooze_inhibited = fields[7] != 0;
+}
+
+
+//! Converts the state of a break to the fields that are replicated.
+static void
+break_state_to_fields(const BreakControl::BreakStateData &data, guint32 *fields)
+{
+  fields[0] = (guint32)data.forced_break;
+  fields[1] = (guint32)data.reached_max_prelude;
+  fields[2] = (guint32)data.prelude_count;
+  fields[3] = (guint32)data.break_stage;
+  fields[4] = (guint32)data.prelude_time;
+}
+
+
+//! Converts the replicated fields to the state of a break.
+static void
+fields_to_break_state(const guint32 *fields, BreakControl::BreakStateData &data)
+{
+  data.forced_break = fields[0] != 0;
+  data.reached_max_prelude = fields[1] != 0;
+  data.prelude_count = fields[2];
+  data.break_stage = fields[3];
+  data.prelude_time = fields[4];
+}
+
+
 bool
 Core::request_break_state(PacketBuffer &buffer)
 {
@@ -1955,6 +2116,7 @@ Core::request_break_state(PacketBuffer &buffer)
         {
           BreakControl::BreakStateData state_data;
           bi->get_state_data(state_data);
+          break_state_to_fields(state_data, sent_break_state.fields[i]);
 
           int pos = buffer.bytes_written();
 
@@ -1969,19 +2131,81 @@ Core::request_break_state(PacketBuffer &buffer)
         }
       else
         {
+          memset(sent_break_state.fields[i], 0, sizeof(sent_break_state.fields[i]));
           buffer.pack_ushort(0);
         }
     }
 
+  sent_break_state.seq++;
+  sent_break_state.valid = true;
+  sent_break_state.updates = 0;
+  buffer.pack_ulong(sent_break_state.seq);
+
   return true;
 }
 
 
+//! Packs the changes of the break state since it was last sent.
+/*!
+ *  The full state is sent if the remote clients may not know the
+ *  previous state.
+ *
+ *  \return false if the state did not change.
+ */
+bool
+Core::request_break_update(PacketBuffer &buffer)
+{
+  if (!sent_break_state.valid || sent_break_state.updates >= STATE_SNAPSHOT_INTERVAL)
+    {
+      return request_break_state(buffer);
+    }
+
+  ReplicatedState current;
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      BreakControl *bi = breaks[i].get_break_control();
+
+      if (bi != NULL)
+        {
+          BreakControl::BreakStateData state_data;
+          bi->get_state_data(state_data);
+          break_state_to_fields(state_data, current.fields[i]);
+        }
+    }
+
+  return pack_state_update(buffer, sent_break_state, current, BREAK_STATE_FIELDS, false);
+}
+
+
 bool
 Core::set_break_state(bool master, PacketBuffer &buffer)
 {
   int num_breaks = buffer.unpack_ushort();
 
+  if (num_breaks == 0 && buffer.bytes_available() > 0)
+    {
+      bool changed[BREAK_ID_SIZEOF];
+      if (!unpack_state_update(buffer, received_break_state, BREAK_STATE_FIELDS, changed))
+        {
+          return false;
+        }
+
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          BreakControl *bi = breaks[i].get_break_control();
+
+          if (changed[i] && bi != NULL)
+            {
+              BreakControl::BreakStateData state_data;
+              fields_to_break_state(received_break_state.fields[i], state_data);
+              bi->set_state_data(master, state_data);
+            }
+        }
+      return true;
+    }
+
+  received_break_state.valid = false;
+
   if (num_breaks > BREAK_ID_SIZEOF)
     {
       num_breaks = BREAK_ID_SIZEOF;
@@ -2004,14 +2228,26 @@ Core::set_break_state(bool master, PacketBuffer &buffer)
           state_data.prelude_time = buffer.unpack_ulong();
 
           bi->set_state_data(master, state_data);
+          break_state_to_fields(state_data, received_break_state.fields[i]);
+        }
+      else
+        {
+          memset(received_break_state.fields[i], 0, sizeof(received_break_state.fields[i]));
         }
     }
 
+  if (num_breaks == BREAK_ID_SIZEOF && buffer.bytes_available() >= 4)
+    {
+      received_break_state.seq = buffer.unpack_ulong();
+      received_break_state.valid = true;
+      received_break_state.requested = false;
+    }
+
   return true;
 }
 
 bool
-Core::request_timer_state(PacketBuffer &buffer) const
+Core::request_timer_state(PacketBuffer &buffer)
 {
   TRACE_ENTER("Core::get_timer_state");
 
@@ -2025,6 +2261,7 @@ Core::request_timer_state(PacketBuffer &buffer) const
       Timer::TimerStateData state_data;
 
       t->get_state_data(state_data);
+      timer_state_to_fields(state_data, sent_timer_state.fields[i]);
 
       int pos = buffer.bytes_written();
 
@@ -2042,11 +2279,43 @@ Core::request_timer_state(PacketBuffer &buffer) const
       buffer.poke_ushort(pos, buffer.bytes_written() - pos);
     }
 
+  sent_timer_state.seq++;
+  sent_timer_state.valid = true;
+  sent_timer_state.updates = 0;
+  buffer.pack_ulong(sent_timer_state.seq);
+
   TRACE_EXIT();
   return true;
 }
 
 
+//! Packs the changes of the timer state since it was last sent.
+/*!
+ *  The full state is sent if the remote clients may not know the
+ *  previous state.
+ *
+ *  \return false if the state did not change.
+ */
+bool
+Core::request_timer_update(PacketBuffer &buffer)
+{
+  if (!sent_timer_state.valid || sent_timer_state.updates >= STATE_SNAPSHOT_INTERVAL)
+    {
+      return request_timer_state(buffer);
+    }
+
+  ReplicatedState current;
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      Timer::TimerStateData state_data;
+      breaks[i].get_timer()->get_state_data(state_data);
+      timer_state_to_fields(state_data, current.fields[i]);
+    }
+
+  return pack_state_update(buffer, sent_timer_state, current, TIMER_STATE_FIELDS, true);
+}
+
+
 bool
 Core::set_timer_state(PacketBuffer &buffer)
 {
@@ -2054,6 +2323,32 @@ Core::set_timer_state(PacketBuffer &buffer)
 
   int num_breaks = buffer.unpack_ushort();
 
+  if (num_breaks == 0 && buffer.bytes_available() > 0)
+    {
+      bool changed[BREAK_ID_SIZEOF];
+      if (!unpack_state_update(buffer, received_timer_state, TIMER_STATE_FIELDS, changed))
+        {
+          TRACE_RETURN("Unknown base state");
+          return false;
+        }
+
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          if (changed[i])
+            {
+              Timer::TimerStateData state_data;
+              fields_to_timer_state(received_timer_state.fields[i], state_data);
+              breaks[i].get_timer()->set_state_data(state_data);
+            }
+        }
+
+      TRACE_EXIT();
+      return true;
+    }
+
+  received_timer_state.valid = false;
+  int num_received = 0;
+
   TRACE_MSG("numtimer = " << num_breaks);
   for (int i = 0; i < num_breaks; i++)
     {
@@ -2093,23 +2388,236 @@ Core::set_timer_state(PacketBuffer &buffer)
       if (t != NULL)
         {
           t->set_state_data(state_data);
+
+          for (int j = 0; j < BREAK_ID_SIZEOF; j++)
+            {
+              if (breaks[j].get_timer() == t)
+                {
+                  timer_state_to_fields(state_data, received_timer_state.fields[j]);
+                  num_received++;
+                }
+            }
         }
 
       g_free(id);
     }
 
+  if (num_received == BREAK_ID_SIZEOF && buffer.bytes_available() >= 4)
+    {
+      received_timer_state.seq = buffer.unpack_ulong();
+      received_timer_state.valid = true;
+      received_timer_state.requested = false;
+    }
+
   TRACE_EXIT();
   return true;
 }
 
 
+//! Packs the fields that changed since the state was last sent.
+/*!
+ *  The update starts with a zero break count, so that clients that do
+ *  not know the delta encoding ignore it. It holds the sequence number
+ *  of the state it is based on, the new sequence number, and for each
+ *  break of which the state changed, a bit mask of the changed fields
+ *  followed by their values.
+ *
+ *  \param timestamped whether the first field is the time at which the
+ *         state was taken, which is only sent along with other changes.
+ *
+ *  \return false if the state did not change.
+ */
 bool
-Core::set_monitor_state(bool master, PacketBuffer &buffer)
+Core::pack_state_update(PacketBuffer &buffer, ReplicatedState &sent, const ReplicatedState &current,
+                        int num_fields, bool timestamped)
+{
+  int first_field = timestamped ? 1 : 0;
+  int masks[BREAK_ID_SIZEOF];
+  int num_changed = 0;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      masks[i] = 0;
+      for (int f = 0; f < num_fields; f++)
+        {
+          if (current.fields[i][f] != sent.fields[i][f])
+            {
+              masks[i] |= 1 << f;
+            }
+        }
+
+      if ((masks[i] >> first_field) == 0)
+        {
+          masks[i] = 0;
+        }
+      else
+        {
+          num_changed++;
+        }
+    }
+
+  if (num_changed == 0)
+    {
+      return false;
+    }
+
+  buffer.pack_ushort(0);
+  buffer.pack_byte(STATE_ENCODING_DELTA);
+  buffer.pack_ulong(sent.seq);
+  buffer.pack_ulong(sent.seq + 1);
+  buffer.pack_byte(num_changed);
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      if (masks[i] != 0)
+        {
+          buffer.pack_byte(i);
+          buffer.pack_byte(masks[i]);
+
+          for (int f = 0; f < num_fields; f++)
+            {
+              if (masks[i] & (1 << f))
+                {
+                  buffer.pack_ulong(current.fields[i][f]);
+                  sent.fields[i][f] = current.fields[i][f];
+                }
+            }
+        }
+    }
+
+  sent.seq++;
+  sent.updates++;
+  return true;
+}
+
+
+//! Applies the changes of the state received from the master.
+/*!
+ *  Changes that are not based on the last received state are ignored
+ *  until the master sends the full state.
+ *
+ *  \param changed set for each break of which the state changed.
+ *
+ *  \return false if the update cannot be applied.
+ */
+bool
+Core::unpack_state_update(PacketBuffer &buffer, ReplicatedState &received, int num_fields, bool *changed)
+{
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      changed[i] = false;
+    }
+
+  int encoding = buffer.unpack_byte();
+  guint32 base_seq = buffer.unpack_ulong();
+  guint32 seq = buffer.unpack_ulong();
+
+  if (encoding != STATE_ENCODING_DELTA || !received.valid || base_seq != received.seq)
+    {
+      // An update was missed, ask for the full state.
+      received.valid = false;
+      received.requested = true;
+      return false;
+    }
+
+  int num_changed = buffer.unpack_byte();
+  for (int c = 0; c < num_changed; c++)
+    {
+      int i = buffer.unpack_byte();
+      int mask = buffer.unpack_byte();
+
+      if (i >= BREAK_ID_SIZEOF)
+        {
+          received.valid = false;
+          received.requested = true;
+          return false;
+        }
+
+      for (int f = 0; f < num_fields; f++)
+        {
+          if (mask & (1 << f))
+            {
+              received.fields[i][f] = buffer.unpack_ulong();
+            }
+        }
+      changed[i] = true;
+    }
+
+  received.seq = seq;
+  return true;
+}
+
+
+//! Exchanges requests for the full timer and break state.
+/*!
+ *  A client that cannot apply an update asks the master for the full
+ *  state, instead of waiting for the next periodic snapshot. The master
+ *  answers all requests that arrived since the previous heartbeat with
+ *  a single snapshot.
+ */
+void
+Core::process_state_requests()
+{
+  PacketBuffer buffer;
+  buffer.create();
+
+  if (master_node)
+    {
+      received_timer_state.requested = false;
+      received_break_state.requested = false;
+
+      if (sent_timer_state.requested && request_timer_state(buffer))
+        {
+          dist_manager->broadcast_client_message(DCM_TIMERS, buffer);
+        }
+      sent_timer_state.requested = false;
+
+      buffer.clear();
+      if (sent_break_state.requested && request_break_state(buffer))
+        {
+          dist_manager->broadcast_client_message(DCM_BREAKS, buffer);
+        }
+      sent_break_state.requested = false;
+    }
+  else
+    {
+      sent_timer_state.requested = false;
+      sent_break_state.requested = false;
+
+      if (received_timer_state.requested)
+        {
+          buffer.pack_ushort(0);
+          dist_manager->broadcast_client_message(DCM_TIMERS, buffer);
+          received_timer_state.requested = false;
+        }
+
+      buffer.clear();
+      if (received_break_state.requested)
+        {
+          buffer.pack_ushort(0);
+          dist_manager->broadcast_client_message(DCM_BREAKS, buffer);
+          received_break_state.requested = false;
+        }
+    }
+}
+
+
+bool
+Core::set_monitor_state(bool master, const char *client_id, PacketBuffer &buffer)
 {
   (void) master;
   TRACE_ENTER_MSG("Core::set_monitor_state", master << " " << master_node);
 
-  if (!master_node)
+  if (leaderless_mode)
+    {
+      if (client_id != NULL)
+        {
+          buffer.unpack_ushort();
+          remote_states[client_id] = (ActivityState) buffer.unpack_ushort();
+          TRACE_MSG(client_id << " " << remote_states[client_id]);
+        }
+    }
+  else if (!master_node)
     {
       buffer.unpack_ushort();
       remote_state = (ActivityState) buffer.unpack_ushort();
@@ -2139,7 +2647,13 @@ Core::signon_remote_client(string client_id)
 
       dist_manager->broadcast_client_message(DCM_MONITOR, buffer);
 
+      // The new client does not know the timer state yet.
       buffer.clear();
+      if (!leaderless_mode && request_timer_state(buffer))
+        {
+          dist_manager->broadcast_client_message(DCM_TIMERS, buffer);
+        }
+      sent_break_state.valid = false;
     }
 }
 
@@ -2156,6 +2670,7 @@ Core::signoff_remote_client(string client_id)
       remote_state = ACTIVITY_IDLE;
     }
 
+  remote_states.erase(client_id);
   idlelog_manager->signoff_remote_client(client_id);
   TRACE_EXIT();
 }
@@ -2169,6 +2684,13 @@ Core::compute_timers()
   for (int i = 0; i < BREAK_ID_SIZEOF; i++)
     {
       int autoreset = breaks[i].get_timer()->get_auto_reset();
+
+      if (leaderless_mode)
+        {
+          compute_merged_timer((BreakId)i, autoreset);
+          continue;
+        }
+
       int idle = idlelog_manager->compute_idle_time();
 
       if (autoreset != 0)
@@ -2193,6 +2715,41 @@ Core::compute_timers()
 }
 
 
+//! Computes a timer from the combined activity of all clients.
+/*!
+ *  Without a master, the active periods of the clients may overlap. A
+ *  second during which several clients were active is counted once.
+ */
+void
+Core::compute_merged_timer(BreakId break_id, int autoreset)
+{
+  Timer *timer = breaks[break_id].get_timer();
+  int idle = idlelog_manager->compute_merged_idle_time();
+
+  if (autoreset != 0)
+    {
+      int active_time = idlelog_manager->compute_merged_active_time(autoreset);
+
+      if (idle > autoreset)
+        {
+          idle = autoreset;
+        }
+
+      timer->set_values(active_time, idle);
+    }
+  else
+    {
+      // Keep the current value if the idle logs do not cover the
+      // whole day.
+      time_t active_time;
+      if (idlelog_manager->compute_merged_total_active_time(active_time))
+        {
+          timer->set_values(active_time, idle);
+        }
+    }
+}
+
+
 //! Sends a break control message to all workrave clients.
 void
 Core::send_break_control_message(BreakId break_id, BreakControlMessage message)
@@ -21,6 +21,7 @@
 #define CORE_HH
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #if STDC_HEADERS
@@ -202,13 +203,52 @@ private:
   bool client_message(DistributionClientMessageID id, bool master, const char *client_id,
                       PacketBuffer &buffer);
 
+  enum
+    {
+      TIMER_STATE_FIELDS = 8,
+      BREAK_STATE_FIELDS = 5,
+      MAX_STATE_FIELDS = 8,
+    };
+
+  //! Timer or break state as replicated to the remote clients.
+  struct ReplicatedState
+  {
+    ReplicatedState() : seq(0), valid(false), requested(false), updates(0)
+    {
+      memset(fields, 0, sizeof(fields));
+    }
+
+    //! Sequence number of the state.
+    guint32 seq;
+
+    //! Is the state known.
+    bool valid;
+
+    //! Has a client asked for the full state (sent state), or must the
+    //! master be asked for it (received state).
+    bool requested;
+
+    //! Number of delta updates since the last full snapshot.
+    int updates;
+
+    //! State of each break.
+    guint32 fields[BREAK_ID_SIZEOF][MAX_STATE_FIELDS];
+  };
+
   bool request_break_state(PacketBuffer &buffer);
+  bool request_break_update(PacketBuffer &buffer);
   bool set_break_state(bool master, PacketBuffer &buffer);
 
-  bool request_timer_state(PacketBuffer &buffer) const;
+  bool request_timer_state(PacketBuffer &buffer);
+  bool request_timer_update(PacketBuffer &buffer);
   bool set_timer_state(PacketBuffer &buffer);
 
-  bool set_monitor_state(bool master, PacketBuffer &buffer);
+  bool pack_state_update(PacketBuffer &buffer, ReplicatedState &sent, const ReplicatedState &current,
+                         int num_fields, bool timestamped);
+  bool unpack_state_update(PacketBuffer &buffer, ReplicatedState &received, int num_fields, bool *changed);
+  void process_state_requests();
+
+  bool set_monitor_state(bool master, const char *client_id, PacketBuffer &buffer);
 
   enum BreakControlMessage
     {
@@ -226,6 +266,7 @@ private:
   void signon_remote_client(string client_id);
   void signoff_remote_client(string client_id);
   void compute_timers();
+  void compute_merged_timer(BreakId break_id, int autoreset);
 #endif // HAVE_DISTRIBUTION
 
 
@@ -311,6 +352,24 @@ private:
   //! State of the remote master.
   ActivityState remote_state;
 
+  //! Do all clients compute their timers without a master?
+  bool leaderless_mode;
+
+  //! State of each remote client in leaderless mode.
+  std::map<std::string, ActivityState> remote_states;
+
+  //! Timer state last sent to the remote clients.
+  ReplicatedState sent_timer_state;
+
+  //! Break state last sent to the remote clients.
+  ReplicatedState sent_break_state;
+
+  //! Timer state last received from the master.
+  ReplicatedState received_timer_state;
+
+  //! Break state last received from the master.
+  ReplicatedState received_break_state;
+
   //! Manager that collects idle times of all clients.
   IdleLogManager *idlelog_manager;
 
@@ -60,6 +60,7 @@ const string CoreConfig::CFG_KEY_DISTRIBUTION              = "distribution";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_ENABLED      = "distribution/enabled";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_LISTENING    = "distribution/listening";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_PEERS        = "distribution/peers";
+const string CoreConfig::CFG_KEY_DISTRIBUTION_LEADERLESS   = "distribution/leaderless";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP          = "distribution/tcp";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_PORT     = "distribution/port";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_USERNAME = "distribution/username";
@@ -67,6 +68,11 @@ const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_PASSWORD = "distribution/passw
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_ATTEMPTS = "distribution/reconnect_attempts";
 const string CoreConfig::CFG_KEY_DISTRIBUTION_TCP_INTERVAL = "distribution/reconnect_interval";
 
+const string CoreConfig::CFG_KEY_STATISTICS                = "statistics";
+const string CoreConfig::CFG_KEY_STATISTICS_PACKED_HISTORY = "statistics/packed_history";
+const string CoreConfig::CFG_KEY_STATISTICS_DAILY_RETENTION = "statistics/daily_retention";
+const string CoreConfig::CFG_KEY_STATISTICS_WEEKLY_RETENTION = "statistics/weekly_retention";
+
 
 bool
 CoreConfig::match(const std::string &str, const std::string &key, workrave::BreakId &id)
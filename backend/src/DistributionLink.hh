@@ -27,6 +27,7 @@ class IDistributionClientMessage;
 class PacketBuffer;
 
 #include "IDistributionClientMessage.hh"
+#include "IDistributionManager.hh"
 
 class DistributionLink
 {
@@ -39,6 +40,9 @@ public:
   //! Returns the number of remote peers.
   virtual int get_number_of_peers() = 0;
 
+  //! Returns the counters of all remote clients.
+  virtual void get_peer_stats(workrave::IDistributionManager::PeerStatsList &stats) = 0;
+
   //! Sets the callback interface to the distribution manager.
   // virtual void set_distribution_manager(DistributionLinkListener *dll) = 0;
 
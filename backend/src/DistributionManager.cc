@@ -116,6 +116,19 @@ DistributionManager::get_number_of_peers()
 }
 
 
+//! Returns the counters of all remote clients.
+void
+DistributionManager::get_peer_stats(PeerStatsList &stats)
+{
+  stats.clear();
+
+  if (link != NULL)
+    {
+      link->get_peer_stats(stats);
+    }
+}
+
+
 //! Returns true if this node is master.
 bool
 DistributionManager::is_master() const
@@ -791,6 +804,31 @@ DistributionManager::set_listening(bool b)
 }
 
 
+//! Returns whether all clients compute their timers without a master.
+/*!
+ *  All clients in the network must use the same setting.
+ */
+bool
+DistributionManager::get_leaderless() const
+{
+  bool ret = false;
+  bool is_set = configurator->get_value(CoreConfig::CFG_KEY_DISTRIBUTION_LEADERLESS, ret);
+  if (!is_set)
+    {
+      ret = false;
+    }
+
+  return ret;
+}
+
+
+void
+DistributionManager::set_leaderless(bool b)
+{
+  configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_LEADERLESS, b);
+}
+
+
 string
 DistributionManager::get_username() const
 {
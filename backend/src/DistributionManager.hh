@@ -58,6 +58,7 @@ public:
   string get_master_id() const;
   string get_my_id() const;
   int get_number_of_peers();
+  void get_peer_stats(PeerStatsList &stats);
   bool claim();
   bool set_lock_master(bool lock);
   bool connect(string url);
@@ -88,6 +89,9 @@ public:
   bool get_listening() const;
   void set_listening(bool b);
 
+  bool get_leaderless() const;
+  void set_leaderless(bool b);
+
   string get_username() const;
   void set_username(string name);
 
@@ -155,6 +159,10 @@ private:
 
   //! Current master.
   string current_master;
+
+#ifdef HAVE_TESTS
+  friend class DistributionTest;
+#endif
 };
 
 
@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <algorithm>
 
 #include "nls.h"
@@ -71,13 +72,21 @@ DistributionSocketLink::DistributionSocketLink(Configurator *conf) :
   master_locked(false),
   server_port(DEFAULT_PORT),
   server_socket(NULL),
+  local_server_socket(NULL),
+  local_session_lock(NULL),
+  local_session(-1),
+  time_source(NULL),
   network_enabled(false),
   server_enabled(false),
   reconnect_attempts(DEFAULT_ATTEMPTS),
   reconnect_interval(DEFAULT_INTERVAL),
-  heartbeat_count(0)
+  heartbeat_count(0),
+  batch_count(0),
+  batch_count_pos(0)
 {
   socket_driver = SocketDriver::create();
+  local_socket_driver = SocketDriver::create_local(string("workrave-") + g_get_user_name());
+  reserve_local_session();
   init_my_id();
 }
 
@@ -90,7 +99,18 @@ DistributionSocketLink::~DistributionSocketLink()
   g_free(username);
   g_free(password);
   delete server_socket;
+  delete local_server_socket;
+  delete local_session_lock;
   delete socket_driver;
+  delete local_socket_driver;
+}
+
+
+//! Returns the current time of the link.
+time_t
+DistributionSocketLink::get_time() const
+{
+  return time_source != NULL ? time_source->get_time() : time(NULL);
 }
 
 
@@ -117,12 +137,14 @@ DistributionSocketLink::init()
 void
 DistributionSocketLink::heartbeat()
 {
+  flush_client_messages();
+
   if (server_enabled)
     {
       TRACE_ENTER("DistributionSocketLink::heartbeat");
       heartbeat_count++;
 
-      time_t current_time = time(NULL);
+      time_t current_time = get_time();
 
       // See if we have some clients that need reconncting.
       list<Client *>::iterator i = clients.begin();
@@ -145,8 +167,11 @@ DistributionSocketLink::heartbeat()
                   c->socket->close();
                   delete c->socket;
                 }
+              clear_output(c);
+              c->protocol = 0;
+              c->reconnects++;
 
-              ISocket *socket = socket_driver->create_socket();
+              ISocket *socket = create_socket(c);
               socket->set_data(c);
               socket->set_listener(this);
               socket->connect(c->hostname, c->port);
@@ -156,17 +181,59 @@ DistributionSocketLink::heartbeat()
           i++;
         }
 
+      // Close a connection of which the output queue overflowed, or
+      // to which a write failed.
+      for (i = clients.begin(); i != clients.end(); i++)
+        {
+          Client *c = *i;
+          if ((c->overflow || c->write_error) && c->socket != NULL)
+            {
+              if (c->write_error)
+                {
+                  dist_manager->log(_("Client %s write error, closing."),
+                                    c->id == NULL ? "Unknown" : c->id);
+                }
+              else
+                {
+                  dist_manager->log(_("Client %s is not reading, closing."),
+                                    c->id == NULL ? "Unknown" : c->id);
+                }
+              close_client(c, c->outbound);
+              break;
+            }
+        }
+
       // Periodically distribute state, in case the master crashes.
       if (heartbeat_count % 30 == 0 && i_am_master)
         {
           send_client_message(DCMT_MASTER);
         }
+
+      // Periodically measure the round trip time to direct clients.
+      if (heartbeat_count % PING_INTERVAL == 0)
+        {
+          for (i = clients.begin(); i != clients.end(); i++)
+            {
+              Client *c = *i;
+              if (c->type == CLIENTTYPE_DIRECT && c->welcome &&
+                  c->protocol >= PROTOCOL_VERSION_PING)
+                {
+                  send_ping(c);
+                }
+            }
+        }
       TRACE_EXIT();
     }
 }
 
 
-//! Initializes the network wrapper.
+//! Initializes the ID of this node.
+/*!
+ *  All sessions of a user on this host share the stored ID. Sessions
+ *  other than the first get an ID that is derived from the stored ID
+ *  and their local session number, as otherwise they would consider
+ *  each other to be themselves.
+ */
 void
 DistributionSocketLink::init_my_id()
 {
@@ -199,6 +266,12 @@ DistributionSocketLink::init_my_id()
       file.close();
     }
 
+  if (local_session > 0)
+    {
+      // The last four bytes are the creation time, the others are random.
+      my_id.raw()[WRID::RAW_LENGTH - 5] ^= (guint8)local_session;
+      TRACE_MSG("Session " << local_session << " " << my_id.str());
+    }
 
   TRACE_EXIT();
 }
@@ -233,6 +306,77 @@ DistributionSocketLink::get_number_of_peers()
 }
 
 
+//! Returns the size of the output queues of all clients.
+/*!
+ *  \param packets number of queued packets.
+ *  \param bytes number of queued bytes that are not yet written.
+ *  \param peak_bytes sum of the largest output queue size of each client.
+ *  \param coalesced number of queued packets replaced by a newer one.
+ */
+void
+DistributionSocketLink::get_output_queue_stats(int &packets, int &bytes, int &peak_bytes, int &coalesced)
+{
+  packets = 0;
+  bytes = 0;
+  peak_bytes = 0;
+  coalesced = 0;
+
+  list<Client *>::iterator i = clients.begin();
+  while (i != clients.end())
+    {
+      Client *c = *i;
+      packets += c->output.size();
+      bytes += c->output_size;
+      peak_bytes += c->output_peak_size;
+      coalesced += c->output_coalesced;
+      i++;
+    }
+}
+
+
+//! Returns the traffic statistics of all clients.
+void
+DistributionSocketLink::get_peer_stats(IDistributionManager::PeerStatsList &stats)
+{
+  time_t current_time = get_time();
+
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      Client *c = *i;
+
+      IDistributionManager::PeerStats ps;
+      if (c->id != NULL)
+        {
+          ps.id = c->id;
+        }
+      else if (c->hostname != NULL)
+        {
+          ps.id = c->hostname;
+        }
+      if (c->type == CLIENTTYPE_ROUTED && c->peer != NULL && c->peer->id != NULL)
+        {
+          ps.via = c->peer->id;
+        }
+
+      ps.bytes_in = c->bytes_in;
+      ps.bytes_out = c->bytes_out;
+      ps.packets_in = c->packets_in;
+      ps.packets_out = c->packets_out;
+      ps.queue_packets = c->output.size();
+      ps.queue_bytes = c->output_size;
+      ps.reconnects = c->reconnects;
+      ps.rtt = c->rtt;
+      ps.claims_out = c->claims_out;
+      ps.claims_in = c->claims_in;
+      ps.rejects_in = c->rejects_in;
+      ps.rejects_out = c->rejects_out;
+      ps.idle = c->last_packet_time != 0 ? (int)(current_time - c->last_packet_time) : -1;
+
+      stats.push_back(ps);
+    }
+}
+
+
 //! Join the WR network.
 void
 DistributionSocketLink::connect(string url)
@@ -432,26 +576,35 @@ DistributionSocketLink::set_server_enabled(bool enabled)
     return ret;
   }
 
-  if (server_socket == NULL && enabled)
+  bool started = server_socket != NULL || local_server_socket != NULL;
+
+  if (!started && enabled)
     {
       // Switching from disabled to enabled;
-      if (!start_async_server())
+      // Sessions on this host can connect if the TCP port is in use.
+      bool tcp_ok = start_async_server();
+      bool local_ok = start_local_server();
+
+      if (!tcp_ok && !local_ok)
         {
           // We did not succeed in starting the server. Arghh.
           dist_manager->log(_("Could not enable network operation."));
           enabled = false;
         }
+      else if (local_ok)
+        {
+          connect_local_sessions();
+        }
     }
-  else if (server_socket != NULL && !enabled)
+  else if (started && !enabled)
     {
       // Switching from enabled to disabled.
-      if (server_socket != NULL)
-        {
-          dist_manager->log(_("Disabling network operation."));
+      dist_manager->log(_("Disabling network operation."));
 
-          delete server_socket;
-        }
+      delete server_socket;
       server_socket = NULL;
+      delete local_server_socket;
+      local_server_socket = NULL;
       disconnect_all();
     }
 
@@ -487,26 +640,52 @@ DistributionSocketLink::unregister_client_message(DistributionClientMessageID id
 
 
 //! Force is state distribution.
+/*!
+ *  The message is added to a single client message packet that is sent
+ *  to all clients at the next heartbeat. The batch is sent early if
+ *  the message would not fit in a packet with a 16 bit length, so that
+ *  clients without wide frames can still receive it. Only a single
+ *  message that is larger than that on its own requires a wide frame.
+ */
 bool
 DistributionSocketLink::broadcast_client_message(DistributionClientMessageID dsid,
                                                  PacketBuffer &buffer)
 {
   TRACE_ENTER("DistributionSocketLink::broadcast_client_message");
 
-  PacketBuffer packet;
-  packet.create();
-  init_packet(packet, PACKET_CLIENTMSG);
+  if (buffer.bytes_written() > 0xffff)
+    {
+      TRACE_RETURN("Message too large");
+      return false;
+    }
 
   string id = get_master();
-  packet.pack_string(id);
+  int size = 4 + buffer.bytes_written();
+
+  if (batch_count > 0 &&
+      (id != batch_master || batch_packet.bytes_written() + size > 0xffff || batch_count == 0xffff))
+    {
+      flush_client_messages();
+    }
+
+  if (batch_count == 0)
+    {
+      batch_packet.create();
+      init_packet(batch_packet, PACKET_CLIENTMSG);
 
-  packet.pack_ushort(1);
-  packet.pack_ushort(dsid);
-  packet.pack_ushort(buffer.bytes_written());
-  packet.pack_raw((unsigned char *)buffer.get_buffer(),
-                  buffer.bytes_written());
+      batch_packet.pack_string(id);
+      batch_master = id;
+
+      batch_count_pos = batch_packet.bytes_written();
+      batch_packet.pack_ushort(0);
+    }
+
+  batch_packet.pack_ushort(dsid);
+  batch_packet.pack_ushort(buffer.bytes_written());
+  batch_packet.pack_raw((unsigned char *)buffer.get_buffer(),
+                        buffer.bytes_written());
+  batch_count++;
 
-  send_packet_broadcast(packet);
   TRACE_EXIT();
   return true;
 }
@@ -546,7 +725,7 @@ DistributionSocketLink::exists_client(gchar *id)
 
 //! Adds a new client and connect to it.
 bool
-DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType type, Client *peer)
+DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType type, Client *peer, bool local)
 {
   TRACE_ENTER_MSG("DistributionSocketLink::add_client",
                   (id != NULL ? id : "NULL") << " " <<
@@ -571,7 +750,7 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
           delete c->socket;
         }
 
-      ISocket *socket = socket_driver->create_socket();
+      ISocket *socket = create_socket(c);
       socket->set_data(c);
       socket->set_listener(this);
       socket->connect(host, port);
@@ -587,11 +766,17 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
       client->type = type;
       client->peer = peer;
       client->packet.create();
+      client->input.create(READ_BUFFER_SIZE);
       client->hostname = g_strdup(host);
       client->id = g_strdup(id);
       client->port = port;
+      client->local = local;
+
+      // A routed client is introduced by its peer, which is welcome.
+      client->welcome = (type == CLIENTTYPE_ROUTED);
 
       clients.push_back(client);
+      index_client(client);
 
       if (client->id != NULL)
         {
@@ -608,7 +793,7 @@ DistributionSocketLink::add_client(gchar *id, gchar *host, gint port, ClientType
               delete client->socket;
             }
 
-          ISocket *socket = socket_driver->create_socket();
+          ISocket *socket = create_socket(client);
           socket->set_data(client);
           socket->set_listener(this);
           socket->connect(host, port);
@@ -679,11 +864,13 @@ DistributionSocketLink::set_client_id(Client *client, gchar *id)
   if (ret)
     {
       // No duplicate, so change the canonical name.
+      unindex_client(client);
       g_free(client->id);
       g_free(client->hostname);
       client->id = g_strdup(id);
       client->hostname = NULL;
       client->port = 0;
+      index_client(client);
 
       if (client->id != NULL)
         {
@@ -720,6 +907,7 @@ DistributionSocketLink::remove_client(Client *client)
 
           dist_manager->log(_("Removing client %s."),
                             (*i)->id == NULL ? "Unknown" : (*i)->id);
+          unindex_client(*i);
           delete *i;
           i = clients.erase(i);
         }
@@ -766,6 +954,7 @@ DistributionSocketLink::remove_peer_clients(Client *client)
               set_master(NULL);
             }
 
+          unindex_client(*i);
           delete *i;
           i = clients.erase(i);
         }
@@ -812,12 +1001,17 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
           // Still connected. Disconect.
           delete client->socket;
           client->socket = NULL;
+          client->input.clear();
+          client->protocol = 0;
+          client->sent_client_list = false;
+          client->sent_signon = false;
+          clear_output(client);
 
           if (reconnect)
             {
               TRACE_MSG("must reconnected");
               client->reconnect_count = reconnect_attempts;
-              client->reconnect_time = time(NULL) + 5;
+              client->reconnect_time = get_time() + 5;
             }
           else
             {
@@ -856,19 +1050,81 @@ DistributionSocketLink::close_client(Client *client, bool reconnect /* = false*/
 bool
 DistributionSocketLink::is_client_valid(Client *client)
 {
-  list<Client *>::iterator i = clients.begin();
-  bool ret = false;
+  return client_set.find(client) != client_set.end();
+}
+
+
+//! Adds a client to the lookup indices.
+/*!
+ *  Clients with the same key are kept in the order in which they were
+ *  indexed; lookups return the first one.
+ */
+void
+DistributionSocketLink::index_client(Client *client)
+{
+  client_set.insert(client);
+
+  if (client->id != NULL)
+    {
+      string id = client->id;
+      clients_by_id.insert(clients_by_id.upper_bound(id), make_pair(id, client));
+    }
+
+  if (client->hostname != NULL)
+    {
+      string name = get_canonical_key(client->hostname, client->port);
+      clients_by_name.insert(clients_by_name.upper_bound(name), make_pair(name, client));
+    }
+}
+
+
+//! Removes a client from the lookup indices.
+/*!
+ *  If another client has the same ID or canonical name, it takes the
+ *  place of the removed client. Only the clients with the same key are
+ *  visited.
+ */
+void
+DistributionSocketLink::unindex_client(Client *client)
+{
+  client_set.erase(client);
+
+  if (client->id != NULL)
+    {
+      unindex_key(clients_by_id, client->id, client);
+    }
+
+  if (client->hostname != NULL)
+    {
+      unindex_key(clients_by_name, get_canonical_key(client->hostname, client->port), client);
+    }
+}
+
 
-  while (!ret && i != clients.end())
+//! Removes the entry of a client from an index.
+void
+DistributionSocketLink::unindex_key(ClientIndex &index, const string &key, Client *client)
+{
+  pair<ClientIndex::iterator, ClientIndex::iterator> range = index.equal_range(key);
+
+  for (ClientIndex::iterator it = range.first; it != range.second; it++)
     {
-      if (*i == client)
+      if (it->second == client)
         {
-          ret = true;
+          index.erase(it);
+          break;
         }
-      i++;
     }
+}
 
-  return ret;
+
+//! Returns the key of a canonical name and port in the client index.
+string
+DistributionSocketLink::get_canonical_key(const gchar *name, gint port)
+{
+  stringstream ss;
+  ss << name << ":" << port;
+  return ss.str();
 }
 
 
@@ -876,36 +1132,27 @@ DistributionSocketLink::is_client_valid(Client *client)
 DistributionSocketLink::Client *
 DistributionSocketLink::find_client_by_canonicalname(gchar *name, gint port)
 {
-  Client *ret = NULL;
-  list<Client *>::iterator i = clients.begin();
-
-  while (i != clients.end())
+  if (name == NULL)
     {
-      if ((*i)->port == port && (*i)->hostname != NULL && strcmp((*i)->hostname, name) == 0)
-        {
-          ret = *i;
-        }
-      i++;
+      return NULL;
     }
-  return ret;
+
+  string key = get_canonical_key(name, port);
+  ClientIndex::iterator it = clients_by_name.lower_bound(key);
+  return (it != clients_by_name.end() && it->first == key) ? it->second : NULL;
 }
 
 //! Finds a remote client by its id.
 DistributionSocketLink::Client *
 DistributionSocketLink::find_client_by_id(gchar *id)
 {
-  Client *ret = NULL;
-  list<Client *>::iterator i = clients.begin();
-
-  while (i != clients.end())
+  if (id == NULL)
     {
-      if ((*i)->id != NULL && strcmp((*i)->id, id) == 0)
-        {
-          ret = *i;
-        }
-      i++;
+      return NULL;
     }
-  return ret;
+
+  ClientIndex::iterator it = clients_by_id.lower_bound(id);
+  return (it != clients_by_id.end() && it->first == id) ? it->second : NULL;
 }
 
 
@@ -1018,46 +1265,54 @@ DistributionSocketLink::send_packet_broadcast(PacketBuffer &packet)
 
 
 //! Sends the specified packet to all clients with the exception of one client.
+/*!
+ *  Clients that are not yet welcome are skipped, as they drop the packet.
+ *  The clients that cannot take the packet right away share a single
+ *  copy of it in their output queues.
+ *
+ *  \param header optional routing header that replaces the first six
+ *         bytes of the packet.
+ */
 void
-DistributionSocketLink::send_packet_except(PacketBuffer &packet, Client *client)
+DistributionSocketLink::send_packet_except(PacketBuffer &packet, Client *client, PacketBuffer *header)
 {
   TRACE_ENTER("DistributionSocketLink::send_packet_except");
 
-  gint size = packet.bytes_written();
-
-  // Length.
-  packet.poke_ushort(0, size);
+  SharedPayload *body = NULL;
 
   list<Client *>::iterator i = clients.begin();
   while (i != clients.end())
     {
       Client *c = *i;
 
-      if (c != client && c->socket != NULL)
+      if (c != client && c->welcome)
         {
-          int bytes_written = 0;
-          try
-            {
-              c->socket->write(packet.get_buffer(), size, bytes_written);
-            }
-          catch (SocketException)
-            {
-              TRACE_MSG("Failed to send");
-            }
+          write_packet(c, packet, header, &body);
         }
       i++;
     }
 
+  if (body != NULL)
+    {
+      body->unref();
+    }
+
   TRACE_EXIT();
 }
 
 
 //! Sends the specified packet to the specified client.
+/*!
+ *  \param header optional routing header that replaces the first six
+ *         bytes of the packet.
+ */
 void
-DistributionSocketLink::send_packet(Client *client, PacketBuffer &packet)
+DistributionSocketLink::send_packet(Client *client, PacketBuffer &packet, PacketBuffer *header)
 {
   TRACE_ENTER("DistributionSocketLink::send_packet");
 
+  PacketBuffer dest_header;
+
   if (client != NULL && client->type == CLIENTTYPE_ROUTED)
     {
       TRACE_MSG("Must route packet.");
@@ -1070,82 +1325,461 @@ DistributionSocketLink::send_packet(Client *client, PacketBuffer &packet)
       packet.restart_read();
       int flags = packet.peek_byte(3);
 
-      if (!(flags & PACKETFLAG_DEST) && client->id != NULL)
+      if (!(flags & PACKETFLAG_DEST) && header == NULL && client->id != NULL)
         {
           assert(!(flags & PACKETFLAG_SOURCE));
 
           TRACE_MSG("Add destination " << client->id);
 
-          packet.poke_byte(3, flags | PACKETFLAG_DEST);
-
-          packet.insert(4, strlen(client->id) + 2);
-          packet.poke_string(6, client->id);
+          init_route_header(dest_header, packet, PACKETFLAG_DEST, client->id);
+          header = &dest_header;
         }
       client = client->peer;
     }
 
-  if (client != NULL && client->socket != NULL)
+  if (client != NULL && client->id != NULL)
+    {
+      TRACE_MSG("Sending to " << client->id);
+    }
+
+  write_packet(client, packet, header);
+
+  TRACE_EXIT();
+}
+
+
+//! Creates a header that adds a routing ID to the specified packet.
+/*!
+ *  The header holds the length, version, flags and command of the packet
+ *  followed by the ID. It is sent in front of the packet without its
+ *  first six bytes, so that a packet sent to several clients is never
+ *  modified.
+ */
+void
+DistributionSocketLink::init_route_header(PacketBuffer &header, PacketBuffer &packet, PacketFlags flag, const gchar *id)
+{
+  packet.restart_read();
+
+  header.create(strlen(id) + 8);
+
+  // Length.
+  header.pack_ushort(0);
+  // Version
+  header.pack_byte(packet.peek_byte(2));
+  // Flags
+  header.pack_byte(packet.peek_byte(3) | flag);
+  // Command
+  header.pack_ushort(packet.peek_ushort(4));
+  // Routing ID
+  header.pack_string(id);
+}
+
+
+//! Writes the specified packet to the socket of the specified client.
+/*!
+ *  The part of the packet that cannot be written without blocking is
+ *  queued, and written once the socket becomes writable. Nothing is
+ *  written to a client of which a write failed; the connection is closed
+ *  at the next heartbeat, as the caller may be iterating the clients.
+ *
+ *  The packet is written as a head, which holds the frame and the
+ *  header, followed by the rest of the packet. Only the head differs
+ *  between clients.
+ *
+ *  \param header optional routing header that replaces the first six
+ *         bytes of the packet.
+ *  \param body copy of the rest of the packet that is shared by the
+ *         output queues of the clients to which the packet is sent. It
+ *         is created when the packet is first queued, and must be
+ *         released by the caller.
+ */
+void
+DistributionSocketLink::write_packet(Client *client, PacketBuffer &packet, PacketBuffer *header,
+                                     SharedPayload **body)
+{
+  if (client == NULL || client->socket == NULL || client->write_error)
     {
-      if (client->id != NULL)
-        {
-          TRACE_MSG("Sending to " << client->id);
-        }
+      return;
+    }
+
+  PacketBuffer *head = (header != NULL) ? header : &packet;
+  int head_size = (header != NULL) ? header->bytes_written() : 6;
+  int size = head_size + packet.bytes_written() - 6;
+
+  SocketBuffer buffers[3];
+  int count = 0;
 
-      gint size = packet.bytes_written();
+  PacketBuffer frame;
 
+  if (size <= 0xffff)
+    {
       // Length.
-      packet.poke_ushort(0, size);
+      head->poke_ushort(0, size);
 
-      int bytes_written = 0;
+      buffers[count].data = head->get_buffer();
+      buffers[count].size = head_size;
+      count++;
+    }
+  else if (client->protocol >= PROTOCOL_VERSION_WIDE_FRAMES && size + 4 <= MAX_PACKET_SIZE)
+    {
+      // A length of 0 is followed by the 32 bit length, which replaces
+      // the 16 bit length of the packet.
+      size += 4;
+
+      frame.create(6);
+      frame.pack_ushort(0);
+      frame.pack_ulong(size);
+
+      buffers[count].data = frame.get_buffer();
+      buffers[count].size = frame.bytes_written();
+      count++;
+      buffers[count].data = head->get_buffer() + 2;
+      buffers[count].size = head_size - 2;
+      count++;
+    }
+  else
+    {
+      TRACE_MSG("Packet too large for client");
+      return;
+    }
+
+  buffers[count].data = packet.get_buffer() + 6;
+  buffers[count].size = packet.bytes_written() - 6;
+  count++;
+
+  int bytes_written = 0;
+  if (client->output.empty())
+    {
       try
         {
-          client->socket->write(packet.get_buffer(), size, bytes_written);
+          client->socket->write(buffers, count, bytes_written);
         }
       catch (SocketException)
         {
           TRACE_MSG("Failed to send");
+          client->write_error = true;
+          return;
         }
     }
 
-  TRACE_EXIT();
+  bool sent = true;
+  if (bytes_written < size)
+    {
+      SharedPayload *own_body = NULL;
+      sent = queue_packet(client, buffers, count, bytes_written, body != NULL ? body : &own_body);
+
+      if (own_body != NULL)
+        {
+          own_body->unref();
+        }
+    }
+
+  if (sent)
+    {
+      client->packets_out++;
+      client->bytes_out += size;
+    }
 }
 
 
-//! Processed an incoming packet.
-void
-DistributionSocketLink::process_client_packet(Client *client)
+//! Adds the specified packet to the output queue of the specified client.
+/*!
+ *  A queued monitor state or full timer state message that is not yet
+ *  being written is replaced by a newer one, as only the latest state is
+ *  of interest.
+ *
+ *  \param buffers the head of the packet, followed by the rest of the
+ *         packet in the last buffer.
+ *  \param bytes_written number of bytes of the packet that are already
+ *         written.
+ *  \param body shared copy of the last buffer. It is created if it is
+ *         NULL.
+ *
+ *  \return false if the packet was dropped because the queue is full.
+ */
+bool
+DistributionSocketLink::queue_packet(Client *client, const SocketBuffer *buffers, int count, int bytes_written,
+                                     SharedPayload **body)
 {
-  TRACE_ENTER("DistributionSocketLink::process_client_packet");
-  PacketBuffer &packet = client->packet;
+  TRACE_ENTER_MSG("DistributionSocketLink::queue_packet", bytes_written);
 
-  client->claim_count = 0;
+  if (client->output_size >= MAX_OUTPUT_SIZE)
+    {
+      TRACE_RETURN("Output queue full");
+      client->overflow = true;
+      return false;
+    }
 
-  gint size = packet.unpack_ushort();
-  g_assert(size == packet.bytes_written());
+  if (*body == NULL)
+    {
+      *body = new SharedPayload(buffers[count - 1]);
+    }
 
-  gint version = packet.unpack_byte();
-  gint flags = packet.unpack_byte();
+  bool was_empty = client->output.empty();
 
-  gint type = packet.unpack_ushort();
-  TRACE_MSG("type = " << type);
-  if (client != NULL && client->id != NULL)
+  client->output.push_back(OutputPacket());
+
+  list<OutputPacket>::iterator last = client->output.end();
+  last--;
+
+  for (int i = 0; i < count - 1; i++)
     {
-      TRACE_MSG("From = " << client->id);
+      last->head.append((const char *)buffers[i].data, buffers[i].size);
     }
+  last->body = *body;
+  last->body->ref();
 
-  Client *source = client;
-  bool forward = true;
-  if (flags & PACKETFLAG_SOURCE)
+  size_t key_size = get_state_key_size(*last);
+  if (key_size > 0)
     {
-      gchar *id = packet.unpack_string();
-
-      if (!client_is_me(id))
+      list<OutputPacket>::iterator i = client->output.begin();
+      if (client->output_offset > 0)
         {
-          TRACE_MSG("routed, source = " << id);
-
-          source = find_client_by_id(id);
+          // Partially written, cannot be replaced.
+          i++;
+        }
 
-          if (source == NULL)
+      while (i != last)
+        {
+          bool same = get_state_key_size(*i) == key_size;
+          for (size_t pos = 2; same && pos < key_size; pos++)
+            {
+              same = i->at(pos) == last->at(pos);
+            }
+
+          if (same)
+            {
+              TRACE_MSG("Replacing queued state");
+              client->output_size -= i->size();
+              client->output_coalesced++;
+              client->output.erase(i);
+              break;
+            }
+          i++;
+        }
+    }
+
+  client->output_size += last->size() - bytes_written;
+  if (was_empty)
+    {
+      client->output_offset = bytes_written;
+    }
+
+  if (client->output_size > client->output_peak_size)
+    {
+      client->output_peak_size = client->output_size;
+    }
+
+  if (client->output_size > OUTPUT_HIGH_WATERMARK && !client->congested)
+    {
+      TRACE_MSG("Congested, pause reading");
+      client->congested = true;
+      client->socket->set_watch_events(false, true);
+    }
+  else if (was_empty)
+    {
+      client->socket->set_watch_events(!client->congested, true);
+    }
+
+  TRACE_EXIT();
+  return true;
+}
+
+
+//! Writes as much of the output queue of the specified client as possible.
+void
+DistributionSocketLink::flush_output(Client *client)
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::flush_output", client->output_size);
+
+  while (!client->output.empty())
+    {
+      SocketBuffer buffers[16];
+      int count = 0;
+      int size = 0;
+      int offset = client->output_offset;
+
+      list<OutputPacket>::iterator i = client->output.begin();
+      while (i != client->output.end() && count < 15)
+        {
+          if (offset < (int)i->head.size())
+            {
+              buffers[count].data = (void *)(i->head.data() + offset);
+              buffers[count].size = i->head.size() - offset;
+              size += buffers[count].size;
+              count++;
+              offset = 0;
+            }
+          else
+            {
+              offset -= i->head.size();
+            }
+
+          buffers[count].data = (void *)(i->body->data.data() + offset);
+          buffers[count].size = i->body->data.size() - offset;
+          size += buffers[count].size;
+          count++;
+          offset = 0;
+          i++;
+        }
+
+      int bytes_written = 0;
+      try
+        {
+          client->socket->write(buffers, count, bytes_written);
+        }
+      catch (SocketException)
+        {
+          // The rest of the stream is lost, so the connection is closed
+          // at the next heartbeat.
+          TRACE_MSG("Failed to send");
+          client->write_error = true;
+          client->socket->set_watch_events(true, false);
+          TRACE_EXIT();
+          return;
+        }
+
+      bool partial = bytes_written < size;
+
+      client->output_size -= bytes_written;
+      bytes_written += client->output_offset;
+
+      while (!client->output.empty() && bytes_written >= (int)client->output.front().size())
+        {
+          bytes_written -= client->output.front().size();
+          client->output.pop_front();
+        }
+      client->output_offset = bytes_written;
+
+      if (partial)
+        {
+          break;
+        }
+    }
+
+  if (client->output.empty())
+    {
+      client->congested = false;
+      client->socket->set_watch_events(true, false);
+    }
+  else if (client->congested && client->output_size < OUTPUT_LOW_WATERMARK)
+    {
+      TRACE_MSG("Resume reading");
+      client->congested = false;
+      client->socket->set_watch_events(true, true);
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Discards the output queue of the specified client.
+void
+DistributionSocketLink::clear_output(Client *client)
+{
+  client->output.clear();
+  client->output_offset = 0;
+  client->output_size = 0;
+  client->congested = false;
+  client->overflow = false;
+  client->write_error = false;
+}
+
+
+//! Returns the size of the part of a packet that identifies the state it carries.
+/*!
+ *  Client messages that carry a single monitor state or full timer state
+ *  supersede earlier ones with the same flags, routing, master and
+ *  message ID.
+ *
+ *  \return 0 if the packet cannot be superseded.
+ */
+size_t
+DistributionSocketLink::get_state_key_size(const OutputPacket &packet)
+{
+  size_t size = packet.size();
+
+  if (size < 6 || packet.head.size() < 6)
+    {
+      return 0;
+    }
+
+  const guint8 *p = (const guint8 *)packet.head.data();
+  if (((p[0] << 8) | p[1]) == 0 || ((p[4] << 8) | p[5]) != PACKET_CLIENTMSG)
+    {
+      return 0;
+    }
+
+  // Routing IDs and master ID.
+  int strings = 1 + ((p[3] & PACKETFLAG_SOURCE) ? 1 : 0) + ((p[3] & PACKETFLAG_DEST) ? 1 : 0);
+  size_t pos = 6;
+
+  for (int i = 0; i < strings; i++)
+    {
+      if (pos + 2 > size)
+        {
+          return 0;
+        }
+      pos += 2 + ((packet.at(pos) << 8) | packet.at(pos + 1));
+    }
+
+  if (pos + 4 > size || ((packet.at(pos) << 8) | packet.at(pos + 1)) != 1)
+    {
+      return 0;
+    }
+
+  int id = (packet.at(pos + 2) << 8) | packet.at(pos + 3);
+  if (id != DCM_TIMERS && id != DCM_MONITOR)
+    {
+      return 0;
+    }
+
+  // Timer state that only holds changes does not supersede anything.
+  if (id == DCM_TIMERS && (pos + 8 > size || ((packet.at(pos + 6) << 8) | packet.at(pos + 7)) == 0))
+    {
+      return 0;
+    }
+
+  return pos + 4;
+}
+
+
+//! Processed an incoming packet.
+void
+DistributionSocketLink::process_client_packet(Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::process_client_packet");
+  PacketBuffer &packet = client->packet;
+
+  client->claim_count = 0;
+
+  // The length is 0 if the packet was received in a frame with a 32 bit length.
+  gint size = packet.unpack_ushort();
+  g_assert(size == 0 || size == packet.bytes_written());
+
+  gint version = packet.unpack_byte();
+  gint flags = packet.unpack_byte();
+
+  gint type = packet.unpack_ushort();
+  TRACE_MSG("type = " << type);
+  if (client != NULL && client->id != NULL)
+    {
+      TRACE_MSG("From = " << client->id);
+    }
+
+  Client *source = client;
+  bool forward = true;
+  if (flags & PACKETFLAG_SOURCE)
+    {
+      gchar *id = packet.unpack_string();
+
+      if (!client_is_me(id))
+        {
+          TRACE_MSG("routed, source = " << id);
+
+          source = find_client_by_id(id);
+
+          if (source == NULL)
             {
               TRACE_MSG("Unknown source. Dropping");
             }
@@ -1193,6 +1827,11 @@ DistributionSocketLink::process_client_packet(Client *client)
 
   TRACE_MSG("size = " << size << ", version = " << version << ", flags = " << flags);
 
+  if (source != NULL)
+    {
+      source->last_packet_time = client->last_packet_time;
+    }
+
   if (source != NULL || type == PACKET_CLIENT_LIST)
     {
       switch (type)
@@ -1213,6 +1852,7 @@ DistributionSocketLink::process_client_packet(Client *client)
 
         case PACKET_CLAIM:
           handle_claim(packet, source);
+          forward = false;
           break;
 
         case PACKET_WELCOME:
@@ -1239,17 +1879,28 @@ DistributionSocketLink::process_client_packet(Client *client)
 
         case PACKET_CLAIM_REJECT:
           handle_claim_reject(packet, source);
+          forward = false;
+          break;
+
+        case PACKET_PING:
+          handle_ping(packet, source);
+          forward = false;
+          break;
+
+        case PACKET_PONG:
+          handle_pong(packet, source);
+          forward = false;
           break;
         }
 
-      if (forward &&
-          find(clients.begin(), clients.end(), client) != clients.end())
+      // A packet with a destination is not forwarded once it arrives.
+      if (forward && !(flags & PACKETFLAG_DEST) && is_client_valid(client))
         {
           forward_packet_except(packet, client, source);
         }
     }
 
-  if (find(clients.begin(), clients.end(), client) != clients.end())
+  if (is_client_valid(client))
     {
       // hack... client may have been removed...
       packet.clear();
@@ -1265,16 +1916,18 @@ DistributionSocketLink::forward_packet_except(PacketBuffer &packet, Client *clie
 {
   TRACE_ENTER("DistributionSocketLink::forward_packet_except");
 
+  PacketBuffer source_header;
+  PacketBuffer *header = NULL;
+
   packet.restart_read();
   int flags = packet.peek_byte(3);
   if (!(flags &  PACKETFLAG_SOURCE) && source->id != NULL)
     {
       TRACE_MSG("Add source " << source->id);
-      packet.poke_byte(3, flags | PACKETFLAG_SOURCE);
-      packet.insert(4, strlen(source->id) + 2);
-      packet.poke_string(6, source->id);
+      init_route_header(source_header, packet, PACKETFLAG_SOURCE, source->id);
+      header = &source_header;
     }
-  send_packet_except(packet, client);
+  send_packet_except(packet, client, header);
 
   TRACE_EXIT();
 }
@@ -1285,16 +1938,18 @@ DistributionSocketLink::forward_packet(PacketBuffer &packet, Client *dest, Clien
 {
   TRACE_ENTER("DistributionSocketLink::forward_packet");
 
+  PacketBuffer source_header;
+  PacketBuffer *header = NULL;
+
   packet.restart_read();
   int flags = packet.peek_byte(3);
   if (!(flags &  PACKETFLAG_SOURCE) && source->id != NULL)
     {
       TRACE_MSG("Add source " << source->id);
-      packet.poke_byte(3, flags | PACKETFLAG_SOURCE);
-      packet.insert(4, strlen(source->id) + 2);
-      packet.poke_string(6, source->id);
+      init_route_header(source_header, packet, PACKETFLAG_SOURCE, source->id);
+      header = &source_header;
     }
-  send_packet(dest, packet);
+  send_packet(dest, packet, header);
   TRACE_EXIT();
 }
 
@@ -1350,8 +2005,11 @@ DistributionSocketLink::handle_hello1(PacketBuffer &packet, Client *client)
   TRACE_MSG(user << " " << id << " " << rnd);
   
   dist_manager->log(_("Client %s saying hello."), id != NULL ? id : "Unknown");
-  
-  if (user != NULL &&  (username == NULL || (strcmp(username, user) == 0)))
+
+  // Sessions of the same user on this host do not need to authenticate.
+  bool trusted = client->socket != NULL && client->socket->is_same_user();
+
+  if (trusted || (user != NULL &&  (username == NULL || (strcmp(username, user) == 0))))
     {
       send_hello2(client, rnd);
     }
@@ -1381,17 +2039,27 @@ DistributionSocketLink::send_hello2(Client *client, gchar *rnd)
   packet.create();
   init_packet(packet, PACKET_HELLO2);
   
-  GHmac *hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)password, strlen(password));
+  packet.pack_string(username);
 
-  g_hmac_update(hmac, (const guchar *)username, strlen(username));
-  g_hmac_update(hmac, (const guchar *)rnd, strlen(rnd));
-  g_hmac_update(hmac, (const guchar *)get_my_id().c_str(), get_my_id().length());
+  if (client->socket != NULL && client->socket->is_same_user())
+    {
+      // Sessions of the same user on this host do not need to authenticate.
+      packet.pack_string("");
+    }
+  else
+    {
+      GHmac *hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)password, strlen(password));
 
-  packet.pack_string(username);
-  packet.pack_string(g_hmac_get_string(hmac));
-  packet.pack_string(get_my_id());
+      g_hmac_update(hmac, (const guchar *)username, strlen(username));
+      g_hmac_update(hmac, (const guchar *)rnd, strlen(rnd));
+      g_hmac_update(hmac, (const guchar *)get_my_id().c_str(), get_my_id().length());
 
-  g_hmac_unref (hmac);
+      packet.pack_string(g_hmac_get_string(hmac));
+      g_hmac_unref (hmac);
+    }
+
+  packet.pack_string(get_my_id());
+  packet.pack_ushort(PROTOCOL_VERSION);
 
   send_packet(client, packet);
   TRACE_EXIT();
@@ -1408,26 +2076,46 @@ DistributionSocketLink::handle_hello2(PacketBuffer &packet, Client *client)
   gchar *pass = packet.unpack_string();
   gchar *id = packet.unpack_string();
 
-  TRACE_MSG(user << " " << pass << " " << id << " " << client->challenge);
+  // Older clients do not send a protocol version.
+  int protocol = packet.bytes_available() >= 2 ? packet.unpack_ushort() : 0;
+
+  TRACE_MSG(user << " " << pass << " " << id << " " << client->challenge << " " << protocol);
   
   dist_manager->log(_("Client %s saying hello."), id != NULL ? id : "Unknown");
 
-  GHmac *hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)password, strlen(password));
-  g_hmac_update(hmac, (const guchar *)username, strlen(username));
-  g_hmac_update(hmac, (const guchar *)client->challenge.c_str(), client->challenge.length());
-  g_hmac_update(hmac, (const guchar *)id, strlen(id));
+  // Sessions of the same user on this host do not need to authenticate.
+  bool authenticated = id != NULL && client->socket != NULL && client->socket->is_same_user();
 
-  if ( user != NULL && pass != NULL &&
-       (username == NULL || (strcmp(username, user) == 0)) &&
-       (password == NULL || (strcmp(g_hmac_get_string(hmac), pass) == 0)))
+  if (!authenticated && id != NULL)
+    {
+      GHmac *hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)password, strlen(password));
+      g_hmac_update(hmac, (const guchar *)username, strlen(username));
+      g_hmac_update(hmac, (const guchar *)client->challenge.c_str(), client->challenge.length());
+      g_hmac_update(hmac, (const guchar *)id, strlen(id));
+
+      authenticated = (user != NULL && pass != NULL &&
+                       (username == NULL || (strcmp(username, user) == 0)) &&
+                       (password == NULL || (strcmp(g_hmac_get_string(hmac), pass) == 0)));
+
+      g_hmac_unref (hmac);
+    }
+
+  if (authenticated)
     {
       bool ok = set_client_id(client, id);
 
       if (ok)
         {
+          client->protocol = MIN(protocol, PROTOCOL_VERSION);
+
           // Welcome!
           send_welcome(client);
           client->welcome = true;
+
+          // The client must know the clients before any of their
+          // packets are forwarded to it.
+          send_client_list(client);
+          client->sent_client_list = true;
         }
       else
         {
@@ -1451,8 +2139,6 @@ DistributionSocketLink::handle_hello2(PacketBuffer &packet, Client *client)
   g_free(id);
   g_free(pass);
 
-  g_hmac_unref (hmac);
-
   TRACE_EXIT();
 }
   
@@ -1588,6 +2274,7 @@ DistributionSocketLink::send_welcome(Client *client)
   packet.pack_string(get_my_id());
   packet.pack_string(get_my_id()); // was: hostname
   packet.pack_ushort(server_port);
+  packet.pack_ushort(client->protocol);
 
   send_packet(client, packet);
   TRACE_EXIT();
@@ -1603,6 +2290,7 @@ DistributionSocketLink::handle_welcome(PacketBuffer &packet, Client *client)
   gchar *id = packet.unpack_string();
   gchar *name = packet.unpack_string();
   /*gint port = */ packet.unpack_ushort();
+  int protocol = packet.bytes_available() >= 2 ? packet.unpack_ushort() : 0;
 
   dist_manager->log(_("Client %s is welcoming us."),
                     id == NULL ? "Unknown" : id);
@@ -1612,6 +2300,7 @@ DistributionSocketLink::handle_welcome(PacketBuffer &packet, Client *client)
   if (ok)
     {
       client->welcome = true;
+      client->protocol = MIN(protocol, PROTOCOL_VERSION);
       
       // The connected client offers the master client.
       // This info will be received in the client list.
@@ -1621,6 +2310,7 @@ DistributionSocketLink::handle_welcome(PacketBuffer &packet, Client *client)
       // All, ok. Send list of known client.
       // WITHOUT info about who's master on out side.
       send_client_list(client);
+      client->sent_client_list = true;
     }
   else
     {
@@ -1668,13 +2358,14 @@ DistributionSocketLink::send_client_list(Client *client, bool except)
       // Size of the client data.
       packet.poke_ushort(pos, packet.bytes_written() - pos);
 
-      // Put known client in the list.
+      // Put known client in the list. Clients that are routed through
+      // the receiver are known to it, and would look like a cycle.
       list<Client *>::iterator i = clients.begin();
       while (i != clients.end())
         {
           Client *c = *i;
 
-          if (c->id != NULL)
+          if (c->id != NULL && (except || c->peer != client))
             {
               count++;
               pos = packet.bytes_written();
@@ -1722,7 +2413,8 @@ DistributionSocketLink::handle_client_list(PacketBuffer &packet, Client *client,
 {
   TRACE_ENTER("DistributionSocketLink::handle_client_list");
 
-  if (!client->welcome)
+  // The source is unknown if the list is routed from a new client.
+  if (!direct->welcome || (client != NULL && !client->welcome))
     {
       TRACE_EXIT();
       return false;;
@@ -1772,8 +2464,10 @@ DistributionSocketLink::handle_client_list(PacketBuffer &packet, Client *client,
               ids[i] = id;
               ports[i] = port;
             }
-          else if (client != NULL && direct == client && !client_is_me(id) && strcmp(client->id, id) != 0)
+          else if (client != NULL && direct == client && !client_is_me(id) && strcmp(client->id, id) != 0 &&
+                   find_client_by_id(id)->peer != client)
             {
+              // Known through another route.
               TRACE_MSG("Strange client: " << id);
               ok = false;
             }
@@ -1783,8 +2477,12 @@ DistributionSocketLink::handle_client_list(PacketBuffer &packet, Client *client,
       size -= (packet.bytes_read() - pos);
       packet.skip(size);
 
-      g_free(name);
-      g_free(id);
+      // The ID and name of a new client are freed after adding it.
+      if (ids[i] == NULL)
+        {
+          g_free(name);
+          g_free(id);
+        }
     }
 
 
@@ -1812,7 +2510,7 @@ DistributionSocketLink::handle_client_list(PacketBuffer &packet, Client *client,
           TRACE_MSG(master_id << " is now master");
         }
 
-      send_client_message(DCMT_SIGNON);
+      send_signon_message();
     }
   else
     {
@@ -1849,7 +2547,7 @@ DistributionSocketLink::send_claim(Client *client)
 {
   TRACE_ENTER("DistributionSocketLink::send_claim");
 
-  if (client->next_claim_time == 0 || time(NULL) >= client->next_claim_time)
+  if (client->next_claim_time == 0 || get_time() >= client->next_claim_time)
     {
       PacketBuffer packet;
 
@@ -1861,9 +2559,10 @@ DistributionSocketLink::send_claim(Client *client)
 
       packet.pack_ushort(0);
 
-      client->next_claim_time = time(NULL) + 10;
+      client->next_claim_time = get_time() + 10;
 
       send_packet(client, packet);
+      client->claims_out++;
 
       if (client->claim_count >= 3)
         {
@@ -1892,6 +2591,7 @@ DistributionSocketLink::handle_claim(PacketBuffer &packet, Client *client)
     }
   
   /*gint count = */ packet.unpack_ushort();
+  client->claims_in++;
 
   if (i_am_master && master_locked)
     {
@@ -1939,6 +2639,7 @@ DistributionSocketLink::send_claim_reject(Client *client)
   init_packet(packet, PACKET_CLAIM_REJECT);
 
   send_packet(client, packet);
+  client->rejects_out++;
   TRACE_EXIT();
 }
 
@@ -1955,7 +2656,9 @@ DistributionSocketLink::handle_claim_reject(PacketBuffer &packet, Client *client
       TRACE_EXIT();
       return;
     }
-  
+
+  client->rejects_in++;
+
   if (client != master_client)
     {
       dist_manager->log(_("Non-master client %s rejected master request."),
@@ -1973,9 +2676,83 @@ DistributionSocketLink::handle_claim_reject(PacketBuffer &packet, Client *client
           count = 6;
         }
 
-      client->next_claim_time = time(NULL) + 5 * count;
+      client->next_claim_time = get_time() + 5 * count;
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Measures the round trip time to the specified client.
+void
+DistributionSocketLink::send_ping(Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::send_ping");
+
+  GTimeVal now;
+  g_get_current_time(&now);
+
+  PacketBuffer packet;
+
+  packet.create();
+  init_packet(packet, PACKET_PING);
+
+  packet.pack_ulong(now.tv_sec);
+  packet.pack_ulong(now.tv_usec);
+
+  send_packet(client, packet);
+  TRACE_EXIT();
+}
+
+
+//! Handles a round trip time measurement of a remote client.
+void
+DistributionSocketLink::handle_ping(PacketBuffer &packet, Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::handle_ping");
+
+  if (!client->welcome || client->type != CLIENTTYPE_DIRECT)
+    {
+      TRACE_EXIT();
+      return;
+    }
+
+  guint32 sec = packet.unpack_ulong();
+  guint32 usec = packet.unpack_ulong();
+
+  PacketBuffer reply;
+
+  reply.create();
+  init_packet(reply, PACKET_PONG);
+
+  // Return the time of the remote client unchanged.
+  reply.pack_ulong(sec);
+  reply.pack_ulong(usec);
+
+  send_packet(client, reply);
+  TRACE_EXIT();
+}
+
+
+//! Handles the reply to my round trip time measurement.
+void
+DistributionSocketLink::handle_pong(PacketBuffer &packet, Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::handle_pong");
+
+  GTimeVal now;
+  g_get_current_time(&now);
+
+  gint64 sec = packet.unpack_ulong();
+  gint64 usec = packet.unpack_ulong();
+
+  gint64 rtt = ((now.tv_sec - sec) * G_USEC_PER_SEC + (now.tv_usec - usec)) / 1000;
+  if (rtt >= 0 && rtt < G_MAXINT)
+    {
+      client->rtt = (int)rtt;
     }
 
+  TRACE_MSG("rtt = " << client->rtt);
   TRACE_EXIT();
 }
 
@@ -2055,12 +2832,15 @@ DistributionSocketLink::handle_new_master(PacketBuffer &packet, Client *client)
 }
 
 
-// Distributes the current client message.
+//! Sends the current client message to the specified client (or all remote clients).
 void
-DistributionSocketLink::send_client_message(DistributionClientMessageType type)
+DistributionSocketLink::send_client_message(DistributionClientMessageType type, Client *client)
 {
   TRACE_ENTER("DistributionSocketLink:send_client_message");
 
+  // Keep the order of client messages.
+  flush_client_messages();
+
   PacketBuffer packet;
   packet.create();
   init_packet(packet, PACKET_CLIENTMSG);
@@ -2093,11 +2873,94 @@ DistributionSocketLink::send_client_message(DistributionClientMessageType type)
       i++;
     }
 
-  send_packet_broadcast(packet);
+  if (client != NULL && client->id != NULL)
+    {
+      // Address the client, so that it does not forward the message.
+      PacketBuffer dest_header;
+      init_route_header(dest_header, packet, PACKETFLAG_DEST, client->id);
+      send_packet(client, packet, &dest_header);
+    }
+  else
+    {
+      send_packet_broadcast(packet);
+    }
+  TRACE_EXIT();
+}
+
+
+//! Sends the sign-on client message to the clients that did not receive it.
+/*!
+ *  Clients that knew this client before already have its sign-on
+ *  message. The message is only broadcast if most clients are new, so
+ *  that a joining client does not make every client broadcast.
+ *
+ *  A client drops messages from unknown clients, so the message is only
+ *  sent once my client list was sent in its direction.
+ */
+void
+DistributionSocketLink::send_signon_message()
+{
+  TRACE_ENTER("DistributionSocketLink::send_signon_message");
+
+  list<Client *> pending;
+  size_t count = 0;
+
+  for (list<Client *>::iterator i = clients.begin(); i != clients.end(); i++)
+    {
+      Client *c = *i;
+      Client *direct = (c->peer != NULL) ? c->peer : c;
+
+      if (c->id != NULL && c->welcome && c->type != CLIENTTYPE_SIGNEDOFF)
+        {
+          count++;
+          if (!c->sent_signon && direct->sent_client_list)
+            {
+              pending.push_back(c);
+            }
+        }
+    }
+
+  TRACE_MSG(pending.size() << " of " << count);
+
+  if (pending.size() * 2 > count)
+    {
+      send_client_message(DCMT_SIGNON);
+
+      for (list<Client *>::iterator i = pending.begin(); i != pending.end(); i++)
+        {
+          (*i)->sent_signon = true;
+        }
+    }
+  else
+    {
+      for (list<Client *>::iterator i = pending.begin(); i != pending.end(); i++)
+        {
+          send_client_message(DCMT_SIGNON, *i);
+          (*i)->sent_signon = true;
+        }
+    }
+
   TRACE_EXIT();
 }
 
 
+//! Sends the batched broadcast client messages to all clients.
+void
+DistributionSocketLink::flush_client_messages()
+{
+  if (batch_count > 0)
+    {
+      TRACE_ENTER_MSG("DistributionSocketLink::flush_client_messages", batch_count);
+
+      batch_packet.poke_ushort(batch_count_pos, batch_count);
+      batch_count = 0;
+
+      send_packet_broadcast(batch_packet);
+      TRACE_EXIT();
+    }
+}
+
+
 //! Handles client message  from a remote client.
 void
 DistributionSocketLink::handle_client_message(PacketBuffer &packet, Client *client)
@@ -2177,6 +3040,8 @@ DistributionSocketLink::start_async_server()
     }
   catch(SocketException e)
     {
+      delete server_socket;
+      server_socket = NULL;
     }
 
   TRACE_RETURN(ret);
@@ -2184,13 +3049,122 @@ DistributionSocketLink::start_async_server()
 }
 
 
+//! Reserves a local session number.
+/*!
+ *  Each session of a user on this host reserves the first free local
+ *  session number by listening at the local socket with port
+ *  MAX_LOCAL_SESSIONS plus the session number. The number determines
+ *  the ID of the session, so it is kept for the lifetime of the session,
+ *  even while network operation is disabled. No session connects to
+ *  these sockets.
+ */
+void
+DistributionSocketLink::reserve_local_session()
+{
+  TRACE_ENTER("DistributionSocketLink::reserve_local_session");
+
+  for (int i = 0; local_socket_driver != NULL && local_session_lock == NULL && i < MAX_LOCAL_SESSIONS; i++)
+    {
+      ISocketServer *server = local_socket_driver->create_server();
+
+      try
+        {
+          server->set_listener(this);
+          server->listen(MAX_LOCAL_SESSIONS + i);
+
+          local_session_lock = server;
+          local_session = i;
+        }
+      catch(SocketException e)
+        {
+          delete server;
+        }
+    }
+
+  TRACE_RETURN(local_session);
+}
+
+
+//! Starts listening for sessions on this host.
+/*!
+ *  Each session of a user on this host listens at the local socket of
+ *  its local session number.
+ */
+bool
+DistributionSocketLink::start_local_server()
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::start_local_server", local_session);
+
+  if (local_socket_driver != NULL && local_server_socket == NULL && local_session >= 0)
+    {
+      ISocketServer *server = local_socket_driver->create_server();
+
+      try
+        {
+          server->set_listener(this);
+          server->listen(local_session);
+
+          local_server_socket = server;
+        }
+      catch(SocketException e)
+        {
+          delete server;
+        }
+    }
+
+  TRACE_RETURN(local_server_socket != NULL);
+  return local_server_socket != NULL;
+}
+
+
+//! Connects to all other sessions on this host.
+/*!
+ *  A session only connects to the sessions that were started before it,
+ *  so that there is a single connection between two sessions. Local
+ *  sockets at which no session listens fail to connect and their clients
+ *  are removed.
+ */
+void
+DistributionSocketLink::connect_local_sessions()
+{
+  TRACE_ENTER_MSG("DistributionSocketLink::connect_local_sessions", local_session);
+
+  for (int i = 0; i < MAX_LOCAL_SESSIONS; i++)
+    {
+      if (i != local_session)
+        {
+          add_client(NULL, (gchar *)LOCAL_HOSTNAME, i, CLIENTTYPE_DIRECT, NULL, true);
+        }
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Creates a socket for a connection to the specified client.
+ISocket *
+DistributionSocketLink::create_socket(Client *client)
+{
+  if (client->local)
+    {
+      return local_socket_driver->create_socket();
+    }
+  return socket_driver->create_socket();
+}
+
+
 void
 DistributionSocketLink::socket_accepted(ISocketServer *scon, ISocket *ccon)
 {
   (void) scon;
 
   TRACE_ENTER("DistributionSocketLink::socket_accepted");
-  if (ccon != NULL)
+  if (ccon != NULL && scon == local_session_lock)
+    {
+      // Not a session socket.
+      delete ccon;
+    }
+  else if (ccon != NULL)
     {
       dist_manager->log(_("Accepted new client."));
 
@@ -2198,6 +3172,7 @@ DistributionSocketLink::socket_accepted(ISocketServer *scon, ISocket *ccon)
       client->type = CLIENTTYPE_DIRECT;
       client->peer = NULL;
       client->packet.create();
+      client->input.create(READ_BUFFER_SIZE);
 
       TRACE_RETURN(client->packet.bytes_available());
       client->socket = ccon;
@@ -2206,10 +3181,12 @@ DistributionSocketLink::socket_accepted(ISocketServer *scon, ISocket *ccon)
       client->port = 0;
       client->reconnect_count = 0;
       client->reconnect_time = 0;
+      client->local = (scon == local_server_socket);
 
       ccon->set_data(client);
       ccon->set_listener(this);
       clients.push_back(client);
+      index_client(client);
 
       send_hello1(client);
     }
@@ -2226,40 +3203,42 @@ DistributionSocketLink::socket_io(ISocket *con, void *data)
   Client *client = (Client *)data;
   g_assert(client != NULL);
 
-  TRACE_MSG("1");
-
   if (!is_client_valid(client) && client->type == CLIENTTYPE_DIRECT)
     {
       TRACE_RETURN("Invalid client");
       return;
     }
 
-  int bytes_read = 0;
-  int bytes_to_read = 4;
-
-  TRACE_MSG("2 " << client->packet.bytes_available() );
+  PacketBuffer &input = client->input;
 
-  if (client->packet.bytes_available() >= 4)
+  // Move unprocessed data to the start of the buffer.
+  int pending = input.bytes_available();
+  if (input.read_ptr != input.buffer)
     {
-      TRACE_MSG("3");
-
-      bytes_to_read = client->packet.peek_ushort(0) - 4;
-
-      TRACE_MSG("4 " << bytes_to_read);
+      memmove(input.buffer, input.read_ptr, pending);
+      input.read_ptr = input.buffer;
+      input.write_ptr = input.buffer + pending;
+    }
 
-      if (bytes_to_read + 4 > client->packet.get_buffer_size())
-        {
-          TRACE_MSG("5 " << bytes_to_read << " " << client->packet.get_buffer_size());
-          // FIXME: the 1024 is lame...
-          client->packet.resize(bytes_to_read + 4 + 1024);
-        }
+  if (pending >= 6 && input.peek_ushort(0) == 0 &&
+      client->protocol >= PROTOCOL_VERSION_WIDE_FRAMES &&
+      input.peek_ulong(2) <= MAX_PACKET_SIZE &&
+      input.get_buffer_size() < (int)input.peek_ulong(2))
+    {
+      // Make room for a complete frame with a 32 bit length.
+      input.resize(input.peek_ulong(2) + READ_BUFFER_SIZE);
+    }
+  else if (input.get_buffer_size() - pending < READ_BUFFER_SIZE &&
+           input.get_buffer_size() < MAX_READ_BUFFER_SIZE)
+    {
+      input.resize(MIN(input.get_buffer_size() + READ_BUFFER_SIZE, MAX_READ_BUFFER_SIZE));
     }
 
-  TRACE_MSG("5");
+  int bytes_read = 0;
   bool ok = true;
   try
     {
-      con->read(client->packet.get_write_ptr(), bytes_to_read, bytes_read);
+      con->read(input.get_write_ptr(), input.get_buffer_size() - pending, bytes_read);
     }
   catch (SocketException)
     {
@@ -2281,11 +3260,22 @@ DistributionSocketLink::socket_io(ISocket *con, void *data)
   else
     {
       g_assert(bytes_read > 0);
-      client->packet.write_ptr += bytes_read;
+      input.write_ptr += bytes_read;
 
-      if (client->packet.peek_ushort(0) == client->packet.bytes_written())
+      if (!read_client_packets(con, client))
         {
-          process_client_packet(client);
+          TRACE_RETURN("Client closed");
+          return;
+        }
+
+      if (input.bytes_available() == 0)
+        {
+          input.clear();
+
+          if (input.get_buffer_size() > MAX_READ_BUFFER_SIZE)
+            {
+              input.create(READ_BUFFER_SIZE);
+            }
         }
     }
 
@@ -2299,6 +3289,112 @@ DistributionSocketLink::socket_io(ISocket *con, void *data)
 }
 
 
+//! Writes queued packets once the socket of a client becomes writable.
+void
+DistributionSocketLink::socket_writable(ISocket *con, void *data)
+{
+  TRACE_ENTER("DistributionSocketLink::socket_writable");
+
+  Client *client = (Client *)data;
+  g_assert(client != NULL);
+
+  if (!is_client_valid(client) && client->type == CLIENTTYPE_DIRECT)
+    {
+      TRACE_RETURN("Invalid client");
+      return;
+    }
+
+  if (client->socket == con)
+    {
+      flush_output(client);
+    }
+  else
+    {
+      con->set_watch_events(true, false);
+    }
+
+  TRACE_EXIT();
+}
+
+
+//! Processes all complete packets in the receive buffer of a client.
+/*!
+ *  Each packet is copied to the packet buffer of the client before it is
+ *  processed. The receive buffer is a linear buffer that is compacted
+ *  before each read, since packets must be contiguous to be unpacked.
+ *
+ *  \return false if the client or its connection was removed while
+ *          processing a packet.
+ */
+bool
+DistributionSocketLink::read_client_packets(ISocket *con, Client *client)
+{
+  TRACE_ENTER("DistributionSocketLink::read_client_packets");
+
+  PacketBuffer &input = client->input;
+
+  while (input.bytes_available() >= 6)
+    {
+      int size = input.peek_ushort(0);
+
+      // Wide frames are only accepted once the client has announced
+      // support for them. Until then, a length of 0 is illegal.
+      bool wide = (size == 0 && client->protocol >= PROTOCOL_VERSION_WIDE_FRAMES);
+
+      if (wide)
+        {
+          // Frame with a 32 bit length.
+          guint32 frame_size = input.peek_ulong(2);
+
+          size = (frame_size >= 10 && frame_size <= MAX_PACKET_SIZE) ? frame_size : 0;
+        }
+
+      if (size < 6)
+        {
+          TRACE_MSG("Illegal packet size " << size);
+          dist_manager->log(_("Client %s read error, closing."),
+                            client->id == NULL ? "Unknown" : client->id);
+          close_client(client, client->outbound);
+          TRACE_RETURN(false);
+          return false;
+        }
+
+      if (input.bytes_available() < size)
+        {
+          break;
+        }
+
+      client->packet.clear();
+      if (wide)
+        {
+          // The packet keeps a length of 0.
+          client->packet.pack_ushort(0);
+          client->packet.pack_raw(input.read_ptr + 6, size - 6);
+        }
+      else
+        {
+          client->packet.pack_raw(input.read_ptr, size);
+        }
+      input.skip(size);
+
+      client->packets_in++;
+      client->bytes_in += size;
+      client->last_packet_time = get_time();
+
+      process_client_packet(client);
+
+      if (!is_client_valid(client) || client->socket != con)
+        {
+          TRACE_RETURN(false);
+          return false;
+        }
+    }
+
+  TRACE_RETURN(true);
+  return true;
+}
+
+
 void
 DistributionSocketLink::socket_connected(ISocket *con, void *data)
 {
@@ -2323,6 +3419,9 @@ DistributionSocketLink::socket_connected(ISocket *con, void *data)
   client->outbound = true;
   client->socket = con;
 
+  // Packets sent while connecting are discarded.
+  clear_output(client);
+
   TRACE_EXIT();
 }
 
@@ -2343,7 +3442,19 @@ DistributionSocketLink::socket_closed(ISocket *con, void *data)
     }
 
   // Socket error. Disable client.
-  if (client->socket != NULL)
+  if (client->local)
+    {
+      // Sessions on this host connect when they start, so there is
+      // nothing to reconnect to.
+      if (client->welcome)
+        {
+          dist_manager->log(_("Client %s closed connection."),
+                            client->id != NULL ? client->id : "Unknown");
+        }
+      close_client(client);
+      remove_client(client);
+    }
+  else if (client->socket != NULL)
     {
       dist_manager->log(_("Client %s closed connection."),
                         client->id != NULL ? client->id : "Unknown");
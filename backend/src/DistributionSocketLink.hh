@@ -21,6 +21,8 @@
 
 #include <list>
 #include <map>
+#include <set>
+#include <string>
 
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
@@ -39,12 +41,49 @@
 #include "PacketBuffer.hh"
 
 #include "SocketDriver.hh"
+#include "TimeSource.hh"
 #include "WRID.hh"
 
 #define DEFAULT_PORT (27273)
 #define DEFAULT_INTERVAL (15)
 #define DEFAULT_ATTEMPTS (5)
 
+//! Minimum free space in the receive buffer before reading.
+#define READ_BUFFER_SIZE (4096)
+
+//! Maximum size of the receive buffer of a client.
+#define MAX_READ_BUFFER_SIZE (2 * 65536)
+
+//! Size of the output queue of a client below which reading resumes.
+#define OUTPUT_LOW_WATERMARK (16 * 1024)
+
+//! Size of the output queue of a client above which reading is paused.
+#define OUTPUT_HIGH_WATERMARK (256 * 1024)
+
+//! Size of the output queue of a client at which its connection is closed.
+#define MAX_OUTPUT_SIZE (1024 * 1024)
+
+//! Protocol version of this client, exchanged in the hello2 and welcome packets.
+#define PROTOCOL_VERSION (5)
+
+//! Lowest protocol version that accepts frames with a 32 bit length.
+#define PROTOCOL_VERSION_WIDE_FRAMES (4)
+
+//! Lowest protocol version that answers ping packets.
+#define PROTOCOL_VERSION_PING (5)
+
+//! Number of heartbeats between two round trip time measurements.
+#define PING_INTERVAL (10)
+
+//! Maximum size of a frame with a 32 bit length.
+#define MAX_PACKET_SIZE (16 * 1024 * 1024)
+
+//! Maximum number of sessions of a user on a single host.
+#define MAX_LOCAL_SESSIONS (8)
+
+//! Host name of clients that are connected through a local socket.
+#define LOCAL_HOSTNAME "local"
+
 class Configurator;
 
 class DistributionSocketLink :
@@ -66,6 +105,8 @@ private:
     PACKET_CLAIM_REJECT = 0x0008,
     PACKET_SIGNOFF      = 0x0009,
     PACKET_HELLO2       = 0x000A,
+    PACKET_PING         = 0x000B,
+    PACKET_PONG         = 0x000C,
   };
 
   enum PacketFlags {
@@ -99,6 +140,100 @@ private:
       CLIENTTYPE_SIGNEDOFF  = 4,
     };
 
+  //! Part of a packet that is queued for several clients.
+  /*!
+   *  All but the first six bytes of a packet are the same for all
+   *  clients, so a packet that cannot be written to several clients is
+   *  copied only once.
+   */
+  struct SharedPayload
+  {
+    SharedPayload(const SocketBuffer &buffer) :
+      data((const char *)buffer.data, buffer.size),
+      ref_count(1)
+    {
+    }
+
+    void ref()
+    {
+      ref_count++;
+    }
+
+    void unref()
+    {
+      if (--ref_count == 0)
+        {
+          delete this;
+        }
+    }
+
+    //! The bytes of the packet.
+    std::string data;
+
+    //! Number of references.
+    int ref_count;
+  };
+
+  //! Packet in the output queue of a client.
+  struct OutputPacket
+  {
+    OutputPacket() :
+      body(NULL)
+    {
+    }
+
+    OutputPacket(const OutputPacket &other) :
+      head(other.head),
+      body(other.body)
+    {
+      if (body != NULL)
+        {
+          body->ref();
+        }
+    }
+
+    ~OutputPacket()
+    {
+      if (body != NULL)
+        {
+          body->unref();
+        }
+    }
+
+    OutputPacket &operator=(const OutputPacket &other)
+    {
+      if (other.body != NULL)
+        {
+          other.body->ref();
+        }
+      if (body != NULL)
+        {
+          body->unref();
+        }
+      head = other.head;
+      body = other.body;
+      return *this;
+    }
+
+    //! Returns the size of the packet.
+    size_t size() const
+    {
+      return head.size() + body->data.size();
+    }
+
+    //! Returns the byte at the specified position of the packet.
+    guint8 at(size_t pos) const
+    {
+      return pos < head.size() ? head[pos] : body->data[pos - head.size()];
+    }
+
+    //! Frame and header of the packet for this client.
+    std::string head;
+
+    //! Rest of the packet.
+    SharedPayload *body;
+  };
+
   struct Client
   {
     Client() :
@@ -110,12 +245,33 @@ private:
       port(0),
       sent_client_list(false),
       welcome(false),
+      sent_signon(false),
       reconnect_count(0),
       reconnect_time(0),
       next_claim_time(0),
       reject_count(0),
       claim_count(0),
-      outbound(false)
+      outbound(false),
+      local(false),
+      protocol(0),
+      output_offset(0),
+      output_size(0),
+      output_peak_size(0),
+      output_coalesced(0),
+      congested(false),
+      overflow(false),
+      write_error(false),
+      bytes_in(0),
+      bytes_out(0),
+      packets_in(0),
+      packets_out(0),
+      reconnects(0),
+      rtt(-1),
+      claims_out(0),
+      claims_in(0),
+      rejects_in(0),
+      rejects_out(0),
+      last_packet_time(0)
     {
     }
 
@@ -159,9 +315,15 @@ private:
     //!
     bool welcome;
 
-    //!
+    //! Was the sign-on client message sent to the client.
+    bool sent_signon;
+
+    //! Packet being processed.
     PacketBuffer packet;
 
+    //! Received data that is not yet processed.
+    PacketBuffer input;
+
     //! Reconnect counter;
     int reconnect_count;
 
@@ -179,8 +341,66 @@ private:
 
     //! Is this an outbound connection
     bool outbound;
+
+    //! Is this a connection through a local socket.
+    bool local;
+
+    //! Negotiated protocol version, 0 if the client did not send one.
+    int protocol;
+
+    //! Packets that could not yet be written.
+    std::list<OutputPacket> output;
+
+    //! Number of bytes of the first queued packet that are already written.
+    int output_offset;
+
+    //! Number of bytes in the output queue that are not yet written.
+    int output_size;
+
+    //! Largest number of bytes that was ever in the output queue.
+    int output_peak_size;
+
+    //! Number of queued packets that were replaced by a newer one.
+    int output_coalesced;
+
+    //! Is reading paused until the output queue drains.
+    bool congested;
+
+    //! Were packets dropped because the output queue is full.
+    bool overflow;
+
+    //! Did a write to the socket fail.
+    bool write_error;
+
+    //! Number of bytes received and sent.
+    gint64 bytes_in;
+    gint64 bytes_out;
+
+    //! Number of packets received and sent.
+    int packets_in;
+    int packets_out;
+
+    //! Number of reconnect attempts.
+    int reconnects;
+
+    //! Last measured round trip time in milliseconds, -1 if unknown.
+    int rtt;
+
+    //! Number of master requests sent and received.
+    int claims_out;
+    int claims_in;
+
+    //! Number of master requests rejected by and for the client.
+    int rejects_in;
+    int rejects_out;
+
+    //! Time of the last packet from the client.
+    time_t last_packet_time;
   };
 
+  //! Clients by ID or by canonical name and port.
+  typedef multimap<std::string, Client *> ClientIndex;
+
 
 public:
   DistributionSocketLink(Configurator *conf);
@@ -189,6 +409,8 @@ public:
   void init_my_id();
   std::string get_my_id() const;
   int get_number_of_peers();
+  void get_output_queue_stats(int &packets, int &bytes, int &peak_bytes, int &coalesced);
+  void get_peer_stats(workrave::IDistributionManager::PeerStatsList &stats);
   void set_distribution_manager(DistributionManager *dll);
   void init();
   void heartbeat();
@@ -210,11 +432,17 @@ public:
   void socket_accepted(ISocketServer *server, ISocket *con);
   void socket_connected(ISocket *con, void *data);
   void socket_io(ISocket *con, void *data);
+  void socket_writable(ISocket *con, void *data);
   void socket_closed(ISocket *con, void *data);
 
 private:
   bool is_client_valid(Client *client);
-  bool add_client(gchar *id, gchar *host, gint port, ClientType type, Client *peer = NULL);
+  void index_client(Client *client);
+  void unindex_client(Client *client);
+  void unindex_key(ClientIndex &index, const std::string &key, Client *client);
+  static std::string get_canonical_key(const gchar *name, gint port);
+  bool add_client(gchar *id, gchar *host, gint port, ClientType type, Client *peer = NULL, bool local = false);
+  ISocket *create_socket(Client *client);
   void remove_client(Client *client);
   void remove_peer_clients(Client *client);
   void close_client(Client *client, bool reconnect = false);
@@ -232,8 +460,17 @@ private:
 
   void init_packet(PacketBuffer &packet, PacketCommand cmd);
   void send_packet_broadcast(PacketBuffer &packet);
-  void send_packet_except(PacketBuffer &packet, Client *client);
-  void send_packet(Client *client, PacketBuffer &packet);
+  void send_packet_except(PacketBuffer &packet, Client *client, PacketBuffer *header = NULL);
+  void send_packet(Client *client, PacketBuffer &packet, PacketBuffer *header = NULL);
+  void init_route_header(PacketBuffer &header, PacketBuffer &packet, PacketFlags flag, const gchar *id);
+  void write_packet(Client *client, PacketBuffer &packet, PacketBuffer *header, SharedPayload **body = NULL);
+  bool queue_packet(Client *client, const SocketBuffer *buffers, int count, int bytes_written,
+                    SharedPayload **body);
+  void flush_output(Client *client);
+  void clear_output(Client *client);
+  static size_t get_state_key_size(const OutputPacket &packet);
+
+  bool read_client_packets(ISocket *con, Client *client);
   void forward_packet_except(PacketBuffer &packet, Client *client, Client *source);
   void forward_packet(PacketBuffer &packet, Client *dest, Client *source);
 
@@ -248,6 +485,8 @@ private:
   void handle_new_master(PacketBuffer &packet, Client *client);
   void handle_client_message(PacketBuffer &packet, Client *client);
   void handle_claim_reject(PacketBuffer &packet, Client *client);
+  void handle_ping(PacketBuffer &packet, Client *client);
+  void handle_pong(PacketBuffer &packet, Client *client);
 
   void send_hello1(Client *client);
   void send_hello2(Client *client, gchar *rnd);
@@ -258,15 +497,22 @@ private:
   void send_claim(Client *client);
   void send_new_master(Client *client = NULL);
   void send_claim_reject(Client *client);
-  void send_client_message(DistributionClientMessageType type);
+  void send_client_message(DistributionClientMessageType type, Client *client = NULL);
+  void send_signon_message();
+  void send_ping(Client *client);
+  void flush_client_messages();
 
   bool start_async_server();
+  void reserve_local_session();
+  bool start_local_server();
+  void connect_local_sessions();
 
   void read_configuration();
   void config_changed_notify(const string &key);
 
   std::string get_random_string() const;
-  
+  time_t get_time() const;
+
 private:
   typedef map<DistributionClientMessageID, ClientMessageListener> ClientMessageMap;
 
@@ -275,6 +521,9 @@ private:
 
   SocketDriver *socket_driver;
 
+  //! Driver for sockets between sessions on this host, NULL if not supported.
+  SocketDriver *local_socket_driver;
+
   //! The configuration access.
   Configurator *configurator;
 
@@ -290,6 +539,15 @@ private:
   //! All clients.
   list<Client *> clients;
 
+  //! All clients, for validity checks.
+  std::set<Client *> client_set;
+
+  //! Clients by ID.
+  ClientIndex clients_by_id;
+
+  //! Clients by canonical name and port.
+  ClientIndex clients_by_name;
+
   //! Active client
   Client *master_client;
 
@@ -311,6 +569,18 @@ private:
   //! The server socket.
   ISocketServer *server_socket;
 
+  //! The server socket for sessions on this host.
+  ISocketServer *local_server_socket;
+
+  //! Socket that reserves the local session number for the lifetime of this session.
+  ISocketServer *local_session_lock;
+
+  //! Number of this session among the sessions on this host, or -1.
+  int local_session;
+
+  //! Source of the current time, NULL for the system clock.
+  const TimeSource *time_source;
+
   //! Whether distribution is enabled.
   bool network_enabled;
   bool server_enabled;
@@ -326,6 +596,22 @@ private:
 
   //!
   int heartbeat_count;
+
+  //! Broadcast client messages that are sent at the next heartbeat.
+  PacketBuffer batch_packet;
+
+  //! Master ID in the batched client messages.
+  std::string batch_master;
+
+  //! Number of batched client messages.
+  int batch_count;
+
+  //! Position of the number of client messages in the batch packet.
+  int batch_count_pos;
+
+#ifdef HAVE_TESTS
+  friend class DistributionTest;
+#endif
 };
 
 #endif // DISTRIBUTIONSOCKETLINK_HH
@@ -23,15 +23,56 @@
 
 #if defined(HAVE_GIO_NET) && defined(HAVE_DISTRIBUTION)
 
+#include <sstream>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#if defined(HAVE_GIO_UNIX_NET)
+#include <gio/gunixsocketaddress.h>
+#endif
+
 #include "debug.hh"
 #include "GIOSocketDriver.hh"
 
 using namespace std;
 
 
+//! Returns the address of the local socket with the specified name and port.
+/*!
+ *  Local sockets are Unix domain sockets in the abstract namespace, so
+ *  that no file needs to be created or removed.
+ *
+ *  \return NULL if abstract Unix domain sockets are not supported.
+ */
+static GSocketAddress *
+create_local_address(const string &name, int port)
+{
+#if defined(HAVE_GIO_UNIX_NET)
+  if (g_unix_socket_address_abstract_names_supported())
+    {
+      stringstream ss;
+      ss << name << "." << port;
+
+      return g_unix_socket_address_new_with_type(ss.str().c_str(), -1,
+                                                 G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    }
+#else
+  (void) name;
+  (void) port;
+#endif
+  return NULL;
+}
+
+
 //! Creates a new listen socket.
-GIOSocketServer::GIOSocketServer() :
-  service(NULL)
+/*!
+ *  \param local_name name of the local socket, empty for a TCP socket.
+ */
+GIOSocketServer::GIOSocketServer(const string &local_name) :
+  service(NULL),
+  local_name(local_name)
 {
 }
 
@@ -60,7 +101,28 @@ GIOSocketServer::listen(int port)
       throw SocketException("Failed to create server");
     }
 
-  gboolean rc = g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service), port, NULL, &error);
+  gboolean rc = FALSE;
+  if (local_name.empty())
+    {
+      rc = g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service), port, NULL, &error);
+    }
+  else
+    {
+      GSocketAddress *address = create_local_address(local_name, port);
+      if (address == NULL)
+        {
+          g_object_unref(service);
+          service = NULL;
+
+          throw SocketException("Local sockets not supported");
+        }
+
+      rc = g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                         G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_DEFAULT,
+                                         NULL, NULL, &error);
+      g_object_unref(address);
+    }
+
   if (!rc)
     {
       g_object_unref(service);
@@ -118,6 +180,11 @@ GIOSocket::static_connected_callback(GObject *source_object,
     {
       TRACE_MSG("failed to connect");
       g_error_free(error);
+
+      if (socket->listener != NULL)
+        {
+          socket->listener->socket_closed(socket, socket->user_data);
+        }
     }
   else if (socket_connection != NULL)
     {
@@ -126,12 +193,8 @@ GIOSocket::static_connected_callback(GObject *source_object,
       g_socket_set_blocking(socket->socket, FALSE);
       g_socket_set_keepalive(socket->socket, TRUE);
 
-      socket->source = g_socket_create_source(socket->socket,
-                                              (GIOCondition) (G_IO_IN | G_IO_ERR | G_IO_HUP),
-                                              NULL);
-      g_source_set_callback(socket->source, (GSourceFunc) static_data_callback, (void*)socket, NULL);
-      g_source_attach(socket->source, NULL);
-      // g_source_unref(source);
+      socket->source = socket->create_source((GIOCondition) (G_IO_IN | G_IO_ERR | G_IO_HUP),
+                                             (GSourceFunc) static_data_callback);
 
       if (socket->listener != NULL)
         {
@@ -159,13 +222,16 @@ GIOSocket::static_data_callback(GSocket *socket,
       // check for socket error
       if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
         {
+          // The source is destroyed when this callback returns FALSE. The
+          // listener may delete the socket, so forget the source first.
+          giosocket->source = NULL;
+          ret = FALSE;
+
           if (giosocket->listener != NULL)
             {
               TRACE_MSG("Closing socket");
-              // giosocket->close();
               giosocket->listener->socket_closed(giosocket, giosocket->user_data);
             }
-          ret = FALSE;
         }
 
       // process input
@@ -181,6 +247,7 @@ GIOSocket::static_data_callback(GSocket *socket,
     {
       // Make sure that no exception reach the glib mainloop.
       TRACE_MSG("Exception. Closing socket");
+      giosocket->source = NULL;
       giosocket->close();
       ret = FALSE;
     }
@@ -188,10 +255,57 @@ GIOSocket::static_data_callback(GSocket *socket,
   return ret;
 }
 
+
+gboolean
+GIOSocket::static_write_callback(GSocket *socket,
+                                 GIOCondition condition,
+                                 gpointer user_data)
+{
+  TRACE_ENTER_MSG("GIOSocket::static_write_callback", (int)condition);
+
+  GIOSocket *giosocket = (GIOSocket *)user_data;
+  gboolean ret = TRUE;
+
+  (void) socket;
+
+  try
+    {
+      if (giosocket->listener != NULL)
+        {
+          giosocket->listener->socket_writable(giosocket, giosocket->user_data);
+        }
+    }
+  catch(...)
+    {
+      // Make sure that no exception reach the glib mainloop.
+      TRACE_MSG("Exception. Closing socket");
+      giosocket->write_source = NULL;
+      giosocket->close();
+      ret = FALSE;
+    }
+  TRACE_EXIT();
+  return ret;
+}
+
+
+//! Creates and attaches a source that watches the socket.
+GSource *
+GIOSocket::create_source(GIOCondition condition, GSourceFunc callback)
+{
+  GSource *s = g_socket_create_source(socket, condition, NULL);
+  g_source_set_callback(s, callback, (void*)this, NULL);
+  g_source_attach(s, NULL);
+  g_source_unref(s);
+
+  return s;
+}
+
 //! Creates a new connection.
 GIOSocket::GIOSocket(GSocketConnection *connection) :
   connection(connection),
-  resolver(NULL)
+  resolver(NULL),
+  write_source(NULL),
+  watch_readable(true)
 {
   TRACE_ENTER("GIOSocket::GIOSocket(con)");
   socket = g_socket_connection_get_socket(connection);
@@ -209,12 +323,19 @@ GIOSocket::GIOSocket(GSocketConnection *connection) :
 
 
 //! Creates a new connection.
-GIOSocket::GIOSocket() :
+/*!
+ *  \param local_name name of the local socket to connect to, empty for
+ *         a TCP connection.
+ */
+GIOSocket::GIOSocket(const string &local_name) :
   connection(NULL),
   socket(NULL),
   resolver(NULL),
   source(NULL),
-  port(0)
+  write_source(NULL),
+  watch_readable(true),
+  port(0),
+  local_name(local_name)
 {
   TRACE_ENTER("GIOSocket::GIOSocket()");
   TRACE_EXIT();
@@ -237,6 +358,10 @@ GIOSocket::~GIOSocket()
     {
       g_source_destroy(source);
     }
+  if (write_source != NULL)
+    {
+      g_source_destroy(write_source);
+    }
   TRACE_EXIT();
 }
 
@@ -248,6 +373,22 @@ GIOSocket::connect(const string &host, int port)
   TRACE_ENTER_MSG("GIOSocket::connect", host << " " << port);
   this->port = port;
 
+  if (!local_name.empty())
+    {
+      // The host is always this host.
+      GSocketAddress *socket_address = create_local_address(local_name, port);
+      if (socket_address == NULL)
+        {
+          throw SocketException("Local sockets not supported");
+        }
+
+      connect(socket_address);
+      g_object_unref(socket_address);
+
+      TRACE_EXIT();
+      return;
+    }
+
   GInetAddress *inet_addr = g_inet_address_new_from_string(host.c_str());
   if (inet_addr != NULL)
     {
@@ -272,6 +413,16 @@ GIOSocket::connect(GInetAddress *inet_addr, int port)
 {
   TRACE_ENTER_MSG("GIOSocket::connect", port);
   GSocketAddress *socket_address = g_inet_socket_address_new(inet_addr, port);
+  connect(socket_address);
+  g_object_unref(socket_address);
+  TRACE_EXIT();
+}
+
+
+void
+GIOSocket::connect(GSocketAddress *socket_address)
+{
+  TRACE_ENTER("GIOSocket::connect");
   GSocketClient *socket_client = g_socket_client_new();
 
   g_socket_client_connect_async(socket_client,
@@ -343,7 +494,42 @@ GIOSocket::write(void *buf, int count, int &bytes_written)
   if (socket != NULL)
     {
       num_written = g_socket_send(socket, (char *)buf, count, NULL, &error);
-      if (error != NULL)
+      if (error != NULL && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          g_error_free(error);
+          num_written = 0;
+        }
+      else if (error != NULL)
+        {
+          throw SocketException(string("socket write error: ") + error->message);
+        }
+    }
+  bytes_written = (int) num_written;
+}
+
+
+//! Write data from several buffers to the connection.
+void
+GIOSocket::write(const SocketBuffer *buffers, int count, int &bytes_written)
+{
+  GError *error = NULL;
+  gssize num_written = 0;
+  if (socket != NULL)
+    {
+      GOutputVector *vectors = g_newa(GOutputVector, count);
+      for (int i = 0; i < count; i++)
+        {
+          vectors[i].buffer = buffers[i].data;
+          vectors[i].size = buffers[i].size;
+        }
+
+      num_written = g_socket_send_message(socket, NULL, vectors, count, NULL, 0, 0, NULL, &error);
+      if (error != NULL && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          g_error_free(error);
+          num_written = 0;
+        }
+      else if (error != NULL)
         {
           throw SocketException(string("socket write error: ") + error->message);
         }
@@ -352,12 +538,80 @@ GIOSocket::write(void *buf, int count, int &bytes_written)
 }
 
 
+//! Select whether the listener is notified that the connection is readable or writable.
+void
+GIOSocket::set_watch_events(bool readable, bool writable)
+{
+  TRACE_ENTER_MSG("GIOSocket::set_watch_events", readable << " " << writable);
+  if (socket != NULL)
+    {
+      if (readable != watch_readable)
+        {
+          if (source != NULL)
+            {
+              g_source_destroy(source);
+            }
+
+          int condition = G_IO_ERR | G_IO_HUP;
+          if (readable)
+            {
+              condition |= G_IO_IN;
+            }
+
+          source = create_source((GIOCondition) condition, (GSourceFunc) static_data_callback);
+          watch_readable = readable;
+        }
+
+      if (writable && write_source == NULL)
+        {
+          write_source = create_source(G_IO_OUT, (GSourceFunc) static_write_callback);
+        }
+      else if (!writable && write_source != NULL)
+        {
+          g_source_destroy(write_source);
+          write_source = NULL;
+        }
+    }
+  TRACE_EXIT();
+}
+
+
+//! Returns whether the other end of the connection runs as the same user.
+/*!
+ *  Only local sockets provide the credentials of the other end.
+ */
+bool
+GIOSocket::is_same_user()
+{
+  bool ret = false;
+
+#if defined(HAVE_GIO_UNIX_NET)
+  if (socket != NULL && g_socket_get_family(socket) == G_SOCKET_FAMILY_UNIX)
+    {
+      GCredentials *credentials = g_socket_get_credentials(socket, NULL);
+      if (credentials != NULL)
+        {
+          ret = g_credentials_get_unix_user(credentials, NULL) == getuid();
+          g_object_unref(credentials);
+        }
+    }
+#endif
+
+  return ret;
+}
+
+
 //! Close the connection.
 void
 GIOSocket::close()
 {
   TRACE_ENTER("GIOSocket::close");
   GError *error = NULL;
+  if (write_source != NULL)
+    {
+      g_source_destroy(write_source);
+      write_source = NULL;
+    }
   if (socket != NULL)
     {
       g_socket_shutdown(socket, TRUE, TRUE, &error);
@@ -367,11 +621,21 @@ GIOSocket::close()
   TRACE_EXIT();
 }
 
+//! Creates a socket driver.
+/*!
+ *  \param local_name name of the local sockets, empty for TCP sockets.
+ */
+GIOSocketDriver::GIOSocketDriver(const string &local_name) :
+  local_name(local_name)
+{
+}
+
+
 //! Create a new socket
 ISocket *
 GIOSocketDriver::create_socket()
 {
-  return new GIOSocket();
+  return new GIOSocket(local_name);
 }
 
 
@@ -379,7 +643,7 @@ GIOSocketDriver::create_socket()
 ISocketServer *
 GIOSocketDriver::create_server()
 {
-  return new GIOSocketServer();
+  return new GIOSocketServer(local_name);
 }
 
 #endif
@@ -21,6 +21,8 @@
 
 #if defined(HAVE_GIO_NET) && defined(HAVE_DISTRIBUTION)
 
+#include <string>
+
 #include <glib.h>
 #include <glib-object.h>
 #include <gio/gio.h>
@@ -34,7 +36,7 @@ class GIOSocketServer
   : public ISocketServer
 {
 public:
-  GIOSocketServer();
+  GIOSocketServer(const std::string &local_name = "");
   virtual ~GIOSocketServer();
 
   // ISocketServer  interface
@@ -49,6 +51,7 @@ private:
 
 private:
   GSocketService *service;
+  std::string local_name;
 };
 
 
@@ -57,7 +60,7 @@ class GIOSocket
   : public ISocket
 {
 public:
-  GIOSocket();
+  GIOSocket(const std::string &local_name = "");
   GIOSocket(GSocketConnection *connection);
   virtual ~GIOSocket();
 
@@ -65,10 +68,14 @@ public:
   virtual void connect(const std::string &hostname, int port);
   virtual void read(void *buf, int count, int &bytes_read);
   virtual void write(void *buf, int count, int &bytes_written);
+  virtual void write(const SocketBuffer *buffers, int count, int &bytes_written);
+  virtual void set_watch_events(bool readable, bool writable);
+  virtual bool is_same_user();
   virtual void close();
 
 private:
   void connect(GInetAddress *inet_addr, int port);
+  void connect(GSocketAddress *socket_address);
 
   static void static_connect_after_resolve(GObject *source_object, GAsyncResult *res, gpointer user_data);
 
@@ -80,23 +87,40 @@ private:
                                    GIOCondition condition,
                                    gpointer user_data);
 
+  static gboolean static_write_callback(GSocket *socket,
+                                        GIOCondition condition,
+                                        gpointer user_data);
+
+  GSource *create_source(GIOCondition condition, GSourceFunc callback);
+
 private:
   GSocketConnection *connection;
   GSocket *socket;
   GResolver *resolver;
   GSource *source;
+  GSource *write_source;
+  bool watch_readable;
   int port;
+  std::string local_name;
 };
 
 
 class GIOSocketDriver
   : public SocketDriver
 {
+public:
+  GIOSocketDriver(const std::string &local_name = "");
+
+private:
   //! Create a new socket
   ISocket *create_socket();
 
   //! Create a new listen socket
   ISocketServer *create_server();
+
+private:
+  //! Name of the local sockets, empty for TCP sockets.
+  std::string local_name;
 };
 
 #endif
@@ -140,6 +140,15 @@ GNetSocket::async_io(GIOChannel *iochannel, GIOCondition condition)
           ret = false;
         }
 
+      // flush output before processing input, which may delete this socket.
+      if (ret && (condition & G_IO_OUT))
+        {
+          if (listener != NULL)
+            {
+              listener->socket_writable(this, user_data);
+            }
+        }
+
       // process input
       if (ret && (condition & G_IO_IN))
         {
@@ -293,7 +302,11 @@ GNetSocket::write(void *buf, int count, int &bytes_written)
   gsize num_written = 0;
   GIOError error = g_io_channel_write(iochannel, (char *)buf, (gsize)count, &num_written);
 
-  if (error != G_IO_ERROR_NONE)
+  if (error == G_IO_ERROR_AGAIN)
+    {
+      num_written = 0;
+    }
+  else if (error != G_IO_ERROR_NONE)
     {
       throw SocketException("write error");
     }
@@ -302,6 +315,38 @@ GNetSocket::write(void *buf, int count, int &bytes_written)
 }
 
 
+//! Select whether the listener is notified that the connection is readable or writable.
+void
+GNetSocket::set_watch_events(bool readable, bool writable)
+{
+  if (iochannel == NULL)
+    {
+      return;
+    }
+
+  gint flags = G_IO_ERR | G_IO_HUP | G_IO_NVAL;
+  if (readable)
+    {
+      flags |= G_IO_IN;
+    }
+  if (writable)
+    {
+      flags |= G_IO_OUT;
+    }
+
+  if (flags != watch_flags)
+    {
+      if (watch != 0)
+        {
+          g_source_remove(watch);
+        }
+
+      watch_flags = flags;
+      watch = g_io_add_watch(iochannel, (GIOCondition)watch_flags, static_async_io, this);
+    }
+}
+
+
 //! Close the connection.
 void
 GNetSocket::close()
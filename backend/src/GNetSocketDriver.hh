@@ -68,9 +68,11 @@ public:
   virtual ~GNetSocket();
 
   // ISocket interface
+  using ISocket::write;
   virtual void connect(const std::string &hostname, int port);
   virtual void read(void *buf, int count, int &bytes_read);
   virtual void write(void *buf, int count, int &bytes_written);
+  virtual void set_watch_events(bool readable, bool writable);
   virtual void close();
 
 private:
@@ -0,0 +1,297 @@
+// IdleLogFile.cc --- Append-only file of fixed size records
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "debug.hh"
+
+#include "IdleLogFile.hh"
+#include "StatsCodec.hh"
+
+using namespace std;
+
+static const char IDLELOG_FILE_MAGIC[] = "WRIL";
+static const guint8 IDLELOG_FILE_VERSION = 1;
+
+
+//! Constructs a new record file.
+IdleLogFile::IdleLogFile(const string &filename, size_t record_size) :
+  filename(filename),
+  record_size(record_size),
+  head(0),
+  tail(0)
+{
+}
+
+
+//! Reads the header of the file.
+/*!
+ *  \return false if the file does not exist or is damaged.
+ */
+bool
+IdleLogFile::load()
+{
+  fstream file(filename.c_str(), ios::in | ios::binary);
+
+  return file.is_open() && read_header(file);
+}
+
+
+//! Reads the last records of the file.
+/*!
+ *  \param count maximum number of records to read.
+ *  \param records the records, oldest first.
+ */
+bool
+IdleLogFile::read(size_t count, string &records)
+{
+  records.clear();
+
+  if (count > size())
+    {
+      count = size();
+    }
+
+  if (count == 0)
+    {
+      return true;
+    }
+
+  fstream file(filename.c_str(), ios::in | ios::binary);
+  if (!file.is_open())
+    {
+      return false;
+    }
+
+  records.resize(count * record_size);
+  file.seekg(HEADER_SIZE + (tail - count) * record_size, ios::beg);
+  file.read(&records[0], records.size());
+
+  if (file.fail())
+    {
+      records.clear();
+      return false;
+    }
+  return true;
+}
+
+
+//! Appends records to the file.
+/*!
+ *  \param records the new records, oldest first.
+ *  \param max_records maximum number of records to keep.
+ */
+bool
+IdleLogFile::append(const string &records, size_t max_records)
+{
+  TRACE_ENTER_MSG("IdleLogFile::append", filename);
+
+  fstream file;
+  if (!open(file) || !read_header(file))
+    {
+      TRACE_EXIT();
+      return write(records);
+    }
+
+  if (!write_records(file, tail, records))
+    {
+      TRACE_RETURN(false);
+      return false;
+    }
+
+  tail += records.size() / record_size;
+  if (size() > max_records)
+    {
+      head = tail - max_records;
+    }
+
+  if (!write_header(file))
+    {
+      TRACE_RETURN(false);
+      return false;
+    }
+  file.close();
+
+  if (head >= max_records)
+    {
+      TRACE_MSG("Compacting " << head << " unused records");
+
+      string live;
+      if (read(size(), live))
+        {
+          write(live);
+        }
+    }
+
+  TRACE_EXIT();
+  return true;
+}
+
+
+//! Replaces all records of the file.
+/*!
+ *  \param records the records, oldest first.
+ */
+bool
+IdleLogFile::write(const string &records)
+{
+  fstream file;
+  if (!open(file))
+    {
+      return false;
+    }
+
+  // Empty the file before overwriting records that are in use.
+  head = 0;
+  tail = 0;
+
+  if (!write_header(file) || !write_records(file, 0, records))
+    {
+      return false;
+    }
+
+  tail = records.size() / record_size;
+  return write_header(file);
+}
+
+
+//! Stores a 32 bit value.
+void
+IdleLogFile::put_uint32(char *data, guint32 value)
+{
+  for (int i = 0; i < 4; i++)
+    {
+      data[i] = (char)(value & 0xff);
+      value >>= 8;
+    }
+}
+
+
+//! Retrieves a 32 bit value.
+guint32
+IdleLogFile::get_uint32(const char *data)
+{
+  guint32 value = 0;
+  for (int i = 3; i >= 0; i--)
+    {
+      value = (value << 8) | (guint8)data[i];
+    }
+  return value;
+}
+
+
+//! Opens the file for reading and writing, creating it if needed.
+bool
+IdleLogFile::open(fstream &file)
+{
+  file.open(filename.c_str(), ios::in | ios::out | ios::binary);
+
+  if (!file.is_open())
+    {
+      file.clear();
+      file.open(filename.c_str(), ios::out | ios::trunc | ios::binary);
+    }
+
+  return file.is_open();
+}
+
+
+//! Reads and checks the header.
+bool
+IdleLogFile::read_header(fstream &file)
+{
+  head = 0;
+  tail = 0;
+
+  char data[HEADER_SIZE];
+  file.seekg(0, ios::beg);
+  file.read(data, HEADER_SIZE);
+
+  if (file.fail() ||
+      memcmp(data, IDLELOG_FILE_MAGIC, 4) != 0 ||
+      (guint8)data[4] != IDLELOG_FILE_VERSION ||
+      (size_t)((guint8)data[6] | ((guint8)data[7] << 8)) != record_size ||
+      get_uint32(data + 16) != StatsCodec::crc32(data, 16))
+    {
+      file.clear();
+      return false;
+    }
+
+  size_t h = get_uint32(data + 8);
+  size_t t = get_uint32(data + 12);
+
+  file.seekg(0, ios::end);
+  streamoff length = file.tellg();
+
+  if (h > t || length < (streamoff)(HEADER_SIZE + t * record_size))
+    {
+      file.clear();
+      return false;
+    }
+
+  head = h;
+  tail = t;
+  return true;
+}
+
+
+//! Writes the header.
+bool
+IdleLogFile::write_header(fstream &file)
+{
+  char data[HEADER_SIZE];
+
+  memcpy(data, IDLELOG_FILE_MAGIC, 4);
+  data[4] = (char)IDLELOG_FILE_VERSION;
+  data[5] = 0;
+  data[6] = (char)(record_size & 0xff);
+  data[7] = (char)(record_size >> 8);
+  put_uint32(data + 8, head);
+  put_uint32(data + 12, tail);
+  put_uint32(data + 16, StatsCodec::crc32(data, 16));
+
+  file.seekp(0, ios::beg);
+  file.write(data, HEADER_SIZE);
+  file.flush();
+
+  return !file.fail();
+}
+
+
+//! Writes records starting at the specified record number.
+bool
+IdleLogFile::write_records(fstream &file, size_t pos, const string &records)
+{
+  if (records.empty())
+    {
+      return true;
+    }
+
+  file.seekp(HEADER_SIZE + pos * record_size, ios::beg);
+  file.write(records.data(), records.size());
+
+  // The records must be on disk before the header refers to them.
+  file.flush();
+
+  return !file.fail();
+}
@@ -0,0 +1,87 @@
+// IdleLogFile.hh --- Append-only file of fixed size records
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef IDLELOGFILE_HH
+#define IDLELOGFILE_HH
+
+#include <string>
+#include <fstream>
+
+#include "glib.h"
+
+//! Append-only file of fixed size records.
+/*!
+ *  The file starts with a header that holds the record size and the
+ *  head and tail record numbers, protected by a CRC32. Records before
+ *  head are no longer used, records from tail onwards are not (yet)
+ *  valid. New records are written after tail and only then become part
+ *  of the file by updating the header, so an interrupted append loses
+ *  the new records but not the existing ones. A damaged header makes
+ *  the file empty.
+ *
+ *  Since records are never moved, a reader can seek directly to the last
+ *  records of the file. The unused space before head is reclaimed once
+ *  it exceeds the number of records that are kept.
+ *
+ *  All integers are stored little endian.
+ */
+class IdleLogFile
+{
+public:
+  IdleLogFile(const std::string &filename, size_t record_size);
+
+  bool load();
+
+  //! Returns the number of records in the file.
+  size_t size() const { return tail - head; }
+
+  bool read(size_t count, std::string &records);
+  bool append(const std::string &records, size_t max_records);
+  bool write(const std::string &records);
+
+  static void put_uint32(char *data, guint32 value);
+  static guint32 get_uint32(const char *data);
+
+private:
+  enum
+    {
+      //! Magic, version, record size, head, tail, CRC32.
+      HEADER_SIZE = 20,
+    };
+
+  bool open(std::fstream &file);
+  bool read_header(std::fstream &file);
+  bool write_header(std::fstream &file);
+  bool write_records(std::fstream &file, size_t pos, const std::string &records);
+
+private:
+  //! Name of the file.
+  std::string filename;
+
+  //! Size of a single record in bytes.
+  size_t record_size;
+
+  //! Number of the first record in use.
+  size_t head;
+
+  //! Number of the first record after the last record in use.
+  size_t tail;
+};
+
+#endif // IDLELOGFILE_HH
@@ -27,9 +27,11 @@
 #include "nls.h"
 
 #include "debug.hh"
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <assert.h>
+#include <string.h>
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -39,12 +41,19 @@
 #include "IdleLogManager.hh"
 #include "TimeSource.hh"
 #include "PacketBuffer.hh"
+#include "IdleLogFile.hh"
+#include "StatsCodec.hh"
 
-#define IDLELOG_MAXSIZE     (4000)
 #define IDLELOG_MAXAGE    (12 * 60 * 60)
 #define IDLELOG_INTERVAL    (30 * 60)
 #define IDLELOG_VERSION   (3)
-#define IDLELOG_INTERVAL_SIZE (17)
+#define IDLELOG_ENCODING_LEGACY (0)
+#define IDLELOG_ENCODING_DELTA (1)
+#define IDLELOG_SNAPSHOT_VERSION (2)
+#define IDLELOG_RECORD_SIZE (16)
+#define IDLELOG_INDEX_ID_SIZE (64)
+#define IDLELOG_INDEX_RECORD_SIZE (80)
+#define IDLELOG_INDEX_MAX_EXTRA (255)
 
 
 //! Constructs a new idlelog manager.
@@ -53,6 +62,9 @@ IdleLogManager::IdleLogManager(string myid, const TimeSource *time_source)
   this->myid = myid;
   this->time_source = time_source;
   this->last_expiration_time = 0;
+  this->active_spans_valid = false;
+  this->leaderless = false;
+  this->reset_time = 0;
 }
 
 
@@ -98,6 +110,64 @@ IdleLogManager::update_all_idlelogs(string master_id, ActivityState current_stat
 }
 
 
+//! Updates the idle history of all clients without a master.
+/*!
+ *  Each client records only its own activity in its idle log. The idle
+ *  logs of the remote clients are received from these clients, see
+ *  set_idlelog(). Their reported state only marks their current active
+ *  period, until the idle log that contains it arrives.
+ *
+ *  \param my_state state of this client.
+ *  \param remote_states last reported state of the remote clients.
+ */
+void
+IdleLogManager::update_all_idlelogs(ActivityState my_state, const map<string, ActivityState> &remote_states)
+{
+  TRACE_ENTER_MSG("IdleLogManager::update_all_idlelogs", my_state);
+
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = i->second;
+      ActivityState state = ACTIVITY_IDLE;
+
+      if (i->first == myid)
+        {
+          state = my_state;
+        }
+      else
+        {
+          map<string, ActivityState>::const_iterator it = remote_states.find(i->first);
+          if (it != remote_states.end())
+            {
+              state = it->second;
+            }
+        }
+
+      if (state != ACTIVITY_ACTIVE)
+        {
+          // Not interested in noise.
+          state = ACTIVITY_IDLE;
+        }
+
+      if (i->first == myid)
+        {
+          update_idlelog(info, state, false);
+        }
+      else
+        {
+          update_remote_activity(info, state);
+        }
+
+      info.master = false;
+      info.state = state;
+    }
+
+  expire();
+
+  TRACE_EXIT();
+}
+
+
 //! Resets the total active time of all clients.
 void
 IdleLogManager::reset()
@@ -108,6 +178,9 @@ IdleLogManager::reset()
       info.update_active_time(time_source->get_time());
       info.total_active_time = 0;
     }
+
+  reset_time = time_source->get_time();
+  save_index();
 }
 
 
@@ -133,8 +206,16 @@ IdleLogManager::init()
     {
       ClientInfo &myinfo = clients[myid];
       myinfo.current_interval = IdleInterval(time_source->get_time(), time_source->get_time());
+
+      // The remote clients receive the complete idle log when they sign on.
+      if (!myinfo.idlelog.empty())
+        {
+          myinfo.sent_end_time = myinfo.idlelog.front().end_time;
+        }
     }
 
+  invalidate_active_time();
+
   TRACE_EXIT();
 }
 
@@ -144,6 +225,7 @@ void
 IdleLogManager::terminate()
 {
   save();
+  save_snapshot();
 }
 
 
@@ -172,36 +254,19 @@ IdleLogManager::expire()
 void
 IdleLogManager::expire(ClientInfo &info)
 {
-  if (info.idlelog.size() > IDLELOG_MAXSIZE)
-    {
-      info.idlelog.resize(IDLELOG_MAXSIZE);
-    }
-
   time_t current_time = time_source->get_time();
-  int count = 0;
-  for (IdleLogRIter i = info.idlelog.rbegin(); i != info.idlelog.rend(); i++)
+  size_t size = info.idlelog.size();
+
+  // The oldest intervals are at the back.
+  while (!info.idlelog.empty() &&
+         info.idlelog.back().end_idle_time < current_time - IDLELOG_MAXAGE)
     {
-      IdleInterval &idle = info.idlelog.back();
-      if (idle.end_idle_time < current_time - IDLELOG_MAXAGE)
-        {
-          count++;
-        }
-      else
-        {
-          break;
-        }
+      info.idlelog.pop_back();
     }
 
-  if (count != 0)
+  if (info.idlelog.size() != size)
     {
-      if (info.idlelog.size() > (size_t)count)
-        {
-          info.idlelog.resize(info.idlelog.size() - count);
-        }
-      else
-        {
-          info.idlelog.clear();
-        }
+      invalidate_active_time();
     }
 }
 
@@ -228,6 +293,7 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
 
           // update active time of last interval.
           info.update_active_time(current_time);
+          info.last_active_begin_time = 0;
 
           // save front.
           if (info.idlelog.size() > 0)
@@ -235,14 +301,16 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
               IdleInterval *save_interval = &(info.idlelog.front());
               if (save_interval->to_be_saved)
                 {
-                  update_idlelog(info, *save_interval);
                   save_interval->to_be_saved = false;
+                  save_idlelog(info);
+                  save_index();
                 }
             }
 
           // Push current
           info.current_interval.to_be_saved = true;
           info.idlelog.push_front(info.current_interval);
+          invalidate_active_time();
 
           // create a new (empty) idle interval.
           info.current_interval = IdleInterval(current_time, current_time);
@@ -262,8 +330,9 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
                   if (save_interval->to_be_saved)
                     {
                       TRACE_MSG("Saving");
-                      update_idlelog(info, *save_interval);
                       save_interval->to_be_saved = false;
+                      save_idlelog(info);
+                      save_index();
                     }
                 }
             }
@@ -287,6 +356,7 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
                 {
                   info.current_interval = oldidle;
                   info.idlelog.pop_front();
+                  invalidate_active_time();
                   idle = &(info.current_interval);
                 }
             }
@@ -308,6 +378,22 @@ IdleLogManager::update_idlelog(ClientInfo &info, ActivityState state, bool maste
 }
 
 
+//! Updates the current active period of a remote client without a master.
+void
+IdleLogManager::update_remote_activity(ClientInfo &info, ActivityState state)
+{
+  if (state == ACTIVITY_ACTIVE && info.remote_active_begin_time == 0)
+    {
+      info.remote_active_begin_time = time_source->get_time();
+    }
+  else if (state != ACTIVITY_ACTIVE && info.remote_active_begin_time != 0)
+    {
+      // The remote client sends the period as part of its idle log.
+      info.remote_active_begin_time = 0;
+    }
+}
+
+
 
 //! Returns the total active time of all clients.
 time_t
@@ -328,298 +414,552 @@ IdleLogManager::compute_total_active_time()
 
 
 //! Returns the active time since an idle period of a least the specified amount of time.
+/*!
+ *  The result only depends on the intervals in the idle logs, so it is
+ *  cached per length until an interval is added or removed.
+ */
 time_t
 IdleLogManager::compute_active_time(int length)
 {
-  TRACE_ENTER("IdleLogManager::compute_active_time");
+  TRACE_ENTER_MSG("IdleLogManager::compute_active_time", length);
 
   time_t current_time = time_source->get_time();
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      (*i).second.update_active_time(current_time);
+    }
+
+  for (vector<ActiveTimeCache>::iterator i = active_time_cache.begin(); i != active_time_cache.end(); i++)
+    {
+      if (i->length == length)
+        {
+          TRACE_RETURN(i->active_time);
+          return i->active_time;
+        }
+    }
+
+  time_t active_time = merge_active_time(length);
+  active_time_cache.push_back(ActiveTimeCache(length, active_time));
+
+  TRACE_RETURN(active_time);
+  return active_time;
+}
+
+
+//! Forgets all results of compute_active_time() and the active period index.
+void
+IdleLogManager::invalidate_active_time()
+{
+  active_time_cache.clear();
+  active_spans_valid = false;
+}
+
+
+//! Computes the active time since an idle period of a least the specified amount of time.
+/*!
+ *  The idle logs of all clients are merged backwards in time. A heap
+ *  holds the next event of each client, so every event costs O(log
+ *  clients) instead of a scan over all clients.
+ */
+time_t
+IdleLogManager::merge_active_time(int length)
+{
+  TRACE_ENTER("IdleLogManager::merge_active_time");
 
   // Number of client.
   int size = clients.size();
 
-  // Data for each client.
-  IdleLogIter *iterators = new IdleLogIter[size];
-  IdleLogIter *end_iterators = new IdleLogIter[size];
-  bool *at_end = new bool[size];
-  time_t *active_time = new time_t[size];
+  // Init data for all clients. The vectors keep their capacity between calls.
+  merge_cursors.resize(size);
+  merge_events.clear();
 
-  // Init data for all clients.
   int count = 0;
   for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
       ClientInfo &info = (*i).second;
+      MergeCursor &cursor = merge_cursors[count];
 
-      iterators[count] = info.idlelog.begin();
-      end_iterators[count] = info.idlelog.end();
-      active_time[count] = 0;
-      at_end[count] = true;
+      cursor.iter = info.idlelog.begin();
+      cursor.end = info.idlelog.end();
+      cursor.active_time = 0;
+      cursor.at_end = true;
+
+      if (cursor.iter != cursor.end)
+        {
+          merge_events.push_back(MergeEvent(cursor.iter->end_idle_time, count));
+        }
 
-      info.update_active_time(current_time);
       count++;
     }
 
+  make_heap(merge_events.begin(), merge_events.end());
 
   // Number of simultaneous idle periods.
   int idle_count = 0;
 
-  // Time of last unprocessed event.
-  time_t last_time = -1;
-
-  // Iterator of last unprocessed event.
-  int last_iter = -1;
-
   // Stop criterium
   bool stop = false;
 
   // Begin and End time of idle perdiod.
   time_t end_idle_time = -1;
 
-  while (!stop)
+  while (!stop && !merge_events.empty())
     {
-      // Find latest event.
-      last_time = -1;
-      for (int i = 0; i < size; i ++)
-        {
-          if (iterators[i] != end_iterators[i])
-            {
-              IdleInterval &ii = *(iterators[i]);
-              time_t t = at_end[i] ? ii.end_idle_time : ii.begin_time;
+      // Take latest event.
+      pop_heap(merge_events.begin(), merge_events.end());
+      int last_iter = merge_events.back().client;
+      merge_events.pop_back();
 
-              if (last_time == -1 || t > last_time)
-                {
-                  last_time = t;
-                  last_iter = i;
-                }
-            }
-        }
+      MergeCursor &cursor = merge_cursors[last_iter];
+      IdleInterval &ii = *(cursor.iter);
 
-      // Did we found one?
-      if (last_time != -1)
+      if (cursor.at_end)
         {
-          IdleInterval &ii = *(iterators[last_iter]);
-          if (at_end[last_iter])
-            {
-              TRACE_MSG("End time " << ii.end_idle_time << " active " << ii.active_time);
-              idle_count++;
+          TRACE_MSG("End time " << ii.end_idle_time << " active " << ii.active_time);
+          idle_count++;
 
-              at_end[last_iter] = false;
-              active_time[last_iter] += ii.active_time;
-              end_idle_time = ii.end_idle_time;
-            }
-          else
-            {
-              TRACE_MSG("Begin time " << ii.begin_time);
+          cursor.at_end = false;
+          cursor.active_time += ii.active_time;
+          end_idle_time = ii.end_idle_time;
+
+          merge_events.push_back(MergeEvent(ii.begin_time, last_iter));
+          push_heap(merge_events.begin(), merge_events.end());
+        }
+      else
+        {
+          TRACE_MSG("Begin time " << ii.begin_time);
 
-              at_end[last_iter] = true;
-              iterators[last_iter]++;
+          cursor.at_end = true;
+          cursor.iter++;
 
-              if (idle_count == size)
+          if (idle_count == size)
+            {
+              TRACE_MSG("Common idle period of " << (end_idle_time - ii.begin_time));
+              if ((end_idle_time - ii.begin_time) > length)
                 {
-                  TRACE_MSG("Common idle period of " << (end_idle_time - ii.begin_time));
-                  if ((end_idle_time - ii.begin_time) > length)
-                    {
-                      stop = true;
-                    }
+                  stop = true;
                 }
+            }
+
+          idle_count--;
 
-              idle_count--;
+          if (cursor.iter != cursor.end)
+            {
+              merge_events.push_back(MergeEvent(cursor.iter->end_idle_time, last_iter));
+              push_heap(merge_events.begin(), merge_events.end());
             }
         }
-      else
-        {
-          stop = true;
-        }
     }
 
   time_t total_active_time = 0;
   for (int i = 0; i < size; i++)
     {
-      TRACE_MSG("active time of " << i << " = " << active_time[i]);
-      total_active_time += active_time[i];
+      TRACE_MSG("active time of " << i << " = " << merge_cursors[i].active_time);
+      total_active_time += merge_cursors[i].active_time;
     }
 
   TRACE_MSG("total = " << total_active_time);
 
-  delete [] iterators;
-  delete [] end_iterators;
-  delete [] at_end;
-  delete [] active_time;
-
   TRACE_EXIT();
   return total_active_time;
 }
 
 
-//! Computes the current idle time.
+//! Returns the active time of all clients combined within a time window.
+/*!
+ *  A second during which several clients were active is counted once.
+ *  The idle time within the window is the remainder of the window.
+ *
+ *  \param from start of the window.
+ *  \param to end of the window (exclusive).
+ */
 time_t
-IdleLogManager::compute_idle_time()
+IdleLogManager::compute_active_time_between(time_t from, time_t to)
 {
-  TRACE_ENTER("IdleLogManager::compute_idle_time");
+  TRACE_ENTER_MSG("IdleLogManager::compute_active_time_between", from << " " << to);
 
-  time_t current_time = time_source->get_time();
+  update_active_spans();
 
-  int count = 0;
-  time_t latest_start_time = 0;
+  time_t active_time = get_active_time(merged_active_spans, from, to);
 
+  // The current intervals are not part of the index. Add the parts that
+  // do not overlap with the indexed periods.
+  vector<ActiveSpan> current;
   for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
-      ClientInfo &info = (*i).second;
-      info.update_active_time(current_time);
-
-      IdleInterval &idle = info.idlelog.front();
-      if (idle.active_time == 0)
+      ActiveSpan span;
+      if (get_current_active_span((*i).second, from, to, span))
         {
-          count++;
+          current.push_back(span);
         }
-      if (idle.begin_time > latest_start_time)
+    }
+
+  if (!current.empty())
+    {
+      ActiveSpans current_spans;
+      build_active_spans(current, current_spans);
+
+      for (size_t i = 0; i < current_spans.begin.size(); i++)
         {
-          latest_start_time = idle.begin_time;
-          TRACE_MSG(current_time - latest_start_time);
+          time_t begin = current_spans.begin[i];
+          time_t end = current_spans.end[i];
+
+          active_time += (end - begin) - get_active_time(merged_active_spans, begin, end);
         }
     }
 
-  TRACE_MSG("count = " << count);
-  if ((unsigned int)count != clients.size() + 1)
+  TRACE_RETURN(active_time);
+  return active_time;
+}
+
+
+//! Returns the active time of a single client within a time window.
+/*!
+ *  \param client_id ID of the client.
+ *  \param from start of the window.
+ *  \param to end of the window (exclusive).
+ */
+time_t
+IdleLogManager::compute_active_time_between(const string &client_id, time_t from, time_t to)
+{
+  TRACE_ENTER_MSG("IdleLogManager::compute_active_time_between", client_id << " " << from << " " << to);
+
+  ClientMapIter i = clients.find(client_id);
+  if (i == clients.end())
     {
-      latest_start_time = current_time;
+      TRACE_RETURN(0);
+      return 0;
     }
 
-  TRACE_MSG((current_time - latest_start_time));
-  TRACE_EXIT();
+  update_active_spans();
 
-  return current_time - latest_start_time;
-}
+  ClientInfo &info = (*i).second;
+  time_t active_time = get_active_time(info.active_spans, from, to);
+
+  ActiveSpan span;
+  if (get_current_active_span(info, from, to, span))
+    {
+      active_time += (span.second - span.first) - get_active_time(info.active_spans, span.first, span.second);
+    }
 
+  TRACE_RETURN(active_time);
+  return active_time;
+}
 
 
-//! Packs the idle interval to the buffer.
-void
-IdleLogManager::pack_idle_interval(PacketBuffer &buffer, const IdleInterval &idle) const
+//! Returns the active time of all clients combined since a common idle period.
+/*!
+ *  Unlike compute_active_time(), a second during which several clients
+ *  were active is counted once, so that this is suitable for clients
+ *  without a master, whose active periods may overlap.
+ *
+ *  \param length minimum length of the common idle period.
+ */
+time_t
+IdleLogManager::compute_merged_active_time(int length)
 {
-  int pos = 0;
+  TRACE_ENTER_MSG("IdleLogManager::compute_merged_active_time", length);
 
-  buffer.reserve_size(pos);
-  buffer.pack_byte(IDLELOG_VERSION);
-  buffer.pack_ulong((guint32)idle.begin_time);
-  buffer.pack_ulong((guint32)idle.end_idle_time);
-  buffer.pack_ulong((guint32)idle.end_time);
-  buffer.pack_ushort((guint32)idle.active_time);
-  buffer.update_size(pos);
+  ActiveSpans spans;
+  get_merged_active_spans(spans);
+
+  time_t active_time = 0;
+  time_t idle_end = time_source->get_time();
+
+  for (size_t i = spans.begin.size(); i > 0; i--)
+    {
+      if (idle_end - spans.end[i - 1] > length)
+        {
+          break;
+        }
+
+      active_time += spans.end[i - 1] - spans.begin[i - 1];
+      idle_end = spans.begin[i - 1];
+    }
+
+  TRACE_RETURN(active_time);
+  return active_time;
 }
 
 
-//! Unpacks the idle interval from the buffer.
-void
-IdleLogManager::unpack_idle_interval(PacketBuffer &buffer, IdleInterval &idle, time_t delta_time) const
+//! Returns the time since any client was last active.
+time_t
+IdleLogManager::compute_merged_idle_time()
 {
-  int pos = 0;
-  int size = buffer.read_size(pos);
+  TRACE_ENTER("IdleLogManager::compute_merged_idle_time");
 
-  if (size > 0 && buffer.bytes_available() >= size)
+  ActiveSpans spans;
+  get_merged_active_spans(spans);
+
+  time_t current_time = time_source->get_time();
+  time_t idle_time = current_time;
+  if (!spans.end.empty())
     {
-      /*int version = */ buffer.unpack_byte();
+      idle_time = current_time - spans.end.back();
+    }
 
-      idle.begin_time = buffer.unpack_ulong() - delta_time;
-      idle.end_idle_time = buffer.unpack_ulong() - delta_time;
-      idle.end_time = buffer.unpack_ulong() - delta_time;
-      idle.active_time = buffer.unpack_ushort();
+  TRACE_RETURN(idle_time);
+  return idle_time;
+}
 
-      buffer.skip_size(pos);
-    }
-  else
+
+//! Returns the active time of all clients combined since the daily reset.
+/*!
+ *  \param active_time the active time, counting overlapping periods once.
+ *  \return false if the idle logs do not cover the time since the reset.
+ */
+bool
+IdleLogManager::compute_merged_total_active_time(time_t &active_time)
+{
+  TRACE_ENTER("IdleLogManager::compute_merged_total_active_time");
+
+  time_t current_time = time_source->get_time();
+  bool ret = reset_time != 0 && reset_time >= current_time - IDLELOG_MAXAGE;
+
+  if (ret)
     {
-      buffer.clear();
+      active_time = compute_active_time_between(reset_time, current_time);
     }
+
+  TRACE_RETURN(ret);
+  return ret;
 }
 
 
-//! Packs the idlelog header to the buffer.
+//! Combines the indexed active periods with the current periods of all clients.
 void
-IdleLogManager::pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const
+IdleLogManager::get_merged_active_spans(ActiveSpans &result)
 {
+  update_active_spans();
+
   time_t current_time = time_source->get_time();
 
-  // Add size.
-  int pos = 0;
-  buffer.reserve_size(pos);
+  vector<ActiveSpan> spans;
+  spans.reserve(merged_active_spans.begin.size() + clients.size());
 
-  // Pack
-  buffer.pack_ulong((guint32)current_time);
-  buffer.pack_string(ci.client_id.c_str());
-  buffer.pack_ulong((guint32)ci.total_active_time);
-  buffer.pack_byte(ci.master);
-  buffer.pack_byte(ci.state);
-  buffer.pack_ushort(ci.idlelog.size());
+  for (size_t i = 0; i < merged_active_spans.begin.size(); i++)
+    {
+      spans.push_back(ActiveSpan(merged_active_spans.begin[i], merged_active_spans.end[i]));
+    }
 
-  buffer.update_size(pos);
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ActiveSpan span;
+      if (get_current_active_span((*i).second, 0, current_time, span))
+        {
+          spans.push_back(span);
+        }
+    }
+
+  build_active_spans(spans, result);
 }
 
 
-//! Unpacks the idlelog header from the buffer.
+//! Rebuilds the active periods of all clients if the idle logs changed.
 void
-IdleLogManager::unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci,
-                               time_t &pack_time, int &num_intervals) const
+IdleLogManager::update_active_spans()
 {
-  int pos = 0;
-  int size = buffer.read_size(pos);
+  if (active_spans_valid)
+    {
+      return;
+    }
 
-  if (size > 0 && buffer.bytes_available() >= size)
+  vector<ActiveSpan> all_spans;
+  vector<ActiveSpan> spans;
+
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
     {
-      pack_time = buffer.unpack_ulong();
+      ClientInfo &info = (*i).second;
 
-      char *id = buffer.unpack_string();
+      // The active period of an interval follows its idle period.
+      spans.clear();
+      spans.reserve(info.idlelog.size());
+      for (IdleLogRIter j = info.idlelog.rbegin(); j != info.idlelog.rend(); j++)
+        {
+          if (j->active_time > 0)
+            {
+              spans.push_back(ActiveSpan(j->end_idle_time, j->end_idle_time + j->active_time));
+            }
+        }
 
-      if (id != NULL)
+      build_active_spans(spans, info.active_spans);
+
+      for (size_t k = 0; k < info.active_spans.begin.size(); k++)
         {
-          ci.client_id = id;
+          all_spans.push_back(ActiveSpan(info.active_spans.begin[k], info.active_spans.end[k]));
         }
+    }
 
-      ci.total_active_time = buffer.unpack_ulong();
-      ci.master = buffer.unpack_byte() != 0;
-      ci.state = (ActivityState) buffer.unpack_byte();
+  build_active_spans(all_spans, merged_active_spans);
+  active_spans_valid = true;
+}
 
-      num_intervals = buffer.unpack_ushort();
 
-      g_free(id);
+//! Returns the active period of the current interval of a client, clipped to a window.
+bool
+IdleLogManager::get_current_active_span(const ClientInfo &info, time_t from, time_t to, ActiveSpan &span) const
+{
+  if (info.remote_active_begin_time != 0)
+    {
+      span.first = max(info.remote_active_begin_time, from);
+      span.second = min(time_source->get_time(), to);
 
-      buffer.skip_size(pos);
+      return span.first < span.second;
     }
-  else
+
+  const IdleInterval &idle = info.current_interval;
+
+  time_t active_time = idle.active_time;
+  if (info.last_active_begin_time != 0)
     {
-      buffer.clear();
+      active_time += time_source->get_time() - info.last_active_begin_time;
     }
+
+  span.first = max(idle.end_idle_time, from);
+  span.second = min(idle.end_idle_time + active_time, to);
+
+  return span.first < span.second;
 }
 
 
-//! Removes the idlelog specified in the buffer.
+//! Builds the index of a set of active periods.
+/*!
+ *  Overlapping periods are combined.
+ *
+ *  \param spans the active periods, sorted on return.
+ *  \param result the index.
+ */
 void
-IdleLogManager::unlink_idlelog(PacketBuffer &buffer) const
+IdleLogManager::build_active_spans(vector<ActiveSpan> &spans, ActiveSpans &result)
 {
-  TRACE_ENTER("IdleLogManager::unlink_idlelog()");
+  sort(spans.begin(), spans.end());
 
-  int pos = 0;
-  int size = buffer.read_size(pos);
+  result.begin.clear();
+  result.end.clear();
+  result.total.clear();
+  result.total.push_back(0);
 
-  if (size > 0 && buffer.bytes_available() >= size)
+  for (vector<ActiveSpan>::iterator i = spans.begin(); i != spans.end(); i++)
     {
-      buffer.unpack_ulong(); // skip pack time.
-      char *id = buffer.unpack_string();
+      if (i->first >= i->second)
+        {
+          continue;
+        }
 
-      if (id != NULL)
+      if (!result.end.empty() && i->first <= result.end.back())
+        {
+          if (i->second > result.end.back())
+            {
+              result.total.back() += i->second - result.end.back();
+              result.end.back() = i->second;
+            }
+        }
+      else
         {
-          stringstream ss;
-          ss << Util::get_home_directory();
-          ss << "idlelog." << id << ".log" << ends;
+          result.begin.push_back(i->first);
+          result.end.push_back(i->second);
+          result.total.push_back(result.total.back() + i->second - i->first);
+        }
+    }
+}
 
-#ifdef PLATFORM_OS_WIN32
-          _unlink(ss.str().c_str());
-#else
-          unlink(ss.str().c_str());
-#endif
 
-          g_free(id);
+//! Returns the active time within a time window.
+/*!
+ *  Two binary searches find the periods that overlap the window. Only
+ *  the first and last of these can extend beyond the window.
+ */
+time_t
+IdleLogManager::get_active_time(const ActiveSpans &spans, time_t from, time_t to)
+{
+  if (from >= to)
+    {
+      return 0;
+    }
+
+  // First period that ends after the start of the window.
+  size_t first = upper_bound(spans.end.begin(), spans.end.end(), from) - spans.end.begin();
+
+  // First period that starts at or after the end of the window.
+  size_t last = lower_bound(spans.begin.begin(), spans.begin.end(), to) - spans.begin.begin();
+
+  if (first >= last)
+    {
+      return 0;
+    }
+
+  time_t active_time = spans.total[last] - spans.total[first];
+
+  if (spans.begin[first] < from)
+    {
+      active_time -= from - spans.begin[first];
+    }
+  if (spans.end[last - 1] > to)
+    {
+      active_time -= spans.end[last - 1] - to;
+    }
+
+  return active_time;
+}
+
+
+//! Computes the current idle time.
+time_t
+IdleLogManager::compute_idle_time()
+{
+  TRACE_ENTER("IdleLogManager::compute_idle_time");
+
+  time_t current_time = time_source->get_time();
+
+  int count = 0;
+  time_t latest_start_time = 0;
+
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = (*i).second;
+      info.update_active_time(current_time);
+
+      IdleInterval &idle = info.idlelog.front();
+      if (idle.active_time == 0)
+        {
+          count++;
+        }
+      if (idle.begin_time > latest_start_time)
+        {
+          latest_start_time = idle.begin_time;
+          TRACE_MSG(current_time - latest_start_time);
         }
+    }
+
+  TRACE_MSG("count = " << count);
+  if ((unsigned int)count != clients.size() + 1)
+    {
+      latest_start_time = current_time;
+    }
+
+  TRACE_MSG((current_time - latest_start_time));
+  TRACE_EXIT();
+
+  return current_time - latest_start_time;
+}
+
+
+
+//! Unpacks the idle interval from the buffer.
+void
+IdleLogManager::unpack_idle_interval(PacketBuffer &buffer, IdleInterval &idle, time_t delta_time) const
+{
+  int pos = 0;
+  int size = buffer.read_size(pos);
+
+  if (size > 0 && buffer.bytes_available() >= size)
+    {
+      /*int version = */ buffer.unpack_byte();
+
+      idle.begin_time = buffer.unpack_ulong() - delta_time;
+      idle.end_idle_time = buffer.unpack_ulong() - delta_time;
+      idle.end_time = buffer.unpack_ulong() - delta_time;
+      idle.active_time = buffer.unpack_ushort();
 
       buffer.skip_size(pos);
     }
@@ -627,155 +967,349 @@ IdleLogManager::unlink_idlelog(PacketBuffer &buffer) const
     {
       buffer.clear();
     }
-  TRACE_EXIT();
 }
 
 
-//! Saves the idlelog index.
+//! Packs the idlelog header to the buffer.
 void
-IdleLogManager::save_index()
+IdleLogManager::pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const
 {
-  TRACE_ENTER("IdleLogManager::save_index()");
+  time_t current_time = time_source->get_time();
 
-  PacketBuffer buffer;
-  buffer.create();
+  // Add size.
+  int pos = 0;
+  buffer.reserve_size(pos);
+
+  // Pack
+  buffer.pack_ulong((guint32)current_time);
+  buffer.pack_string(ci.client_id.c_str());
+  buffer.pack_ulong((guint32)ci.total_active_time);
+  buffer.pack_byte(ci.master);
+  buffer.pack_byte(ci.state);
 
-  buffer.pack_ushort(IDLELOG_VERSION);
-  buffer.pack_string(myid.c_str());
+  // The intervals follow the header in the compact encoding. Older
+  // clients only know the legacy interval count and skip the rest.
+  buffer.pack_ushort(0);
+  buffer.pack_byte(IDLELOG_ENCODING_DELTA);
 
-  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+  buffer.update_size(pos);
+}
+
+
+//! Packs the idle intervals in the compact encoding.
+/*!
+ *  The number of intervals is followed by the most recent intervals,
+ *  most recent first. Every time is stored as a zigzag varint relative to the
+ *  preceding time: the end time relative to the begin time of the more
+ *  recent interval (or to the base time), the end of the idle period
+ *  relative to the end time and the begin time relative to the end of
+ *  the idle period. A typical interval takes 6 to 9 bytes instead of 19.
+ */
+void
+IdleLogManager::pack_idle_intervals(PacketBuffer &buffer, const ClientInfo &ci, time_t base_time, size_t count) const
+{
+  time_t previous_time = base_time;
+
+  buffer.pack_varint(count);
+
+  for (size_t i = 0; i < count; i++)
     {
-      ClientInfo &info = (*i).second;
-      info.update_active_time(time_source->get_time());
-      TRACE_MSG("Saving " << i->first << " " << info.client_id);
+      const IdleInterval &idle = ci.idlelog[i];
 
-      pack_idlelog(buffer, info);
+      buffer.pack_svarint(previous_time - idle.end_time);
+      buffer.pack_svarint(idle.end_time - idle.end_idle_time);
+      buffer.pack_svarint(idle.end_idle_time - idle.begin_time);
+      buffer.pack_varint(idle.active_time);
+
+      previous_time = idle.begin_time;
     }
+}
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog.idx" << ends;
 
-  ofstream file(ss.str().c_str(), ios::binary);
-  file.write(buffer.get_buffer(), buffer.bytes_written());
-  file.close();
+//! Unpacks idle intervals in the compact encoding.
+void
+IdleLogManager::unpack_idle_intervals(PacketBuffer &buffer, ClientInfo &ci, time_t base_time) const
+{
+  time_t previous_time = base_time;
 
-  TRACE_EXIT();
+  guint64 num_intervals = buffer.unpack_varint();
+
+  for (guint64 i = 0; i < num_intervals && buffer.bytes_available() > 0; i++)
+    {
+      IdleInterval idle;
+
+      idle.end_time = previous_time - buffer.unpack_svarint();
+      idle.end_idle_time = idle.end_time - buffer.unpack_svarint();
+      idle.begin_time = idle.end_idle_time - buffer.unpack_svarint();
+      idle.active_time = buffer.unpack_varint();
+
+      ci.idlelog.push_back(idle);
+      previous_time = idle.begin_time;
+    }
 }
 
 
+//! Unpacks the idlelog header from the buffer.
+void
+IdleLogManager::unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci,
+                               time_t &pack_time, int &num_intervals, int &encoding) const
+{
+  int pos = 0;
+  int size = buffer.read_size(pos);
 
-//! Loads the idlelog index.
+  if (size > 0 && buffer.bytes_available() >= size)
+    {
+      pack_time = buffer.unpack_ulong();
+
+      char *id = buffer.unpack_string();
+
+      if (id != NULL)
+        {
+          ci.client_id = id;
+        }
+
+      ci.total_active_time = buffer.unpack_ulong();
+      ci.master = buffer.unpack_byte() != 0;
+      ci.state = (ActivityState) buffer.unpack_byte();
+
+      num_intervals = buffer.unpack_ushort();
+
+      encoding = IDLELOG_ENCODING_LEGACY;
+      if (buffer.bytes_read() < pos)
+        {
+          encoding = buffer.unpack_byte();
+        }
+
+      g_free(id);
+
+      buffer.skip_size(pos);
+    }
+  else
+    {
+      buffer.clear();
+    }
+}
+
+
+//! Appends the idle interval to a record of the idle log file.
 void
-IdleLogManager::load_index()
+IdleLogManager::pack_idle_record(string &records, const IdleInterval &idle) const
 {
-  TRACE_ENTER("IdleLogManager::load()");
+  char record[IDLELOG_RECORD_SIZE];
 
+  IdleLogFile::put_uint32(record, (guint32)idle.begin_time);
+  IdleLogFile::put_uint32(record + 4, (guint32)idle.end_idle_time);
+  IdleLogFile::put_uint32(record + 8, (guint32)idle.end_time);
+  IdleLogFile::put_uint32(record + 12, (guint32)idle.active_time);
+
+  records.append(record, IDLELOG_RECORD_SIZE);
+}
+
+
+//! Retrieves the idle interval from a record of the idle log file.
+void
+IdleLogManager::unpack_idle_record(const char *record, IdleInterval &idle) const
+{
+  idle.begin_time = IdleLogFile::get_uint32(record);
+  idle.end_idle_time = IdleLogFile::get_uint32(record + 4);
+  idle.end_time = IdleLogFile::get_uint32(record + 8);
+  idle.active_time = IdleLogFile::get_uint32(record + 12);
+}
+
+
+//! Returns the name of the idle log file of the specified client.
+string
+IdleLogManager::get_idlelog_filename(const string &client_id) const
+{
   stringstream ss;
   ss << Util::get_home_directory();
-  ss << "idlelog.idx" << ends;
-
-  bool exists = Util::file_exists(ss.str());
 
-  if (exists)
+  if (client_id.size() > IDLELOG_INDEX_ID_SIZE)
     {
-      TRACE_MSG("File exists - ok");
+      // Long IDs may exceed the maximum length of a file name.
+      ss << "idlelog." << hex << StatsCodec::crc32(client_id.data(), client_id.size())
+         << dec << "-" << client_id.size() << ".log";
+    }
+  else
+    {
+      ss << "idlelog." << client_id << ".log";
+    }
 
-      // Open file
-      ifstream file(ss.str().c_str(), ios::binary);
+  return ss.str();
+}
 
-      // get file size using buffer's members
-      filebuf *pbuf=file.rdbuf();
-      int size=pbuf->pubseekoff (0,ios::end,ios::in);
-      pbuf->pubseekpos (0,ios::in);
 
-      TRACE_MSG("Size - " << size);
+//! Returns the name of the idlelog index file.
+string
+IdleLogManager::get_index_filename() const
+{
+  stringstream ss;
+  ss << Util::get_home_directory();
+  ss << "idlelog.idx";
+
+  return ss.str();
+}
+
+
+//! Saves the idlelog index.
+/*!
+ *  The index holds a record per client with its ID, the save time, the
+ *  total active time, the master and activity state and the time of the
+ *  last daily reset. An ID that does not fit in the record continues in
+ *  the records that follow it.
+ */
+void
+IdleLogManager::save_index()
+{
+  TRACE_ENTER("IdleLogManager::save_index()");
 
-      PacketBuffer buffer;
-      buffer.create(size);
+  time_t current_time = time_source->get_time();
 
-      file.read(buffer.get_buffer(), size);
-      file.close();
-      buffer.write_ptr += size;
+  string records;
+  records.reserve(clients.size() * IDLELOG_INDEX_RECORD_SIZE);
 
-      // Read
-      int version = buffer.unpack_ushort();
-      TRACE_MSG("Version - " << version);
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = (*i).second;
+      info.update_active_time(current_time);
+      TRACE_MSG("Saving " << i->first << " " << info.client_id);
 
-      if (version == IDLELOG_VERSION)
+      const string &id = info.client_id;
+      size_t extra = 0;
+      if (id.size() > IDLELOG_INDEX_ID_SIZE)
         {
-          TRACE_MSG("Version - ok");
-
-          char *id = buffer.unpack_string();
-          if (id != NULL)
+          extra = (id.size() - IDLELOG_INDEX_ID_SIZE + IDLELOG_INDEX_RECORD_SIZE - 1) / IDLELOG_INDEX_RECORD_SIZE;
+          if (extra > IDLELOG_INDEX_MAX_EXTRA)
             {
-              TRACE_MSG("id = " << id);
+              // The client is known again once it signs on.
+              TRACE_MSG("ID too long " << id.size());
+              continue;
             }
+        }
 
-          while (buffer.bytes_available() > 0)
-            {
-              ClientInfo info;
-
-              int num_intervals;
-              time_t pack_time;
+      char record[IDLELOG_INDEX_RECORD_SIZE];
+      memset(record, 0, sizeof(record));
+      memcpy(record, id.data(), min(id.size(), (size_t)IDLELOG_INDEX_ID_SIZE));
 
-              unpack_idlelog(buffer, info, pack_time, num_intervals);
-              info.master = false;
-              info.state = ACTIVITY_IDLE;
-              info.last_update_time = pack_time;
-              TRACE_MSG("Add client " << info.client_id);
+      IdleLogFile::put_uint32(record + IDLELOG_INDEX_ID_SIZE, (guint32)current_time);
+      IdleLogFile::put_uint32(record + IDLELOG_INDEX_ID_SIZE + 4, (guint32)info.total_active_time);
+      record[IDLELOG_INDEX_ID_SIZE + 8] = info.master;
+      record[IDLELOG_INDEX_ID_SIZE + 9] = info.state;
+      IdleLogFile::put_uint32(record + IDLELOG_INDEX_ID_SIZE + 10, (guint32)reset_time);
+      record[IDLELOG_INDEX_ID_SIZE + 14] = (char)extra;
 
-              clients[info.client_id] = info;
-            }
+      records.append(record, IDLELOG_INDEX_RECORD_SIZE);
 
-          g_free(id);
+      for (size_t pos = IDLELOG_INDEX_ID_SIZE; pos < id.size(); pos += IDLELOG_INDEX_RECORD_SIZE)
+        {
+          memset(record, 0, sizeof(record));
+          memcpy(record, id.data() + pos, min(id.size() - pos, (size_t)IDLELOG_INDEX_RECORD_SIZE));
+          records.append(record, IDLELOG_INDEX_RECORD_SIZE);
         }
-      else
+    }
+
+  IdleLogFile index(get_index_filename(), IDLELOG_INDEX_RECORD_SIZE);
+  index.write(records);
+
+  TRACE_EXIT();
+}
+
+
+
+//! Loads the idlelog index.
+void
+IdleLogManager::load_index()
+{
+  TRACE_ENTER("IdleLogManager::load_index()");
+
+  IdleLogFile index(get_index_filename(), IDLELOG_INDEX_RECORD_SIZE);
+  string records;
+
+  if (index.load() && index.read(index.size(), records))
+    {
+      for (size_t pos = 0; pos < records.size(); pos += IDLELOG_INDEX_RECORD_SIZE)
         {
-          TRACE_MSG("Old version - deleting logs of old version");
+          const char *record = records.data() + pos;
 
-          char *id = buffer.unpack_string();
-          if (id != NULL)
-            {
-              TRACE_MSG("id = " << id);
-            }
+          string id(record, IDLELOG_INDEX_ID_SIZE);
+          id = id.substr(0, id.find('\0'));
 
-          while (buffer.bytes_available() > 0)
+          // Older versions leave the number of continuation records zero.
+          size_t extra = (guint8)record[IDLELOG_INDEX_ID_SIZE + 14];
+          for (size_t i = 0; i < extra && pos + IDLELOG_INDEX_RECORD_SIZE < records.size(); i++)
             {
-              unlink_idlelog(buffer);
+              pos += IDLELOG_INDEX_RECORD_SIZE;
+
+              string part(records.data() + pos, IDLELOG_INDEX_RECORD_SIZE);
+              id += part.substr(0, part.find('\0'));
             }
 
-          g_free(id);
+          ClientInfo info;
+          info.client_id = id;
+          info.total_active_time = IdleLogFile::get_uint32(record + IDLELOG_INDEX_ID_SIZE + 4);
+          info.master = false;
+          info.state = ACTIVITY_IDLE;
+          info.last_update_time = IdleLogFile::get_uint32(record + IDLELOG_INDEX_ID_SIZE);
+          TRACE_MSG("Add client " << info.client_id);
+
+          // Older versions leave the reset time zero.
+          reset_time = max(reset_time, (time_t)IdleLogFile::get_uint32(record + IDLELOG_INDEX_ID_SIZE + 10));
+
+          clients[info.client_id] = info;
         }
     }
+  else
+    {
+      TRACE_MSG("No valid index");
+    }
+
   TRACE_EXIT();
 }
 
 
 
 //! Saves the idlelog for the specified client.
+/*!
+ *  Only the intervals that are not yet stored are appended to the idle
+ *  log file. The file is rewritten if none of the intervals in memory
+ *  are stored, e.g. after receiving the idle log of a remote client.
+ */
 void
 IdleLogManager::save_idlelog(ClientInfo &info)
 {
   info.update_active_time(time_source->get_time());
 
-  PacketBuffer buffer;
-  buffer.create();
+  // Unsaved intervals are at the front.
+  size_t unsaved = 0;
+  while (unsaved < info.idlelog.size() && !info.idlelog[unsaved].saved)
+    {
+      unsaved++;
+    }
 
-  for (IdleLogRIter i = info.idlelog.rbegin(); i != info.idlelog.rend(); i++)
+  bool rewrite = unsaved == info.idlelog.size();
+  if (unsaved == 0 && !rewrite)
     {
-      IdleInterval &idle = *i;
+      return;
+    }
+
+  string records;
+  records.reserve(unsaved * IDLELOG_RECORD_SIZE);
 
-      pack_idle_interval(buffer, idle);
+  for (size_t i = unsaved; i > 0; i--)
+    {
+      pack_idle_record(records, info.idlelog[i - 1]);
     }
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
+  IdleLogFile file(get_idlelog_filename(info.client_id), IDLELOG_RECORD_SIZE);
+  bool ok = rewrite ? file.write(records) : file.append(records, IDLELOG_MAXSIZE);
 
-  ofstream file(ss.str().c_str(), ios::binary);
-  file.write(buffer.get_buffer(), buffer.bytes_written());
-  file.close();
+  if (ok)
+    {
+      for (size_t i = 0; i < unsaved; i++)
+        {
+          info.idlelog[i].saved = true;
+        }
+    }
 }
 
 
@@ -787,55 +1321,30 @@ IdleLogManager::load_idlelog(ClientInfo &info)
 
   time_t current_time = time_source->get_time();
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
-
-  // Open file
-  ifstream file(ss.str().c_str(), ios::binary);
+  IdleLogFile file(get_idlelog_filename(info.client_id), IDLELOG_RECORD_SIZE);
+  string records;
 
-  // get file size using buffer's members
-  filebuf *pbuf=file.rdbuf();
-  int size=pbuf->pubseekoff (0,ios::end,ios::in);
-  pbuf->pubseekpos (0,ios::in);
-
-  // Process it.
-  int num_intervals = size / IDLELOG_INTERVAL_SIZE;
-  if (num_intervals * IDLELOG_INTERVAL_SIZE == size)
+  // Only the most recent intervals are read.
+  if (file.load() && file.read(IDLELOG_MAXSIZE, records))
     {
-      if (num_intervals > IDLELOG_MAXSIZE)
-        {
-          TRACE_MSG("Skipping " << (num_intervals - IDLELOG_MAXSIZE) << " intervals");
-          int skip = (num_intervals - IDLELOG_MAXSIZE) * IDLELOG_INTERVAL_SIZE;
-          file.seekg(skip);
-          size -= skip;
-          num_intervals = IDLELOG_MAXSIZE;
-        }
-
-      // Create buffer and load data.
-      PacketBuffer buffer;
-      buffer.create(size);
-      file.read(buffer.get_buffer(), size);
-      file.close();
-      buffer.write_ptr += size;
-
-      TRACE_MSG("loading " << num_intervals << " intervals");
-      for (int i = 0; i < num_intervals; i++)
+      TRACE_MSG("loading " << records.size() / IDLELOG_RECORD_SIZE << " intervals");
+      for (size_t pos = 0; pos < records.size(); pos += IDLELOG_RECORD_SIZE)
         {
           IdleInterval idle;
-          unpack_idle_interval(buffer, idle, 0);
+          unpack_idle_record(records.data() + pos, idle);
 
           if (idle.end_idle_time >= current_time - IDLELOG_MAXAGE)
             {
+              idle.saved = true;
               info.idlelog.push_front(idle);
             }
         }
 
-	  if (info.idlelog.size() > 0)
-	    {
-           IdleInterval &idle = info.idlelog.back();
-           idle.begin_time = 1;
-	    }
+      if (info.idlelog.size() > 0)
+        {
+          IdleInterval &idle = info.idlelog.back();
+          idle.begin_time = 1;
+        }
     }
 
   dump_idlelog(info);
@@ -846,9 +1355,18 @@ IdleLogManager::load_idlelog(ClientInfo &info)
 
 
 //! Loads the entire idlelog.
+/*!
+ *  The snapshot of the previous session is used if it is valid.
+ *  Otherwise the index and the idle log of each client are read.
+ */
 void
 IdleLogManager::load()
 {
+  if (load_snapshot())
+    {
+      return;
+    }
+
   load_index();
 
   for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
@@ -874,29 +1392,156 @@ IdleLogManager::save()
 }
 
 
-//! Adds the specified idle interval to persistent storage.
+//! Returns the name of the idlelog snapshot file.
+string
+IdleLogManager::get_snapshot_filename() const
+{
+  stringstream ss;
+  ss << Util::get_home_directory();
+  ss << "idlelog.snapshot";
+
+  return ss.str();
+}
+
+
+//! Saves the idle logs of all clients in a single file.
+/*!
+ *  The snapshot is written at shutdown, after the idle logs are saved,
+ *  so that the next session can start without reading the idle log of
+ *  every client. It holds the save time, the reset time and, for each
+ *  client, the ID, the total active time, the last update time and the
+ *  idle intervals in the compact encoding. A CRC32 of the contents
+ *  follows.
+ */
 void
-IdleLogManager::update_idlelog(ClientInfo &info, const IdleInterval &idle)
+IdleLogManager::save_snapshot()
 {
-  info.update_active_time(time_source->get_time());
+  TRACE_ENTER("IdleLogManager::save_snapshot");
+
+  time_t current_time = time_source->get_time();
 
   PacketBuffer buffer;
   buffer.create();
 
-  pack_idle_interval(buffer, idle);
+  buffer.pack_ushort(IDLELOG_SNAPSHOT_VERSION);
+  buffer.pack_ulong((guint32)current_time);
+  buffer.pack_ulong((guint32)reset_time);
+  buffer.pack_ushort(clients.size());
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "idlelog." << info.client_id << ".log" << ends;
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = (*i).second;
+      info.update_active_time(current_time);
+
+      buffer.pack_string(info.client_id);
+      buffer.pack_ulong((guint32)info.total_active_time);
+      buffer.pack_ulong((guint32)info.last_update_time);
+      pack_idle_intervals(buffer, info, current_time, info.idlelog.size());
+    }
 
-  ofstream file(ss.str().c_str(), ios::app | ios::binary);
+  buffer.pack_ulong(StatsCodec::crc32(buffer.get_buffer(), buffer.bytes_written()));
+
+  ofstream file(get_snapshot_filename().c_str(), ios::binary);
   file.write(buffer.get_buffer(), buffer.bytes_written());
   file.close();
 
-  save_index();
+  TRACE_EXIT();
 }
 
 
+//! Loads the idle logs of all clients from the snapshot.
+/*!
+ *  The snapshot is removed once it is read, so that it is only used by
+ *  the session directly following the one that wrote it. If a session
+ *  ends without writing a snapshot, the next one falls back to reading
+ *  the idle logs.
+ *
+ *  \return false if there is no valid snapshot.
+ */
+bool
+IdleLogManager::load_snapshot()
+{
+  TRACE_ENTER("IdleLogManager::load_snapshot");
+
+  time_t current_time = time_source->get_time();
+  string filename = get_snapshot_filename();
+
+  string data;
+  bool ok = StatsCodec::read_file(filename, data) && data.size() > 4;
+
+#ifdef PLATFORM_OS_WIN32
+  _unlink(filename.c_str());
+#else
+  unlink(filename.c_str());
+#endif
+
+  PacketBuffer buffer;
+  time_t save_time = 0;
+
+  if (ok)
+    {
+      int size = data.size() - 4;
+
+      buffer.create(data.size());
+      buffer.pack_raw((const guint8 *)data.data(), data.size());
+
+      ok = (buffer.peek_ulong(size) == StatsCodec::crc32(data.data(), size) &&
+            buffer.unpack_ushort() == IDLELOG_SNAPSHOT_VERSION);
+
+      if (ok)
+        {
+          save_time = buffer.unpack_ulong();
+          ok = save_time <= current_time && current_time - save_time < IDLELOG_MAXAGE;
+        }
+    }
+
+  if (!ok)
+    {
+      TRACE_RETURN("No valid snapshot");
+      return false;
+    }
+
+  reset_time = buffer.unpack_ulong();
+
+  int num_clients = buffer.unpack_ushort();
+  for (int i = 0; i < num_clients; i++)
+    {
+      char *id = buffer.unpack_string();
+      if (id == NULL)
+        {
+          break;
+        }
+
+      ClientInfo &info = clients[id];
+      info.client_id = id;
+      info.total_active_time = buffer.unpack_ulong();
+      info.last_update_time = buffer.unpack_ulong();
+      info.master = false;
+      info.state = ACTIVITY_IDLE;
+      g_free(id);
+
+      unpack_idle_intervals(buffer, info, save_time);
+      expire(info);
+
+      // The idle log file is up-to-date.
+      for (IdleLogIter j = info.idlelog.begin(); j != info.idlelog.end(); j++)
+        {
+          j->saved = true;
+        }
+
+      if (info.idlelog.size() > 0)
+        {
+          info.idlelog.back().begin_time = 1;
+        }
+
+      fix_idlelog(info);
+      TRACE_MSG("Loaded " << info.client_id << " " << info.idlelog.size());
+    }
+
+  TRACE_RETURN(num_clients);
+  return true;
+}
+
 
 void
 IdleLogManager::get_idlelog(PacketBuffer &buffer)
@@ -909,18 +1554,88 @@ IdleLogManager::get_idlelog(PacketBuffer &buffer)
   // First make sure that all data is up-to-date.
   myinfo.update_active_time(time_source->get_time());
 
-  // Pack header.
   pack_idlelog(buffer, myinfo);
+  pack_idle_intervals(buffer, myinfo, time_source->get_time(), myinfo.idlelog.size());
 
-  for (IdleLogIter i = myinfo.idlelog.begin(); i != myinfo.idlelog.end(); i++)
+  if (!myinfo.idlelog.empty())
     {
-      pack_idle_interval(buffer, *i);
+      myinfo.sent_end_time = myinfo.idlelog.front().end_time;
     }
 
   TRACE_EXIT();
 }
 
 
+//! Sets whether each client only records its own activity.
+/*!
+ *  Without a master, the idle log of a remote client is only written by
+ *  that client, and received with set_idlelog().
+ */
+void
+IdleLogManager::set_leaderless(bool leaderless)
+{
+  TRACE_ENTER_MSG("IdleLogManager::set_leaderless", leaderless);
+
+  time_t current_time = time_source->get_time();
+
+  for (ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      ClientInfo &info = (*i).second;
+      if (i->first != myid)
+        {
+          info.update_active_time(current_time);
+          info.last_active_begin_time = 0;
+          info.remote_active_begin_time = 0;
+          info.has_clock_offset = false;
+        }
+    }
+
+  this->leaderless = leaderless;
+  invalidate_active_time();
+
+  TRACE_EXIT();
+}
+
+
+//! Returns whether the idle log of this client has intervals that were not sent.
+bool
+IdleLogManager::has_unsent_idlelog()
+{
+  ClientInfo &myinfo = clients[myid];
+  return !myinfo.idlelog.empty() && myinfo.idlelog.front().end_time > myinfo.sent_end_time;
+}
+
+
+//! Packs the intervals of this client that were not sent yet.
+/*!
+ *  The most recent interval is sent again if it was extended since.
+ */
+void
+IdleLogManager::get_unsent_idlelog(PacketBuffer &buffer)
+{
+  TRACE_ENTER("IdleLogManager::get_unsent_idlelog");
+
+  ClientInfo &myinfo = clients[myid];
+  myinfo.update_active_time(time_source->get_time());
+
+  size_t count = 0;
+  while (count < myinfo.idlelog.size() && myinfo.idlelog[count].end_time > myinfo.sent_end_time)
+    {
+      count++;
+    }
+
+  pack_idlelog(buffer, myinfo);
+  pack_idle_intervals(buffer, myinfo, time_source->get_time(), count);
+
+  if (count > 0)
+    {
+      myinfo.sent_end_time = myinfo.idlelog.front().end_time;
+    }
+
+  TRACE_RETURN(count);
+}
+
+
 void
 IdleLogManager::set_idlelog(PacketBuffer &buffer)
 {
@@ -929,31 +1644,127 @@ IdleLogManager::set_idlelog(PacketBuffer &buffer)
   time_t delta_time = 0;
   time_t pack_time = 0;
   int num_intervals = 0;
+  int encoding = IDLELOG_ENCODING_LEGACY;
 
   ClientInfo info;
-  unpack_idlelog(buffer, info, pack_time, num_intervals);
+  unpack_idlelog(buffer, info, pack_time, num_intervals, encoding);
+
+  if (info.client_id == myid)
+    {
+      // Only this client records its own idle history.
+      TRACE_RETURN("Own idle log");
+      return;
+    }
 
-  delta_time = pack_time - time_source->get_time();
-  clients[info.client_id] = info;
-  info.last_update_time = 0;
+  // Without a master, the received intervals are added to the ones
+  // received before.
+  ClientMapIter it = clients.find(info.client_id);
+  bool merge = leaderless && it != clients.end();
 
-  for (int i = 0; i < num_intervals; i++)
+  // The pack time of the sender corresponds to our current time.
+  time_t clock_offset = time_source->get_time() - pack_time;
+  if (merge && it->second.has_clock_offset)
     {
-      IdleInterval idle;
-      unpack_idle_interval(buffer, idle, delta_time);
+      // Convert each idle log of a client with the same offset, so that
+      // an interval that is received twice has the same times.
+      clock_offset = it->second.clock_offset;
+    }
+  delta_time = -clock_offset;
 
-      TRACE_MSG(info.client_id << " " << idle.begin_time << " " << idle.end_idle_time << " " << idle.active_time);
-      clients[info.client_id].idlelog.push_back(idle);
+  if (encoding == IDLELOG_ENCODING_DELTA)
+    {
+      unpack_idle_intervals(buffer, info, pack_time + clock_offset);
     }
+  else
+    {
+      for (int i = 0; i < num_intervals; i++)
+        {
+          IdleInterval idle;
+          unpack_idle_interval(buffer, idle, delta_time);
 
-  fix_idlelog(info);
+          TRACE_MSG(info.client_id << " " << idle.begin_time << " " << idle.end_idle_time << " " << idle.active_time);
+          info.idlelog.push_back(idle);
+        }
+    }
+
+  if (merge)
+    {
+      merge_idlelog(it->second, info);
+    }
+  else
+    {
+      clients[info.client_id] = info;
+      fix_idlelog(info);
+    }
+
+  ClientInfo &client = clients[info.client_id];
+  if (leaderless)
+    {
+      client.clock_offset = clock_offset;
+      client.has_clock_offset = true;
+    }
+
+  invalidate_active_time();
   save_index();
-  save_idlelog(clients[info.client_id]);
+  save_idlelog(client);
 
   TRACE_EXIT();
 }
 
 
+//! Merges a received idle log into the idle log of a remote client.
+/*!
+ *  Intervals are identified by their start time. A received interval
+ *  replaces the stored one with the same start time, as the remote
+ *  client may have extended its most recent interval since. Stored
+ *  intervals that were not received are kept.
+ */
+void
+IdleLogManager::merge_idlelog(ClientInfo &info, const ClientInfo &received)
+{
+  TRACE_ENTER_MSG("IdleLogManager::merge_idlelog", received.client_id << " " << received.idlelog.size());
+
+  map<time_t, IdleInterval> intervals;
+  for (size_t i = 0; i < info.idlelog.size(); i++)
+    {
+      intervals[info.idlelog[i].begin_time] = info.idlelog[i];
+    }
+
+  bool changed = false;
+  for (size_t i = 0; i < received.idlelog.size(); i++)
+    {
+      const IdleInterval &idle = received.idlelog[i];
+
+      map<time_t, IdleInterval>::iterator j = intervals.find(idle.begin_time);
+      if (j == intervals.end() ||
+          j->second.end_idle_time != idle.end_idle_time ||
+          j->second.active_time != idle.active_time)
+        {
+          intervals[idle.begin_time] = idle;
+          changed = true;
+        }
+    }
+
+  info.total_active_time = received.total_active_time;
+
+  if (changed)
+    {
+      // Intervals may be inserted anywhere, so the idle log file is rewritten.
+      info.idlelog.clear();
+      for (map<time_t, IdleInterval>::reverse_iterator j = intervals.rbegin(); j != intervals.rend(); j++)
+        {
+          IdleInterval &idle = j->second;
+          idle.saved = false;
+          idle.to_be_saved = false;
+
+          info.idlelog.push_back(idle);
+        }
+    }
+
+  TRACE_RETURN(changed);
+}
+
+
 //! A remote client has signed on.
 void
 IdleLogManager::signon_remote_client(string client_id)
@@ -963,9 +1774,14 @@ IdleLogManager::signon_remote_client(string client_id)
   time_t current_time = time_source->get_time();
 
   ClientInfo &info = clients[client_id];
-  info.idlelog.push_front(IdleInterval(1, current_time));
   info.client_id = client_id;
 
+  if (!leaderless)
+    {
+      info.idlelog.push_front(IdleInterval(1, current_time));
+      invalidate_active_time();
+    }
+
   save_index();
   save_idlelog(info);
 
@@ -981,6 +1797,7 @@ IdleLogManager::signoff_remote_client(string client_id)
 
   clients[client_id].state = ACTIVITY_IDLE;
   clients[client_id].master = false;
+  clients[client_id].remote_active_begin_time = 0;
 
   TRACE_EXIT();
 }
@@ -1100,6 +1917,7 @@ IdleLogManager::fix_idlelog(ClientInfo &info)
     }
 
   info.idlelog.push_front(IdleInterval(next_time, current_time));
+  invalidate_active_time();
 
   TRACE_EXIT();
 }
@@ -39,10 +39,15 @@
 #include <string>
 #include <list>
 #include <map>
+#include <vector>
 
 using namespace std;
 
 #include "ActivityMonitor.hh"
+#include "RingBuffer.hh"
+
+//! Maximum number of idle intervals per client.
+#define IDLELOG_MAXSIZE     (4000)
 
 class TimeSource;
 class PacketBuffer;
@@ -58,7 +63,8 @@ private:
       end_idle_time(0),
       end_time(0),
       active_time(0),
-      to_be_saved(false)
+      to_be_saved(false),
+      saved(false)
     {
     }
 
@@ -67,7 +73,8 @@ private:
       end_idle_time(e),
       end_time(e),
       active_time(0),
-      to_be_saved(false)
+      to_be_saved(false),
+      saved(false)
     {
     }
 
@@ -85,10 +92,30 @@ private:
 
     //! Yet to be saved
     bool to_be_saved;
+
+    //! Stored in the idle log file.
+    bool saved;
   };
 
 
-  typedef list<IdleInterval> IdleLog;
+  //! Active periods, sorted by time, for time window queries.
+  struct ActiveSpans
+  {
+    //! Start times of the active periods.
+    vector<time_t> begin;
+
+    //! End times of the active periods.
+    vector<time_t> end;
+
+    //! Total length of all active periods before the period with the same index.
+    vector<time_t> total;
+  };
+
+  //! A single active period.
+  typedef pair<time_t, time_t> ActiveSpan;
+
+  //! Idle intervals, most recent first.
+  typedef RingBuffer<IdleInterval> IdleLog;
   typedef IdleLog::iterator IdleLogIter;
   typedef IdleLog::reverse_iterator IdleLogRIter;
 
@@ -96,12 +123,17 @@ private:
   struct ClientInfo
   {
     ClientInfo() :
+      idlelog(IDLELOG_MAXSIZE),
       state(ACTIVITY_UNKNOWN),
       master(false),
       total_active_time(0),
       last_active_begin_time(0),
       last_active_time(0),
-      last_update_time()
+      last_update_time(),
+      remote_active_begin_time(0),
+      clock_offset(0),
+      has_clock_offset(false),
+      sent_end_time(0)
     {
     }
 
@@ -132,7 +164,30 @@ private:
     //! Last time this idle log was updated.
     time_t last_update_time;
 
+    //! Active periods of the idle log.
+    ActiveSpans active_spans;
+
+    //! Start time of the current active period of a remote client without master.
+    /*!
+     *  The period is not part of the idle log, which only the remote
+     *  client itself writes.
+     */
+    time_t remote_active_begin_time;
+
+    //! Difference between the local clock and the clock of a remote client.
+    time_t clock_offset;
+
+    //! Is the clock offset known?
+    bool has_clock_offset;
+
+    //! End time of the most recent interval sent to the remote clients.
+    time_t sent_end_time;
+
     //! Update the active time of the most recent idle interval.
+    /*!
+     *  An active period that is still in progress continues at the current
+     *  time, so that it is not cut short by a query.
+     */
     void update_active_time(time_t current_time)
     {
       if (last_active_begin_time != 0)
@@ -141,7 +196,7 @@ private:
           total_active_time            += (current_time - last_active_begin_time);
 
           last_active_time = 0;
-          last_active_begin_time = 0;
+          last_active_begin_time = (state == ACTIVITY_ACTIVE) ? current_time : 0;
         }
     }
   };
@@ -149,6 +204,52 @@ private:
   typedef map<string, ClientInfo> ClientMap;
   typedef ClientMap::iterator ClientMapIter;
 
+  //! Position of compute_active_time() in the idle log of a single client.
+  struct MergeCursor
+  {
+    //! Current interval.
+    IdleLogIter iter;
+
+    //! End of the idle log.
+    IdleLogIter end;
+
+    //! Is the end of the current interval the next event?
+    bool at_end;
+
+    //! Active time processed so far.
+    time_t active_time;
+  };
+
+  //! Result of compute_active_time() for a single length.
+  struct ActiveTimeCache
+  {
+    ActiveTimeCache(int l, time_t t) : length(l), active_time(t) {}
+
+    //! Length of the common idle period.
+    int length;
+
+    //! Active time since the common idle period.
+    time_t active_time;
+  };
+
+  //! Next event of a client, ordered by time.
+  struct MergeEvent
+  {
+    MergeEvent(time_t t, int c) : time(t), client(c) {}
+
+    //! Time of the event.
+    time_t time;
+
+    //! Index of the client's cursor.
+    int client;
+
+    //! Later events come first; on a tie, the lowest client index.
+    bool operator<(const MergeEvent &other) const
+    {
+      return time < other.time || (time == other.time && client > other.client);
+    }
+  };
+
 private:
   // My ID
   string myid;
@@ -162,10 +263,32 @@ private:
   //! Last time we performed an expiration run.
   time_t last_expiration_time;
 
+  //! Client cursors, reused by compute_active_time().
+  vector<MergeCursor> merge_cursors;
+
+  //! Heap of pending events, reused by compute_active_time().
+  vector<MergeEvent> merge_events;
+
+  //! Results of compute_active_time() since the idle logs last changed.
+  vector<ActiveTimeCache> active_time_cache;
+
+  //! Active periods of all clients combined.
+  ActiveSpans merged_active_spans;
+
+  //! Are the active periods up-to-date with the idle logs?
+  bool active_spans_valid;
+
+  //! Does each client only record its own activity?
+  bool leaderless;
+
+  //! Time of the last daily reset, or 0 if not known.
+  time_t reset_time;
+
 public:
   IdleLogManager(string myid, const TimeSource *control);
 
   void update_all_idlelogs(string master_id, ActivityState state);
+  void update_all_idlelogs(ActivityState my_state, const map<string, ActivityState> &remote_states);
   void reset();
   void init();
   void terminate();
@@ -176,33 +299,67 @@ public:
   void get_idlelog(PacketBuffer &buffer);
   void set_idlelog(PacketBuffer &buffer);
 
+  void set_leaderless(bool leaderless);
+  bool has_unsent_idlelog();
+  void get_unsent_idlelog(PacketBuffer &buffer);
+
   time_t compute_total_active_time();
   time_t compute_active_time(int length);
   time_t compute_idle_time();
 
+  time_t compute_active_time_between(time_t from, time_t to);
+  time_t compute_active_time_between(const string &client_id, time_t from, time_t to);
+
+  time_t compute_merged_active_time(int length);
+  time_t compute_merged_idle_time();
+  bool compute_merged_total_active_time(time_t &active_time);
+
 private:
+  time_t merge_active_time(int length);
+  void invalidate_active_time();
+
+  void update_active_spans();
+  bool get_current_active_span(const ClientInfo &info, time_t from, time_t to, ActiveSpan &span) const;
+  static void build_active_spans(vector<ActiveSpan> &spans, ActiveSpans &result);
+  static time_t get_active_time(const ActiveSpans &spans, time_t from, time_t to);
+  void get_merged_active_spans(ActiveSpans &result);
+  void merge_idlelog(ClientInfo &info, const ClientInfo &received);
+
   void update_idlelog(ClientInfo &info, ActivityState state, bool master);
+  void update_remote_activity(ClientInfo &info, ActivityState state);
   void expire();
   void expire(ClientInfo &info);
 
-  void pack_idle_interval(PacketBuffer &buffer, const IdleInterval &idle) const;
   void unpack_idle_interval(PacketBuffer &buffer, IdleInterval &idle, time_t delta_time) const;
+  void pack_idle_intervals(PacketBuffer &buffer, const ClientInfo &ci, time_t base_time, size_t count) const;
+  void unpack_idle_intervals(PacketBuffer &buffer, ClientInfo &ci, time_t base_time) const;
 
   void pack_idlelog(PacketBuffer &buffer, const ClientInfo &ci) const;
-  void unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci, time_t &pack_time, int &num_intervals) const;
-  void unlink_idlelog(PacketBuffer &buffer) const;
+  void unpack_idlelog(PacketBuffer &buffer, ClientInfo &ci, time_t &pack_time, int &num_intervals, int &encoding) const;
+
+  void pack_idle_record(string &records, const IdleInterval &idle) const;
+  void unpack_idle_record(const char *record, IdleInterval &idle) const;
+  string get_idlelog_filename(const string &client_id) const;
+  string get_index_filename() const;
+  string get_snapshot_filename() const;
 
   void save_index();
   void load_index();
   void save_idlelog(ClientInfo &info);
   void load_idlelog(ClientInfo &info);
 
+  void save_snapshot();
+  bool load_snapshot();
+
   void save();
   void load();
-  void update_idlelog(ClientInfo &info, const IdleInterval &idle);
 
   void fix_idlelog(ClientInfo &info);
   void dump_idlelog(ClientInfo &info);
+
+#ifdef HAVE_TESTS
+  friend class IdleLogTest;
+#endif
 };
 
 
@@ -40,12 +40,24 @@ PacketBuffer::PacketBuffer() :
 }
 
 
+//! Unused buffers.
+/*!
+ *  Packet buffers are short lived: one is created for every packet that
+ *  is sent. Released buffers are kept here and handed out again by
+ *  create(). PacketBuffers are only used from the main loop, so the pool
+ *  needs no locking.
+ */
+static guint8 *pool_data[POOL_BUFFERS];
+static int pool_size[POOL_BUFFERS];
+static int pool_count = 0;
+
+
 PacketBuffer::~PacketBuffer()
 {
   narrow(0, -1);
   if (buffer != NULL)
     {
-      g_free(buffer);
+      pool_free(buffer, buffer_size);
     }
 }
 
@@ -56,7 +68,7 @@ PacketBuffer::create(int size)
 
   if (buffer != NULL)
     {
-      g_free(buffer);
+      pool_free(buffer, buffer_size);
     }
 
   if (size == 0)
@@ -64,7 +76,7 @@ PacketBuffer::create(int size)
       size = 1024;
     }
 
-  buffer = g_new(guint8, size);
+  buffer = pool_alloc(size);
   read_ptr = buffer;
   write_ptr = buffer;
   buffer_size = size;
@@ -110,6 +122,49 @@ PacketBuffer::resize(int size)
   //TRACE_EXIT();
 }
 
+//! Returns a buffer of at least the specified size.
+/*!
+ *  \param size the requested size, updated to the actual size.
+ */
+guint8 *
+PacketBuffer::pool_alloc(int &size)
+{
+  for (int i = pool_count - 1; i >= 0; i--)
+    {
+      if (pool_size[i] >= size)
+        {
+          guint8 *data = pool_data[i];
+          size = pool_size[i];
+
+          pool_count--;
+          pool_data[i] = pool_data[pool_count];
+          pool_size[i] = pool_size[pool_count];
+
+          return data;
+        }
+    }
+
+  return g_new(guint8, size);
+}
+
+
+//! Releases a buffer.
+void
+PacketBuffer::pool_free(guint8 *data, int size)
+{
+  if (pool_count < POOL_BUFFERS && size <= POOL_BUFFER_SIZE)
+    {
+      pool_data[pool_count] = data;
+      pool_size[pool_count] = size;
+      pool_count++;
+    }
+  else
+    {
+      g_free(data);
+    }
+}
+
+
 void
 PacketBuffer::grow(int size)
 {
@@ -252,6 +307,27 @@ PacketBuffer::pack_byte(guint8 data)
 }
 
 
+//! Packs an unsigned integer in 7 bit groups, least significant first.
+void
+PacketBuffer::pack_varint(guint64 data)
+{
+  while (data >= 0x80)
+    {
+      pack_byte((guint8)(data | 0x80));
+      data >>= 7;
+    }
+  pack_byte((guint8)data);
+}
+
+
+//! Packs a signed integer as a zigzag encoded varint.
+void
+PacketBuffer::pack_svarint(gint64 data)
+{
+  pack_varint((guint64(data) << 1) ^ guint64(data >> 63));
+}
+
+
 void
 PacketBuffer::poke_byte(int pos, guint8 data)
 {
@@ -399,6 +475,34 @@ PacketBuffer::unpack_byte()
 }
 
 
+guint64
+PacketBuffer::unpack_varint()
+{
+  guint64 ret = 0;
+
+  for (int shift = 0; shift < 64 && read_ptr + 1 <= write_ptr; shift += 7)
+    {
+      guint8 b = read_ptr[0];
+      read_ptr++;
+
+      ret |= guint64(b & 0x7f) << shift;
+      if ((b & 0x80) == 0)
+        {
+          break;
+        }
+    }
+  return ret;
+}
+
+
+gint64
+PacketBuffer::unpack_svarint()
+{
+  guint64 data = unpack_varint();
+  return gint64(data >> 1) ^ -gint64(data & 1);
+}
+
+
 int
 PacketBuffer::peek(int pos, guint8 **data)
 {
@@ -26,6 +26,12 @@
 
 #define GROW_SIZE (4096)
 
+//! Maximum number of unused buffers kept for reuse.
+#define POOL_BUFFERS (16)
+
+//! Maximum size of a buffer kept for reuse.
+#define POOL_BUFFER_SIZE (65536)
+
 class PacketBuffer
 {
 public:
@@ -50,6 +56,8 @@ public:
   void pack_ushort(guint16 data);
   void pack_ulong(guint32 data);
   void pack_byte(guint8 data);
+  void pack_varint(guint64 data);
+  void pack_svarint(gint64 data);
 
   void poke_byte(int pos, guint8 data);
   void poke_ushort(int pos, guint16 data);
@@ -61,6 +69,8 @@ public:
   guint32 unpack_ulong();
   guint16 unpack_ushort();
   guint8 unpack_byte();
+  guint64 unpack_varint();
+  gint64 unpack_svarint();
 
   int peek(int pos, guint8 **data);
   gchar *peek_string(int pos);
@@ -81,6 +91,10 @@ public:
   int get_buffer_size() { return buffer_size; }
   void restart_read() { read_ptr = buffer; }
 
+private:
+  static guint8 *pool_alloc(int &size);
+  static void pool_free(guint8 *data, int size);
+
 public:
   guint8 *buffer;
   guint8 *read_ptr;
@@ -0,0 +1,201 @@
+// RingBuffer.hh --- Bounded double ended queue in contiguous storage
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef RINGBUFFER_HH
+#define RINGBUFFER_HH
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+//! Bounded double ended queue in contiguous storage.
+/*!
+ *  Elements are stored in a single circular array that grows by
+ *  doubling as needed. Once max_size elements are stored, push_front()
+ *  discards the element at the back, and push_back() is ignored.
+ *  Removing elements at either end only moves an index.
+ *
+ *  The interface follows the subset of std::list that is needed to
+ *  replace it: front() is element 0 and iteration runs from front to
+ *  back.
+ */
+template<class T>
+class RingBuffer
+{
+public:
+  template<class V, class R, class P, class B>
+  class basic_iterator
+  {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef V value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef P pointer;
+    typedef R reference;
+
+    basic_iterator() : ring(NULL), index(0) {}
+    basic_iterator(B *ring, size_t index) : ring(ring), index(index) {}
+
+    template<class V2, class R2, class P2, class B2>
+    basic_iterator(const basic_iterator<V2, R2, P2, B2> &other) : ring(other.ring), index(other.index) {}
+
+    reference operator*() const { return (*ring)[index]; }
+    pointer operator->() const { return &(*ring)[index]; }
+
+    basic_iterator &operator++() { index++; return *this; }
+    basic_iterator operator++(int) { basic_iterator tmp = *this; index++; return tmp; }
+    basic_iterator &operator--() { index--; return *this; }
+    basic_iterator operator--(int) { basic_iterator tmp = *this; index--; return tmp; }
+
+    bool operator==(const basic_iterator &other) const { return index == other.index && ring == other.ring; }
+    bool operator!=(const basic_iterator &other) const { return !(*this == other); }
+
+    B *ring;
+    size_t index;
+  };
+
+  typedef T value_type;
+  typedef basic_iterator<T, T &, T *, RingBuffer> iterator;
+  typedef basic_iterator<T, const T &, const T *, const RingBuffer> const_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+  explicit RingBuffer(size_t max_size) : max_elements(max_size), mask(0), head(0), count(0) {}
+
+  size_t size() const { return count; }
+  size_t max_size() const { return max_elements; }
+  bool empty() const { return count == 0; }
+
+  T &operator[](size_t i) { return data[(head + i) & mask]; }
+  const T &operator[](size_t i) const { return data[(head + i) & mask]; }
+
+  T &front() { return (*this)[0]; }
+  const T &front() const { return (*this)[0]; }
+  T &back() { return (*this)[count - 1]; }
+  const T &back() const { return (*this)[count - 1]; }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, count); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, count); }
+
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+  const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+  void push_front(const T &value)
+  {
+    if (max_elements == 0)
+      {
+        return;
+      }
+
+    if (count == max_elements)
+      {
+        // Full, discard the back.
+        count--;
+      }
+    else if (count == data.size())
+      {
+        grow();
+      }
+
+    head = (head - 1) & mask;
+    data[head] = value;
+    count++;
+  }
+
+  void push_back(const T &value)
+  {
+    if (count == max_elements)
+      {
+        return;
+      }
+    else if (count == data.size())
+      {
+        grow();
+      }
+
+    data[(head + count) & mask] = value;
+    count++;
+  }
+
+  void pop_front()
+  {
+    head = (head + 1) & mask;
+    count--;
+  }
+
+  void pop_back()
+  {
+    count--;
+  }
+
+  //! Removes elements at the back until size() is at most the specified size.
+  void truncate(size_t size)
+  {
+    if (size < count)
+      {
+        count = size;
+      }
+  }
+
+  void clear()
+  {
+    head = 0;
+    count = 0;
+  }
+
+private:
+  void grow()
+  {
+    size_t capacity = data.empty() ? 16 : data.size() * 2;
+
+    std::vector<T> grown;
+    grown.reserve(capacity);
+    for (size_t i = 0; i < count; i++)
+      {
+        grown.push_back((*this)[i]);
+      }
+    grown.resize(capacity);
+
+    data.swap(grown);
+    mask = capacity - 1;
+    head = 0;
+  }
+
+private:
+  //! Circular storage.
+  std::vector<T> data;
+
+  //! Maximum number of elements.
+  size_t max_elements;
+
+  //! Capacity of data minus one. The capacity is a power of two.
+  size_t mask;
+
+  //! Index of the front element in data.
+  size_t head;
+
+  //! Number of elements.
+  size_t count;
+};
+
+#endif // RINGBUFFER_HH
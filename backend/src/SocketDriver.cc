@@ -34,6 +34,41 @@ static const char rcsid[] = "$Id: GNetSocketDriver.cc 1184 2007-05-12 09:16:31Z
 #include "GNetSocketDriver.hh"
 #endif
 
+//! Write data from several buffers to the connection.
+/*!
+ *  Writes the buffers one at a time. Drivers that support vectored I/O
+ *  override this.
+ */
+void
+ISocket::write(const SocketBuffer *buffers, int count, int &bytes_written)
+{
+  bytes_written = 0;
+
+  for (int i = 0; i < count; i++)
+    {
+      int written = 0;
+      write(buffers[i].data, buffers[i].size, written);
+      bytes_written += written;
+
+      if (written < buffers[i].size)
+        {
+          break;
+        }
+    }
+}
+
+
+//! Returns whether the other end of the connection runs as the same user.
+/*!
+ *  Drivers that cannot tell return false.
+ */
+bool
+ISocket::is_same_user()
+{
+  return false;
+}
+
+
 //! Create a new socket
 SocketDriver *
 SocketDriver::create()
@@ -47,3 +82,20 @@ SocketDriver::create()
 #endif
 }
 
+
+//! Create a driver for sockets between sessions on this host.
+/*!
+ *  \param name name of the local sockets.
+ *
+ *  \return NULL if local sockets are not supported.
+ */
+SocketDriver *
+SocketDriver::create_local(const std::string &name)
+{
+#if defined(HAVE_GIO_UNIX_NET)
+  return new GIOSocketDriver(name);
+#else
+  (void) name;
+  return NULL;
+#endif
+}
@@ -40,6 +40,9 @@ public:
   //! The specified socket has data ready to be read.
   virtual void socket_io(ISocket *con, void *data) = 0;
 
+  //! The specified socket can be written without blocking.
+  virtual void socket_writable(ISocket *con, void *data) = 0;
+
   //! The specified socket closed its connection.
   virtual void socket_closed(ISocket *con, void *data) = 0;
 };
@@ -57,6 +60,17 @@ public:
 };
 
 
+//! A block of data for a vectored write.
+struct SocketBuffer
+{
+  //! Start of the data.
+  void *data;
+
+  //! Number of bytes.
+  int size;
+};
+
+
 //! TCP Socket.
 class ISocket
 {
@@ -77,6 +91,15 @@ public:
   //! Write data to the connection
   virtual void write(void *buf, int count, int &bytes_written) = 0;
 
+  //! Write data from several buffers to the connection.
+  virtual void write(const SocketBuffer *buffers, int count, int &bytes_written);
+
+  //! Select whether the listener is notified that the connection is readable or writable.
+  virtual void set_watch_events(bool readable, bool writable) = 0;
+
+  //! Returns whether the other end of the connection runs as the same user.
+  virtual bool is_same_user();
+
   //! Close the connection.
   virtual void close() = 0;
 
@@ -125,6 +148,7 @@ class SocketDriver
 {
 public:
   static SocketDriver *create();
+  static SocketDriver *create_local(const std::string &name);
 
   virtual ~SocketDriver() {};
 
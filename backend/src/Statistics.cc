@@ -25,16 +25,23 @@
 #include "OSXHelpers.hh"
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <sstream>
 #include <assert.h>
 #include <math.h>
+#include <limits.h>
+#include <stdio.h>
 
 #include "debug.hh"
 
 #include "Statistics.hh"
+#include "StatsCodec.hh"
+#include "StatsReader.hh"
 
 #include "Core.hh"
+#include "CoreConfig.hh"
+#include "Configurator.hh"
 #include "Util.hh"
 #include "Timer.hh"
 #include "TimePred.hh"
@@ -46,6 +53,11 @@
 #include "DistributionManager.hh"
 #endif
 
+#ifdef HAVE_DBUS
+#include "DBus.hh"
+#include "DBusWorkrave.hh"
+#endif
+
 const char *WORKRAVESTATS="WorkRaveStats";
 const int STATSVERSION = 4;
 
@@ -56,6 +68,11 @@ Statistics::Statistics() :
   core(NULL),
   current_day(NULL),
   been_active(false),
+  packed_history(false),
+  packed_tail_pos(-1),
+  compaction_source(0),
+  compaction_pos(0),
+  compaction_changed(false),
   prev_x(-1),
   prev_y(-1),
   click_x(-1),
@@ -63,6 +80,8 @@ Statistics::Statistics() :
 {
   last_mouse_time.tv_sec = 0;
   last_mouse_time.tv_usec = 0;
+
+  memset((void *)hourly_totals, 0, sizeof(hourly_totals));
 }
 
 
@@ -71,9 +90,14 @@ Statistics::~Statistics()
 {
   update();
 
-  for (vector<DailyStatsImpl *>::iterator i = history.begin(); i != history.end(); i++)
+  if (compaction_source != 0)
+    {
+      g_source_remove(compaction_source);
+    }
+
+  if (core != NULL)
     {
-      delete *i;
+      core->get_configurator()->remove_listener(this);
     }
 
   delete current_day;
@@ -91,6 +115,9 @@ Statistics::init(Core *control)
 {
   core = control;
 
+  core->get_configurator()->get_value_with_default(CoreConfig::CFG_KEY_STATISTICS_PACKED_HISTORY,
+                                                   packed_history, false);
+
   input_monitor = InputMonitorFactory::get_monitor(IInputMonitorFactory::CAPABILITY_STATISTICS);
   if (input_monitor != NULL)
     {
@@ -107,8 +134,16 @@ Statistics::init(Core *control)
     {
       start_new_day();
     }
+  else
+    {
+      // Counted in the hourly statistics before the restart.
+      get_hourly_totals(current_day, hourly_totals);
+    }
 
   load_history();
+
+  core->get_configurator()->add_listener(CoreConfig::CFG_KEY_STATISTICS, this);
+  schedule_compaction();
 }
 
 
@@ -133,6 +168,11 @@ Statistics::update()
     }
 
   update_current_day(state == ACTIVITY_ACTIVE);
+
+  const time_t now = core->get_time();
+  struct tm *tmnow = localtime(&now);
+  update_hourly_stats(tmnow->tm_hour);
+
   save_day(current_day);
   TRACE_EXIT();
 }
@@ -150,12 +190,20 @@ Statistics::delete_all_history()
     }
     else
     {
-        for( vector<DailyStatsImpl *>::iterator i = history.begin(); ( i != history.end() ); delete *i++ )
-            ;
-
         history.clear();
     }
 
+    string packedfile = Util::get_home_directory() + "historystats.packed";
+    if( Util::file_exists( packedfile.c_str() ) && std::remove( packedfile.c_str() ) )
+    {
+        return false;
+    }
+    else
+    {
+        packed_tail.clear();
+        packed_tail_pos = -1;
+    }
+
     string todayfile = Util::get_home_directory() + "todaystats";
     if( Util::file_exists( todayfile.c_str() ) && std::remove( todayfile.c_str() ) )
     {
@@ -193,12 +241,22 @@ Statistics::start_new_day()
       if (current_day != NULL)
         {
           TRACE_MSG("Save old day");
+          // Account the last minutes to the last active hour of the old day.
+          update_hourly_stats(current_day->stop.tm_hour);
+
           day_to_history(current_day);
           day_to_remote_history(current_day);
+#ifdef HAVE_DBUS
+          send_day_rolled(current_day);
+#endif
+          schedule_compaction();
+
+          delete current_day;
         }
 
       current_day = new DailyStatsImpl();
       been_active = false;
+      memset((void *)hourly_totals, 0, sizeof(hourly_totals));
 
       current_day->start = *tmnow;
       current_day->stop = *tmnow;
@@ -214,7 +272,13 @@ Statistics::start_new_day()
 void
 Statistics::day_to_history(DailyStatsImpl *stats)
 {
-  add_history(stats);
+  add_history(*stats);
+
+  if (packed_history)
+    {
+      save_packed_day(stats);
+      return;
+    }
 
   stringstream ss;
   ss << Util::get_home_directory();
@@ -234,6 +298,103 @@ Statistics::day_to_history(DailyStatsImpl *stats)
 }
 
 
+//! Appends a day to the packed history.
+/*!
+ *  Only the last block of the history is encoded again. Once it is
+ *  full, a new block is started at the end of the file.
+ */
+void
+Statistics::save_packed_day(DailyStatsImpl *stats)
+{
+  TRACE_ENTER("Statistics::save_packed_day");
+
+  string filename = Util::get_home_directory() + "historystats.packed";
+
+  string data;
+  if (packed_tail_pos < 0 || !StatsCodec::read_file(filename, data) || data.size() < (size_t)packed_tail_pos)
+    {
+      // Missing or unreadable file, rewrite it completely.
+      save_packed_history();
+      TRACE_EXIT();
+      return;
+    }
+
+  if (packed_tail.size() >= (size_t)StatsCodec::BLOCK_DAYS)
+    {
+      packed_tail_pos = (long)data.size();
+      packed_tail.clear();
+    }
+
+  packed_tail.push_back(*stats);
+
+  // The new last block can be shorter than the old one.
+  data.resize(packed_tail_pos);
+  StatsCodec::encode_block(data, packed_tail);
+
+  save_packed_file(filename, data);
+
+  TRACE_EXIT();
+}
+
+
+//! Writes the complete history in the packed format.
+void
+Statistics::save_packed_history()
+{
+  TRACE_ENTER("Statistics::save_packed_history");
+
+  string filename = Util::get_home_directory() + "historystats.packed";
+
+  string data;
+  StatsCodec::encode_header(data);
+
+  packed_tail.clear();
+  packed_tail_pos = (long)data.size();
+
+  for (HistoryIter i = history.begin(); i != history.end(); i++)
+    {
+      if (packed_tail.size() >= (size_t)StatsCodec::BLOCK_DAYS)
+        {
+          StatsCodec::encode_block(data, packed_tail);
+          packed_tail_pos = (long)data.size();
+          packed_tail.clear();
+        }
+      packed_tail.push_back(*i);
+    }
+
+  if (!packed_tail.empty())
+    {
+      StatsCodec::encode_block(data, packed_tail);
+    }
+
+  save_packed_file(filename, data);
+
+  TRACE_EXIT();
+}
+
+
+//! Replaces the packed history file.
+/*!
+ *  The data is written to a new file first, so that the old history
+ *  is kept if the write fails.
+ */
+void
+Statistics::save_packed_file(const string &filename, const string &data)
+{
+  string tmp_filename = filename + ".new";
+
+  ofstream stats_file(tmp_filename.c_str(), ios::out | ios::binary | ios::trunc);
+  stats_file.write(data.data(), data.size());
+  stats_file.close();
+
+  if (stats_file.good())
+    {
+      std::remove(filename.c_str());
+      std::rename(tmp_filename.c_str(), filename.c_str());
+    }
+}
+
+
 //! Adds the current day to this history.
 void
 Statistics::day_to_remote_history(DailyStatsImpl *stats)
@@ -293,7 +454,31 @@ Statistics::save_day(DailyStatsImpl *stats, ofstream &stats_file)
     }
   stats_file << endl;
 
-  stats_file.close();
+  if (stats->resolution != STATS_RESOLUTION_DAY)
+    {
+      stats_file << "R " << stats->resolution << endl;
+    }
+
+  for (int h = 0; stats->hourly_stats != NULL && h < STATS_HOURS; h++)
+    {
+      HourlyStats &hs = stats->hourly_stats[h];
+
+      bool empty = true;
+      for (int j = 0; j < STATS_HOURLY_SIZEOF; j++)
+        {
+          empty = empty && hs[j] == 0;
+        }
+
+      if (!empty)
+        {
+          stats_file << "H " << h << " " << STATS_HOURLY_SIZEOF << " ";
+          for (int j = 0; j < STATS_HOURLY_SIZEOF; j++)
+            {
+              stats_file << hs[j] << " ";
+            }
+          stats_file << endl;
+        }
+    }
 }
 
 
@@ -314,58 +499,93 @@ Statistics::save_day(DailyStatsImpl *stats)
 
 
 //! Add the stats the the history list.
+/*!
+ *  A day that is already in the history is replaced.
+ */
 void
-Statistics::add_history(DailyStatsImpl *stats)
+Statistics::add_history(const DailyStatsImpl &stats)
 {
-  if (history.size() == 0)
+  // New days are almost always appended.
+  if (history.empty() || DailyStatsImpl::date_less(history.back(), stats))
     {
       history.push_back(stats);
+      return;
+    }
+
+  HistoryIter i = std::lower_bound(history.begin(), history.end(), stats, DailyStatsImpl::date_less);
+  if (i != history.end() && i->get_date_key() == stats.get_date_key())
+    {
+      *i = stats;
     }
   else
     {
-      bool found = false;
-      HistoryRIter i = history.rbegin();
-      while (i != history.rend())
+      history.insert(i, stats);
+    }
+}
+
+
+//! Sorts the history after a bulk load.
+/*!
+ *  Days are appended unsorted while loading. If a day was loaded more
+ *  than once, the last copy wins, just like add_history() would do.
+ */
+void
+Statistics::sort_history()
+{
+  std::stable_sort(history.begin(), history.end(), DailyStatsImpl::date_less);
+
+  size_t out = 0;
+  for (size_t i = 0; i < history.size(); i++)
+    {
+      if (out > 0 && history[out - 1].get_date_key() == history[i].get_date_key())
         {
-          DailyStatsImpl *ref = *i;
+          out--;
+        }
+      if (out != i)
+        {
+          history[out] = history[i];
+        }
+      out++;
+    }
+  history.resize(out);
+}
 
-          if (stats->start.tm_year == ref->start.tm_year  &&
-              stats->start.tm_mon == ref->start.tm_mon &&
-              stats->start.tm_mday == ref->start.tm_mday)
-            {
-              delete *i;
-              *i = stats;
-              found = true;
-              break;
-            }
+//! Rewrites the complete history.
+void
+Statistics::save_history()
+{
+  TRACE_ENTER("Statistics::save_history");
 
-          else if ( stats->start.tm_year > ref->start.tm_year
-                    || (stats->start.tm_year == ref->start.tm_year
-                        && (stats->start.tm_mon > ref->start.tm_mon
-                            || (stats->start.tm_mon == ref->start.tm_mon
-                                && stats->start.tm_mday > ref->start.tm_mday))))
-          {
-            if (i == history.rbegin())
-              {
-                history.push_back(stats);
-              }
-            else
-              {
-                history.insert(i.base(), stats);
-              }
-            found = true;
-            break;
-          }
-          i++;
+  if (packed_history)
+    {
+      save_packed_history();
+    }
+  else
+    {
+      string filename = Util::get_home_directory() + "historystats";
+      string tmp_filename = filename + ".new";
+
+      ofstream stats_file(tmp_filename.c_str());
+      stats_file << WORKRAVESTATS << " " << STATSVERSION  << endl;
+
+      for (HistoryIter i = history.begin(); i != history.end(); i++)
+        {
+          save_day(&*i, stats_file);
         }
 
-      if (!found)
+      stats_file.close();
+
+      if (stats_file.good())
         {
-          history.insert(history.begin(), stats);
+          std::remove(filename.c_str());
+          std::rename(tmp_filename.c_str(), filename.c_str());
         }
     }
+
+  TRACE_EXIT();
 }
 
+
 //! Load the statistics of the current day.
 bool
 Statistics::load_current_day()
@@ -375,9 +595,7 @@ Statistics::load_current_day()
   ss << Util::get_home_directory();
   ss << "todaystats" << ends;
 
-  ifstream stats_file(ss.str().c_str());
-
-  load(stats_file, false);
+  load(ss.str(), false);
 
   been_active = true;
 
@@ -392,151 +610,116 @@ Statistics::load_history()
 {
   TRACE_ENTER("Statistics::load_history");
 
-  stringstream ss;
-  ss << Util::get_home_directory();
-  ss << "historystats" << ends;
+  load_packed_history();
+
+  string filename = Util::get_home_directory() + "historystats";
+  bool exists = Util::file_exists(filename);
 
-  ifstream stats_file(ss.str().c_str());
+  load(filename, true);
+  sort_history();
 
-  load(stats_file, true);
+  if (packed_history && exists)
+    {
+      // Migrate the text history to the packed format.
+      save_packed_history();
+      std::rename(filename.c_str(), (filename + ".old").c_str());
+    }
   TRACE_EXIT();
 }
 
 
-//! Loads the statistics.
+//! Loads the packed history.
 void
-Statistics::load(ifstream &infile, bool history)
+Statistics::load_packed_history()
 {
-  TRACE_ENTER("Statistics::load");
-
-  DailyStatsImpl *stats = NULL;
+  TRACE_ENTER("Statistics::load_packed_history");
 
-  bool ok = infile.good();
+  string data;
+  string filename = Util::get_home_directory() + "historystats.packed";
 
-  if (ok)
+  size_t pos = 0;
+  if (!StatsCodec::read_file(filename, data) ||
+      !StatsCodec::decode_header(data.data(), data.size(), pos))
     {
-      string tag;
-      infile >> tag;
-
-      ok = (tag == WORKRAVESTATS);
+      TRACE_EXIT();
+      return;
     }
 
-  if (ok)
+  packed_tail_pos = (long)pos;
+
+  bool done = false;
+  while (!done)
     {
-      int version;
-      infile >> version;
+      vector<DailyStats> days;
+      size_t block_pos = pos;
 
-      ok = (version == STATSVERSION) || (version == 3);
+      switch (StatsCodec::decode_block(data.data(), data.size(), pos, days))
+        {
+        case StatsCodec::DECODE_OK:
+          for (vector<DailyStats>::iterator i = days.begin(); i != days.end(); i++)
+            {
+              history.push_back(DailyStatsImpl());
+              static_cast<DailyStats &>(history.back()) = *i;
+            }
+          packed_tail = days;
+          packed_tail_pos = (long)block_pos;
+          break;
+
+        case StatsCodec::DECODE_CORRUPT:
+          TRACE_MSG("Skipping damaged block at " << block_pos);
+          packed_tail.clear();
+          packed_tail_pos = (long)pos;
+          break;
+
+        case StatsCodec::DECODE_END:
+          if (pos != block_pos || packed_tail.empty())
+            {
+              packed_tail.clear();
+              packed_tail_pos = (long)block_pos;
+            }
+          done = true;
+          break;
+        }
     }
 
+  TRACE_EXIT();
+}
 
-  while (ok && !infile.eof())
-    {
-      char line[BUFSIZ] = "";
-      char cmd;
 
-      infile.getline(line, BUFSIZ);
+//! Loads the statistics.
+void
+Statistics::load(const string &filename, bool history)
+{
+  TRACE_ENTER("Statistics::load");
 
-      if (strlen(line) > 1)
-        {
-          cmd = line[0];
+  StatsReader reader;
+  DailyStats day;
 
-          stringstream ss(line+1);
+  bool ok = reader.open(filename);
 
-          if (cmd == 'D')
-            {
-              if (history && stats != NULL)
-                {
-                  add_history(stats);
-                  stats = NULL;
-                }
-              else if (!history && stats != NULL)
-                {
-                  /* Corrupt today stats */
-                  return;
-                }
-
-              stats = new DailyStatsImpl();
-
-              ss >> stats->start.tm_mday
-                 >> stats->start.tm_mon
-                 >> stats->start.tm_year
-                 >> stats->start.tm_hour
-                 >> stats->start.tm_min
-                 >> stats->stop.tm_mday
-                 >> stats->stop.tm_mon
-                 >> stats->stop.tm_year
-                 >> stats->stop.tm_hour
-                 >> stats->stop.tm_min;
-
-              if (!history)
-                {
-                  current_day = stats;
-                }
-            }
-          else if (stats != NULL)
+  while (ok && reader.next(day))
+    {
+      if (history)
+        {
+          // Sorted by load_history() once all files are read.
+          this->history.push_back(DailyStatsImpl());
+          static_cast<DailyStats &>(this->history.back()) = day;
+        }
+      else
+        {
+          // Only a single day is expected. If the file contains more,
+          // the last one was written most recently.
+          if (current_day == NULL)
             {
-              if (cmd == 'B')
-                {
-                  int bt, size;
-                  ss >> bt;
-                  ss >> size;
-
-                  BreakStats &bs = stats->break_stats[bt];
-
-                  if (size > STATS_BREAKVALUE_SIZEOF)
-                    {
-                      size = STATS_BREAKVALUE_SIZEOF;
-                    }
-
-                  for(int j = 0; j < size; j++)
-                    {
-                      int value;
-                      ss >> value;
-
-                      bs[j] = value;
-                    }
-                }
-              else if (cmd == 'M' || cmd == 'm')
-                {
-                  int size;
-                  ss >> size;
-
-                  if (size > STATS_VALUE_SIZEOF)
-                    {
-                      size = STATS_VALUE_SIZEOF;
-                    }
-
-                  for(int j = 0; j < size; j++)
-                    {
-                      int value;
-                      ss >> value;
-
-                      if (cmd == 'm')
-                        {
-                          // Ignore older 'M' stats. they are broken....
-                          stats->misc_stats[j] = value;
-                        }
-                      else
-                        {
-                          stats->misc_stats[j] = 0;
-                        }
-                    }
-                }
-              else if (cmd == 'G')
-                {
-                  int total_active;
-                  ss >> total_active;
-
-                  stats->misc_stats[STATS_VALUE_TOTAL_ACTIVE_TIME] = total_active;
-                }
+              current_day = new DailyStatsImpl();
             }
+          *static_cast<DailyStats *>(current_day) = day;
         }
     }
 
-  if (history && stats != NULL)
+  if (reader.get_damaged_count() > 0)
     {
-      add_history(stats);
+      TRACE_MSG("Skipped " << reader.get_damaged_count() << " damaged records in " << filename);
     }
 
   TRACE_EXIT();
@@ -659,7 +842,7 @@ Statistics::get_day(int day) const
 
       if (day < int(history.size()) && day >= 0)
         {
-          ret = history[day];
+          ret = const_cast<DailyStatsImpl *>(&history[day]);
         }
     }
 
@@ -675,8 +858,8 @@ Statistics::get_day_index_by_date(int y, int m, int d,
   for (int i = 0; i <= int(history.size()); i++)
     {
       int j = history.size() - i;
-      DailyStatsImpl *stats = j == 0 ? current_day : history[i];
-      if (idx < 0 && stats->starts_at_date(y, m, d))
+      const DailyStatsImpl *stats = j == 0 ? current_day : &history[i];
+      if (idx < 0 && stats->contains_date(y, m, d))
         {
           idx = j;
         }
@@ -710,6 +893,179 @@ Statistics::get_history_size() const
 }
 
 
+//! Returns the names of the values of a packed day.
+void
+Statistics::get_stats_field_names(FieldNames &names)
+{
+  names = StatsReader::get_field_names();
+}
+
+
+//! Returns the period that contains a date (YYYYMMDD) as a packed row.
+bool
+Statistics::get_day_stats(gint32 date, PackedStats &values)
+{
+  int idx, next, prev;
+  get_day_index_by_date(date / 10000, (date / 100) % 100, date % 100, idx, next, prev);
+
+  DailyStatsImpl *stats = idx >= 0 ? get_day(idx) : NULL;
+  if (stats == NULL)
+    {
+      values.clear();
+      return false;
+    }
+
+  StatsReader::get_fields(*stats, values);
+  return true;
+}
+
+
+//! Returns the periods that start within a date range as packed rows.
+/*!
+ *  The rows are concatenated; each row has the fields of
+ *  get_stats_field_names(). At most max_days rows are returned. If
+ *  more rows are available, next is set to the date at which the next
+ *  request should start, otherwise it is set to 0.
+ */
+void
+Statistics::get_range_stats(gint32 from, gint32 to, gint32 max_days, PackedStats &values, gint32 &next)
+{
+  // Upper bound on the size of a single reply.
+  static const int MAX_PAGE_DAYS = 366;
+
+  if (max_days <= 0 || max_days > MAX_PAGE_DAYS)
+    {
+      max_days = MAX_PAGE_DAYS;
+    }
+
+  size_t begin, end;
+  bool today;
+  find_range(from, to, begin, end, today);
+
+  size_t count = end - begin + (today ? 1 : 0);
+  size_t page = MIN(count, (size_t)max_days);
+
+  next = 0;
+  if (page < count)
+    {
+      const DailyStatsImpl *first = (begin + page < end) ? &history[begin + page] : current_day;
+      next = StatsReader::get_date(*first);
+    }
+
+  vector<gint64> row;
+  values.clear();
+  for (size_t i = 0; i < page; i++)
+    {
+      const DailyStatsImpl *stats = (begin + i < end) ? &history[begin + i] : current_day;
+
+      StatsReader::get_fields(*stats, row);
+      if (values.empty())
+        {
+          values.reserve(page * row.size());
+        }
+      values.insert(values.end(), row.begin(), row.end());
+    }
+}
+
+
+//! Returns the sum of all periods that start within a date range as a packed row.
+gint32
+Statistics::get_aggregate_stats(gint32 from, gint32 to, PackedStats &values)
+{
+  size_t begin, end;
+  bool today;
+  find_range(from, to, begin, end, today);
+
+  DailyStatsImpl total;
+  gint32 count = 0;
+
+  for (size_t i = begin; i < end || (i == end && today); i++)
+    {
+      const DailyStatsImpl *stats = (i < end) ? &history[i] : current_day;
+
+      if (count == 0)
+        {
+          total.start = stats->start;
+        }
+      if (stats->resolution > total.resolution)
+        {
+          total.resolution = stats->resolution;
+        }
+      merge_stats(&total, stats);
+      count++;
+    }
+
+  values.clear();
+  if (count > 0)
+    {
+      StatsReader::get_fields(total, values);
+    }
+
+  return count;
+}
+
+
+//! Finds the periods that start within a date range.
+/*!
+ *  The history entries [begin, end) start within the range; today is
+ *  set if the current day does too.
+ */
+void
+Statistics::find_range(gint32 from, gint32 to, size_t &begin, size_t &end, bool &today) const
+{
+  DailyStatsImpl key;
+
+  key.start.tm_year = from / 10000 - 1900;
+  key.start.tm_mon = (from / 100) % 100 - 1;
+  key.start.tm_mday = from % 100;
+  begin = std::lower_bound(history.begin(), history.end(), key, DailyStatsImpl::date_less) - history.begin();
+
+  int to_key = date_to_key(to);
+
+  end = begin;
+  while (end < history.size() && history[end].get_date_key() <= to_key)
+    {
+      end++;
+    }
+
+  today = (current_day != NULL &&
+           current_day->get_date_key() >= date_to_key(from) &&
+           current_day->get_date_key() <= to_key);
+}
+
+
+//! Converts a date (YYYYMMDD) into the key of DailyStatsImpl::get_date_key().
+int
+Statistics::date_to_key(gint32 date)
+{
+  return ((date / 10000 - 1900) * 16 + (date / 100) % 100 - 1) * 32 + date % 100;
+}
+
+
+#ifdef HAVE_DBUS
+//! Notifies D-Bus clients that a day was moved into the history.
+void
+Statistics::send_day_rolled(const DailyStatsImpl *stats)
+{
+  DBus *dbus = core->get_dbus();
+  org_workrave_StatisticsInterface *iface = NULL;
+
+  if (dbus != NULL)
+    {
+      iface = org_workrave_StatisticsInterface::instance(dbus);
+    }
+
+  if (iface != NULL)
+    {
+      PackedStats values;
+      StatsReader::get_fields(*stats, values);
+
+      iface->DayRolled("/org/workrave/Workrave/Core", StatsReader::get_date(*stats), values);
+    }
+}
+#endif
+
+
 
 void
 Statistics::update_current_day(bool active)
@@ -744,6 +1100,285 @@ Statistics::update_current_day(bool active)
 }
 
 
+//! Adds the activity since the previous heartbeat to an hour of the current day.
+void
+Statistics::update_hourly_stats(int hour)
+{
+  if (current_day == NULL || hour < 0 || hour >= STATS_HOURS)
+    {
+      return;
+    }
+
+  int64_t totals[STATS_HOURLY_SIZEOF];
+
+  lock.lock();
+  get_hourly_totals(current_day, totals);
+  lock.unlock();
+
+  for (int j = 0; j < STATS_HOURLY_SIZEOF; j++)
+    {
+      int64_t delta = totals[j] - hourly_totals[j];
+
+      // Counters can be reset, e.g. the daily limit timer.
+      if (delta > 0)
+        {
+          current_day->get_hourly_stats(hour)[j] += (int)delta;
+        }
+      hourly_totals[j] = totals[j];
+    }
+}
+
+
+//! Returns the day totals of the counters that are kept per hour.
+void
+Statistics::get_hourly_totals(const DailyStatsImpl *stats, int64_t *totals)
+{
+  totals[STATS_HOURLY_ACTIVE_TIME] = stats->misc_stats[STATS_VALUE_TOTAL_ACTIVE_TIME];
+  totals[STATS_HOURLY_MOUSE_MOVEMENT] = stats->misc_stats[STATS_VALUE_TOTAL_MOUSE_MOVEMENT];
+  totals[STATS_HOURLY_CLICKS] = stats->misc_stats[STATS_VALUE_TOTAL_CLICKS];
+  totals[STATS_HOURLY_KEYSTROKES] = stats->misc_stats[STATS_VALUE_TOTAL_KEYSTROKES];
+  totals[STATS_HOURLY_BREAKS_PROMPTED] = 0;
+  totals[STATS_HOURLY_BREAKS_TAKEN] = 0;
+  totals[STATS_HOURLY_BREAKS_SKIPPED] = 0;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      totals[STATS_HOURLY_BREAKS_PROMPTED] += stats->break_stats[i][STATS_BREAKVALUE_PROMPTED];
+      totals[STATS_HOURLY_BREAKS_TAKEN] += stats->break_stats[i][STATS_BREAKVALUE_TAKEN];
+      totals[STATS_HOURLY_BREAKS_SKIPPED] += stats->break_stats[i][STATS_BREAKVALUE_SKIPPED];
+    }
+}
+
+
+//! Returns the number of days since 1970-01-01 of the specified date.
+static int
+day_number(int y, int m, int d)
+{
+  // Months are allowed to be out of range.
+  y += (m - 1) / 12;
+  m = (m - 1) % 12 + 1;
+  if (m <= 0)
+    {
+      m += 12;
+      y--;
+    }
+
+  y -= m <= 2;
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+
+//! Returns the first day of the week (Monday) that contains the specified day.
+static int
+week_start(int day)
+{
+  return day - ((day % 7 + 10) % 7);
+}
+
+
+//! Returns the last day of the month that contains the specified date.
+static int
+month_end(int y, int m)
+{
+  return day_number(y, m + 1, 1) - 1;
+}
+
+
+//! Schedules a compaction of the history in the background.
+void
+Statistics::schedule_compaction()
+{
+  if (compaction_source == 0)
+    {
+      compaction_pos = 0;
+      compaction_source = g_idle_add(on_compact_history, this);
+    }
+}
+
+
+gboolean
+Statistics::on_compact_history(gpointer data)
+{
+  Statistics *self = (Statistics *) data;
+
+  // Limit the amount of work per main loop iteration.
+  for (int i = 0; i < 16; i++)
+    {
+      if (!self->compact_history_step())
+        {
+          if (self->compaction_changed)
+            {
+              self->save_history();
+              self->compaction_changed = false;
+            }
+          self->compaction_source = 0;
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+
+//! Rolls up one week or month of old statistics.
+/*!
+ *  Days older than the daily retention are merged into weeks, and
+ *  weeks older than the weekly retention are merged into months.
+ *
+ *  \return false if there is nothing left to compact.
+ */
+bool
+Statistics::compact_history_step()
+{
+  TRACE_ENTER("Statistics::compact_history_step");
+
+  IConfigurator *config = core->get_configurator();
+
+  int daily_retention, weekly_retention;
+  config->get_value_with_default(CoreConfig::CFG_KEY_STATISTICS_DAILY_RETENTION, daily_retention, 0);
+  config->get_value_with_default(CoreConfig::CFG_KEY_STATISTICS_WEEKLY_RETENTION, weekly_retention, 0);
+
+  if (daily_retention <= 0 && weekly_retention <= 0)
+    {
+      TRACE_RETURN(false);
+      return false;
+    }
+
+  const time_t now = core->get_time();
+  struct tm *tmnow = localtime(&now);
+  int y = tmnow->tm_year + 1900;
+  int m = tmnow->tm_mon + 1;
+  int d = tmnow->tm_mday;
+
+  int day_cutoff = daily_retention > 0 ? day_number(y, m - daily_retention, d) : INT_MIN;
+  int week_cutoff = weekly_retention > 0 ? day_number(y - weekly_retention, m, d) : INT_MIN;
+
+  for (; compaction_pos < history.size(); compaction_pos++)
+    {
+      const DailyStatsImpl *stats = &history[compaction_pos];
+
+      int sy = stats->start.tm_year + 1900;
+      int sm = stats->start.tm_mon + 1;
+      int day = day_number(sy, sm, stats->start.tm_mday);
+
+      StatsResolution target = STATS_RESOLUTION_DAY;
+      int first = 0, last = 0;
+
+      if (stats->resolution != STATS_RESOLUTION_MONTH && month_end(sy, sm) < week_cutoff)
+        {
+          target = STATS_RESOLUTION_MONTH;
+          first = day_number(sy, sm, 1);
+          last = month_end(sy, sm);
+        }
+      else if (stats->resolution == STATS_RESOLUTION_DAY)
+        {
+          // A week that spans two months is split at the month boundary,
+          // so that each part is later rolled up into its own month.
+          first = std::max(week_start(day), day_number(sy, sm, 1));
+          last = std::min(week_start(day) + 6, month_end(sy, sm));
+
+          if (last < day_cutoff)
+            {
+              target = STATS_RESOLUTION_WEEK;
+            }
+        }
+
+      if (target == STATS_RESOLUTION_DAY)
+        {
+          continue;
+        }
+
+      // The history is sorted, so the period is a contiguous range.
+      size_t begin = compaction_pos;
+      while (begin > 0)
+        {
+          const DailyStatsImpl *prev = &history[begin - 1];
+          int prev_day = day_number(prev->start.tm_year + 1900, prev->start.tm_mon + 1, prev->start.tm_mday);
+          if (prev_day < first || prev->resolution > target)
+            {
+              break;
+            }
+          begin--;
+        }
+
+      size_t end = compaction_pos + 1;
+      while (end < history.size())
+        {
+          const DailyStatsImpl *next = &history[end];
+          int next_day = day_number(next->start.tm_year + 1900, next->start.tm_mon + 1, next->start.tm_mday);
+          if (next_day > last || next->resolution > target)
+            {
+              break;
+            }
+          end++;
+        }
+
+      DailyStatsImpl *rollup = &history[begin];
+      for (size_t i = begin + 1; i < end; i++)
+        {
+          merge_stats(rollup, &history[i]);
+        }
+      history.erase(history.begin() + begin + 1, history.begin() + end);
+      rollup->resolution = target;
+
+      compaction_pos = begin + 1;
+      compaction_changed = true;
+
+      TRACE_RETURN(true);
+      return true;
+    }
+
+  TRACE_RETURN(false);
+  return false;
+}
+
+
+//! Adds the statistics of another period.
+void
+Statistics::merge_stats(DailyStatsImpl *stats, const DailyStatsImpl *other)
+{
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          stats->break_stats[i][j] += other->break_stats[i][j];
+        }
+    }
+
+  for (int j = 0; j < STATS_VALUE_SIZEOF; j++)
+    {
+      stats->misc_stats[j] += other->misc_stats[j];
+    }
+
+  for (int h = 0; other->hourly_stats != NULL && h < STATS_HOURS; h++)
+    {
+      for (int j = 0; j < STATS_HOURLY_SIZEOF; j++)
+        {
+          stats->get_hourly_stats(h)[j] += other->hourly_stats[h][j];
+        }
+    }
+
+  // The history is sorted, so only the end of the period can change.
+  stats->stop = other->stop;
+}
+
+
+//! Notification that the configuration has changed.
+void
+Statistics::config_changed_notify(const string &key)
+{
+  if (key == CoreConfig::CFG_KEY_STATISTICS_DAILY_RETENTION ||
+      key == CoreConfig::CFG_KEY_STATISTICS_WEEKLY_RETENTION)
+    {
+      schedule_compaction();
+    }
+}
+
+
 #ifdef HAVE_DISTRIBUTION
 // Create the monitor based on the specified configuration.
 void
@@ -936,6 +1571,7 @@ Statistics::client_message(DistributionClientMessageID id, bool master, const ch
             {
               TRACE_MSG("Save to history");
               day_to_history(stats);
+              delete stats;
               stats_to_history = false;
             }
           break;
@@ -955,6 +1591,7 @@ Statistics::client_message(DistributionClientMessageID id, bool master, const ch
       // this should not happend. but just to avoid a potential memory leak...
       TRACE_MSG("Save to history");
       day_to_history(stats);
+      delete stats;
       stats_to_history = false;
     }
 
@@ -967,7 +1604,7 @@ Statistics::client_message(DistributionClientMessageID id, bool master, const ch
 #endif
 
 bool
-Statistics::DailyStatsImpl::starts_at_date(int y, int m, int d)
+Statistics::DailyStatsImpl::starts_at_date(int y, int m, int d) const
 {
   return (start.tm_year + 1900 == y
           && start.tm_mon + 1 == m
@@ -975,7 +1612,31 @@ Statistics::DailyStatsImpl::starts_at_date(int y, int m, int d)
 }
 
 bool
-Statistics::DailyStatsImpl::starts_before_date(int y, int m, int d)
+Statistics::DailyStatsImpl::contains_date(int y, int m, int d) const
+{
+  int sy = start.tm_year + 1900;
+  int sm = start.tm_mon + 1;
+
+  switch (resolution)
+    {
+    case STATS_RESOLUTION_WEEK:
+      {
+        // Weeks are split at month boundaries.
+        int first = week_start(day_number(sy, sm, start.tm_mday));
+        int day = day_number(y, m, d);
+        return sy == y && sm == m && day >= first && day < first + 7;
+      }
+
+    case STATS_RESOLUTION_MONTH:
+      return sy == y && sm == m;
+
+    default:
+      return starts_at_date(y, m, d);
+    }
+}
+
+bool
+Statistics::DailyStatsImpl::starts_before_date(int y, int m, int d) const
 {
   return (start.tm_year + 1900 < y
           || (start.tm_year + 1900 == y
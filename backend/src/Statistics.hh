@@ -28,6 +28,7 @@
 
 #include "IStatistics.hh"
 #include "IInputMonitorListener.hh"
+#include "IConfiguratorListener.hh"
 #include "Mutex.hh"
 
 // Forward declarion of external interface.
@@ -50,7 +51,8 @@ using namespace std;
 
 class Statistics :
   public IStatistics,
-  public IInputMonitorListener
+  public IInputMonitorListener,
+  public IConfiguratorListener
 #ifdef HAVE_DISTRIBUTION
   ,
   public IDistributionClientMessage
@@ -95,21 +97,35 @@ private:
       // Empty marker.
       start.tm_year = 0;
 
+      resolution = STATS_RESOLUTION_DAY;
+
       total_mouse_time.tv_sec = 0;
       total_mouse_time.tv_usec = 0;
     }
 
-    bool starts_at_date(int y, int m, int d);
-    bool starts_before_date(int y, int m, int d);
+    bool starts_at_date(int y, int m, int d) const;
+    bool starts_before_date(int y, int m, int d) const;
+    bool contains_date(int y, int m, int d) const;
     bool is_empty() const
     {
       return start.tm_year == 0;
     }
+
+    //! Returns a number that sorts in the same order as the start date.
+    int get_date_key() const
+    {
+      return (start.tm_year * 16 + start.tm_mon) * 32 + start.tm_mday;
+    }
+
+    static bool date_less(const DailyStatsImpl &a, const DailyStatsImpl &b)
+    {
+      return a.get_date_key() < b.get_date_key();
+    }
   };
 
-  typedef std::vector<DailyStatsImpl *> History;
-  typedef std::vector<DailyStatsImpl *>::iterator HistoryIter;
-  typedef std::vector<DailyStatsImpl *>::reverse_iterator HistoryRIter;
+  //! The history is stored by value, sorted by start date.
+  typedef std::vector<DailyStatsImpl> History;
+  typedef std::vector<DailyStatsImpl>::iterator HistoryIter;
 
 public:
   //! Constructor.
@@ -138,25 +154,55 @@ public:
   void set_counter(StatsValueType t, int value);
   int64_t get_counter(StatsValueType t);
 
+  typedef std::vector<gint64> PackedStats;
+  typedef std::vector<std::string> FieldNames;
+
+  void get_stats_field_names(FieldNames &names);
+  bool get_day_stats(gint32 date, PackedStats &values);
+  void get_range_stats(gint32 from, gint32 to, gint32 max_days, PackedStats &values, gint32 &next);
+  gint32 get_aggregate_stats(gint32 from, gint32 to, PackedStats &values);
+
 private:
   void action_notify();
   void mouse_notify(int x, int y, int wheel = 0);
   void button_notify(bool is_press);
   void keyboard_notify(bool repeat);
 
+  void config_changed_notify(const std::string &key);
+
   bool load_current_day();
   void update_current_day(bool active);
+  void update_hourly_stats(int hour);
+  static void get_hourly_totals(const DailyStatsImpl *stats, int64_t *totals);
   void load_history();
 
 private:
   void save_day(DailyStatsImpl *stats);
   void save_day(DailyStatsImpl *stats, std::ofstream &stats_file);
-  void load(std::ifstream &infile, bool history);
+  void load(const std::string &filename, bool history);
 
   void day_to_history(DailyStatsImpl *stats);
   void day_to_remote_history(DailyStatsImpl *stats);
 
-  void add_history(DailyStatsImpl *stats);
+  void load_packed_history();
+  void save_packed_day(DailyStatsImpl *stats);
+  void save_packed_history();
+  void save_packed_file(const std::string &filename, const std::string &data);
+
+  void add_history(const DailyStatsImpl &stats);
+  void sort_history();
+  void save_history();
+
+  void find_range(gint32 from, gint32 to, size_t &begin, size_t &end, bool &today) const;
+  static int date_to_key(gint32 date);
+#ifdef HAVE_DBUS
+  void send_day_rolled(const DailyStatsImpl *stats);
+#endif
+
+  void schedule_compaction();
+  bool compact_history_step();
+  void merge_stats(DailyStatsImpl *stats, const DailyStatsImpl *other);
+  static gboolean on_compact_history(gpointer data);
 
 #ifdef HAVE_DISTRIBUTION
   void init_distribution_manager();
@@ -182,9 +228,30 @@ private:
   //! Has the user been active on the current day?
   bool been_active;
 
+  //! Counters of the current day at the previous heartbeat.
+  int64_t hourly_totals[STATS_HOURLY_SIZEOF];
+
   //! History
   History history;
 
+  //! Store the history in the packed format.
+  bool packed_history;
+
+  //! File offset of the last block of the packed history.
+  long packed_tail_pos;
+
+  //! Days in the last block of the packed history.
+  std::vector<DailyStats> packed_tail;
+
+  //! Idle source of the history compaction, or 0.
+  guint compaction_source;
+
+  //! History index at which the compaction continues.
+  size_t compaction_pos;
+
+  //! Has the compaction modified the history?
+  bool compaction_changed;
+
   //! Internal locking
   Mutex lock;
 
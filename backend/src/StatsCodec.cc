@@ -0,0 +1,500 @@
+// StatsCodec.cc --- Compact encoding of the statistics history
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fstream>
+#include <string.h>
+
+#include "debug.hh"
+
+#include "StatsCodec.hh"
+
+using namespace std;
+
+static const char STATS_PACKED_MAGIC[] = "WRSZ";
+static const guint8 STATS_PACKED_VERSION = 1;
+static const guint8 STATS_PACKED_BLOCK_V1 = 0xB1;
+static const guint8 STATS_PACKED_BLOCK_V2 = 0xB2;
+static const guint8 STATS_PACKED_BLOCK = 0xB3;
+
+// Sanity limits, used to reject damaged block headers.
+static const guint64 MAX_BLOCK_DIMENSION = 64;
+
+
+//! Writes the file header.
+void
+StatsCodec::encode_header(string &out)
+{
+  out.append(STATS_PACKED_MAGIC, 4);
+  out.push_back((char)STATS_PACKED_VERSION);
+}
+
+
+//! Checks the file header.
+bool
+StatsCodec::decode_header(const char *data, size_t size, size_t &pos)
+{
+  if (size - pos < 5 || memcmp(data + pos, STATS_PACKED_MAGIC, 4) != 0)
+    {
+      return false;
+    }
+
+  if ((guint8)data[pos + 4] != STATS_PACKED_VERSION)
+    {
+      return false;
+    }
+
+  pos += 5;
+  return true;
+}
+
+
+//! Encodes a block of days.
+void
+StatsCodec::encode_block(string &out, const vector<DailyStats> &days)
+{
+  const int num_fields = INFO_FIELDS
+    + BREAK_ID_SIZEOF * IStatistics::STATS_BREAKVALUE_SIZEOF
+    + IStatistics::STATS_VALUE_SIZEOF
+    + IStatistics::STATS_HOURS * IStatistics::STATS_HOURLY_SIZEOF;
+
+  gint64 prev[num_fields];
+  gint64 cur[num_fields];
+  memset(prev, 0, sizeof(prev));
+
+  string payload;
+  payload.reserve(days.size() * num_fields);
+
+  // Runs of unchanged fields, mostly idle hours, are stored as a zero
+  // followed by the number of additional unchanged fields.
+  guint64 zeros = 0;
+
+  for (vector<DailyStats>::const_iterator i = days.begin(); i != days.end(); i++)
+    {
+      flatten(*i, cur);
+      for (int f = 0; f < num_fields; f++)
+        {
+          gint64 delta = cur[f] - prev[f];
+          prev[f] = cur[f];
+
+          if (delta == 0)
+            {
+              zeros++;
+              continue;
+            }
+
+          if (zeros > 0)
+            {
+              encode_varint(payload, 0);
+              encode_varint(payload, zeros - 1);
+              zeros = 0;
+            }
+          encode_varint(payload, zigzag_encode(delta));
+        }
+    }
+
+  if (zeros > 0)
+    {
+      encode_varint(payload, 0);
+      encode_varint(payload, zeros - 1);
+    }
+
+  out.push_back((char)STATS_PACKED_BLOCK);
+  encode_varint(out, INFO_FIELDS);
+  encode_varint(out, days.size());
+  encode_varint(out, BREAK_ID_SIZEOF);
+  encode_varint(out, IStatistics::STATS_BREAKVALUE_SIZEOF);
+  encode_varint(out, IStatistics::STATS_VALUE_SIZEOF);
+  encode_varint(out, IStatistics::STATS_HOURS);
+  encode_varint(out, IStatistics::STATS_HOURLY_SIZEOF);
+  encode_varint(out, payload.size());
+  out.append(payload);
+  encode_uint32(out, crc32(payload.data(), payload.size()));
+}
+
+
+//! Decodes the block at the specified position.
+StatsCodec::DecodeResult
+StatsCodec::decode_block(const char *data, size_t size, size_t &pos, vector<DailyStats> &days)
+{
+  TRACE_ENTER("StatsCodec::decode_block");
+
+  guint64 num_info = TIME_FIELDS, count = 0, num_breaks = 0, num_break_values = 0, num_misc = 0;
+  guint64 num_hours = 0, num_hourly = 0;
+  guint64 payload_size = 0;
+
+  guint8 tag = pos < size ? (guint8)data[pos] : 0;
+  if (tag != STATS_PACKED_BLOCK && tag != STATS_PACKED_BLOCK_V2 && tag != STATS_PACKED_BLOCK_V1)
+    {
+      TRACE_RETURN("End");
+      return DECODE_END;
+    }
+  pos++;
+
+  bool ok = ((tag == STATS_PACKED_BLOCK_V1 || decode_varint(data, size, pos, num_info)) &&
+             decode_varint(data, size, pos, count) &&
+             decode_varint(data, size, pos, num_breaks) &&
+             decode_varint(data, size, pos, num_break_values) &&
+             decode_varint(data, size, pos, num_misc) &&
+             (tag != STATS_PACKED_BLOCK || decode_varint(data, size, pos, num_hours)) &&
+             (tag != STATS_PACKED_BLOCK || decode_varint(data, size, pos, num_hourly)) &&
+             decode_varint(data, size, pos, payload_size));
+
+  if (!ok ||
+      num_info < (guint64)TIME_FIELDS ||
+      num_info > MAX_BLOCK_DIMENSION ||
+      count > (guint64)BLOCK_DAYS ||
+      num_breaks > MAX_BLOCK_DIMENSION ||
+      num_break_values > MAX_BLOCK_DIMENSION ||
+      num_misc > MAX_BLOCK_DIMENSION ||
+      num_hours > MAX_BLOCK_DIMENSION ||
+      num_hourly > MAX_BLOCK_DIMENSION ||
+      payload_size > (guint64)MAX_BLOCK_PAYLOAD ||
+      payload_size + 4 > size - pos)
+    {
+      // The block length itself cannot be trusted, so nothing after
+      // this point can be found.
+      TRACE_RETURN("Damaged block header");
+      return DECODE_END;
+    }
+
+  const char *payload = data + pos;
+  size_t end = pos + payload_size;
+
+  size_t crc_pos = end;
+  guint32 crc = 0;
+  decode_uint32(data, size, crc_pos, crc);
+
+  if (crc != crc32(payload, payload_size))
+    {
+      pos = crc_pos;
+      TRACE_RETURN("Checksum mismatch");
+      return DECODE_CORRUPT;
+    }
+
+  const int num_fields = int(num_info + num_breaks * num_break_values + num_misc + num_hours * num_hourly);
+  vector<gint64> fields(num_fields, 0);
+
+  size_t p = 0;
+  size_t first = days.size();
+  bool zero_runs = (tag == STATS_PACKED_BLOCK);
+  guint64 zeros = 0;
+
+  for (guint64 d = 0; ok && d < count; d++)
+    {
+      for (int f = 0; ok && f < num_fields; f++)
+        {
+          if (zeros > 0)
+            {
+              zeros--;
+              continue;
+            }
+
+          guint64 value;
+          ok = decode_varint(payload, payload_size, p, value);
+
+          if (ok && zero_runs && value == 0)
+            {
+              ok = decode_varint(payload, payload_size, p, zeros);
+            }
+          fields[f] += zigzag_decode(value);
+        }
+
+      if (ok)
+        {
+          days.push_back(DailyStats());
+          unflatten(&fields[0], int(num_info), int(num_breaks), int(num_break_values), int(num_misc),
+                    int(num_hours), int(num_hourly), days.back());
+        }
+    }
+
+  pos = crc_pos;
+
+  if (!ok)
+    {
+      days.resize(first);
+      TRACE_RETURN("Truncated payload");
+      return DECODE_CORRUPT;
+    }
+
+  TRACE_RETURN(count);
+  return DECODE_OK;
+}
+
+
+//! Reads a complete file into memory.
+bool
+StatsCodec::read_file(const string &filename, string &data)
+{
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+
+  if (!file.good())
+    {
+      return false;
+    }
+
+  file.seekg(0, ios::end);
+  streamoff size = file.tellg();
+  file.seekg(0, ios::beg);
+
+  if (size <= 0)
+    {
+      data.clear();
+      return size == 0;
+    }
+
+  data.resize((size_t)size);
+  file.read(&data[0], size);
+
+  return !file.fail();
+}
+
+
+void
+StatsCodec::encode_varint(string &out, guint64 value)
+{
+  while (value >= 0x80)
+    {
+      out.push_back((char)((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+  out.push_back((char)value);
+}
+
+
+bool
+StatsCodec::decode_varint(const char *data, size_t size, size_t &pos, guint64 &value)
+{
+  value = 0;
+
+  for (int shift = 0; shift < 64 && pos < size; shift += 7)
+    {
+      guint8 b = (guint8)data[pos++];
+      value |= guint64(b & 0x7f) << shift;
+
+      if ((b & 0x80) == 0)
+        {
+          return true;
+        }
+    }
+
+  return false;
+}
+
+
+void
+StatsCodec::encode_uint32(string &out, guint32 value)
+{
+  for (int i = 0; i < 4; i++)
+    {
+      out.push_back((char)(value & 0xff));
+      value >>= 8;
+    }
+}
+
+
+bool
+StatsCodec::decode_uint32(const char *data, size_t size, size_t &pos, guint32 &value)
+{
+  if (size - pos < 4)
+    {
+      return false;
+    }
+
+  value = 0;
+  for (int i = 3; i >= 0; i--)
+    {
+      value = (value << 8) | (guint8)data[pos + i];
+    }
+  pos += 4;
+
+  return true;
+}
+
+
+//! Converts a day into an array of fields.
+void
+StatsCodec::flatten(const DailyStats &stats, gint64 *fields)
+{
+  *fields++ = stats.start.tm_mday;
+  *fields++ = stats.start.tm_mon;
+  *fields++ = stats.start.tm_year;
+  *fields++ = stats.start.tm_hour;
+  *fields++ = stats.start.tm_min;
+  *fields++ = stats.stop.tm_mday;
+  *fields++ = stats.stop.tm_mon;
+  *fields++ = stats.stop.tm_year;
+  *fields++ = stats.stop.tm_hour;
+  *fields++ = stats.stop.tm_min;
+  *fields++ = stats.resolution;
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          *fields++ = stats.break_stats[i][j];
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      *fields++ = stats.misc_stats[j];
+    }
+
+  for (int h = 0; h < IStatistics::STATS_HOURS; h++)
+    {
+      for (int j = 0; j < IStatistics::STATS_HOURLY_SIZEOF; j++)
+        {
+          *fields++ = stats.get_hourly_value(h, IStatistics::StatsHourlyValueType(j));
+        }
+    }
+}
+
+
+//! Converts an array of fields into a day.
+/*!
+ *  The dimensions are those of the block, which may have been written
+ *  by a version with fewer or more fields, breaks or counters.
+ */
+void
+StatsCodec::unflatten(const gint64 *fields, int num_info, int num_breaks, int num_break_values,
+                      int num_misc, int num_hours, int num_hourly, DailyStats &stats)
+{
+  stats.clear();
+
+  stats.start.tm_mday = (int)*fields++;
+  stats.start.tm_mon = (int)*fields++;
+  stats.start.tm_year = (int)*fields++;
+  stats.start.tm_hour = (int)*fields++;
+  stats.start.tm_min = (int)*fields++;
+  stats.stop.tm_mday = (int)*fields++;
+  stats.stop.tm_mon = (int)*fields++;
+  stats.stop.tm_year = (int)*fields++;
+  stats.stop.tm_hour = (int)*fields++;
+  stats.stop.tm_min = (int)*fields++;
+
+  if (num_info > TIME_FIELDS)
+    {
+      gint64 resolution = fields[0];
+      if (resolution >= 0 && resolution < IStatistics::STATS_RESOLUTION_SIZEOF)
+        {
+          stats.resolution = IStatistics::StatsResolution(resolution);
+        }
+    }
+  fields += num_info - TIME_FIELDS;
+
+  for (int i = 0; i < num_breaks; i++)
+    {
+      for (int j = 0; j < num_break_values; j++)
+        {
+          gint64 value = *fields++;
+          if (i < BREAK_ID_SIZEOF && j < IStatistics::STATS_BREAKVALUE_SIZEOF)
+            {
+              stats.break_stats[i][j] = (int)value;
+            }
+        }
+    }
+
+  for (int j = 0; j < num_misc; j++)
+    {
+      gint64 value = *fields++;
+      if (j < IStatistics::STATS_VALUE_SIZEOF)
+        {
+          stats.misc_stats[j] = value;
+        }
+    }
+
+  for (int h = 0; h < num_hours; h++)
+    {
+      for (int j = 0; j < num_hourly; j++)
+        {
+          gint64 value = *fields++;
+          if (value != 0 && h < IStatistics::STATS_HOURS && j < IStatistics::STATS_HOURLY_SIZEOF)
+            {
+              stats.get_hourly_stats(h)[j] = (int)value;
+            }
+        }
+    }
+}
+
+
+//! CRC32 (IEEE 802.3) lookup table, polynomial 0xedb88320.
+static const guint32 crc32_table[256] =
+{
+  0x00000000U, 0x77073096U, 0xee0e612cU, 0x990951baU, 0x076dc419U, 0x706af48fU,
+  0xe963a535U, 0x9e6495a3U, 0x0edb8832U, 0x79dcb8a4U, 0xe0d5e91eU, 0x97d2d988U,
+  0x09b64c2bU, 0x7eb17cbdU, 0xe7b82d07U, 0x90bf1d91U, 0x1db71064U, 0x6ab020f2U,
+  0xf3b97148U, 0x84be41deU, 0x1adad47dU, 0x6ddde4ebU, 0xf4d4b551U, 0x83d385c7U,
+  0x136c9856U, 0x646ba8c0U, 0xfd62f97aU, 0x8a65c9ecU, 0x14015c4fU, 0x63066cd9U,
+  0xfa0f3d63U, 0x8d080df5U, 0x3b6e20c8U, 0x4c69105eU, 0xd56041e4U, 0xa2677172U,
+  0x3c03e4d1U, 0x4b04d447U, 0xd20d85fdU, 0xa50ab56bU, 0x35b5a8faU, 0x42b2986cU,
+  0xdbbbc9d6U, 0xacbcf940U, 0x32d86ce3U, 0x45df5c75U, 0xdcd60dcfU, 0xabd13d59U,
+  0x26d930acU, 0x51de003aU, 0xc8d75180U, 0xbfd06116U, 0x21b4f4b5U, 0x56b3c423U,
+  0xcfba9599U, 0xb8bda50fU, 0x2802b89eU, 0x5f058808U, 0xc60cd9b2U, 0xb10be924U,
+  0x2f6f7c87U, 0x58684c11U, 0xc1611dabU, 0xb6662d3dU, 0x76dc4190U, 0x01db7106U,
+  0x98d220bcU, 0xefd5102aU, 0x71b18589U, 0x06b6b51fU, 0x9fbfe4a5U, 0xe8b8d433U,
+  0x7807c9a2U, 0x0f00f934U, 0x9609a88eU, 0xe10e9818U, 0x7f6a0dbbU, 0x086d3d2dU,
+  0x91646c97U, 0xe6635c01U, 0x6b6b51f4U, 0x1c6c6162U, 0x856530d8U, 0xf262004eU,
+  0x6c0695edU, 0x1b01a57bU, 0x8208f4c1U, 0xf50fc457U, 0x65b0d9c6U, 0x12b7e950U,
+  0x8bbeb8eaU, 0xfcb9887cU, 0x62dd1ddfU, 0x15da2d49U, 0x8cd37cf3U, 0xfbd44c65U,
+  0x4db26158U, 0x3ab551ceU, 0xa3bc0074U, 0xd4bb30e2U, 0x4adfa541U, 0x3dd895d7U,
+  0xa4d1c46dU, 0xd3d6f4fbU, 0x4369e96aU, 0x346ed9fcU, 0xad678846U, 0xda60b8d0U,
+  0x44042d73U, 0x33031de5U, 0xaa0a4c5fU, 0xdd0d7cc9U, 0x5005713cU, 0x270241aaU,
+  0xbe0b1010U, 0xc90c2086U, 0x5768b525U, 0x206f85b3U, 0xb966d409U, 0xce61e49fU,
+  0x5edef90eU, 0x29d9c998U, 0xb0d09822U, 0xc7d7a8b4U, 0x59b33d17U, 0x2eb40d81U,
+  0xb7bd5c3bU, 0xc0ba6cadU, 0xedb88320U, 0x9abfb3b6U, 0x03b6e20cU, 0x74b1d29aU,
+  0xead54739U, 0x9dd277afU, 0x04db2615U, 0x73dc1683U, 0xe3630b12U, 0x94643b84U,
+  0x0d6d6a3eU, 0x7a6a5aa8U, 0xe40ecf0bU, 0x9309ff9dU, 0x0a00ae27U, 0x7d079eb1U,
+  0xf00f9344U, 0x8708a3d2U, 0x1e01f268U, 0x6906c2feU, 0xf762575dU, 0x806567cbU,
+  0x196c3671U, 0x6e6b06e7U, 0xfed41b76U, 0x89d32be0U, 0x10da7a5aU, 0x67dd4accU,
+  0xf9b9df6fU, 0x8ebeeff9U, 0x17b7be43U, 0x60b08ed5U, 0xd6d6a3e8U, 0xa1d1937eU,
+  0x38d8c2c4U, 0x4fdff252U, 0xd1bb67f1U, 0xa6bc5767U, 0x3fb506ddU, 0x48b2364bU,
+  0xd80d2bdaU, 0xaf0a1b4cU, 0x36034af6U, 0x41047a60U, 0xdf60efc3U, 0xa867df55U,
+  0x316e8eefU, 0x4669be79U, 0xcb61b38cU, 0xbc66831aU, 0x256fd2a0U, 0x5268e236U,
+  0xcc0c7795U, 0xbb0b4703U, 0x220216b9U, 0x5505262fU, 0xc5ba3bbeU, 0xb2bd0b28U,
+  0x2bb45a92U, 0x5cb36a04U, 0xc2d7ffa7U, 0xb5d0cf31U, 0x2cd99e8bU, 0x5bdeae1dU,
+  0x9b64c2b0U, 0xec63f226U, 0x756aa39cU, 0x026d930aU, 0x9c0906a9U, 0xeb0e363fU,
+  0x72076785U, 0x05005713U, 0x95bf4a82U, 0xe2b87a14U, 0x7bb12baeU, 0x0cb61b38U,
+  0x92d28e9bU, 0xe5d5be0dU, 0x7cdcefb7U, 0x0bdbdf21U, 0x86d3d2d4U, 0xf1d4e242U,
+  0x68ddb3f8U, 0x1fda836eU, 0x81be16cdU, 0xf6b9265bU, 0x6fb077e1U, 0x18b74777U,
+  0x88085ae6U, 0xff0f6a70U, 0x66063bcaU, 0x11010b5cU, 0x8f659effU, 0xf862ae69U,
+  0x616bffd3U, 0x166ccf45U, 0xa00ae278U, 0xd70dd2eeU, 0x4e048354U, 0x3903b3c2U,
+  0xa7672661U, 0xd06016f7U, 0x4969474dU, 0x3e6e77dbU, 0xaed16a4aU, 0xd9d65adcU,
+  0x40df0b66U, 0x37d83bf0U, 0xa9bcae53U, 0xdebb9ec5U, 0x47b2cf7fU, 0x30b5ffe9U,
+  0xbdbdf21cU, 0xcabac28aU, 0x53b39330U, 0x24b4a3a6U, 0xbad03605U, 0xcdd70693U,
+  0x54de5729U, 0x23d967bfU, 0xb3667a2eU, 0xc4614ab8U, 0x5d681b02U, 0x2a6f2b94U,
+  0xb40bbe37U, 0xc30c8ea1U, 0x5a05df1bU, 0x2d02ef8dU
+};
+
+
+//! Computes the CRC32 (IEEE 802.3) of a buffer.
+guint32
+StatsCodec::crc32(const char *data, size_t size)
+{
+  guint32 crc = 0xffffffffU;
+  for (size_t i = 0; i < size; i++)
+    {
+      crc = crc32_table[(crc ^ (guint8)data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+  return crc ^ 0xffffffffU;
+}
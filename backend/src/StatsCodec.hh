@@ -0,0 +1,105 @@
+// StatsCodec.hh --- Compact encoding of the statistics history
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef STATSCODEC_HH
+#define STATSCODEC_HH
+
+#include <string>
+#include <vector>
+
+#include "glib.h"
+
+#include "IStatistics.hh"
+
+using namespace workrave;
+
+//! Packed encoding of daily statistics.
+/*!
+ *  The packed history file consists of a small file header followed by
+ *  a sequence of independent blocks. Each block holds up to BLOCK_DAYS
+ *  days. Every field of a day is stored as the zigzag varint encoded
+ *  difference with the same field of the previous day in the block, so
+ *  slowly changing counters take only one or two bytes. The first day
+ *  of a block is encoded against an all-zero day. Each block carries a
+ *  CRC32 of its payload; a damaged block is skipped without losing the
+ *  remainder of the file. A run of unchanged fields, such as the hourly
+ *  buckets of idle hours, is stored as a zero followed by its length.
+ */
+class StatsCodec
+{
+public:
+  typedef IStatistics::DailyStats DailyStats;
+
+  //! Maximum number of days in a block.
+  static const int BLOCK_DAYS = 32;
+
+  //! Maximum size of the payload of a block.
+  static const size_t MAX_BLOCK_PAYLOAD = 1024 * 1024;
+
+  //! Maximum size of a complete block: tag, header varints, payload and CRC.
+  static const size_t MAX_BLOCK_SIZE = 1 + 8 * 10 + MAX_BLOCK_PAYLOAD + 4;
+
+  enum DecodeResult
+    {
+      //! A block was decoded.
+      DECODE_OK,
+
+      //! A damaged block was skipped.
+      DECODE_CORRUPT,
+
+      //! No more blocks can be decoded.
+      DECODE_END,
+    };
+
+  static void encode_header(std::string &out);
+  static bool decode_header(const char *data, size_t size, size_t &pos);
+
+  static void encode_block(std::string &out, const std::vector<DailyStats> &days);
+  static DecodeResult decode_block(const char *data, size_t size, size_t &pos,
+                                   std::vector<DailyStats> &days);
+
+  static bool read_file(const std::string &filename, std::string &data);
+
+  static guint32 crc32(const char *data, size_t size);
+
+private:
+  enum
+    {
+      //! Start and stop time.
+      TIME_FIELDS = 10,
+
+      //! Start and stop time, resolution.
+      INFO_FIELDS = 11,
+    };
+
+  static void encode_varint(std::string &out, guint64 value);
+  static bool decode_varint(const char *data, size_t size, size_t &pos, guint64 &value);
+
+  static void encode_uint32(std::string &out, guint32 value);
+  static bool decode_uint32(const char *data, size_t size, size_t &pos, guint32 &value);
+
+  static guint64 zigzag_encode(gint64 value) { return (guint64(value) << 1) ^ guint64(value >> 63); }
+  static gint64 zigzag_decode(guint64 value) { return gint64(value >> 1) ^ -gint64(value & 1); }
+
+  static void flatten(const DailyStats &stats, gint64 *fields);
+  static void unflatten(const gint64 *fields, int num_info, int num_breaks, int num_break_values,
+                        int num_misc, int num_hours, int num_hourly, DailyStats &stats);
+};
+
+#endif // STATSCODEC_HH
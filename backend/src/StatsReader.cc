@@ -0,0 +1,702 @@
+// StatsReader.cc --- Sequential reader for statistics files
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <algorithm>
+
+#include "debug.hh"
+
+#include "StatsReader.hh"
+#include "StatsCodec.hh"
+
+using namespace std;
+
+static const char *STATS_TEXT_TAG = "WorkRaveStats";
+
+//! Number of bytes read from the file at once.
+static const size_t READ_SIZE = 64 * 1024;
+
+//! Longer lines of a text file are split, and end up as damaged records.
+static const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+// The names are indexed by the enums of IStatistics. The array sizes
+// are checked at compile time so that they cannot get out of sync.
+static const char *break_names[] =
+  {
+    "micro_pause",
+    "rest_break",
+    "daily_limit",
+  };
+
+static const char *value_names[] =
+  {
+    "total_active_time",
+    "total_mouse_movement",
+    "total_click_movement",
+    "total_movement_time",
+    "total_clicks",
+    "total_keystrokes",
+  };
+
+static const char *break_value_names[] =
+  {
+    "prompted",
+    "taken",
+    "natural_taken",
+    "skipped",
+    "postponed",
+    "unique_breaks",
+    "total_overdue",
+  };
+
+static const char *hourly_value_names[] =
+  {
+    "active_time",
+    "mouse_movement",
+    "clicks",
+    "keystrokes",
+    "breaks_prompted",
+    "breaks_taken",
+    "breaks_skipped",
+  };
+
+//! Number of fixed fields before the counters: date, start, stop and resolution.
+static const int FIXED_FIELDS = 4;
+
+typedef char break_names_check[sizeof(break_names) / sizeof(break_names[0]) == BREAK_ID_SIZEOF ? 1 : -1];
+typedef char value_names_check[sizeof(value_names) / sizeof(value_names[0]) == IStatistics::STATS_VALUE_SIZEOF ? 1 : -1];
+typedef char break_value_names_check[sizeof(break_value_names) / sizeof(break_value_names[0]) == IStatistics::STATS_BREAKVALUE_SIZEOF ? 1 : -1];
+typedef char hourly_value_names_check[sizeof(hourly_value_names) / sizeof(hourly_value_names[0]) == IStatistics::STATS_HOURLY_SIZEOF ? 1 : -1];
+
+
+StatsReader::StatsReader() :
+  format(FORMAT_NONE),
+  pos(0),
+  damaged(0),
+  block_index(0)
+{
+}
+
+
+StatsReader::~StatsReader()
+{
+  close();
+}
+
+
+//! Opens a statistics file.
+bool
+StatsReader::open(const string &filename)
+{
+  TRACE_ENTER_MSG("StatsReader::open", filename);
+  close();
+
+  file.open(filename.c_str(), ios::in | ios::binary);
+  if (!file.is_open())
+    {
+      TRACE_RETURN("Cannot open file");
+      return false;
+    }
+
+  fill(READ_SIZE);
+
+  if (StatsCodec::decode_header(data.data(), data.size(), pos))
+    {
+      format = FORMAT_PACKED;
+      TRACE_RETURN("packed");
+      return true;
+    }
+
+  const char *begin, *end;
+  bool ok = next_line(begin, end);
+
+  if (ok)
+    {
+      size_t len = strlen(STATS_TEXT_TAG);
+      ok = (size_t(end - begin) > len && memcmp(begin, STATS_TEXT_TAG, len) == 0);
+      begin += len;
+    }
+
+  if (ok)
+    {
+      gint64 version;
+      ok = parse_int(begin, end, 0, G_MAXINT, version) && (version == 4 || version == 3);
+    }
+
+  if (ok)
+    {
+      format = FORMAT_TEXT;
+    }
+  else
+    {
+      close();
+    }
+
+  TRACE_RETURN(ok);
+  return ok;
+}
+
+
+//! Closes the statistics file.
+void
+StatsReader::close()
+{
+  format = FORMAT_NONE;
+  if (file.is_open())
+    {
+      file.close();
+    }
+  file.clear();
+  data.clear();
+  block.clear();
+  pos = 0;
+  damaged = 0;
+  block_index = 0;
+}
+
+
+//! Reads the next day.
+bool
+StatsReader::next(DailyStats &stats)
+{
+  switch (format)
+    {
+    case FORMAT_TEXT:
+      return next_text(stats);
+
+    case FORMAT_PACKED:
+      return next_packed(stats);
+
+    default:
+      return false;
+    }
+}
+
+
+//! Returns the number of damaged records that were skipped so far.
+int
+StatsReader::get_damaged_count() const
+{
+  return damaged;
+}
+
+
+//! Reads the next day from a text file.
+bool
+StatsReader::next_text(DailyStats &stats)
+{
+  bool found = false;
+
+  while (true)
+    {
+      const char *begin, *end;
+
+      if (!next_line(begin, end))
+        {
+          break;
+        }
+
+      if (begin == end)
+        {
+          continue;
+        }
+
+      if (*begin == 'D')
+        {
+          if (found)
+            {
+              // Start of the next day.
+              pos = begin - data.data();
+              break;
+            }
+
+          stats.clear();
+
+          const char *p = begin + 1;
+          if (parse_date(p, end, stats.start) && parse_date(p, end, stats.stop) && parse_end(p, end))
+            {
+              found = true;
+            }
+          else
+            {
+              // Skip all records up to the next day.
+              TRACE_MSG("Damaged day");
+              damaged++;
+            }
+        }
+      else if (found && !parse_line(begin, end, stats))
+        {
+          TRACE_MSG("Damaged record");
+          damaged++;
+        }
+    }
+
+  return found;
+}
+
+
+//! Reads the next day from a packed file.
+bool
+StatsReader::next_packed(DailyStats &stats)
+{
+  while (block_index >= block.size())
+    {
+      block.clear();
+      block_index = 0;
+
+      // A block that does not fit in the buffered data is reported as
+      // the end of the data. Read more of the file and try again until
+      // the largest valid block would fit.
+      size_t block_pos = pos;
+      StatsCodec::DecodeResult res = StatsCodec::decode_block(data.data(), data.size(), pos, block);
+      while (res == StatsCodec::DECODE_END && data.size() - block_pos < StatsCodec::MAX_BLOCK_SIZE)
+        {
+          pos = block_pos;
+          if (!fill(data.size() - pos + READ_SIZE))
+            {
+              break;
+            }
+
+          block_pos = pos;
+          res = StatsCodec::decode_block(data.data(), data.size(), pos, block);
+        }
+
+      if (res == StatsCodec::DECODE_END)
+        {
+          return false;
+        }
+      else if (res == StatsCodec::DECODE_CORRUPT)
+        {
+          damaged++;
+        }
+    }
+
+  stats = block[block_index++];
+  return true;
+}
+
+
+//! Reads from the file until at least the specified number of bytes are buffered.
+/*!
+ *  The data before the read position is discarded, so this invalidates
+ *  all pointers into the buffer and changes the read position. Returns
+ *  false if nothing could be read.
+ */
+bool
+StatsReader::fill(size_t size)
+{
+  size_t available = data.size() - pos;
+  if (available >= size || !file.is_open() || !file.good())
+    {
+      return false;
+    }
+
+  data.erase(0, pos);
+  pos = 0;
+
+  size_t count = std::max(size - available, READ_SIZE);
+  data.resize(available + count);
+  file.read(&data[available], count);
+
+  size_t read = (size_t)file.gcount();
+  data.resize(available + read);
+
+  return read > 0;
+}
+
+
+//! Returns the next line of a text file, without line terminator.
+/*!
+ *  The returned pointers remain valid until the next call.
+ */
+bool
+StatsReader::next_line(const char *&begin, const char *&end)
+{
+  const char *nl = NULL;
+
+  while (true)
+    {
+      size_t available = data.size() - pos;
+      nl = (const char *)memchr(data.data() + pos, '\n', available);
+
+      if (nl != NULL || available >= MAX_LINE_LENGTH || !fill(available + 1))
+        {
+          break;
+        }
+    }
+
+  if (pos >= data.size())
+    {
+      return false;
+    }
+
+  begin = data.data() + pos;
+  end = (nl != NULL) ? nl : data.data() + data.size();
+
+  pos = (end - data.data()) + (nl != NULL ? 1 : 0);
+
+  if (end > begin && end[-1] == '\r')
+    {
+      end--;
+    }
+
+  return true;
+}
+
+
+//! Parses a single record of a text file.
+/*!
+ *  The record is only applied if the complete line is valid. Unknown
+ *  records are ignored.
+ */
+bool
+StatsReader::parse_line(const char *begin, const char *end, DailyStats &stats)
+{
+  // Upper bound on the number of values of a record.
+  static const int MAX_VALUES = 64;
+
+  gint64 values[MAX_VALUES];
+  gint64 index = 0, size = 0;
+
+  char cmd = *begin;
+  const char *p = begin + 1;
+
+  switch (cmd)
+    {
+    case 'B':
+      if (!parse_int(p, end, 0, BREAK_ID_SIZEOF - 1, index))
+        {
+          return false;
+        }
+      break;
+
+    case 'H':
+      if (!parse_int(p, end, 0, IStatistics::STATS_HOURS - 1, index))
+        {
+          return false;
+        }
+      break;
+
+    case 'M':
+    case 'm':
+      break;
+
+    case 'R':
+    case 'G':
+      size = 1;
+      break;
+
+    default:
+      return true;
+    }
+
+  if (size == 0 && !parse_int(p, end, 0, MAX_VALUES, size))
+    {
+      return false;
+    }
+
+  // Counters are 32 bit, except for the misc statistics.
+  gint64 min = (cmd == 'M' || cmd == 'm' || cmd == 'G') ? G_MININT64 : G_MININT;
+  gint64 max = (cmd == 'M' || cmd == 'm' || cmd == 'G') ? G_MAXINT64 : G_MAXINT;
+
+  for (int j = 0; j < size; j++)
+    {
+      if (!parse_int(p, end, min, max, values[j]))
+        {
+          return false;
+        }
+    }
+
+  if (!parse_end(p, end))
+    {
+      return false;
+    }
+
+  switch (cmd)
+    {
+    case 'B':
+      for (int j = 0; j < size && j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          stats.break_stats[index][j] = (int)values[j];
+        }
+      break;
+
+    case 'H':
+      for (int j = 0; j < size && j < IStatistics::STATS_HOURLY_SIZEOF; j++)
+        {
+          stats.get_hourly_stats(index)[j] = (int)values[j];
+        }
+      break;
+
+    case 'M':
+    case 'm':
+      for (int j = 0; j < size && j < IStatistics::STATS_VALUE_SIZEOF; j++)
+        {
+          // Ignore older 'M' stats. they are broken....
+          stats.misc_stats[j] = (cmd == 'm') ? values[j] : 0;
+        }
+      break;
+
+    case 'R':
+      if (values[0] < 0 || values[0] >= IStatistics::STATS_RESOLUTION_SIZEOF)
+        {
+          return false;
+        }
+      stats.resolution = IStatistics::StatsResolution(values[0]);
+      break;
+
+    case 'G':
+      stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME] = values[0];
+      break;
+    }
+
+  return true;
+}
+
+
+//! Parses the day, month, year, hour and minute of a day record.
+bool
+StatsReader::parse_date(const char *&p, const char *end, struct tm &tm)
+{
+  gint64 mday, mon, year, hour, min;
+
+  if (parse_int(p, end, 0, 31, mday) &&
+      parse_int(p, end, 0, 11, mon) &&
+      parse_int(p, end, 0, 8099, year) &&
+      parse_int(p, end, 0, 23, hour) &&
+      parse_int(p, end, 0, 59, min))
+    {
+      tm.tm_mday = (int)mday;
+      tm.tm_mon = (int)mon;
+      tm.tm_year = (int)year;
+      tm.tm_hour = (int)hour;
+      tm.tm_min = (int)min;
+      return true;
+    }
+
+  return false;
+}
+
+
+//! Parses a decimal integer within the range [min, max].
+bool
+StatsReader::parse_int(const char *&p, const char *end, gint64 min, gint64 max, gint64 &value)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+
+  bool negative = (p < end && *p == '-');
+  if (negative)
+    {
+      p++;
+    }
+
+  if (p == end || *p < '0' || *p > '9')
+    {
+      return false;
+    }
+
+  guint64 v = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    {
+      if (v > (guint64)G_MAXINT64 / 10)
+        {
+          return false;
+        }
+      v = v * 10 + (*p++ - '0');
+    }
+
+  if (p < end && *p != ' ' && *p != '\t')
+    {
+      return false;
+    }
+
+  if (v > (guint64)G_MAXINT64)
+    {
+      return false;
+    }
+
+  value = negative ? -(gint64)v : (gint64)v;
+  return value >= min && value <= max;
+}
+
+
+//! Checks that only whitespace remains.
+bool
+StatsReader::parse_end(const char *p, const char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+
+  return p == end;
+}
+
+
+const char *
+StatsReader::get_break_name(BreakId id)
+{
+  return (id >= 0 && id < BREAK_ID_SIZEOF) ? break_names[id] : NULL;
+}
+
+
+const char *
+StatsReader::get_value_name(IStatistics::StatsValueType type)
+{
+  return (type >= 0 && type < IStatistics::STATS_VALUE_SIZEOF) ? value_names[type] : NULL;
+}
+
+
+const char *
+StatsReader::get_break_value_name(IStatistics::StatsBreakValueType type)
+{
+  return (type >= 0 && type < IStatistics::STATS_BREAKVALUE_SIZEOF) ? break_value_names[type] : NULL;
+}
+
+
+const char *
+StatsReader::get_hourly_value_name(IStatistics::StatsHourlyValueType type)
+{
+  return (type >= 0 && type < IStatistics::STATS_HOURLY_SIZEOF) ? hourly_value_names[type] : NULL;
+}
+
+
+//! Returns the names of the fields returned by get_fields().
+/*!
+ *  The counter names are taken from the statistics enums, so that new
+ *  counters are included automatically.
+ */
+vector<string>
+StatsReader::get_field_names()
+{
+  vector<string> names;
+
+  names.push_back("date");
+  names.push_back("start");
+  names.push_back("stop");
+  names.push_back("resolution");
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          names.push_back(string(get_break_name(BreakId(i))) + "_" +
+                          get_break_value_name(IStatistics::StatsBreakValueType(j)));
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      names.push_back(get_value_name(IStatistics::StatsValueType(j)));
+    }
+
+  return names;
+}
+
+
+//! Returns the date of a day as YYYYMMDD.
+int
+StatsReader::get_date(const DailyStats &stats)
+{
+  return (stats.start.tm_year + 1900) * 10000 + (stats.start.tm_mon + 1) * 100 + stats.start.tm_mday;
+}
+
+
+//! Returns a day as a flat row of values.
+/*!
+ *  Start and stop are exported as HHMM. The resolution is 0 for a
+ *  single day, 1 for a weekly and 2 for a monthly rollup.
+ */
+void
+StatsReader::get_fields(const DailyStats &stats, vector<gint64> &fields)
+{
+  fields.clear();
+  fields.reserve(FIXED_FIELDS
+                 + BREAK_ID_SIZEOF * IStatistics::STATS_BREAKVALUE_SIZEOF
+                 + IStatistics::STATS_VALUE_SIZEOF);
+
+  fields.push_back(get_date(stats));
+  fields.push_back(stats.start.tm_hour * 100 + stats.start.tm_min);
+  fields.push_back(stats.stop.tm_hour * 100 + stats.stop.tm_min);
+  fields.push_back(stats.resolution);
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          fields.push_back(stats.break_stats[i][j]);
+        }
+    }
+
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      fields.push_back(stats.misc_stats[j]);
+    }
+}
+
+
+//! Returns the names of the fields returned by get_hourly_fields().
+/*!
+ *  The names are of the form hourHH_<counter>, e.g. hour09_keystrokes.
+ */
+vector<string>
+StatsReader::get_hourly_field_names()
+{
+  vector<string> names;
+
+  for (int h = 0; h < IStatistics::STATS_HOURS; h++)
+    {
+      char hour[8];
+      g_snprintf(hour, sizeof(hour), "hour%02d_", h);
+
+      for (int j = 0; j < IStatistics::STATS_HOURLY_SIZEOF; j++)
+        {
+          names.push_back(string(hour) + get_hourly_value_name(IStatistics::StatsHourlyValueType(j)));
+        }
+    }
+
+  return names;
+}
+
+
+//! Appends the hourly buckets of a day to a row of values.
+/*!
+ *  The hourly buckets are kept out of get_fields(), as they would
+ *  increase the size of every row by a factor of five.
+ */
+void
+StatsReader::get_hourly_fields(const DailyStats &stats, vector<gint64> &fields)
+{
+  fields.reserve(fields.size() + IStatistics::STATS_HOURS * IStatistics::STATS_HOURLY_SIZEOF);
+
+  for (int h = 0; h < IStatistics::STATS_HOURS; h++)
+    {
+      for (int j = 0; j < IStatistics::STATS_HOURLY_SIZEOF; j++)
+        {
+          fields.push_back(stats.get_hourly_value(h, IStatistics::StatsHourlyValueType(j)));
+        }
+    }
+}
@@ -0,0 +1,112 @@
+// StatsReader.hh --- Sequential reader for statistics files
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef STATSREADER_HH
+#define STATSREADER_HH
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "glib.h"
+
+#include "IStatistics.hh"
+
+using namespace workrave;
+
+//! Reads the days of a statistics file one at a time.
+/*!
+ *  Both the text format and the packed format are supported; the format
+ *  is detected from the file header. The file is read incrementally:
+ *  only the current line (or, for the packed format, the current block)
+ *  and a small read ahead are buffered, so the memory use does not
+ *  depend on the size of the file.
+ *
+ *  Damaged records are skipped rather than ending the file. A day with
+ *  a damaged date line is dropped as a whole, a damaged counter line
+ *  only loses that line. The number of skipped records is available
+ *  from get_damaged_count().
+ */
+class StatsReader
+{
+public:
+  typedef IStatistics::DailyStats DailyStats;
+
+  StatsReader();
+  ~StatsReader();
+
+  bool open(const std::string &filename);
+  void close();
+  bool next(DailyStats &stats);
+  int get_damaged_count() const;
+
+  static const char *get_break_name(BreakId id);
+  static const char *get_value_name(IStatistics::StatsValueType type);
+  static const char *get_break_value_name(IStatistics::StatsBreakValueType type);
+  static const char *get_hourly_value_name(IStatistics::StatsHourlyValueType type);
+
+  static std::vector<std::string> get_field_names();
+  static int get_date(const DailyStats &stats);
+  static void get_fields(const DailyStats &stats, std::vector<gint64> &fields);
+
+  static std::vector<std::string> get_hourly_field_names();
+  static void get_hourly_fields(const DailyStats &stats, std::vector<gint64> &fields);
+
+private:
+  enum Format
+    {
+      FORMAT_NONE,
+      FORMAT_TEXT,
+      FORMAT_PACKED,
+    };
+
+  bool next_text(DailyStats &stats);
+  bool next_packed(DailyStats &stats);
+
+  bool fill(size_t size);
+  bool next_line(const char *&begin, const char *&end);
+  bool parse_line(const char *begin, const char *end, DailyStats &stats);
+  static bool parse_date(const char *&p, const char *end, struct tm &tm);
+  static bool parse_int(const char *&p, const char *end, gint64 min, gint64 max, gint64 &value);
+  static bool parse_end(const char *p, const char *end);
+
+private:
+  //! Format of the opened file.
+  Format format;
+
+  //! Opened file.
+  std::ifstream file;
+
+  //! Buffered part of the file.
+  std::string data;
+
+  //! Read position in the buffered data.
+  size_t pos;
+
+  //! Number of damaged records that were skipped.
+  int damaged;
+
+  //! Current decoded block of the packed data.
+  std::vector<DailyStats> block;
+
+  //! Next day in the current block.
+  size_t block_index;
+};
+
+#endif // STATSREADER_HH
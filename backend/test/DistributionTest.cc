@@ -0,0 +1,898 @@
+// DistributionTest.cc --- Tests and benchmarks of networks of distribution managers
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <glib.h>
+
+#include "Configurator.hh"
+#include "CoreConfig.hh"
+#include "IConfigBackend.hh"
+#include "IConfiguratorListener.hh"
+#include "DistributionManager.hh"
+#include "DistributionSocketLink.hh"
+#include "IDistributionClientMessage.hh"
+
+#include "MemorySocketDriver.hh"
+#include "TestUtil.hh"
+
+using namespace std;
+
+//! Interval between two heartbeats in ms.
+#define HEARTBEAT_INTERVAL (1000)
+
+//! Configuration backend that keeps all values in memory.
+/*!
+ *  Changes are reported to the configurator, like the monitoring
+ *  backends do, so that the configurator does not need the core.
+ */
+class MemoryConfigBackend :
+  public IConfigBackend,
+  public IConfigBackendMonitoring
+{
+public:
+  MemoryConfigBackend() : listener(NULL) {}
+
+  bool load(string filename) { (void) filename; return true; }
+  bool save(string filename) { (void) filename; return true; }
+  bool save() { return true; }
+
+  bool remove_key(const string &key)
+  {
+    return values.erase(key) > 0;
+  }
+
+  bool get_value(const string &key, VariantType type, Variant &value) const
+  {
+    map<string, Variant>::const_iterator i = values.find(key);
+    if (i == values.end() || (type != VARIANT_TYPE_NONE && i->second.type != type))
+      {
+        return false;
+      }
+
+    value = i->second;
+    return true;
+  }
+
+  bool set_value(const string &key, Variant &value)
+  {
+    values[key] = value;
+    if (listener != NULL)
+      {
+        listener->config_changed_notify(key);
+      }
+    return true;
+  }
+
+  void set_listener(IConfiguratorListener *l) { listener = l; }
+  bool add_listener(const string &key_prefix) { (void) key_prefix; return true; }
+  bool remove_listener(const string &key_prefix) { (void) key_prefix; return true; }
+
+private:
+  //! All values.
+  map<string, Variant> values;
+
+  //! The configurator.
+  IConfiguratorListener *listener;
+};
+
+
+//! Sign-on client message of a node, like the idle log of the core.
+/*!
+ *  Records the nodes from which the message was received.
+ */
+class SignonMessage : public IDistributionClientMessage
+{
+public:
+  SignonMessage(const string &host) : host(host), num_received(0) {}
+
+  bool request_client_message(DistributionClientMessageID id, PacketBuffer &buffer)
+  {
+    (void) id;
+    buffer.pack_string(host);
+    return true;
+  }
+
+  bool client_message(DistributionClientMessageID id, bool active, const char *client_id,
+                      PacketBuffer &buffer)
+  {
+    (void) id;
+    (void) active;
+    (void) client_id;
+
+    gchar *sender = buffer.unpack_string();
+    if (sender != NULL)
+      {
+        senders.insert(sender);
+      }
+    g_free(sender);
+
+    num_received++;
+    return true;
+  }
+
+  //! Host of the node.
+  string host;
+
+  //! Hosts from which the message was received.
+  set<string> senders;
+
+  //! Number of received messages.
+  int num_received;
+};
+
+
+//! Client message with a payload of a specified size.
+/*!
+ *  Counts the received messages of which the payload is intact.
+ */
+class PayloadMessage : public IDistributionClientMessage
+{
+public:
+  PayloadMessage() : num_received(0), num_corrupt(0) {}
+
+  //! Creates a message of which the payload depends on its sequence number.
+  static void create(PacketBuffer &buffer, int seq, int size)
+  {
+    buffer.create(size + 4);
+    buffer.pack_ulong(seq);
+    for (int i = 0; i < size; i++)
+      {
+        buffer.pack_byte((seq + i) & 0xff);
+      }
+  }
+
+  bool request_client_message(DistributionClientMessageID id, PacketBuffer &buffer)
+  {
+    (void) id;
+    (void) buffer;
+    return false;
+  }
+
+  bool client_message(DistributionClientMessageID id, bool active, const char *client_id,
+                      PacketBuffer &buffer)
+  {
+    (void) id;
+    (void) active;
+    (void) client_id;
+
+    int seq = buffer.unpack_ulong();
+    int size = buffer.bytes_available();
+
+    bool intact = true;
+    for (int i = 0; i < size; i++)
+      {
+        intact = intact && buffer.unpack_byte() == ((seq + i) & 0xff);
+      }
+
+    if (intact)
+      {
+        num_received++;
+      }
+    else
+      {
+        num_corrupt++;
+      }
+    return true;
+  }
+
+  //! Number of intact messages.
+  int num_received;
+
+  //! Number of messages of which the payload was corrupt.
+  int num_corrupt;
+};
+
+
+//! Simulation of a network of distribution managers.
+/*!
+ *  Each node is a distribution manager with its own socket link. The
+ *  links communicate through a simulated network, and their
+ *  heartbeats are driven by its virtual clock. One node is active, and
+ *  claims the master status like the core does while the user is
+ *  active.
+ */
+class DistributionTest
+{
+public:
+  //! How the nodes connect to each other.
+  enum Topology
+    {
+      //! All nodes connect to the first node.
+      TOPOLOGY_STAR,
+
+      //! Each node connects to its parent in a binary tree.
+      TOPOLOGY_TREE,
+
+      //! Each node connects to the previous node.
+      TOPOLOGY_CHAIN,
+    };
+
+  DistributionTest(TestUtil &test, int num_nodes, Topology topology);
+  ~DistributionTest();
+
+  void start();
+  void run(int seconds);
+  int run_until_connected(int max_seconds);
+  int run_until_master(int master, int max_seconds);
+  int run_until_received(int count, int max_seconds);
+
+  bool is_connected();
+  bool is_master(int master);
+  void set_active(int node);
+  int get_num_signon_messages() const;
+  void broadcast_payloads(int node, int count, int size);
+  int get_num_corrupt_payloads() const;
+  int get_queued_bytes(int node);
+  int get_packets_out(int node);
+
+  //! The simulated network.
+  MemoryNetwork network;
+
+private:
+  //! A node of the network.
+  struct Node
+  {
+    string host;
+    Configurator *configurator;
+    DistributionManager *manager;
+    SignonMessage *signon;
+    PayloadMessage *payload;
+  };
+
+  void heartbeat();
+  static int get_num_known_clients(DistributionManager *manager);
+  static string get_peer(int node);
+
+private:
+  TestUtil &test;
+  Topology topology;
+
+  //! All nodes.
+  vector<Node> nodes;
+
+  //! The node of which the user is active.
+  int active;
+};
+
+
+//! Creates the nodes of a network, with distribution disabled.
+/*!
+ *  The socket link of each node uses the simulated network and its
+ *  clock instead of real sockets, and has its own ID.
+ */
+DistributionTest::DistributionTest(TestUtil &test, int num_nodes, Topology topology)
+  : test(test), topology(topology), active(0)
+{
+  for (int i = 0; i < num_nodes; i++)
+    {
+      Node node;
+
+      stringstream ss;
+      ss << "node" << i;
+      node.host = ss.str();
+
+      test.select_home_directory(node.host);
+
+      node.configurator = new Configurator(new MemoryConfigBackend());
+      node.configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_ENABLED, false);
+      node.configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_LISTENING, true);
+      node.configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_USERNAME, string("workrave"));
+      node.configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_TCP_PASSWORD, string("secret"));
+
+      if (i > 0)
+        {
+          int peer = i - 1;
+          if (topology == TOPOLOGY_STAR)
+            {
+              peer = 0;
+            }
+          else if (topology == TOPOLOGY_TREE)
+            {
+              peer = (i - 1) / 2;
+            }
+          node.configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_PEERS, get_peer(peer));
+        }
+
+      node.manager = new DistributionManager();
+      node.manager->init(node.configurator);
+
+      node.signon = new SignonMessage(node.host);
+      node.manager->register_client_message(DCM_IDLELOG, DCMT_SIGNON, node.signon);
+
+      node.payload = new PayloadMessage();
+      node.manager->register_client_message(DCM_SCRIPT, DCMT_PASSIVE, node.payload);
+
+      DistributionSocketLink *link = (DistributionSocketLink *)node.manager->link;
+
+      delete link->socket_driver;
+      link->socket_driver = new MemorySocketDriver(&network, node.host);
+
+      delete link->local_session_lock;
+      link->local_session_lock = NULL;
+      delete link->local_socket_driver;
+      link->local_socket_driver = NULL;
+      link->local_session = -1;
+
+      link->time_source = &network;
+
+      nodes.push_back(node);
+    }
+
+  test.clean_home_directory();
+}
+
+
+//! Destructs all nodes.
+DistributionTest::~DistributionTest()
+{
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      delete nodes[i].manager;
+    }
+
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      delete nodes[i].configurator;
+      delete nodes[i].signon;
+      delete nodes[i].payload;
+    }
+}
+
+
+//! Enables distribution on all nodes.
+/*!
+ *  Each node connects to its peer, which already listens.
+ */
+void
+DistributionTest::start()
+{
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      nodes[i].configurator->set_value(CoreConfig::CFG_KEY_DISTRIBUTION_ENABLED, true);
+    }
+}
+
+
+//! Runs the network for the specified number of virtual seconds.
+void
+DistributionTest::run(int seconds)
+{
+  for (int i = 0; i < seconds; i++)
+    {
+      network.run(network.get_current_ms() + HEARTBEAT_INTERVAL);
+      heartbeat();
+    }
+}
+
+
+//! Runs the network until each node knows all other nodes and their sign-on messages.
+/*!
+ *  \return the number of virtual seconds, or -1 if the nodes did not
+ *          know each other in time.
+ */
+int
+DistributionTest::run_until_connected(int max_seconds)
+{
+  for (int i = 0; i <= max_seconds; i++)
+    {
+      if (is_connected())
+        {
+          return i;
+        }
+      run(1);
+    }
+  return -1;
+}
+
+
+//! Runs the network until all nodes agree on the specified master.
+/*!
+ *  \return the number of virtual seconds, or -1 if the nodes did not
+ *          agree in time.
+ */
+int
+DistributionTest::run_until_master(int master, int max_seconds)
+{
+  for (int i = 0; i <= max_seconds; i++)
+    {
+      if (is_master(master))
+        {
+          return i;
+        }
+      run(1);
+    }
+  return -1;
+}
+
+
+//! Runs the network until each node received the specified number of payload messages.
+/*!
+ *  The node that sent the messages does not receive them.
+ *
+ *  \return the number of virtual seconds, or -1 if the messages did not
+ *          arrive in time.
+ */
+int
+DistributionTest::run_until_received(int count, int max_seconds)
+{
+  for (int i = 0; i <= max_seconds; i++)
+    {
+      int done = 0;
+      for (size_t j = 0; j < nodes.size(); j++)
+        {
+          if (nodes[j].payload->num_received >= count)
+            {
+              done++;
+            }
+        }
+
+      if (done >= (int)nodes.size() - 1)
+        {
+          return i;
+        }
+      run(1);
+    }
+  return -1;
+}
+
+
+//! Returns whether each node knows all other nodes and their sign-on messages.
+bool
+DistributionTest::is_connected()
+{
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      if (get_num_known_clients(nodes[i].manager) != (int)nodes.size() - 1 ||
+          nodes[i].signon->senders.size() != nodes.size() - 1)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+
+//! Returns whether all nodes agree that the specified node is master.
+bool
+DistributionTest::is_master(int master)
+{
+  string id = nodes[master].manager->get_my_id();
+
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      DistributionManager *manager = nodes[i].manager;
+
+      if (manager->is_master() != ((int)i == master) || manager->get_master_id() != id)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+
+//! Makes the user active at the specified node.
+void
+DistributionTest::set_active(int node)
+{
+  active = node;
+}
+
+
+//! Returns the number of sign-on messages that all nodes received.
+int
+DistributionTest::get_num_signon_messages() const
+{
+  int count = 0;
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      count += nodes[i].signon->num_received;
+    }
+  return count;
+}
+
+
+//! Sends payload messages of the specified size from a node to all other nodes.
+/*!
+ *  Each message is sent in its own packet.
+ */
+void
+DistributionTest::broadcast_payloads(int node, int count, int size)
+{
+  DistributionSocketLink *link = (DistributionSocketLink *)nodes[node].manager->link;
+
+  for (int i = 0; i < count; i++)
+    {
+      PacketBuffer buffer;
+      PayloadMessage::create(buffer, i, size);
+
+      link->broadcast_client_message(DCM_SCRIPT, buffer);
+      link->flush_client_messages();
+    }
+}
+
+
+//! Returns the number of payload messages that were received corrupt.
+int
+DistributionTest::get_num_corrupt_payloads() const
+{
+  int count = 0;
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      count += nodes[i].payload->num_corrupt;
+    }
+  return count;
+}
+
+
+//! Returns the number of bytes in the output queues of a node.
+int
+DistributionTest::get_queued_bytes(int node)
+{
+  DistributionSocketLink *link = (DistributionSocketLink *)nodes[node].manager->link;
+
+  int packets, bytes, peak_bytes, coalesced;
+  link->get_output_queue_stats(packets, bytes, peak_bytes, coalesced);
+  return bytes;
+}
+
+
+//! Returns the number of packets that a node sent to its direct clients.
+int
+DistributionTest::get_packets_out(int node)
+{
+  DistributionSocketLink *link = (DistributionSocketLink *)nodes[node].manager->link;
+
+  int count = 0;
+  for (list<DistributionSocketLink::Client *>::iterator i = link->clients.begin(); i != link->clients.end(); i++)
+    {
+      count += (*i)->packets_out;
+    }
+  return count;
+}
+
+
+//! Performs a heartbeat of all nodes, as the core does.
+void
+DistributionTest::heartbeat()
+{
+  for (size_t i = 0; i < nodes.size(); i++)
+    {
+      DistributionManager *manager = nodes[i].manager;
+
+      manager->heartbeart();
+      manager->set_lock_master((int)i == active);
+
+      if ((int)i == active && !manager->is_master())
+        {
+          manager->claim();
+        }
+    }
+}
+
+
+//! Returns the number of other nodes of which a node knows the ID.
+int
+DistributionTest::get_num_known_clients(DistributionManager *manager)
+{
+  DistributionSocketLink *link = (DistributionSocketLink *)manager->link;
+
+  int count = 0;
+  for (list<DistributionSocketLink::Client *>::iterator i = link->clients.begin(); i != link->clients.end(); i++)
+    {
+      DistributionSocketLink::Client *c = *i;
+      if (c->id != NULL && c->type != DistributionSocketLink::CLIENTTYPE_SIGNEDOFF)
+        {
+          count++;
+        }
+    }
+  return count;
+}
+
+
+//! Returns the URL of a node.
+string
+DistributionTest::get_peer(int node)
+{
+  stringstream ss;
+  ss << "tcp://node" << node << ":" << DEFAULT_PORT;
+  return ss.str();
+}
+
+
+//! Checks that a network connects, elects the active node, and hands over.
+static void
+test_election(TestUtil &test, int num_nodes, DistributionTest::Topology topology,
+              int min_latency, int max_latency, int loss)
+{
+  stringstream ss;
+  ss << num_nodes << " nodes, topology " << topology
+     << ", latency " << min_latency << "-" << max_latency << " ms, loss " << loss << "%";
+
+  DistributionTest sim(test, num_nodes, topology);
+  sim.network.set_latency(min_latency, max_latency);
+  sim.network.set_loss(loss);
+  sim.start();
+
+  test.check(ss.str() + ": connected", sim.run_until_connected(120) >= 0);
+  test.check(ss.str() + ": first master", sim.run_until_master(0, 120) >= 0);
+
+  sim.set_active(num_nodes - 1);
+  test.check(ss.str() + ": next master", sim.run_until_master(num_nodes - 1, 120) >= 0);
+
+  test.clean_home_directory();
+}
+
+
+//! Checks that a claim from a partitioned node succeeds once the partition heals.
+static void
+test_partition(TestUtil &test, int num_nodes)
+{
+  DistributionTest sim(test, num_nodes, DistributionTest::TOPOLOGY_STAR);
+  sim.network.set_latency(5, 50);
+  sim.start();
+
+  test.check("partition: connected", sim.run_until_connected(120) >= 0);
+  test.check("partition: first master", sim.run_until_master(0, 120) >= 0);
+
+  stringstream ss;
+  ss << "node" << num_nodes - 1;
+  sim.network.set_partition(ss.str(), 1);
+  sim.set_active(num_nodes - 1);
+  sim.run(30);
+
+  test.check("partition: no master while partitioned", !sim.is_master(num_nodes - 1));
+
+  sim.network.heal_partitions();
+  test.check("partition: master after healing", sim.run_until_master(num_nodes - 1, 120) >= 0);
+
+  test.clean_home_directory();
+}
+
+
+//! Checks that packets queued for clients that do not read arrive intact.
+/*!
+ *  The window of the network only lets a part of the first packets
+ *  through until the clients read, so the rest is queued, and written
+ *  in parts.
+ */
+static void
+test_fanout(TestUtil &test, int num_clients, int num_packets, int packet_size)
+{
+  stringstream ss;
+  ss << "fanout of " << num_packets << " packets of " << packet_size << " bytes";
+
+  DistributionTest sim(test, num_clients + 1, DistributionTest::TOPOLOGY_STAR);
+  sim.start();
+
+  test.check(ss.str() + ": connected", sim.run_until_connected(120) >= 0);
+
+  sim.network.set_window(4000);
+  sim.broadcast_payloads(0, num_packets, packet_size);
+
+  test.check(ss.str() + ": queued", sim.get_queued_bytes(0) > 0);
+  test.check(ss.str() + ": received", sim.run_until_received(num_packets, 120) >= 0);
+  test.check(ss.str() + ": intact", sim.get_num_corrupt_payloads() == 0);
+  test.check(ss.str() + ": flushed", sim.get_queued_bytes(0) == 0);
+
+  test.clean_home_directory();
+}
+
+
+//! Checks that a node closes the connections to which a write fails, and reconnects.
+static void
+test_write_error(TestUtil &test)
+{
+  DistributionTest sim(test, 3, DistributionTest::TOPOLOGY_STAR);
+  sim.start();
+
+  test.check("write error: connected", sim.run_until_connected(120) >= 0);
+
+  sim.network.set_write_error("node0", true);
+  sim.network.reset_counters();
+
+  int packets_out = sim.get_packets_out(0);
+  sim.broadcast_payloads(0, 1, 100);
+  test.check_equal("write error: packets sent", sim.get_packets_out(0), packets_out);
+
+  sim.run(2);
+  test.check("write error: closed", !sim.is_connected());
+  test.check_equal("write error: queue dropped", sim.get_queued_bytes(0), 0);
+
+  test.clean_home_directory();
+}
+
+
+//! Reports the time to connect and elect, and the traffic, of a network.
+static void
+benchmark_election(TestUtil &test, int num_nodes, DistributionTest::Topology topology)
+{
+  DistributionTest sim(test, num_nodes, topology);
+  sim.network.set_latency(1, 20);
+  sim.start();
+
+  gint64 start = g_get_monotonic_time();
+
+  int connect_time = sim.run_until_connected(600);
+  gint64 connect_bytes = sim.network.get_bytes_sent();
+  gint64 connect_writes = sim.network.get_num_writes();
+  int signon_messages = sim.get_num_signon_messages();
+
+  int master_time = sim.run_until_master(0, 600);
+
+  sim.network.reset_counters();
+  sim.set_active(num_nodes - 1);
+  int handover_time = sim.run_until_master(num_nodes - 1, 600);
+  gint64 handover_bytes = sim.network.get_bytes_sent();
+  gint64 handover_writes = sim.network.get_num_writes();
+
+  sim.network.reset_counters();
+  sim.run(60);
+  gint64 idle_bytes = sim.network.get_bytes_sent();
+
+  gint64 cpu_time = g_get_monotonic_time() - start;
+
+  const char *names[] = { "star", "tree", "chain" };
+
+  cout << num_nodes << " nodes, " << names[topology] << ": "
+       << "connected after " << connect_time << " s ("
+       << connect_bytes << " bytes, " << connect_writes << " writes, "
+       << signon_messages << " sign-on messages), "
+       << "master after " << master_time << " s, "
+       << "handover after " << handover_time << " s ("
+       << handover_bytes << " bytes, " << handover_writes << " writes), "
+       << idle_bytes / 60 << " bytes/s idle, "
+       << cpu_time / 1000 << " ms to simulate"
+       << endl;
+
+  test.clean_home_directory();
+}
+
+
+//! Reports the allocations to queue broadcast packets for clients that do not read.
+static void
+benchmark_fanout(TestUtil &test, int num_clients, int num_packets, int packet_size)
+{
+  DistributionTest sim(test, num_clients + 1, DistributionTest::TOPOLOGY_STAR);
+  sim.start();
+  sim.run_until_connected(600);
+
+  sim.network.set_window(4000);
+
+  TestUtil::count_allocations(true);
+
+  gint64 start = g_get_monotonic_time();
+  sim.broadcast_payloads(0, num_packets, packet_size);
+  gint64 cpu_time = g_get_monotonic_time() - start;
+
+  TestUtil::count_allocations(false);
+
+  int queued_bytes = sim.get_queued_bytes(0);
+  int delivery_time = sim.run_until_received(num_packets, 600);
+
+  cout << num_clients << " clients, " << num_packets << " packets of " << packet_size << " bytes: "
+       << queued_bytes << " bytes queued, "
+       << TestUtil::get_num_allocations() << " allocations of "
+       << TestUtil::get_allocated_bytes() << " bytes, "
+       << cpu_time << " us to queue, "
+       << "delivered after " << delivery_time << " s"
+       << endl;
+
+  test.clean_home_directory();
+}
+
+
+//! Reports the cost of sending small packets from one node to another.
+/*!
+ *  The packets are sent in batches, and the network runs until the
+ *  output queue is empty before the next batch. The window of the
+ *  network is that of a typical socket buffer, so that the receiver can
+ *  read many packets at once.
+ */
+static void
+benchmark_pump(TestUtil &test, int num_packets, int packet_size)
+{
+  DistributionTest sim(test, 2, DistributionTest::TOPOLOGY_STAR);
+  sim.start();
+  sim.run_until_connected(600);
+
+  sim.network.set_window(65536);
+  sim.network.reset_counters();
+
+  const int batch_size = 1000;
+
+  gint64 start = g_get_monotonic_time();
+  for (int i = 0; i < num_packets; i += batch_size)
+    {
+      sim.broadcast_payloads(0, MIN(batch_size, num_packets - i), packet_size);
+      while (sim.get_queued_bytes(0) > 0)
+        {
+          sim.network.run(sim.network.get_current_ms() + 1);
+        }
+    }
+  int delivery_time = sim.run_until_received(num_packets, 600);
+  gint64 cpu_time = g_get_monotonic_time() - start;
+
+  gint64 reads = sim.network.get_num_reads();
+
+  cout << num_packets << " packets of " << packet_size << " bytes: "
+       << sim.network.get_bytes_sent() << " bytes, "
+       << sim.network.get_num_writes() << " writes, "
+       << reads << " reads ("
+       << (double)num_packets / MAX(reads, 1) << " packets per read), "
+       << (double)cpu_time / num_packets << " us per packet, "
+       << "delivered after " << delivery_time << " s"
+       << endl;
+
+  test.clean_home_directory();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  TestUtil test("distribution-test");
+
+  bool benchmark = argc > 1 && string(argv[1]) == "--benchmark";
+
+  if (benchmark)
+    {
+      int sizes[] = { 2, 5, 10, 20, 50, 100, 200 };
+      for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+          benchmark_election(test, sizes[i], DistributionTest::TOPOLOGY_STAR);
+          benchmark_election(test, sizes[i], DistributionTest::TOPOLOGY_TREE);
+        }
+
+      benchmark_fanout(test, 10, 100, 1000);
+      benchmark_fanout(test, 100, 100, 1000);
+      benchmark_fanout(test, 100, 10, 60000);
+
+      benchmark_pump(test, 10000, 16);
+      benchmark_pump(test, 100000, 16);
+      benchmark_pump(test, 10000, 1000);
+    }
+  else
+    {
+      test_election(test, 2, DistributionTest::TOPOLOGY_STAR, 0, 0, 0);
+      test_election(test, 5, DistributionTest::TOPOLOGY_STAR, 0, 0, 0);
+      test_election(test, 7, DistributionTest::TOPOLOGY_TREE, 0, 0, 0);
+      test_election(test, 5, DistributionTest::TOPOLOGY_CHAIN, 0, 0, 0);
+      test_election(test, 10, DistributionTest::TOPOLOGY_TREE, 10, 200, 0);
+      test_election(test, 10, DistributionTest::TOPOLOGY_STAR, 10, 200, 10);
+      test_election(test, 50, DistributionTest::TOPOLOGY_TREE, 1, 20, 0);
+      test_partition(test, 4);
+      test_fanout(test, 5, 100, 1000);
+      test_fanout(test, 5, 10, 65531);
+      test_fanout(test, 1, 10000, 16);
+      test_write_error(test);
+    }
+
+  return test.finish();
+}
@@ -0,0 +1,962 @@
+// IdleLogTest.cc --- Tests and benchmarks of the idle log manager
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "Util.hh"
+#include "IdleLogManager.hh"
+#include "TimeSource.hh"
+#include "PacketBuffer.hh"
+
+#include "TestUtil.hh"
+
+using namespace std;
+
+//! Time of the first simulated second.
+#define START_TIME (1000000)
+
+//! Number of simulated seconds.
+#define DURATION (4 * 60 * 60)
+
+//! Time source that is moved forward by the test.
+class FakeTimeSource : public TimeSource
+{
+public:
+  FakeTimeSource() : current_time(0) {}
+
+  time_t get_time() const { return current_time; }
+
+  time_t current_time;
+};
+
+
+//! Activity of all clients during a simulation, one entry per second.
+/*!
+ *  At most one client, the master, is active during a second.
+ */
+struct Timeline
+{
+  //! Master during each second.
+  vector<int> master;
+
+  //! Is the master active during each second?
+  vector<bool> active;
+
+  int num_clients;
+
+  //! Returns whether the specified client is active during the specified second.
+  bool is_active(int client, time_t t) const
+  {
+    size_t i = t - START_TIME;
+    return active[i] && master[i] == client;
+  }
+};
+
+
+//! Per second reference model of the idle logs.
+class ReferenceModel
+{
+public:
+  ReferenceModel(const Timeline &timeline, time_t now);
+
+  time_t active_time_between(time_t from, time_t to) const;
+  time_t active_time_between(int client, time_t from, time_t to) const;
+  time_t total_active_time() const;
+  time_t active_time(int length) const;
+
+private:
+  bool is_logged_idle(int client, time_t t) const;
+
+  const Timeline &timeline;
+
+  //! Current time.
+  time_t now;
+
+  //! Time at which each client last became idle.
+  vector<time_t> last_push;
+};
+
+
+//! Builds the reference model at the specified time.
+ReferenceModel::ReferenceModel(const Timeline &timeline, time_t now)
+  : timeline(timeline), now(now)
+{
+  last_push.resize(timeline.num_clients, START_TIME);
+
+  for (time_t t = START_TIME + 1; t < now; t++)
+    {
+      for (int c = 0; c < timeline.num_clients; c++)
+        {
+          if (timeline.is_active(c, t - 1) && !timeline.is_active(c, t))
+            {
+              last_push[c] = t;
+            }
+        }
+    }
+}
+
+
+//! Returns the number of seconds in a window during which any client was active.
+time_t
+ReferenceModel::active_time_between(time_t from, time_t to) const
+{
+  time_t active_time = 0;
+
+  for (time_t t = max(from, (time_t)START_TIME); t < min(to, now); t++)
+    {
+      for (int c = 0; c < timeline.num_clients; c++)
+        {
+          if (timeline.is_active(c, t))
+            {
+              active_time++;
+              break;
+            }
+        }
+    }
+
+  return active_time;
+}
+
+
+//! Returns the number of seconds in a window during which a client was active.
+time_t
+ReferenceModel::active_time_between(int client, time_t from, time_t to) const
+{
+  time_t active_time = 0;
+
+  for (time_t t = max(from, (time_t)START_TIME); t < min(to, now); t++)
+    {
+      if (timeline.is_active(client, t))
+        {
+          active_time++;
+        }
+    }
+
+  return active_time;
+}
+
+
+//! Returns the active time of all clients.
+time_t
+ReferenceModel::total_active_time() const
+{
+  time_t active_time = 0;
+
+  for (int c = 0; c < timeline.num_clients; c++)
+    {
+      active_time += active_time_between(c, START_TIME, now);
+    }
+
+  return active_time;
+}
+
+
+//! Is the client idle during a second that is stored in its idle log?
+/*!
+ *  The idle log holds the intervals up to the last time the client
+ *  became idle. Remote clients have no idle history before they signed
+ *  on, unlike the local client.
+ */
+bool
+ReferenceModel::is_logged_idle(int client, time_t t) const
+{
+  if (t >= last_push[client])
+    {
+      return false;
+    }
+  if (t < START_TIME)
+    {
+      return client == 0 && timeline.num_clients == 1 && t >= 1;
+    }
+  return !timeline.is_active(client, t);
+}
+
+
+//! Returns the active time since the last common idle period longer than length.
+time_t
+ReferenceModel::active_time(int length) const
+{
+  time_t end = now;
+  time_t common_idle_end = -1;
+
+  // Walk back over periods in which all clients are idle. A period never
+  // spans the sign on time, as every client starts a new interval then.
+  time_t first = timeline.num_clients == 1 ? 1 : START_TIME;
+
+  while (common_idle_end == -1 && end > first)
+    {
+      time_t t = end - 1;
+      bool idle = true;
+      for (int c = 0; c < timeline.num_clients && idle; c++)
+        {
+          idle = is_logged_idle(c, t);
+        }
+
+      if (!idle)
+        {
+          end--;
+          continue;
+        }
+
+      time_t begin = t;
+      while (begin > 1 && begin != START_TIME)
+        {
+          bool all_idle = true;
+          for (int c = 0; c < timeline.num_clients && all_idle; c++)
+            {
+              all_idle = is_logged_idle(c, begin - 1);
+            }
+          if (!all_idle)
+            {
+              break;
+            }
+          begin--;
+        }
+
+      if (end - begin > length)
+        {
+          common_idle_end = end;
+        }
+      end = begin;
+    }
+
+  time_t active_time = 0;
+  for (int c = 0; c < timeline.num_clients; c++)
+    {
+      active_time += active_time_between(c, max(common_idle_end, (time_t)START_TIME), last_push[c]);
+    }
+
+  return active_time;
+}
+
+
+//! Whitebox access to the idle log manager.
+class IdleLogTest
+{
+public:
+  static time_t merge_active_time(IdleLogManager *manager, int length);
+  static time_t linear_merge_active_time(IdleLogManager *manager, int length);
+  static size_t count_intervals(IdleLogManager *manager);
+};
+
+
+//! Returns the active time since an idle period, bypassing the cache.
+time_t
+IdleLogTest::merge_active_time(IdleLogManager *manager, int length)
+{
+  return manager->merge_active_time(length);
+}
+
+
+//! Returns the active time since an idle period, using a linear scan over all clients.
+/*!
+ *  This is the algorithm that compute_active_time() used before the
+ *  heap based merge. It finds each next event by scanning all clients.
+ */
+time_t
+IdleLogTest::linear_merge_active_time(IdleLogManager *manager, int length)
+{
+  IdleLogManager::ClientMap &clients = manager->clients;
+
+  // Number of client.
+  int size = clients.size();
+
+  // Data for each client.
+  IdleLogManager::IdleLogIter *iterators = new IdleLogManager::IdleLogIter[size];
+  IdleLogManager::IdleLogIter *end_iterators = new IdleLogManager::IdleLogIter[size];
+  bool *at_end = new bool[size];
+  time_t *active_time = new time_t[size];
+
+  // Init data for all clients.
+  int count = 0;
+  for (IdleLogManager::ClientMapIter i = clients.begin(); i != clients.end(); i++)
+    {
+      IdleLogManager::ClientInfo &info = (*i).second;
+
+      iterators[count] = info.idlelog.begin();
+      end_iterators[count] = info.idlelog.end();
+      active_time[count] = 0;
+      at_end[count] = true;
+      count++;
+    }
+
+  // Number of simultaneous idle periods.
+  int idle_count = 0;
+
+  // Iterator of last unprocessed event.
+  int last_iter = -1;
+
+  // Stop criterium
+  bool stop = false;
+
+  // End time of idle period.
+  time_t end_idle_time = -1;
+
+  while (!stop)
+    {
+      // Find latest event.
+      time_t last_time = -1;
+      for (int i = 0; i < size; i ++)
+        {
+          if (iterators[i] != end_iterators[i])
+            {
+              IdleLogManager::IdleInterval &ii = *(iterators[i]);
+              time_t t = at_end[i] ? ii.end_idle_time : ii.begin_time;
+
+              if (last_time == -1 || t > last_time)
+                {
+                  last_time = t;
+                  last_iter = i;
+                }
+            }
+        }
+
+      if (last_time == -1)
+        {
+          stop = true;
+        }
+      else if (at_end[last_iter])
+        {
+          IdleLogManager::IdleInterval &ii = *(iterators[last_iter]);
+
+          idle_count++;
+          at_end[last_iter] = false;
+          active_time[last_iter] += ii.active_time;
+          end_idle_time = ii.end_idle_time;
+        }
+      else
+        {
+          IdleLogManager::IdleInterval &ii = *(iterators[last_iter]);
+
+          at_end[last_iter] = true;
+          iterators[last_iter]++;
+
+          if (idle_count == size && (end_idle_time - ii.begin_time) > length)
+            {
+              stop = true;
+            }
+
+          idle_count--;
+        }
+    }
+
+  time_t total_active_time = 0;
+  for (int i = 0; i < size; i++)
+    {
+      total_active_time += active_time[i];
+    }
+
+  delete [] iterators;
+  delete [] end_iterators;
+  delete [] at_end;
+  delete [] active_time;
+
+  return total_active_time;
+}
+
+
+//! Returns the number of intervals in the idle logs of all clients.
+size_t
+IdleLogTest::count_intervals(IdleLogManager *manager)
+{
+  size_t count = 0;
+  for (IdleLogManager::ClientMapIter i = manager->clients.begin(); i != manager->clients.end(); i++)
+    {
+      count += (*i).second.idlelog.size();
+    }
+  return count;
+}
+
+
+//! Generates the activity of a number of clients.
+/*!
+ *  The activity consists of segments of random length. If short_gaps is
+ *  false, each segment lasts at least 10 seconds, so that no idle period
+ *  is short enough to be merged with the previous interval.
+ */
+static void
+generate_timeline(Timeline &timeline, int num_clients, bool short_gaps)
+{
+  timeline.num_clients = num_clients;
+  timeline.master.clear();
+  timeline.active.clear();
+
+  int master = 0;
+  bool active = false;
+  int length = 30;
+
+  while (timeline.master.size() < DURATION)
+    {
+      for (int i = 0; i < length && timeline.master.size() < DURATION; i++)
+        {
+          timeline.master.push_back(master);
+          timeline.active.push_back(active);
+        }
+
+      active = TestUtil::random(2) == 0;
+      if (active)
+        {
+          master = TestUtil::random(num_clients);
+        }
+      length = short_gaps ? 1 + TestUtil::random(60) : 10 + TestUtil::random(300);
+    }
+}
+
+
+//! Returns the ID of a simulated client.
+static string
+get_client_id(int client)
+{
+  stringstream ss;
+  ss << "client" << client;
+  return ss.str();
+}
+
+
+//! Creates an idle log manager with a number of clients.
+static IdleLogManager *
+create_manager(FakeTimeSource &time_source, int num_clients)
+{
+  time_source.current_time = START_TIME;
+
+  IdleLogManager *manager = new IdleLogManager(get_client_id(0), &time_source);
+  manager->init();
+
+  for (int c = 1; c < num_clients; c++)
+    {
+      manager->signon_remote_client(get_client_id(c));
+    }
+
+  return manager;
+}
+
+
+//! Advances the simulation to the specified time.
+static void
+run_timeline(IdleLogManager *manager, FakeTimeSource &time_source, const Timeline &timeline, time_t end)
+{
+  for (time_t t = time_source.current_time; t < end; t++)
+    {
+      size_t i = t - START_TIME;
+
+      time_source.current_time = t;
+      manager->update_all_idlelogs(get_client_id(timeline.master[i]),
+                                   timeline.active[i] ? ACTIVITY_ACTIVE : ACTIVITY_IDLE);
+    }
+  time_source.current_time = end;
+}
+
+
+//! Compares all queries of the idle log manager with the reference model.
+static void
+check_queries(TestUtil &test, IdleLogManager *manager, const Timeline &timeline,
+              time_t now, bool short_gaps)
+{
+  ReferenceModel reference(timeline, now);
+  stringstream where;
+  where << timeline.num_clients << " clients at " << (now - START_TIME) << "s";
+
+  test.check_equal(where.str() + ", total active time",
+                   manager->compute_total_active_time(), reference.total_active_time());
+
+  // The heap based merge must give the same results as the linear scan,
+  // also when idle periods were merged.
+  static const int merge_lengths[] = { 0, 10, 60, 300, 900, 3600, DURATION };
+  for (size_t i = 0; i < sizeof(merge_lengths) / sizeof(merge_lengths[0]); i++)
+    {
+      stringstream what;
+      what << where.str() << ", merged active time since idle period of " << merge_lengths[i] << "s";
+
+      test.check_equal(what.str(), manager->compute_active_time(merge_lengths[i]),
+                       IdleLogTest::linear_merge_active_time(manager, merge_lengths[i]));
+    }
+
+  for (int c = 0; c < timeline.num_clients; c++)
+    {
+      test.check_equal(where.str() + ", active time of " + get_client_id(c),
+                       manager->compute_active_time_between(get_client_id(c), 0, now),
+                       reference.active_time_between(c, 0, now));
+    }
+
+  if (short_gaps)
+    {
+      // Merged idle periods move active time within the log, so only the
+      // totals are exact.
+      return;
+    }
+
+  test.check_equal(where.str() + ", active time",
+                   manager->compute_active_time_between(0, now),
+                   reference.active_time_between(0, now));
+
+  for (int i = 0; i < 20; i++)
+    {
+      time_t from = START_TIME - 100 + TestUtil::random(now - START_TIME + 200);
+      time_t to = from + TestUtil::random(3600);
+      int c = TestUtil::random(timeline.num_clients);
+
+      stringstream window;
+      window << where.str() << ", window " << (from - START_TIME) << "-" << (to - START_TIME);
+
+      test.check_equal(window.str(),
+                       manager->compute_active_time_between(from, to),
+                       reference.active_time_between(from, to));
+      test.check_equal(window.str() + " of " + get_client_id(c),
+                       manager->compute_active_time_between(get_client_id(c), from, to),
+                       reference.active_time_between(c, from, to));
+    }
+
+  static const int lengths[] = { 0, 10, 60, 300, 900, 3600 };
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+      stringstream what;
+      what << where.str() << ", active time since idle period of " << lengths[i] << "s";
+
+      test.check_equal(what.str(), manager->compute_active_time(lengths[i]), reference.active_time(lengths[i]));
+    }
+}
+
+
+//! Cross-checks a simulation of a number of clients.
+static void
+test_clients(TestUtil &test, int num_clients, bool short_gaps)
+{
+  Timeline timeline;
+  generate_timeline(timeline, num_clients, short_gaps);
+
+  FakeTimeSource time_source;
+  IdleLogManager *manager = create_manager(time_source, num_clients);
+
+  for (time_t now = START_TIME + 600; now <= START_TIME + DURATION; now += 600 + TestUtil::random(600))
+    {
+      run_timeline(manager, time_source, timeline, now);
+      check_queries(test, manager, timeline, now, short_gaps);
+    }
+
+  delete manager;
+  test.clean_home_directory();
+}
+
+
+//! Activity of clients without a master, one entry per second.
+/*!
+ *  The clients are active independently, so that their active periods
+ *  overlap.
+ */
+struct LeaderlessTimeline
+{
+  //! Activity of each client during each second.
+  vector<vector<bool> > active;
+
+  //! Returns whether any client is active during the specified second.
+  bool is_active(time_t t) const
+  {
+    for (size_t c = 0; c < active.size(); c++)
+      {
+        if (active[c][t - START_TIME])
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+
+  //! Returns the number of seconds in a window during which any client was active.
+  time_t active_time_between(time_t from, time_t to) const
+  {
+    time_t active_time = 0;
+    for (time_t t = from; t < to; t++)
+      {
+        active_time += is_active(t) ? 1 : 0;
+      }
+    return active_time;
+  }
+
+  //! Returns the active time since the last common idle period longer than length.
+  time_t active_time(int length, time_t now) const
+  {
+    time_t active_time = 0;
+    time_t idle_time = 0;
+
+    for (time_t t = now - 1; t >= START_TIME; t--)
+      {
+        if (is_active(t))
+          {
+            active_time++;
+            idle_time = 0;
+          }
+        else if (++idle_time > length)
+          {
+            break;
+          }
+      }
+    return active_time;
+  }
+};
+
+
+//! Generates the independent activity of a number of clients.
+/*!
+ *  Each idle period lasts at least 10 seconds, so that it is not merged
+ *  with the previous interval.
+ */
+static void
+generate_leaderless_timeline(LeaderlessTimeline &timeline, int num_clients)
+{
+  timeline.active.resize(num_clients);
+
+  for (int c = 0; c < num_clients; c++)
+    {
+      vector<bool> &active = timeline.active[c];
+      active.clear();
+
+      bool state = false;
+      int length = 30;
+
+      while (active.size() < DURATION)
+        {
+          for (int i = 0; i < length && active.size() < DURATION; i++)
+            {
+              active.push_back(state);
+            }
+
+          state = !state;
+          length = 10 + TestUtil::random(state ? 300 : 600);
+        }
+    }
+}
+
+
+//! Sends an idle log to all other clients.
+static void
+send_idlelog(TestUtil &test, vector<IdleLogManager *> &managers, int sender, PacketBuffer &buffer)
+{
+  for (size_t c = 0; c < managers.size(); c++)
+    {
+      if ((int)c != sender)
+        {
+          test.select_home_directory(get_client_id(c));
+
+          buffer.restart_read();
+          managers[c]->set_idlelog(buffer);
+        }
+    }
+}
+
+
+//! Cross-checks a simulation of a number of clients without a master.
+/*!
+ *  Each client has its own idle log manager and clock. The clients send
+ *  their idle log when they sign on and whenever it changes, and their
+ *  current state every second.
+ */
+static void
+test_leaderless_clients(TestUtil &test, int num_clients)
+{
+  LeaderlessTimeline timeline;
+  generate_leaderless_timeline(timeline, num_clients);
+
+  vector<FakeTimeSource> time_sources(num_clients);
+  vector<IdleLogManager *> managers(num_clients);
+
+  // The clocks of the clients differ.
+  vector<time_t> clock_offset(num_clients);
+  for (int c = 0; c < num_clients; c++)
+    {
+      clock_offset[c] = c * 1000;
+      time_sources[c].current_time = START_TIME + clock_offset[c];
+
+      test.select_home_directory(get_client_id(c));
+      managers[c] = new IdleLogManager(get_client_id(c), &time_sources[c]);
+      managers[c]->init();
+      managers[c]->set_leaderless(true);
+      managers[c]->reset();
+
+      for (int r = 0; r < num_clients; r++)
+        {
+          if (r != c)
+            {
+              managers[c]->signon_remote_client(get_client_id(r));
+            }
+        }
+    }
+
+  for (int c = 0; c < num_clients; c++)
+    {
+      PacketBuffer buffer;
+      buffer.create();
+
+      test.select_home_directory(get_client_id(c));
+      managers[c]->get_idlelog(buffer);
+      send_idlelog(test, managers, c, buffer);
+    }
+
+  time_t check_time = START_TIME + 600;
+
+  for (time_t t = START_TIME; t <= START_TIME + DURATION; t++)
+    {
+      if (t == check_time)
+        {
+          for (int c = 0; c < num_clients; c++)
+            {
+              IdleLogManager *manager = managers[c];
+              time_t now = time_sources[c].current_time;
+              time_t active_time = 0;
+
+              stringstream where;
+              where << num_clients << " clients without master, " << get_client_id(c)
+                    << " at " << (t - START_TIME) << "s";
+
+              test.check_equal(where.str() + ", active time",
+                               manager->compute_active_time_between(0, now),
+                               timeline.active_time_between(START_TIME, t));
+
+              test.check(where.str() + ", total active time known",
+                         manager->compute_merged_total_active_time(active_time));
+              test.check_equal(where.str() + ", total active time",
+                               active_time, timeline.active_time_between(START_TIME, t));
+
+              static const int lengths[] = { 0, 10, 60, 300, 900 };
+              for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+                {
+                  stringstream what;
+                  what << where.str() << ", active time since idle period of " << lengths[i] << "s";
+
+                  test.check_equal(what.str(), manager->compute_merged_active_time(lengths[i]),
+                                   timeline.active_time(lengths[i], t));
+                }
+            }
+
+          check_time += 600 + TestUtil::random(600);
+        }
+
+      if (t == START_TIME + DURATION)
+        {
+          break;
+        }
+
+      size_t i = t - START_TIME;
+
+      for (int c = 0; c < num_clients; c++)
+        {
+          map<string, ActivityState> remote_states;
+          for (int r = 0; r < num_clients; r++)
+            {
+              if (r != c)
+                {
+                  remote_states[get_client_id(r)] = timeline.active[r][i] ? ACTIVITY_ACTIVE : ACTIVITY_IDLE;
+                }
+            }
+
+          test.select_home_directory(get_client_id(c));
+          time_sources[c].current_time = t + clock_offset[c];
+          managers[c]->update_all_idlelogs(timeline.active[c][i] ? ACTIVITY_ACTIVE : ACTIVITY_IDLE,
+                                           remote_states);
+        }
+
+      for (int c = 0; c < num_clients; c++)
+        {
+          test.select_home_directory(get_client_id(c));
+          if (managers[c]->has_unsent_idlelog())
+            {
+              PacketBuffer buffer;
+              buffer.create();
+
+              managers[c]->get_unsent_idlelog(buffer);
+              send_idlelog(test, managers, c, buffer);
+            }
+        }
+
+      for (int c = 0; c < num_clients; c++)
+        {
+          time_sources[c].current_time = t + 1 + clock_offset[c];
+        }
+    }
+
+  for (int c = 0; c < num_clients; c++)
+    {
+      delete managers[c];
+    }
+  test.clean_home_directory();
+}
+
+
+//! Checks that the idle log of a remote client with a long ID is stored.
+static void
+test_long_client_id(TestUtil &test, size_t length)
+{
+  string id = "client";
+  while (id.size() < length)
+    {
+      id += (char)('a' + TestUtil::random(26));
+    }
+
+  FakeTimeSource time_source;
+  IdleLogManager *manager = create_manager(time_source, 1);
+  manager->signon_remote_client(id);
+
+  // Active for 100s, then idle long enough to save the interval.
+  for (time_t t = START_TIME; t < START_TIME + 200; t++)
+    {
+      time_source.current_time = t;
+      manager->update_all_idlelogs(id, t < START_TIME + 100 ? ACTIVITY_ACTIVE : ACTIVITY_IDLE);
+    }
+  delete manager;
+
+  manager = new IdleLogManager(get_client_id(0), &time_source);
+  manager->init();
+
+  stringstream what;
+  what << "active time of client with ID of " << length << " bytes after loading";
+  test.check_equal(what.str(), manager->compute_active_time_between(id, 0, time_source.current_time), 100);
+
+  delete manager;
+  test.clean_home_directory();
+}
+
+
+//! Checks that the reset time is kept when the snapshot is loaded.
+static void
+test_reset_after_restart(TestUtil &test)
+{
+  FakeTimeSource time_source;
+  IdleLogManager *manager = create_manager(time_source, 1);
+  manager->reset();
+
+  // Active for 100s, then idle long enough to save the interval.
+  for (time_t t = START_TIME; t < START_TIME + 200; t++)
+    {
+      time_source.current_time = t;
+      manager->update_all_idlelogs(get_client_id(0), t < START_TIME + 100 ? ACTIVITY_ACTIVE : ACTIVITY_IDLE);
+    }
+  manager->terminate();
+  delete manager;
+
+  manager = new IdleLogManager(get_client_id(0), &time_source);
+  manager->init();
+
+  time_t active_time = 0;
+  test.check("total active time known after restart", manager->compute_merged_total_active_time(active_time));
+  test.check_equal("total active time after restart", active_time, 100);
+
+  delete manager;
+  test.clean_home_directory();
+}
+
+
+//! Reports the time per query for a number of clients.
+/*!
+ *  The activity changes every 30 seconds on average, so that the idle
+ *  logs hold many intervals.
+ */
+static void
+benchmark_clients(TestUtil &test, int num_clients)
+{
+  Timeline timeline;
+  generate_timeline(timeline, num_clients, true);
+
+  FakeTimeSource time_source;
+  IdleLogManager *manager = create_manager(time_source, num_clients);
+  run_timeline(manager, time_source, timeline, START_TIME + DURATION);
+
+  const int count = 1000;
+
+  // The length exceeds the simulated time, so that the complete idle
+  // logs are merged.
+  gint64 start = g_get_monotonic_time();
+  for (int i = 0; i < count; i++)
+    {
+      IdleLogTest::merge_active_time(manager, DURATION);
+    }
+  gint64 merge_time = g_get_monotonic_time() - start;
+
+  start = g_get_monotonic_time();
+  for (int i = 0; i < count; i++)
+    {
+      IdleLogTest::linear_merge_active_time(manager, DURATION);
+    }
+  gint64 linear_merge_time = g_get_monotonic_time() - start;
+
+  start = g_get_monotonic_time();
+  manager->compute_active_time_between(START_TIME, START_TIME + 1);
+  gint64 index_time = g_get_monotonic_time() - start;
+
+  start = g_get_monotonic_time();
+  for (int i = 0; i < count; i++)
+    {
+      time_t from = START_TIME + TestUtil::random(DURATION);
+      manager->compute_active_time_between(from, from + 3600);
+    }
+  gint64 window_time = g_get_monotonic_time() - start;
+
+  cout << num_clients << " clients, "
+       << IdleLogTest::count_intervals(manager) << " intervals: "
+       << (double)merge_time / count << " us per compute_active_time ("
+       << (double)linear_merge_time / count << " us with a linear scan), "
+       << index_time << " us to index, "
+       << (double)window_time / count << " us per compute_active_time_between"
+       << endl;
+
+  delete manager;
+  test.clean_home_directory();
+}
+
+
+int
+main(int argc, char **argv)
+{
+  TestUtil test("idlelog-test");
+
+  bool benchmark = argc > 1 && string(argv[1]) == "--benchmark";
+
+  if (benchmark)
+    {
+      benchmark_clients(test, 1);
+      benchmark_clients(test, 10);
+      benchmark_clients(test, 20);
+      benchmark_clients(test, 100);
+    }
+  else
+    {
+      test_clients(test, 1, false);
+      test_clients(test, 3, false);
+      test_clients(test, 10, false);
+      test_clients(test, 3, true);
+      test_leaderless_clients(test, 2);
+      test_leaderless_clients(test, 4);
+      test_long_client_id(test, 40);
+      test_long_client_id(test, 64);
+      test_long_client_id(test, 65);
+      test_long_client_id(test, 300);
+      test_reset_after_restart(test);
+    }
+
+  return test.finish();
+}
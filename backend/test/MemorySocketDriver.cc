@@ -0,0 +1,742 @@
+// MemorySocketDriver.cc --- Sockets of a simulated network
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sstream>
+
+#include "MemorySocketDriver.hh"
+#include "TestUtil.hh"
+
+using namespace std;
+
+//! Time of the start of the simulation.
+#define START_TIME (1000000)
+
+
+//! Creates a network without latency, loss or partitions.
+MemoryNetwork::MemoryNetwork() :
+  current_ms(0),
+  next_seq(0),
+  next_socket_id(1),
+  min_latency(0),
+  max_latency(0),
+  loss(0),
+  window(0),
+  bytes_sent(0),
+  num_writes(0),
+  num_reads(0),
+  num_connects(0)
+{
+}
+
+
+//! Destructs the network.
+/*!
+ *  \pre All sockets and servers of the network are deleted.
+ */
+MemoryNetwork::~MemoryNetwork()
+{
+}
+
+
+//! Returns the current virtual time in seconds.
+time_t
+MemoryNetwork::get_time() const
+{
+  return START_TIME + current_ms / 1000;
+}
+
+
+//! Returns the current virtual time in ms since the start of the simulation.
+gint64
+MemoryNetwork::get_current_ms() const
+{
+  return current_ms;
+}
+
+
+//! Processes all events up to the specified virtual time.
+void
+MemoryNetwork::run(gint64 until_ms)
+{
+  while (!events.empty() && events.begin()->time <= until_ms)
+    {
+      Event event = *events.begin();
+      events.erase(events.begin());
+
+      current_ms = event.time;
+      dispatch(event);
+    }
+
+  if (until_ms > current_ms)
+    {
+      current_ms = until_ms;
+    }
+}
+
+
+//! Sets the range of the latency of all connections.
+void
+MemoryNetwork::set_latency(int min_ms, int max_ms)
+{
+  min_latency = min_ms;
+  max_latency = max_ms;
+}
+
+
+//! Sets the percentage of writes that must be retransmitted.
+void
+MemoryNetwork::set_loss(int percent)
+{
+  loss = percent;
+}
+
+
+//! Sets the number of bytes of a connection that can be written before they are read.
+/*!
+ *  A write to a connection of which the other end does not read is
+ *  partial, and the socket only becomes writable again once data is
+ *  read. A window of 0 does not limit writes.
+ */
+void
+MemoryNetwork::set_window(int bytes)
+{
+  window = bytes;
+}
+
+
+//! Moves a host to the specified partition.
+/*!
+ *  Hosts in different partitions cannot connect to each other, and the
+ *  data of their existing connections is held back.
+ */
+void
+MemoryNetwork::set_partition(const string &host, int partition)
+{
+  partitions[host] = partition;
+}
+
+
+//! Moves all hosts back into a single partition.
+void
+MemoryNetwork::heal_partitions()
+{
+  partitions.clear();
+}
+
+
+//! Makes all writes of the sockets of a host fail, or succeed again.
+void
+MemoryNetwork::set_write_error(const string &host, bool error)
+{
+  if (error)
+    {
+      write_errors.insert(host);
+    }
+  else
+    {
+      write_errors.erase(host);
+    }
+}
+
+
+//! Returns the number of bytes written to all sockets.
+gint64
+MemoryNetwork::get_bytes_sent() const
+{
+  return bytes_sent;
+}
+
+
+//! Returns the number of writes to all sockets.
+gint64
+MemoryNetwork::get_num_writes() const
+{
+  return num_writes;
+}
+
+
+//! Returns the number of reads from all sockets that returned data.
+gint64
+MemoryNetwork::get_num_reads() const
+{
+  return num_reads;
+}
+
+
+//! Returns the number of connection attempts.
+int
+MemoryNetwork::get_num_connects() const
+{
+  return num_connects;
+}
+
+
+//! Resets the traffic counters.
+void
+MemoryNetwork::reset_counters()
+{
+  bytes_sent = 0;
+  num_writes = 0;
+  num_reads = 0;
+  num_connects = 0;
+}
+
+
+//! Schedules an event of a socket after the specified delay.
+void
+MemoryNetwork::schedule(MemorySocket *socket, EventType type, gint64 delay)
+{
+  Event event;
+  event.time = current_ms + delay;
+  event.seq = next_seq++;
+  event.socket_id = socket->id;
+  event.type = type;
+
+  events.insert(event);
+}
+
+
+//! Processes an event.
+/*!
+ *  The listener of a socket may delete the socket, so the socket is
+ *  looked up again after each notification.
+ */
+void
+MemoryNetwork::dispatch(const Event &event)
+{
+  MemorySocket *socket = find_socket(event.socket_id);
+  if (socket == NULL || socket->closed)
+    {
+      return;
+    }
+
+  switch (event.type)
+    {
+    case EVENT_CONNECT:
+      accept(socket);
+      break;
+
+    case EVENT_CONNECTED:
+      socket->connected = true;
+      if (socket->listener != NULL)
+        {
+          socket->listener->socket_connected(socket, socket->user_data);
+        }
+      break;
+
+    case EVENT_DELIVER:
+      deliver(socket);
+      break;
+
+    case EVENT_IO:
+      if (!socket->input.empty())
+        {
+          if (socket->watch_readable && socket->listener != NULL)
+            {
+              socket->listener->socket_io(socket, socket->user_data);
+
+              socket = find_socket(event.socket_id);
+              if (socket != NULL && !socket->closed && socket->watch_readable && !socket->input.empty())
+                {
+                  schedule(socket, EVENT_IO, 0);
+                }
+            }
+        }
+      else if (socket->peer_closed && !socket->closed_notified)
+        {
+          socket->closed_notified = true;
+          if (socket->listener != NULL)
+            {
+              socket->listener->socket_closed(socket, socket->user_data);
+            }
+        }
+      break;
+
+    case EVENT_WRITABLE:
+      if (socket->connected && socket->watch_writable && socket->listener != NULL)
+        {
+          socket->listener->socket_writable(socket, socket->user_data);
+
+          socket = find_socket(event.socket_id);
+          if (socket != NULL && !socket->closed && socket->watch_writable)
+            {
+              schedule(socket, EVENT_WRITABLE, 1);
+            }
+        }
+      break;
+
+    case EVENT_PEER_CLOSED:
+      if (!socket->in_flight.empty())
+        {
+          // Data of the other end is held back by a partition.
+          schedule(socket, EVENT_PEER_CLOSED, RETRANSMIT_TIMEOUT);
+        }
+      else
+        {
+          socket->peer_closed = true;
+          schedule(socket, EVENT_IO, 0);
+        }
+      break;
+    }
+}
+
+
+//! Starts connecting a socket to the specified host and port.
+void
+MemoryNetwork::connect(MemorySocket *socket, const string &hostname, int port)
+{
+  num_connects++;
+
+  socket->peer_host = hostname;
+  socket->port = port;
+
+  schedule(socket, EVENT_CONNECT,
+           is_partitioned(socket->host, hostname) ? CONNECT_TIMEOUT : get_delay());
+}
+
+
+//! Completes a connection attempt of a socket.
+/*!
+ *  The connection fails if nobody listens at the port or if the hosts
+ *  are in different partitions. Otherwise, the server accepts the
+ *  connection, and the socket is notified after another latency.
+ */
+void
+MemoryNetwork::accept(MemorySocket *socket)
+{
+  stringstream ss;
+  ss << socket->peer_host << ":" << socket->port;
+
+  map<string, MemorySocketServer *>::iterator i = servers.find(ss.str());
+
+  if (i == servers.end() || is_partitioned(socket->host, socket->peer_host))
+    {
+      socket->closed_notified = true;
+      if (socket->listener != NULL)
+        {
+          socket->listener->socket_closed(socket, socket->user_data);
+        }
+      return;
+    }
+
+  MemorySocketServer *server = i->second;
+  MemorySocket *con = new MemorySocket(this, server->host);
+
+  con->peer_id = socket->id;
+  con->peer_host = socket->host;
+  con->connected = true;
+  socket->peer_id = con->id;
+
+  // The socket must be connected before data of the server arrives.
+  gint64 delay = get_delay();
+  con->last_arrival = current_ms + delay;
+  schedule(socket, EVENT_CONNECTED, delay);
+
+  if (server->listener != NULL)
+    {
+      server->listener->socket_accepted(server, con);
+    }
+  else
+    {
+      delete con;
+    }
+}
+
+
+//! Moves data that has arrived at a socket to its input.
+void
+MemoryNetwork::deliver(MemorySocket *socket)
+{
+  if (socket->in_flight.empty())
+    {
+      return;
+    }
+
+  if (is_partitioned(socket->host, socket->peer_host))
+    {
+      schedule(socket, EVENT_DELIVER, RETRANSMIT_TIMEOUT);
+      return;
+    }
+
+  while (!socket->in_flight.empty() && socket->in_flight.front().time <= current_ms)
+    {
+      socket->input += socket->in_flight.front().data;
+      socket->in_flight.pop_front();
+    }
+
+  if (!socket->input.empty())
+    {
+      schedule(socket, EVENT_IO, 0);
+    }
+}
+
+
+//! Sends data from a socket to the other end of its connection.
+/*!
+ *  Data arrives in order, so data that is lost delays all data that is
+ *  sent after it.
+ */
+void
+MemoryNetwork::send(MemorySocket *socket, const char *data, int size)
+{
+  bytes_sent += size;
+  num_writes++;
+
+  MemorySocket *peer = find_socket(socket->peer_id);
+  if (peer == NULL)
+    {
+      return;
+    }
+
+  gint64 delay = get_delay();
+
+  Chunk chunk;
+  chunk.time = MAX(current_ms + delay, socket->last_arrival);
+  if (loss > 0 && TestUtil::random(100) < loss)
+    {
+      chunk.time += RETRANSMIT_TIMEOUT;
+    }
+  chunk.data.assign(data, size);
+
+  socket->last_arrival = chunk.time;
+  peer->in_flight.push_back(chunk);
+  peer->unread += size;
+
+  schedule(peer, EVENT_DELIVER, chunk.time - current_ms);
+}
+
+
+//! Returns the number of bytes that can be written to a socket.
+int
+MemoryNetwork::get_window_space(MemorySocket *socket) const
+{
+  MemorySocket *peer = find_socket(socket->peer_id);
+  if (window == 0 || peer == NULL)
+    {
+      return G_MAXINT;
+    }
+  return MAX(window - peer->unread, 0);
+}
+
+
+//! Notifies the other end of the connection of a socket that it is closed.
+void
+MemoryNetwork::close(MemorySocket *socket)
+{
+  MemorySocket *peer = find_socket(socket->peer_id);
+  if (peer != NULL)
+    {
+      gint64 delay = get_delay();
+      gint64 time = MAX(current_ms + delay, socket->last_arrival);
+      schedule(peer, EVENT_PEER_CLOSED, time - current_ms);
+    }
+}
+
+
+//! Returns the latency of a write.
+gint64
+MemoryNetwork::get_delay()
+{
+  int delay = min_latency;
+  if (max_latency > min_latency)
+    {
+      delay += TestUtil::random(max_latency - min_latency + 1);
+    }
+  return delay;
+}
+
+
+//! Returns whether two hosts are in different partitions.
+bool
+MemoryNetwork::is_partitioned(const string &host1, const string &host2) const
+{
+  map<string, int>::const_iterator i1 = partitions.find(host1);
+  map<string, int>::const_iterator i2 = partitions.find(host2);
+
+  int p1 = i1 != partitions.end() ? i1->second : 0;
+  int p2 = i2 != partitions.end() ? i2->second : 0;
+
+  return p1 != p2;
+}
+
+
+//! Adds a socket to the network.
+void
+MemoryNetwork::add_socket(MemorySocket *socket)
+{
+  socket->id = next_socket_id++;
+  sockets[socket->id] = socket;
+}
+
+
+//! Removes a socket from the network.
+void
+MemoryNetwork::remove_socket(MemorySocket *socket)
+{
+  sockets.erase(socket->id);
+}
+
+
+//! Returns the socket with the specified ID, or NULL if it was deleted.
+MemorySocket *
+MemoryNetwork::find_socket(int id) const
+{
+  map<int, MemorySocket *>::const_iterator i = sockets.find(id);
+  return i != sockets.end() ? i->second : NULL;
+}
+
+
+//! Lets a server listen at the specified port of its host.
+bool
+MemoryNetwork::add_server(MemorySocketServer *server, int port)
+{
+  stringstream ss;
+  ss << server->host << ":" << port;
+
+  if (servers.find(ss.str()) != servers.end())
+    {
+      return false;
+    }
+
+  server->address = ss.str();
+  servers[server->address] = server;
+  return true;
+}
+
+
+//! Stops a server listening.
+void
+MemoryNetwork::remove_server(MemorySocketServer *server)
+{
+  if (server->address != "")
+    {
+      servers.erase(server->address);
+      server->address = "";
+    }
+}
+
+
+//! Creates an unconnected socket.
+MemorySocket::MemorySocket(MemoryNetwork *network, const string &host) :
+  network(network),
+  host(host),
+  id(0),
+  peer_id(0),
+  port(0),
+  unread(0),
+  connected(false),
+  watch_readable(true),
+  watch_writable(false),
+  closed(false),
+  peer_closed(false),
+  closed_notified(false),
+  last_arrival(0)
+{
+  user_data = NULL;
+  network->add_socket(this);
+}
+
+
+//! Destructs the socket.
+MemorySocket::~MemorySocket()
+{
+  close();
+  network->remove_socket(this);
+}
+
+
+//! Creates a connection to the specified host and port.
+void
+MemorySocket::connect(const string &hostname, int port)
+{
+  network->connect(this, hostname, port);
+}
+
+
+//! Reads data from the connection.
+/*!
+ *  Reading 0 bytes means that the connection was closed.
+ */
+void
+MemorySocket::read(void *buf, int count, int &bytes_read)
+{
+  bytes_read = MIN(count, (int)input.size());
+
+  memcpy(buf, input.data(), bytes_read);
+  input.erase(0, bytes_read);
+  unread -= bytes_read;
+
+  if (bytes_read > 0)
+    {
+      network->num_reads++;
+    }
+}
+
+
+//! Writes data to the connection.
+/*!
+ *  Nothing is written until the connection is established, and no more
+ *  than the window of the network allows.
+ */
+void
+MemorySocket::write(void *buf, int count, int &bytes_written)
+{
+  bytes_written = 0;
+
+  if (network->write_errors.count(host) > 0)
+    {
+      throw SocketException("write error");
+    }
+
+  if (connected && !closed)
+    {
+      bytes_written = MIN(count, network->get_window_space(this));
+      if (bytes_written > 0)
+        {
+          network->send(this, (const char *)buf, bytes_written);
+        }
+    }
+}
+
+
+//! Writes data from several buffers to the connection.
+void
+MemorySocket::write(const SocketBuffer *buffers, int count, int &bytes_written)
+{
+  bytes_written = 0;
+
+  if (network->write_errors.count(host) > 0)
+    {
+      throw SocketException("write error");
+    }
+
+  if (connected && !closed)
+    {
+      int space = network->get_window_space(this);
+
+      string data;
+      for (int i = 0; i < count && (int)data.size() < space; i++)
+        {
+          data.append((const char *)buffers[i].data, MIN(buffers[i].size, space - (int)data.size()));
+        }
+
+      if (!data.empty())
+        {
+          network->send(this, data.data(), data.size());
+        }
+      bytes_written = data.size();
+    }
+}
+
+
+//! Selects whether the listener is notified that the connection is readable or writable.
+void
+MemorySocket::set_watch_events(bool readable, bool writable)
+{
+  watch_readable = readable;
+  if (readable && (!input.empty() || peer_closed))
+    {
+      network->schedule(this, MemoryNetwork::EVENT_IO, 0);
+    }
+
+  if (writable && !watch_writable)
+    {
+      network->schedule(this, MemoryNetwork::EVENT_WRITABLE, 0);
+    }
+  watch_writable = writable;
+}
+
+
+//! Returns whether the other end of the connection runs as the same user.
+bool
+MemorySocket::is_same_user()
+{
+  return false;
+}
+
+
+//! Closes the connection.
+void
+MemorySocket::close()
+{
+  if (!closed)
+    {
+      closed = true;
+      network->close(this);
+
+      input.clear();
+      in_flight.clear();
+      unread = 0;
+    }
+}
+
+
+//! Creates a server that does not listen yet.
+MemorySocketServer::MemorySocketServer(MemoryNetwork *network, const string &host) :
+  network(network),
+  host(host)
+{
+}
+
+
+//! Stops listening.
+MemorySocketServer::~MemorySocketServer()
+{
+  network->remove_server(this);
+}
+
+
+//! Listens at the specified port.
+void
+MemorySocketServer::listen(int port)
+{
+  if (!network->add_server(this, port))
+    {
+      throw SocketException("address already in use");
+    }
+}
+
+
+//! Creates a driver for the specified host.
+MemorySocketDriver::MemorySocketDriver(MemoryNetwork *network, const string &host) :
+  network(network),
+  host(host)
+{
+}
+
+
+//! Creates a new socket.
+ISocket *
+MemorySocketDriver::create_socket()
+{
+  return new MemorySocket(network, host);
+}
+
+
+//! Creates a new listen socket.
+ISocketServer *
+MemorySocketDriver::create_server()
+{
+  return new MemorySocketServer(network, host);
+}
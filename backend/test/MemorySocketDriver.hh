@@ -0,0 +1,285 @@
+// MemorySocketDriver.hh --- Sockets of a simulated network
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef MEMORYSOCKETDRIVER_HH
+#define MEMORYSOCKETDRIVER_HH
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+#include <glib.h>
+
+#include "SocketDriver.hh"
+#include "TimeSource.hh"
+
+class MemorySocket;
+class MemorySocketServer;
+
+//! A simulated network with a virtual clock.
+/*!
+ *  All sockets of the network deliver their events from a single event
+ *  queue, in the order of their virtual time. Data is delivered after a
+ *  latency, or after a retransmission timeout if it is lost. A
+ *  connection between hosts in different partitions does not deliver
+ *  data until the partition is healed.
+ */
+class MemoryNetwork : public TimeSource
+{
+public:
+  MemoryNetwork();
+  virtual ~MemoryNetwork();
+
+  time_t get_time() const;
+  gint64 get_current_ms() const;
+  void run(gint64 until_ms);
+
+  void set_latency(int min_ms, int max_ms);
+  void set_loss(int percent);
+  void set_window(int bytes);
+  void set_partition(const std::string &host, int partition);
+  void heal_partitions();
+  void set_write_error(const std::string &host, bool error);
+
+  gint64 get_bytes_sent() const;
+  gint64 get_num_writes() const;
+  gint64 get_num_reads() const;
+  int get_num_connects() const;
+  void reset_counters();
+
+private:
+  //! Type of a socket event.
+  enum EventType
+    {
+      EVENT_CONNECT,
+      EVENT_CONNECTED,
+      EVENT_DELIVER,
+      EVENT_IO,
+      EVENT_WRITABLE,
+      EVENT_PEER_CLOSED,
+    };
+
+  //! An event of a socket.
+  struct Event
+  {
+    gint64 time;
+    guint64 seq;
+    int socket_id;
+    EventType type;
+
+    bool operator<(const Event &other) const
+    {
+      return time < other.time || (time == other.time && seq < other.seq);
+    }
+  };
+
+  //! Data written to a socket that is not yet delivered to its peer.
+  struct Chunk
+  {
+    gint64 time;
+    std::string data;
+  };
+
+  void schedule(MemorySocket *socket, EventType type, gint64 delay);
+  void dispatch(const Event &event);
+  void connect(MemorySocket *socket, const std::string &hostname, int port);
+  void accept(MemorySocket *socket);
+  void deliver(MemorySocket *socket);
+  void send(MemorySocket *socket, const char *data, int size);
+  int get_window_space(MemorySocket *socket) const;
+  void close(MemorySocket *socket);
+  gint64 get_delay();
+  bool is_partitioned(const std::string &host1, const std::string &host2) const;
+
+  void add_socket(MemorySocket *socket);
+  void remove_socket(MemorySocket *socket);
+  MemorySocket *find_socket(int id) const;
+  bool add_server(MemorySocketServer *server, int port);
+  void remove_server(MemorySocketServer *server);
+
+private:
+  //! Retransmission timeout in ms.
+  static const int RETRANSMIT_TIMEOUT = 1000;
+
+  //! Connect timeout in ms.
+  static const int CONNECT_TIMEOUT = 5000;
+
+  //! Current virtual time in ms.
+  gint64 current_ms;
+
+  //! Sequence number of the next event.
+  guint64 next_seq;
+
+  //! Pending events.
+  std::set<Event> events;
+
+  //! All sockets by ID.
+  std::map<int, MemorySocket *> sockets;
+
+  //! ID of the next socket.
+  int next_socket_id;
+
+  //! Listening servers by host and port.
+  std::map<std::string, MemorySocketServer *> servers;
+
+  //! Partition of each host. Hosts that are not listed are in partition 0.
+  std::map<std::string, int> partitions;
+
+  //! Hosts of which all writes fail.
+  std::set<std::string> write_errors;
+
+  //! Minimum latency in ms.
+  int min_latency;
+
+  //! Maximum latency in ms.
+  int max_latency;
+
+  //! Percentage of lost writes.
+  int loss;
+
+  //! Maximum number of written bytes of a connection that are not yet read, 0 for no limit.
+  int window;
+
+  //! Number of bytes written to all sockets.
+  gint64 bytes_sent;
+
+  //! Number of writes to all sockets.
+  gint64 num_writes;
+
+  //! Number of reads from all sockets that returned data.
+  gint64 num_reads;
+
+  //! Number of connection attempts.
+  int num_connects;
+
+  friend class MemorySocket;
+  friend class MemorySocketServer;
+};
+
+
+//! A socket of a simulated network.
+class MemorySocket : public ISocket
+{
+public:
+  MemorySocket(MemoryNetwork *network, const std::string &host);
+  virtual ~MemorySocket();
+
+  void connect(const std::string &hostname, int port);
+  void read(void *buf, int count, int &bytes_read);
+  void write(void *buf, int count, int &bytes_written);
+  void write(const SocketBuffer *buffers, int count, int &bytes_written);
+  void set_watch_events(bool readable, bool writable);
+  bool is_same_user();
+  void close();
+
+private:
+  //! The network of the socket.
+  MemoryNetwork *network;
+
+  //! Host of the socket.
+  std::string host;
+
+  //! ID of the socket in the network.
+  int id;
+
+  //! ID of the other end of the connection, 0 if not connected.
+  int peer_id;
+
+  //! Host of the other end of the connection.
+  std::string peer_host;
+
+  //! Port to which the socket connects.
+  int port;
+
+  //! Data written by the other end, not yet delivered.
+  std::deque<MemoryNetwork::Chunk> in_flight;
+
+  //! Delivered data that is not yet read.
+  std::string input;
+
+  //! Number of bytes written by the other end that are not yet read.
+  int unread;
+
+  //! Is the connection established?
+  bool connected;
+
+  //! Does the listener want to be notified of incoming data?
+  bool watch_readable;
+
+  //! Does the listener want to be notified that the socket is writable?
+  bool watch_writable;
+
+  //! Was the socket closed locally?
+  bool closed;
+
+  //! Was the connection closed by the other end?
+  bool peer_closed;
+
+  //! Was the listener notified that the connection was closed?
+  bool closed_notified;
+
+  //! Time at which the last data written to the other end arrives.
+  gint64 last_arrival;
+
+  friend class MemoryNetwork;
+};
+
+
+//! A listening socket of a simulated network.
+class MemorySocketServer : public ISocketServer
+{
+public:
+  MemorySocketServer(MemoryNetwork *network, const std::string &host);
+  virtual ~MemorySocketServer();
+
+  void listen(int port);
+
+private:
+  //! The network of the server.
+  MemoryNetwork *network;
+
+  //! Host of the server.
+  std::string host;
+
+  //! Host and port at which the server listens, empty if not listening.
+  std::string address;
+
+  friend class MemoryNetwork;
+};
+
+
+//! Creates sockets of a single host of a simulated network.
+class MemorySocketDriver : public SocketDriver
+{
+public:
+  MemorySocketDriver(MemoryNetwork *network, const std::string &host);
+
+  ISocket *create_socket();
+  ISocketServer *create_server();
+
+private:
+  //! The network of the host.
+  MemoryNetwork *network;
+
+  //! Name of the host.
+  std::string host;
+};
+
+#endif // MEMORYSOCKETDRIVER_HH
@@ -0,0 +1,635 @@
+// StatsReaderTest.cc --- Tests and benchmarks of the statistics reader
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "Util.hh"
+#include "StatsReader.hh"
+#include "StatsCodec.hh"
+
+#include "TestUtil.hh"
+
+using namespace std;
+
+typedef IStatistics::DailyStats DailyStats;
+
+//! Number of days of the synthetic history of the benchmark.
+#define HISTORY_DAYS (20 * 365 + 5)
+
+//! Number of mutated copies of each file of the corpus.
+#define FUZZ_ITERATIONS (500)
+
+//! Expected result of reading a file of the corpus.
+struct CorpusResult
+{
+  //! Name of the file.
+  const char *name;
+
+  //! Is the file recognized as a statistics file?
+  bool opens;
+
+  //! Number of days.
+  int days;
+
+  //! Number of damaged records.
+  int damaged;
+};
+
+static const CorpusResult corpus_results[] =
+  {
+    { "valid-v4.txt",             true,  3, 0 },
+    { "valid-v3.txt",             true,  1, 0 },
+    { "valid-crlf.txt",           true,  2, 0 },
+    { "duplicate-day.txt",        true,  2, 0 },
+    { "damaged-date.txt",         true,  2, 1 },
+    { "damaged-break-index.txt",  true,  1, 2 },
+    { "damaged-counters.txt",     true,  1, 5 },
+    { "damaged-hour.txt",         true,  1, 2 },
+    { "truncated.txt",            true,  1, 1 },
+    { "truncated-counter.txt",    true,  1, 1 },
+    { "garbage.txt",              true,  1, 2 },
+    { "bad-version.txt",          false, 0, 0 },
+    { "no-header.txt",            false, 0, 0 },
+    { "empty.txt",                false, 0, 0 },
+  };
+
+//! Characters that are likely to change the meaning of a statistics file.
+/*!
+ *  The terminating null character is used as well.
+ */
+static const char fuzz_chars[] = "0123456789 -\t\r\nDBHMmRG\xff";
+
+
+//! Returns the path of a file of the corpus.
+/*!
+ *  The corpus is found relative to the source directory, which is set
+ *  by make check.
+ */
+static string
+get_corpus_path(const string &name)
+{
+  const char *srcdir = g_getenv("srcdir");
+
+  gchar *path = g_build_filename(srcdir != NULL ? srcdir : ".", "stats-corpus", name.c_str(), NULL);
+  string ret = path;
+  g_free(path);
+
+  return ret;
+}
+
+
+//! Returns the names of all files of the corpus.
+static vector<string>
+get_corpus_names()
+{
+  vector<string> names;
+
+  GDir *dir = g_dir_open(get_corpus_path("").c_str(), 0, NULL);
+  if (dir != NULL)
+    {
+      const gchar *file;
+      while ((file = g_dir_read_name(dir)) != NULL)
+        {
+          names.push_back(file);
+        }
+      g_dir_close(dir);
+    }
+
+  return names;
+}
+
+
+//! Writes data to a file in the scratch home directory.
+/*!
+ *  \return the path of the file.
+ */
+static string
+write_file(const string &name, const string &data)
+{
+  string path = Util::get_home_directory() + G_DIR_SEPARATOR_S + name;
+
+  ofstream file(path.c_str(), ios::out | ios::binary | ios::trunc);
+  file.write(data.data(), data.size());
+
+  return path;
+}
+
+
+//! Reads all days of a statistics file.
+/*!
+ *  \return whether the file is a statistics file.
+ */
+static bool
+read_days(const string &path, vector<DailyStats> &days, int &damaged)
+{
+  days.clear();
+  damaged = 0;
+
+  StatsReader reader;
+  if (!reader.open(path))
+    {
+      return false;
+    }
+
+  DailyStats stats;
+  while (reader.next(stats))
+    {
+      days.push_back(stats);
+    }
+
+  damaged = reader.get_damaged_count();
+  return true;
+}
+
+
+//! Returns whether the date and resolution of a day are in range.
+static bool
+is_sane(const DailyStats &stats)
+{
+  const struct tm *dates[] = { &stats.start, &stats.stop };
+
+  for (int i = 0; i < 2; i++)
+    {
+      const struct tm *tm = dates[i];
+      if (tm->tm_mday < 0 || tm->tm_mday > 31 || tm->tm_mon < 0 || tm->tm_mon > 11 ||
+          tm->tm_year < 0 || tm->tm_year > 8099 || tm->tm_hour < 0 || tm->tm_hour > 23 ||
+          tm->tm_min < 0 || tm->tm_min > 59)
+        {
+          return false;
+        }
+    }
+
+  return stats.resolution >= 0 && stats.resolution < IStatistics::STATS_RESOLUTION_SIZEOF;
+}
+
+
+//! Writes a day in the text format, as the statistics do.
+static void
+format_day(ostream &out, const DailyStats &stats)
+{
+  out << "D "
+      << stats.start.tm_mday << " " << stats.start.tm_mon << " " << stats.start.tm_year << " "
+      << stats.start.tm_hour << " " << stats.start.tm_min << " "
+      << stats.stop.tm_mday << " " << stats.stop.tm_mon << " " << stats.stop.tm_year << " "
+      << stats.stop.tm_hour << " " << stats.stop.tm_min << "\n";
+
+  for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+    {
+      out << "B " << i << " " << IStatistics::STATS_BREAKVALUE_SIZEOF << " ";
+      for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+        {
+          out << stats.break_stats[i][j] << " ";
+        }
+      out << "\n";
+    }
+
+  out << "m " << IStatistics::STATS_VALUE_SIZEOF << " ";
+  for (int j = 0; j < IStatistics::STATS_VALUE_SIZEOF; j++)
+    {
+      out << stats.misc_stats[j] << " ";
+    }
+  out << "\n";
+
+  for (int h = 0; h < IStatistics::STATS_HOURS; h++)
+    {
+      if (stats.get_hourly_value(h, IStatistics::STATS_HOURLY_ACTIVE_TIME) != 0)
+        {
+          out << "H " << h << " " << IStatistics::STATS_HOURLY_SIZEOF << " ";
+          for (int j = 0; j < IStatistics::STATS_HOURLY_SIZEOF; j++)
+            {
+              out << stats.get_hourly_value(h, IStatistics::StatsHourlyValueType(j)) << " ";
+            }
+          out << "\n";
+        }
+    }
+}
+
+
+//! Generates a history of working days and lighter weekends.
+static void
+generate_history(vector<DailyStats> &days, int num_days)
+{
+  days.clear();
+
+  struct tm date;
+  memset((void *)&date, 0, sizeof(date));
+  date.tm_year = 106;
+  date.tm_mday = 1;
+  date.tm_hour = 12;
+  date.tm_isdst = -1;
+
+  for (int d = 0; d < num_days; d++)
+    {
+      mktime(&date);
+
+      DailyStats stats;
+
+      bool weekend = date.tm_wday == 0 || date.tm_wday == 6;
+      int first_hour = 8 + TestUtil::random(3);
+      int hours = weekend ? 1 + TestUtil::random(3) : 6 + TestUtil::random(5);
+
+      stats.start = date;
+      stats.start.tm_hour = first_hour;
+      stats.start.tm_min = TestUtil::random(60);
+      stats.stop = date;
+      stats.stop.tm_hour = first_hour + hours;
+      stats.stop.tm_min = TestUtil::random(60);
+
+      for (int h = first_hour; h < first_hour + hours; h++)
+        {
+          IStatistics::HourlyStats &hs = stats.get_hourly_stats(h);
+          hs[IStatistics::STATS_HOURLY_ACTIVE_TIME] = 600 + TestUtil::random(3000);
+          hs[IStatistics::STATS_HOURLY_MOUSE_MOVEMENT] = TestUtil::random(300000);
+          hs[IStatistics::STATS_HOURLY_CLICKS] = TestUtil::random(1000);
+          hs[IStatistics::STATS_HOURLY_KEYSTROKES] = TestUtil::random(10000);
+          hs[IStatistics::STATS_HOURLY_BREAKS_PROMPTED] = TestUtil::random(20);
+          hs[IStatistics::STATS_HOURLY_BREAKS_TAKEN] = TestUtil::random(20);
+          hs[IStatistics::STATS_HOURLY_BREAKS_SKIPPED] = TestUtil::random(3);
+
+          stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME] += hs[IStatistics::STATS_HOURLY_ACTIVE_TIME];
+          stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_MOUSE_MOVEMENT] += hs[IStatistics::STATS_HOURLY_MOUSE_MOVEMENT];
+          stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_CLICKS] += hs[IStatistics::STATS_HOURLY_CLICKS];
+          stats.misc_stats[IStatistics::STATS_VALUE_TOTAL_KEYSTROKES] += hs[IStatistics::STATS_HOURLY_KEYSTROKES];
+        }
+
+      for (int i = 0; i < BREAK_ID_SIZEOF; i++)
+        {
+          for (int j = 0; j < IStatistics::STATS_BREAKVALUE_SIZEOF; j++)
+            {
+              stats.break_stats[i][j] = TestUtil::random(hours * 10);
+            }
+        }
+
+      days.push_back(stats);
+      date.tm_mday++;
+    }
+}
+
+
+//! Encodes days in the text format.
+static string
+encode_text(const vector<DailyStats> &days)
+{
+  stringstream ss;
+  ss << "WorkRaveStats 4\n";
+
+  for (size_t i = 0; i < days.size(); i++)
+    {
+      format_day(ss, days[i]);
+    }
+
+  return ss.str();
+}
+
+
+//! Encodes days in the packed format.
+static string
+encode_packed(const vector<DailyStats> &days)
+{
+  string data;
+  StatsCodec::encode_header(data);
+
+  for (size_t i = 0; i < days.size(); i += StatsCodec::BLOCK_DAYS)
+    {
+      size_t end = MIN(i + StatsCodec::BLOCK_DAYS, days.size());
+      StatsCodec::encode_block(data, vector<DailyStats>(days.begin() + i, days.begin() + end));
+    }
+
+  return data;
+}
+
+
+//! Damages a random part of the data.
+static void
+mutate(string &data)
+{
+  int count = 1 + TestUtil::random(4);
+
+  for (int i = 0; i < count; i++)
+    {
+      size_t pos = TestUtil::random(data.size() + 1);
+      char c = fuzz_chars[TestUtil::random(sizeof(fuzz_chars))];
+
+      switch (TestUtil::random(6))
+        {
+        case 0:
+          if (pos < data.size())
+            {
+              data[pos] = c;
+            }
+          break;
+
+        case 1:
+          data.insert(pos, 1, c);
+          break;
+
+        case 2:
+          data.erase(pos, 1 + TestUtil::random(16));
+          break;
+
+        case 3:
+          if (pos < data.size())
+            {
+              data[pos] ^= 1 << TestUtil::random(8);
+            }
+          break;
+
+        case 4:
+          data.insert(pos, data.substr(pos, 1 + TestUtil::random(64)));
+          break;
+
+        case 5:
+          data.resize(pos);
+          break;
+        }
+    }
+}
+
+
+//! Checks the number of days and damaged records of each file of the corpus.
+static void
+test_corpus(TestUtil &test)
+{
+  for (size_t i = 0; i < sizeof(corpus_results) / sizeof(corpus_results[0]); i++)
+    {
+      const CorpusResult &expected = corpus_results[i];
+      string name = expected.name;
+
+      vector<DailyStats> days;
+      int damaged;
+      bool opens = read_days(get_corpus_path(name), days, damaged);
+
+      test.check(name + ": opens", opens == expected.opens);
+      test.check_equal(name + ": days", days.size(), expected.days);
+      test.check_equal(name + ": damaged records", damaged, expected.damaged);
+    }
+}
+
+
+//! Checks the values of the valid files of the corpus.
+static void
+test_values(TestUtil &test)
+{
+  vector<DailyStats> days;
+  int damaged;
+
+  read_days(get_corpus_path("valid-v4.txt"), days, damaged);
+
+  if (days.size() == 3)
+    {
+      test.check_equal("valid-v4.txt: date", StatsReader::get_date(days[0]), 20130314);
+      test.check_equal("valid-v4.txt: break value", days[0].break_stats[BREAK_ID_REST_BREAK][IStatistics::STATS_BREAKVALUE_TOTAL_OVERDUE], 300);
+      test.check_equal("valid-v4.txt: misc value", days[1].misc_stats[IStatistics::STATS_VALUE_TOTAL_KEYSTROKES], 60112);
+      test.check_equal("valid-v4.txt: hourly value", days[0].get_hourly_value(10, IStatistics::STATS_HOURLY_ACTIVE_TIME), 3600);
+      test.check_equal("valid-v4.txt: resolution", days[2].resolution, IStatistics::STATS_RESOLUTION_MONTH);
+    }
+
+  read_days(get_corpus_path("valid-v3.txt"), days, damaged);
+
+  if (days.size() == 1)
+    {
+      test.check_equal("valid-v3.txt: old misc value", days[0].misc_stats[IStatistics::STATS_VALUE_TOTAL_CLICKS], 0);
+      test.check_equal("valid-v3.txt: active time", days[0].misc_stats[IStatistics::STATS_VALUE_TOTAL_ACTIVE_TIME], 25200);
+    }
+
+  read_days(get_corpus_path("damaged-break-index.txt"), days, damaged);
+
+  if (days.size() == 1)
+    {
+      test.check_equal("damaged-break-index.txt: skipped break", days[0].break_stats[BREAK_ID_REST_BREAK][0], 0);
+      test.check_equal("damaged-break-index.txt: valid break", days[0].break_stats[BREAK_ID_MICRO_BREAK][0], 120);
+    }
+
+  test.clean_home_directory();
+}
+
+
+//! Checks that a line that is too long does not hide the next day.
+static void
+test_long_line(TestUtil &test)
+{
+  vector<DailyStats> history;
+  generate_history(history, 2);
+
+  // Insert the line at the end of the first day.
+  string data = encode_text(history);
+  size_t pos = data.find("\nD ", data.find("\nD ") + 1);
+  data.insert(pos + 1, "m 6 " + string(200 * 1024, '1') + "\n");
+
+  vector<DailyStats> days;
+  int damaged;
+  read_days(write_file("long-line.txt", data), days, damaged);
+
+  test.check_equal("long line: days", days.size(), 2);
+  test.check("long line: damaged records", damaged > 0);
+
+  test.clean_home_directory();
+}
+
+
+//! Reads damaged copies of the corpus and of a packed file.
+/*!
+ *  All days that are read must be within range. Memory errors are
+ *  found by running the test with a memory checker.
+ */
+static void
+test_fuzz(TestUtil &test)
+{
+  vector<string> seeds;
+  vector<string> names = get_corpus_names();
+
+  for (size_t i = 0; i < names.size(); i++)
+    {
+      string data;
+      if (StatsCodec::read_file(get_corpus_path(names[i]), data))
+        {
+          seeds.push_back(data);
+        }
+    }
+
+  test.check("fuzz: corpus found", seeds.size() >= sizeof(corpus_results) / sizeof(corpus_results[0]));
+
+  vector<DailyStats> history;
+  generate_history(history, 2 * StatsCodec::BLOCK_DAYS + 3);
+  seeds.push_back(encode_packed(history));
+  names.push_back("packed");
+
+  for (size_t i = 0; i < seeds.size(); i++)
+    {
+      int sane = 0, insane = 0;
+
+      for (int j = 0; j < FUZZ_ITERATIONS; j++)
+        {
+          string data = seeds[i];
+          mutate(data);
+
+          vector<DailyStats> days;
+          int damaged;
+          read_days(write_file("fuzz.txt", data), days, damaged);
+
+          for (size_t d = 0; d < days.size(); d++)
+            {
+              if (is_sane(days[d]))
+                {
+                  sane++;
+                }
+              else
+                {
+                  insane++;
+                }
+            }
+        }
+
+      stringstream ss;
+      ss << "fuzz " << names[i] << ": " << insane << " of " << sane + insane << " days out of range";
+      test.check(ss.str(), insane == 0);
+    }
+
+  test.clean_home_directory();
+}
+
+
+//! Reports the time and allocations to read a file.
+static void
+benchmark_file(TestUtil &test, const string &what, const string &data, int expected_days)
+{
+  string path = write_file("history", data);
+
+  const int count = 10;
+
+  vector<DailyStats> days;
+  int damaged = 0;
+
+  gint64 best_time = G_MAXINT64;
+  for (int i = 0; i < count; i++)
+    {
+      gint64 start = g_get_monotonic_time();
+
+      StatsReader reader;
+      reader.open(path);
+
+      DailyStats stats;
+      int num_days = 0;
+      while (reader.next(stats))
+        {
+          num_days++;
+        }
+      damaged = reader.get_damaged_count();
+
+      gint64 time = g_get_monotonic_time() - start;
+      best_time = MIN(best_time, time);
+
+      test.check_equal(what + ": days", num_days, expected_days);
+    }
+
+  TestUtil::count_allocations(true);
+
+  StatsReader reader;
+  reader.open(path);
+
+  DailyStats stats;
+  while (reader.next(stats))
+    {
+    }
+
+  TestUtil::count_allocations(false);
+
+  cout << what << ": " << expected_days << " days, "
+       << data.size() << " bytes, "
+       << best_time / 1000 << " ms, "
+       << (double)data.size() / MAX(best_time, 1) << " MB/s, "
+       << TestUtil::get_num_allocations() << " allocations of "
+       << TestUtil::get_allocated_bytes() << " bytes, "
+       << damaged << " damaged records"
+       << endl;
+
+  test.clean_home_directory();
+}
+
+
+//! Reports the time to read a history of 20 years.
+/*!
+ *  The history is read in the text and the packed format, and in the
+ *  text format with damaged lines.
+ */
+static void
+benchmark_history(TestUtil &test)
+{
+  vector<DailyStats> history;
+  generate_history(history, HISTORY_DAYS);
+
+  string text = encode_text(history);
+  benchmark_file(test, "text", text, HISTORY_DAYS);
+
+  // Damage one counter line in a hundred. A damaged date line would
+  // drop its day.
+  string damaged;
+  int num_lines = 0;
+  size_t pos = 0;
+  while (pos < text.size())
+    {
+      size_t end = text.find('\n', pos);
+      end = (end == string::npos) ? text.size() : end + 1;
+
+      string line = text.substr(pos, end - pos);
+      if (line[0] != 'D' && ++num_lines % 100 == 0)
+        {
+          line[line.size() / 2] = 'x';
+        }
+      damaged += line;
+      pos = end;
+    }
+  benchmark_file(test, "damaged text", damaged, HISTORY_DAYS);
+
+  benchmark_file(test, "packed", encode_packed(history), HISTORY_DAYS);
+}
+
+
+int
+main(int argc, char **argv)
+{
+  TestUtil test("statsreader-test");
+
+  bool benchmark = argc > 1 && string(argv[1]) == "--benchmark";
+
+  if (benchmark)
+    {
+      benchmark_history(test);
+    }
+  else
+    {
+      test_corpus(test);
+      test_values(test);
+      test_long_line(test);
+      test_fuzz(test);
+    }
+
+  return test.finish();
+}
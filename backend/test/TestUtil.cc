@@ -0,0 +1,266 @@
+// TestUtil.cc --- Support for the backend tests
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <glib/gstdio.h>
+
+#include "Util.hh"
+#include "TestUtil.hh"
+
+using namespace std;
+
+//! Maximum number of failures that are reported.
+#define MAX_REPORTED_FAILURES (20)
+
+guint32 TestUtil::random_state = 1;
+
+//! Are allocations counted?
+static bool allocations_counted = false;
+
+//! Number of counted allocations.
+static gint64 num_allocations = 0;
+
+//! Number of bytes of the counted allocations.
+static gint64 allocated_bytes = 0;
+
+
+//! Allocates memory, and counts the allocation if requested.
+void *
+operator new(size_t size)
+#if __cplusplus < 201103L
+  throw (std::bad_alloc)
+#endif
+{
+  if (allocations_counted)
+    {
+      num_allocations++;
+      allocated_bytes += size;
+    }
+
+  void *p = malloc(size > 0 ? size : 1);
+  if (p == NULL)
+    {
+      throw std::bad_alloc();
+    }
+  return p;
+}
+
+
+//! Frees memory allocated by operator new.
+void
+operator delete(void *p) throw ()
+{
+  free(p);
+}
+
+
+//! Creates a scratch home directory for the test.
+TestUtil::TestUtil(const string &name)
+  : name(name), checks(0), failures(0)
+{
+  stringstream ss;
+  ss << g_get_tmp_dir() << G_DIR_SEPARATOR_S << name << "-" << getpid();
+  home = ss.str();
+
+  g_mkdir_with_parents(home.c_str(), 0700);
+  Util::set_home_directory(home);
+}
+
+
+//! Removes the scratch home directory.
+TestUtil::~TestUtil()
+{
+  clean_home_directory();
+  g_rmdir(home.c_str());
+}
+
+
+//! Checks a condition.
+void
+TestUtil::check(const string &what, bool ok)
+{
+  checks++;
+
+  if (!ok)
+    {
+      failures++;
+      if (failures <= MAX_REPORTED_FAILURES)
+        {
+          cerr << name << ": FAILED: " << what << endl;
+        }
+    }
+}
+
+
+//! Checks a value.
+void
+TestUtil::check_equal(const string &what, gint64 value, gint64 expected)
+{
+  if (value != expected)
+    {
+      stringstream ss;
+      ss << what << ": " << value << ", expected " << expected;
+      check(ss.str(), false);
+    }
+  else
+    {
+      check(what, true);
+    }
+}
+
+
+//! Reports the result of all checks.
+/*!
+ *  \return the exit status of the test.
+ */
+int
+TestUtil::finish()
+{
+  cout << name << ": " << checks << " checks, " << failures << " failed" << endl;
+  return failures == 0 ? 0 : 1;
+}
+
+
+//! Removes all files from the scratch home directory.
+/*!
+ *  Sub directories and their files are removed as well, and the scratch
+ *  home directory becomes the home directory again.
+ */
+void
+TestUtil::clean_home_directory()
+{
+  GDir *dir = g_dir_open(home.c_str(), 0, NULL);
+  if (dir != NULL)
+    {
+      const gchar *file;
+      while ((file = g_dir_read_name(dir)) != NULL)
+        {
+          gchar *path = g_build_filename(home.c_str(), file, NULL);
+
+          if (g_file_test(path, G_FILE_TEST_IS_DIR))
+            {
+              remove_files(path);
+              g_rmdir(path);
+            }
+          else
+            {
+              g_remove(path);
+            }
+          g_free(path);
+        }
+      g_dir_close(dir);
+    }
+
+  Util::set_home_directory(home);
+}
+
+
+//! Makes a sub directory of the scratch home directory the home directory.
+/*!
+ *  This allows several simulated clients to keep their files apart.
+ */
+void
+TestUtil::select_home_directory(const string &subdir)
+{
+  string path = home + G_DIR_SEPARATOR_S + subdir;
+
+  g_mkdir_with_parents(path.c_str(), 0700);
+  Util::set_home_directory(path);
+}
+
+
+//! Removes all files from a directory.
+void
+TestUtil::remove_files(const string &path)
+{
+  GDir *dir = g_dir_open(path.c_str(), 0, NULL);
+  if (dir != NULL)
+    {
+      const gchar *file;
+      while ((file = g_dir_read_name(dir)) != NULL)
+        {
+          gchar *file_path = g_build_filename(path.c_str(), file, NULL);
+          g_remove(file_path);
+          g_free(file_path);
+        }
+      g_dir_close(dir);
+    }
+}
+
+
+//! Returns a pseudo random number between 0 and range - 1.
+int
+TestUtil::random(int range)
+{
+  random_state = random_state * 1103515245 + 12345;
+  return (int)((random_state >> 8) % (guint32)range);
+}
+
+
+//! Restarts the pseudo random numbers.
+void
+TestUtil::seed(guint32 seed)
+{
+  random_state = seed;
+}
+
+
+//! Starts or stops counting allocations.
+/*!
+ *  The counters are reset when counting starts.
+ */
+void
+TestUtil::count_allocations(bool count)
+{
+  if (count)
+    {
+      num_allocations = 0;
+      allocated_bytes = 0;
+    }
+  allocations_counted = count;
+}
+
+
+//! Returns the number of counted allocations.
+gint64
+TestUtil::get_num_allocations()
+{
+  return num_allocations;
+}
+
+
+//! Returns the number of bytes of the counted allocations.
+gint64
+TestUtil::get_allocated_bytes()
+{
+  return allocated_bytes;
+}
@@ -0,0 +1,71 @@
+// TestUtil.hh --- Support for the backend tests
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef TESTUTIL_HH
+#define TESTUTIL_HH
+
+#include <string>
+
+#include <glib.h>
+
+//! Checks results, and provides random numbers and a scratch home directory.
+/*!
+ *  The random numbers are the same in each run, so that a failure can be
+ *  reproduced. Benchmarks can count the allocations of a test.
+ */
+class TestUtil
+{
+public:
+  TestUtil(const std::string &name);
+  ~TestUtil();
+
+  void check(const std::string &what, bool ok);
+  void check_equal(const std::string &what, gint64 value, gint64 expected);
+  int finish();
+
+  void clean_home_directory();
+  void select_home_directory(const std::string &subdir);
+
+  static int random(int range);
+  static void seed(guint32 seed);
+
+  static void count_allocations(bool count);
+  static gint64 get_num_allocations();
+  static gint64 get_allocated_bytes();
+
+private:
+  static void remove_files(const std::string &path);
+
+  //! Name of the test.
+  std::string name;
+
+  //! Scratch home directory.
+  std::string home;
+
+  //! Number of checks.
+  int checks;
+
+  //! Number of failed checks.
+  int failures;
+
+  //! State of the random number generator.
+  static guint32 random_state;
+};
+
+#endif // TESTUTIL_HH
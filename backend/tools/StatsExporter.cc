@@ -0,0 +1,298 @@
+// StatsExporter.cc --- Export of statistics to external formats
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sstream>
+
+#include "StatsExporter.hh"
+#include "StatsReader.hh"
+
+using namespace std;
+
+//! Comma separated values, one line per day.
+class CsvStatsExporter : public StatsExporter
+{
+public:
+  CsvStatsExporter(ostream &out, Mutex *lock) : StatsExporter(out, lock) {}
+
+  void begin()
+  {
+    vector<string> names = get_field_names();
+
+    stringstream ss;
+    ss << "user";
+    for (vector<string>::iterator i = names.begin(); i != names.end(); i++)
+      {
+        ss << "," << *i;
+      }
+    ss << "\n";
+
+    write(ss.str());
+  }
+
+  void write_day(const string &user, const DailyStats &stats)
+  {
+    vector<gint64> fields;
+    get_fields(stats, fields);
+
+    string quoted;
+    for (string::const_iterator i = user.begin(); i != user.end(); i++)
+      {
+        quoted += *i;
+        if (*i == '"')
+          {
+            quoted += '"';
+          }
+      }
+
+    stringstream ss;
+    ss << "\"" << quoted << "\"";
+    for (vector<gint64>::iterator i = fields.begin(); i != fields.end(); i++)
+      {
+        ss << "," << *i;
+      }
+    ss << "\n";
+
+    write(ss.str());
+  }
+
+  void end()
+  {
+    out.flush();
+  }
+};
+
+
+//! JSON Lines, one object per day.
+class JsonStatsExporter : public StatsExporter
+{
+public:
+  JsonStatsExporter(ostream &out, Mutex *lock) : StatsExporter(out, lock)
+  {
+    names = get_field_names();
+  }
+
+  void begin()
+  {
+  }
+
+  void write_day(const string &user, const DailyStats &stats)
+  {
+    vector<gint64> fields;
+    get_fields(stats, fields);
+
+    string quoted;
+    for (string::const_iterator i = user.begin(); i != user.end(); i++)
+      {
+        if (*i == '"' || *i == '\\')
+          {
+            quoted += '\\';
+          }
+        quoted += *i;
+      }
+
+    stringstream ss;
+    ss << "{\"user\":\"" << quoted << "\"";
+    for (size_t i = 0; i < fields.size(); i++)
+      {
+        ss << ",\"" << names[i] << "\":" << fields[i];
+      }
+    ss << "}\n";
+
+    write(ss.str());
+  }
+
+  void end()
+  {
+    out.flush();
+  }
+
+private:
+  vector<string> names;
+};
+
+
+//! Simple columnar binary format.
+/*!
+ *  The header consists of the magic "WRSC", a version byte, the number
+ *  of columns and the zero terminated column names. The data follows
+ *  in chunks of at most CHUNK_DAYS rows: a row count followed by all
+ *  values of the first column, all values of the second column, etc.
+ *  All integers are 64 bit little endian, except for the row and column
+ *  counts, which are 32 bit.
+ */
+class ColumnarStatsExporter : public StatsExporter
+{
+public:
+  ColumnarStatsExporter(ostream &out, Mutex *lock) : StatsExporter(out, lock), rows(0)
+  {
+    names = get_field_names();
+    columns.resize(names.size());
+  }
+
+  void begin()
+  {
+    string header("WRSC\001", 5);
+    pack_uint32(header, names.size());
+    for (vector<string>::iterator i = names.begin(); i != names.end(); i++)
+      {
+        header.append(i->c_str(), i->size() + 1);
+      }
+
+    write(header);
+  }
+
+  void write_day(const string &user, const DailyStats &stats)
+  {
+    (void) user;
+
+    vector<gint64> fields;
+    get_fields(stats, fields);
+
+    for (size_t i = 0; i < fields.size(); i++)
+      {
+        columns[i].push_back(fields[i]);
+      }
+
+    if (++rows == CHUNK_DAYS)
+      {
+        flush_chunk();
+      }
+  }
+
+  void end()
+  {
+    flush_chunk();
+    out.flush();
+  }
+
+private:
+  static const int CHUNK_DAYS = 1024;
+
+  void flush_chunk()
+  {
+    if (rows == 0)
+      {
+        return;
+      }
+
+    string chunk;
+    chunk.reserve(4 + rows * columns.size() * 8);
+
+    pack_uint32(chunk, rows);
+    for (size_t c = 0; c < columns.size(); c++)
+      {
+        for (int r = 0; r < rows; r++)
+          {
+            guint64 value = columns[c][r];
+            for (int b = 0; b < 8; b++)
+              {
+                chunk.push_back((char)(value & 0xff));
+                value >>= 8;
+              }
+          }
+        columns[c].clear();
+      }
+    rows = 0;
+
+    write(chunk);
+  }
+
+  static void pack_uint32(string &data, guint32 value)
+  {
+    for (int b = 0; b < 4; b++)
+      {
+        data.push_back((char)(value & 0xff));
+        value >>= 8;
+      }
+  }
+
+private:
+  vector<string> names;
+  vector<vector<gint64> > columns;
+  int rows;
+};
+
+
+StatsExporter *
+StatsExporter::create(Format format, ostream &out, Mutex *lock)
+{
+  switch (format)
+    {
+    case FORMAT_CSV:
+      return new CsvStatsExporter(out, lock);
+
+    case FORMAT_JSON:
+      return new JsonStatsExporter(out, lock);
+
+    case FORMAT_COLUMNAR:
+      return new ColumnarStatsExporter(out, lock);
+    }
+
+  return NULL;
+}
+
+
+StatsExporter::StatsExporter(ostream &out, Mutex *lock) :
+  out(out),
+  lock(lock)
+{
+}
+
+
+//! Writes data to the output stream.
+void
+StatsExporter::write(const string &data)
+{
+  if (lock != NULL)
+    {
+      lock->lock();
+    }
+
+  out.write(data.data(), data.size());
+
+  if (lock != NULL)
+    {
+      lock->unlock();
+    }
+}
+
+
+//! Returns the names of all exported fields, including the hourly buckets.
+vector<string>
+StatsExporter::get_field_names()
+{
+  vector<string> names = StatsReader::get_field_names();
+  vector<string> hourly = StatsReader::get_hourly_field_names();
+
+  names.insert(names.end(), hourly.begin(), hourly.end());
+  return names;
+}
+
+
+//! Returns all exported fields of a day.
+void
+StatsExporter::get_fields(const DailyStats &stats, vector<gint64> &fields)
+{
+  StatsReader::get_fields(stats, fields);
+  StatsReader::get_hourly_fields(stats, fields);
+}
@@ -0,0 +1,77 @@
+// StatsExporter.hh --- Export of statistics to external formats
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef STATSEXPORTER_HH
+#define STATSEXPORTER_HH
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "glib.h"
+
+#include "IStatistics.hh"
+#include "Mutex.hh"
+
+using namespace workrave;
+
+//! Writes daily statistics to a stream.
+/*!
+ *  Days are written as soon as they are passed to write_day(), so an
+ *  exporter never holds more than a small, fixed number of days. An
+ *  exporter can be shared between threads when a lock is passed to
+ *  the constructor.
+ */
+class StatsExporter
+{
+public:
+  typedef IStatistics::DailyStats DailyStats;
+
+  enum Format
+    {
+      FORMAT_CSV,
+      FORMAT_JSON,
+      FORMAT_COLUMNAR,
+    };
+
+  static StatsExporter *create(Format format, std::ostream &out, Mutex *lock = NULL);
+
+  virtual ~StatsExporter() {}
+
+  virtual void begin() = 0;
+  virtual void write_day(const std::string &user, const DailyStats &stats) = 0;
+  virtual void end() = 0;
+
+protected:
+  StatsExporter(std::ostream &out, Mutex *lock);
+
+  void write(const std::string &data);
+
+  static std::vector<std::string> get_field_names();
+  static void get_fields(const DailyStats &stats, std::vector<gint64> &fields);
+
+protected:
+  //! Output stream.
+  std::ostream &out;
+
+  //! Lock for the output stream, or NULL.
+  Mutex *lock;
+};
+
+#endif // STATSEXPORTER_HH
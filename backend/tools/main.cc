@@ -0,0 +1,332 @@
+// main.cc --- Statistics export tool
+//
+// Copyright (C) 2013 Rob Caelers & Raymond Penners
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "glib.h"
+
+#include "StatsExporter.hh"
+#include "StatsReader.hh"
+#include "Mutex.hh"
+#include "Thread.hh"
+#include "Runnable.hh"
+
+using namespace std;
+
+static gchar *opt_format = NULL;
+static gchar *opt_from = NULL;
+static gchar *opt_to = NULL;
+static gchar *opt_output = NULL;
+static gint opt_jobs = 4;
+static gchar **opt_directories = NULL;
+
+static GOptionEntry options[] =
+  {
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &opt_format, "Output format: csv, json or columnar", "FORMAT" },
+    { "from", 0, 0, G_OPTION_ARG_STRING, &opt_from, "First day to export", "YYYY-MM-DD" },
+    { "to", 0, 0, G_OPTION_ARG_STRING, &opt_to, "Last day to export", "YYYY-MM-DD" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write one file per user into DIR", "DIR" },
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &opt_jobs, "Number of users processed in parallel", "N" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_directories, NULL, NULL },
+    { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
+  };
+
+
+//! Exports the statistics of a list of users.
+class ExportJob : public Runnable
+{
+public:
+  ExportJob(const vector<string> &directories, StatsExporter::Format format,
+            int from, int to, StatsExporter *shared) :
+    directories(directories),
+    format(format),
+    from(from),
+    to(to),
+    shared(shared),
+    next_directory(0),
+    failed(false)
+  {
+  }
+
+  void run();
+  bool has_failed() const { return failed; }
+
+private:
+  bool get_next_directory(string &directory);
+  void export_user(const string &directory);
+  bool export_file(const string &user, const string &directory, const char *name,
+                   StatsExporter *exporter, int after, int &last);
+
+private:
+  const vector<string> &directories;
+  StatsExporter::Format format;
+  int from;
+  int to;
+  StatsExporter *shared;
+
+  //! Protects next_directory, failed and error output.
+  Mutex lock;
+  size_t next_directory;
+  bool failed;
+};
+
+
+void
+ExportJob::run()
+{
+  string directory;
+  while (get_next_directory(directory))
+    {
+      export_user(directory);
+    }
+}
+
+
+bool
+ExportJob::get_next_directory(string &directory)
+{
+  bool ret = false;
+
+  lock.lock();
+  if (next_directory < directories.size())
+    {
+      directory = directories[next_directory++];
+      ret = true;
+    }
+  lock.unlock();
+
+  return ret;
+}
+
+
+//! Exports the history and today's statistics of a single user.
+void
+ExportJob::export_user(const string &directory)
+{
+  gchar *base = g_path_get_basename(directory.c_str());
+  string user = base;
+  g_free(base);
+
+  StatsExporter *exporter = shared;
+  ofstream file;
+
+  if (exporter == NULL)
+    {
+      static const char *extensions[] = { ".csv", ".json", ".wrsc" };
+
+      gchar *filename = g_build_filename(opt_output, (user + extensions[format]).c_str(), NULL);
+      file.open(filename, ios::out | ios::binary | ios::trunc);
+      g_free(filename);
+
+      if (!file.good())
+        {
+          cerr << "Cannot create output file for " << user << endl;
+          lock.lock();
+          failed = true;
+          lock.unlock();
+          return;
+        }
+
+      exporter = StatsExporter::create(format, file);
+      exporter->begin();
+    }
+
+  // The text history is only read if there is no packed history. It
+  // is left behind if its migration to the packed format was
+  // interrupted, in which case it holds the same days. Days of today's
+  // statistics that already made it into the history are skipped.
+  int last = 0;
+  if (!export_file(user, directory, "historystats.packed", exporter, 0, last))
+    {
+      export_file(user, directory, "historystats", exporter, 0, last);
+    }
+  export_file(user, directory, "todaystats", exporter, last, last);
+
+  if (exporter != shared)
+    {
+      exporter->end();
+      delete exporter;
+    }
+}
+
+
+//! Streams all days of a statistics file within the date range.
+/*!
+ *  Only days after the specified date are exported. The date of the
+ *  last day in the file is returned in last. Returns false if the file
+ *  cannot be opened.
+ */
+bool
+ExportJob::export_file(const string &user, const string &directory, const char *name,
+                       StatsExporter *exporter, int after, int &last)
+{
+  StatsReader reader;
+  IStatistics::DailyStats stats;
+
+  gchar *path = g_build_filename(directory.c_str(), name, NULL);
+  string filename = path;
+  g_free(path);
+
+  bool ok = reader.open(filename);
+  if (ok)
+    {
+      while (reader.next(stats))
+        {
+          int date = StatsReader::get_date(stats);
+          if (date > after && date >= from && date <= to)
+            {
+              exporter->write_day(user, stats);
+            }
+          last = MAX(last, date);
+        }
+
+      if (reader.get_damaged_count() > 0)
+        {
+          lock.lock();
+          cerr << "Skipped " << reader.get_damaged_count() << " damaged records in " << filename << endl;
+          lock.unlock();
+        }
+    }
+
+  return ok;
+}
+
+
+//! Converts YYYY-MM-DD into YYYYMMDD.
+static bool
+parse_date(const gchar *str, int &date)
+{
+  int y, m, d;
+  if (str == NULL || sscanf(str, "%d-%d-%d", &y, &m, &d) != 3)
+    {
+      return false;
+    }
+
+  date = y * 10000 + m * 100 + d;
+  return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  GError *error = NULL;
+  GOptionContext *context = g_option_context_new("DIRECTORY... - export Workrave statistics");
+  g_option_context_add_main_entries(context, options, NULL);
+
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+    {
+      cerr << error->message << endl;
+      g_error_free(error);
+      return 1;
+    }
+  g_option_context_free(context);
+
+  StatsExporter::Format format = StatsExporter::FORMAT_CSV;
+  if (opt_format != NULL)
+    {
+      if (strcmp(opt_format, "json") == 0)
+        {
+          format = StatsExporter::FORMAT_JSON;
+        }
+      else if (strcmp(opt_format, "columnar") == 0)
+        {
+          format = StatsExporter::FORMAT_COLUMNAR;
+        }
+      else if (strcmp(opt_format, "csv") != 0)
+        {
+          cerr << "Unknown format " << opt_format << endl;
+          return 1;
+        }
+    }
+
+  int from = 0;
+  int to = 99991231;
+  if ((opt_from != NULL && !parse_date(opt_from, from)) ||
+      (opt_to != NULL && !parse_date(opt_to, to)))
+    {
+      cerr << "Invalid date, expected YYYY-MM-DD" << endl;
+      return 1;
+    }
+
+  if (format == StatsExporter::FORMAT_COLUMNAR && opt_output == NULL)
+    {
+      cerr << "The columnar format requires --output" << endl;
+      return 1;
+    }
+
+  vector<string> directories;
+  for (gchar **dir = opt_directories; dir != NULL && *dir != NULL; dir++)
+    {
+      directories.push_back(*dir);
+    }
+
+  if (directories.empty())
+    {
+      cerr << "No directories specified" << endl;
+      return 1;
+    }
+
+#if !GLIB_CHECK_VERSION(2, 31, 0)
+  g_thread_init(NULL);
+#endif
+
+  // Without an output directory, all users are written to stdout.
+  Mutex stdout_lock;
+  StatsExporter *shared = NULL;
+  if (opt_output == NULL)
+    {
+      shared = StatsExporter::create(format, cout, &stdout_lock);
+      shared->begin();
+    }
+
+  ExportJob job(directories, format, from, to, shared);
+
+  int num_threads = MAX(1, MIN(opt_jobs, (int)directories.size()));
+  vector<Thread *> threads;
+  for (int i = 0; i < num_threads; i++)
+    {
+      Thread *thread = new Thread(&job);
+      threads.push_back(thread);
+      thread->start();
+    }
+
+  for (vector<Thread *>::iterator i = threads.begin(); i != threads.end(); i++)
+    {
+      (*i)->wait();
+      delete *i;
+    }
+
+  if (shared != NULL)
+    {
+      shared->end();
+      delete shared;
+    }
+
+  return job.has_failed() ? 1 : 0;
+}
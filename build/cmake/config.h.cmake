@@ -21,6 +21,8 @@
 
 #cmakedefine HAVE_GIO_NET
 
+#cmakedefine HAVE_GIO_UNIX_NET
+
 #cmakedefine HAVE_EXERCISES 
 
 #cmakedefine HAVE_DISTRIBUTION
@@ -68,6 +68,7 @@ NetworkPreferencePage::NetworkPreferencePage()
   create_general_page(tnotebook);
   create_peers_page(tnotebook);
   create_advanced_page(tnotebook);
+  create_status_page(tnotebook);
 
   init_page_values();
 
@@ -83,6 +84,7 @@ NetworkPreferencePage::NetworkPreferencePage()
 NetworkPreferencePage::~NetworkPreferencePage()
 {
   TRACE_ENTER("NetworkPreferencePage::~NetworkPreferencePage");
+  status_timer.disconnect();
   TRACE_EXIT();
 }
 
@@ -152,12 +154,19 @@ NetworkPreferencePage::create_advanced_page(Gtk::Notebook *tnotebook)
   advanced_frame->add_label(_("Reconnect attempts:"), *attempts_entry);
   advanced_frame->add_label(_("Reconnect interval:"), *interval_entry);
 
+  leaderless_cb = Gtk::manage(new Gtk::CheckButton());
+  Gtk::Label *leaderless_lab
+    = Gtk::manage(GtkUtil::create_label(_("Compute timers on every host"), true));
+  leaderless_cb->add(*leaderless_lab);
+  advanced_frame->add_widget(*leaderless_cb);
+
   advanced_frame->set_border_width(12);
   tnotebook->append_page(*advanced_frame, _("Advanced"));
 
   port_entry->signal_changed().connect(sigc::mem_fun(*this, &NetworkPreferencePage::on_port_changed));
   interval_entry->signal_changed().connect(sigc::mem_fun(*this, &NetworkPreferencePage::on_interval_changed));
   attempts_entry->signal_changed().connect(sigc::mem_fun(*this, &NetworkPreferencePage::on_attempts_changed));
+  leaderless_cb->signal_toggled().connect(sigc::mem_fun(*this, &NetworkPreferencePage::on_leaderless_toggled));
 
 }
 
@@ -250,6 +259,93 @@ NetworkPreferencePage::create_peers_page(Gtk::Notebook *tnotebook)
   tnotebook->append_page(*gp, _("Hosts"));
 }
 
+
+void
+NetworkPreferencePage::create_status_page(Gtk::Notebook *tnotebook)
+{
+  Gtk::TreeView *status_list = Gtk::manage(new Gtk::TreeView());
+  status_store = Gtk::ListStore::create(status_columns);
+  status_list->set_model(status_store);
+  status_list->set_rules_hint();
+
+  status_list->append_column(_("Peer"), status_columns.peer);
+  status_list->append_column(_("Via"), status_columns.via);
+  status_list->append_column(_("Received"), status_columns.received);
+  status_list->append_column(_("Sent"), status_columns.sent);
+  status_list->append_column(_("Queued"), status_columns.queued);
+  status_list->append_column(_("Round trip"), status_columns.rtt);
+  status_list->append_column(_("Reconnects"), status_columns.reconnects);
+  status_list->append_column(_("Master requests"), status_columns.claims);
+  status_list->append_column(_("Rejected"), status_columns.rejects);
+  status_list->append_column(_("Last packet"), status_columns.idle);
+
+  for (guint i = 0; i < status_list->get_columns().size(); i++)
+    {
+      status_list->get_column(i)->set_resizable(true);
+    }
+
+  Gtk::ScrolledWindow *status_scroll = Gtk::manage(new Gtk::ScrolledWindow());
+  status_scroll->set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
+  status_scroll->add(*status_list);
+  status_scroll->set_border_width(12);
+
+  tnotebook->append_page(*status_scroll, _("Status"));
+
+  on_status_timer();
+  status_timer = Glib::signal_timeout().connect(sigc::mem_fun(*this, &NetworkPreferencePage::on_status_timer), 1000);
+}
+
+
+//! Updates the status page with the current statistics of all peers.
+bool
+NetworkPreferencePage::on_status_timer()
+{
+  IDistributionManager::PeerStatsList stats;
+  dist_manager->get_peer_stats(stats);
+
+  status_store->clear();
+
+  for (IDistributionManager::PeerStatsList::iterator i = stats.begin(); i != stats.end(); i++)
+    {
+      const IDistributionManager::PeerStats &ps = *i;
+
+      Gtk::TreeRow row = *(status_store->append());
+
+      row[status_columns.peer] = ps.id;
+      row[status_columns.via] = ps.via;
+
+      std::stringstream received, sent, queued, rtt, reconnects, claims, rejects, idle;
+
+      received << ps.bytes_in << " (" << ps.packets_in << ")";
+      sent << ps.bytes_out << " (" << ps.packets_out << ")";
+      queued << ps.queue_bytes << " (" << ps.queue_packets << ")";
+      reconnects << ps.reconnects;
+      claims << ps.claims_out << " / " << ps.claims_in;
+      rejects << ps.rejects_in << " / " << ps.rejects_out;
+
+      if (ps.rtt >= 0)
+        {
+          rtt << ps.rtt << " ms";
+        }
+
+      if (ps.idle >= 0)
+        {
+          idle << ps.idle << " s";
+        }
+
+      row[status_columns.received] = received.str();
+      row[status_columns.sent] = sent.str();
+      row[status_columns.queued] = queued.str();
+      row[status_columns.rtt] = rtt.str();
+      row[status_columns.reconnects] = reconnects.str();
+      row[status_columns.claims] = claims.str();
+      row[status_columns.rejects] = rejects.str();
+      row[status_columns.idle] = idle.str();
+    }
+
+  return true;
+}
+
 void
 NetworkPreferencePage::create_model()
 {
@@ -311,6 +407,10 @@ NetworkPreferencePage::init_page_values()
   bool listening = dist_manager->get_listening();
   listening_cb->set_active(listening);
 
+  // Leaderless switch.
+  bool leaderless = dist_manager->get_leaderless();
+  leaderless_cb->set_active(leaderless);
+
   // Username.
   string str = dist_manager->get_username();
   username_entry->set_text(str);
@@ -352,6 +452,14 @@ NetworkPreferencePage::on_listening_toggled()
 }
 
 
+void
+NetworkPreferencePage::on_leaderless_toggled()
+{
+  bool leaderless = leaderless_cb->get_active();
+  dist_manager->set_leaderless(leaderless);
+}
+
+
 void
 NetworkPreferencePage::on_username_changed()
 {
@@ -61,10 +61,12 @@ private:
   void create_general_page(Gtk::Notebook *tnotebook);
   void create_advanced_page(Gtk::Notebook *tnotebook);
   void create_peers_page(Gtk::Notebook *tnotebook);
+  void create_status_page(Gtk::Notebook *tnotebook);
   void create_model();
 
   void on_enabled_toggled();
   void on_listening_toggled();
+  void on_leaderless_toggled();
   void on_username_changed();
   void on_password_changed();
   void on_port_changed();
@@ -79,6 +81,7 @@ private:
   void on_port_edited(const Glib::ustring& path_string, const Glib::ustring& new_text);
 
   void update_peers();
+  bool on_status_timer();
 
   void remove_peer(const Gtk::TreeModel::iterator &iter);
   void parse_peers(const std::string &peer, std::string &hostname, std::string &port);
@@ -89,6 +92,7 @@ private:
   Gtk::Entry *password_entry;
   Gtk::CheckButton *enabled_cb;
   Gtk::CheckButton *listening_cb;
+  Gtk::CheckButton *leaderless_cb;
   Gtk::SpinButton *port_entry;
   Gtk::SpinButton *attempts_entry;
   Gtk::SpinButton *interval_entry;
@@ -111,6 +115,38 @@ private:
   Gtk::TreeView *peers_list;
   Glib::RefPtr<Gtk::ListStore> peers_store;
   ModelColumns peers_columns;
+
+  struct StatusColumns : public Gtk::TreeModelColumnRecord
+  {
+    Gtk::TreeModelColumn<Glib::ustring> peer;
+    Gtk::TreeModelColumn<Glib::ustring> via;
+    Gtk::TreeModelColumn<Glib::ustring> received;
+    Gtk::TreeModelColumn<Glib::ustring> sent;
+    Gtk::TreeModelColumn<Glib::ustring> queued;
+    Gtk::TreeModelColumn<Glib::ustring> rtt;
+    Gtk::TreeModelColumn<Glib::ustring> reconnects;
+    Gtk::TreeModelColumn<Glib::ustring> claims;
+    Gtk::TreeModelColumn<Glib::ustring> rejects;
+    Gtk::TreeModelColumn<Glib::ustring> idle;
+
+    StatusColumns()
+    {
+      add(peer);
+      add(via);
+      add(received);
+      add(sent);
+      add(queued);
+      add(rtt);
+      add(reconnects);
+      add(claims);
+      add(rejects);
+      add(idle);
+    }
+  };
+
+  Glib::RefPtr<Gtk::ListStore> status_store;
+  StatusColumns status_columns;
+  sigc::connection status_timer;
 };
 
 #endif // NETWORKPREFERENCEPAGE_HH
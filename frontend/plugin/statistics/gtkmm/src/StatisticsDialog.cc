@@ -419,7 +419,17 @@ StatisticsDialog::display_statistics(IStatistics::DailyStats *stats)
       strftime(start, sizeof(start), "%X", &stats->start);
       strftime(stop, sizeof(stop), "%X", &stats->stop);
       char buf[200];
-      sprintf(buf, _("%s, from %s to %s"), date, start, stop);
+      if (stats->resolution != IStatistics::STATS_RESOLUTION_DAY)
+        {
+          // Rolled up statistics of a week or month.
+          char last_date[100];
+          strftime(last_date, sizeof(last_date), "%x", &stats->stop);
+          sprintf(buf, _("%s to %s"), date, last_date);
+        }
+      else
+        {
+          sprintf(buf, _("%s, from %s to %s"), date, start, stop);
+        }
       date_label->set_text(buf);
     }
 
@@ -520,6 +530,7 @@ StatisticsDialog::display_week_statistics()
 
   int offset = (time_loc->tm_wday - Locale::get_week_start() + 7) % 7;
   int64_t total_week = 0;
+  int last_idx = -1;
   for (int i = 0; i < 7; i++)
     {
       std::memset(&timeinfo, 0, sizeof(timeinfo));
@@ -534,8 +545,10 @@ StatisticsDialog::display_week_statistics()
                                         time_loc->tm_mon + 1,
                                         time_loc->tm_mday, idx, next, prev);
 
-      if (idx >= 0)
+      // Rolled up weeks and months cover more than one day.
+      if (idx >= 0 && idx != last_idx)
         {
+          last_idx = idx;
           IStatistics::DailyStats *stats = statistics->get_day(idx);
           if (stats != NULL)
             {
@@ -577,12 +590,14 @@ StatisticsDialog::display_month_statistics() {
     }
 
   int64_t total_month = 0;
+  int last_idx = -1;
   for (guint i = 1; i <= max_mday; i++)
     {
       int idx, next, prev;
       statistics->get_day_index_by_date(y, m + 1, i, idx, next, prev);
-      if (idx >= 0)
+      if (idx >= 0 && idx != last_idx)
         {
+          last_idx = idx;
           IStatistics::DailyStats *stats = statistics->get_day(idx);
           if (stats != NULL)
             {